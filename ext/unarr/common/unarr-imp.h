@@ -67,6 +67,7 @@ struct ar_archive_s {
 
     ar_stream *stream;
     bool at_eof;
+    bool is_solid;
     off64_t entry_offset;
     off64_t entry_offset_first;
     off64_t entry_offset_next;
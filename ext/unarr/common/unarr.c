@@ -34,6 +34,11 @@ bool ar_at_eof(ar_archive *ar)
     return ar->at_eof;
 }
 
+bool ar_is_solid(ar_archive *ar)
+{
+    return ar->is_solid;
+}
+
 bool ar_parse_entry(ar_archive *ar)
 {
     return ar->parse_entry(ar, ar->entry_offset_next);
@@ -53,6 +53,7 @@ static bool rar_parse_entry(ar_archive *ar, off64_t offset)
                 return false;
             }
             rar->archive_flags = header.flags;
+            ar->is_solid = (header.flags & MHD_SOLID) != 0;
             break;
 
         case TYPE_FILE_ENTRY:
@@ -56,6 +56,9 @@ bool ar_parse_entry_at(ar_archive *ar, off64_t offset);
 bool ar_parse_entry_for(ar_archive *ar, const char *entry_name);
 /* returns whether the last ar_parse_entry call has reached the file's expected end */
 bool ar_at_eof(ar_archive *ar);
+/* returns whether entries are compressed as a single stream, in which case they can only
+   be uncompressed efficiently if they're uncompressed in order and completely */
+bool ar_is_solid(ar_archive *ar);
 
 /* returns the name of the current entry as UTF-8 string; this pointer is only valid until the next call to ar_parse_entry */
 const char *ar_entry_get_name(ar_archive *ar);
@@ -226,6 +226,9 @@ void fz_set_aa_level(fz_context *ctx, int bits);
 	enabled by defining FITZ_DEBUG_LOCKING.
 */
 
+/* SumatraPDF: the glyph cache uses one lock per shard */
+#define FZ_GLYPH_CACHE_SHARDS 8
+
 struct fz_locks_context_s
 {
 	void *user;
@@ -238,6 +241,7 @@ enum {
 	FZ_LOCK_FILE, /* Unused now */
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_GLYPHCACHE_LAST = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_SHARDS - 1,
 	FZ_LOCK_MAX
 };
 
@@ -88,4 +88,13 @@ fz_display_list *fz_keep_display_list(fz_context *ctx, fz_display_list *list);
 */
 void fz_drop_display_list(fz_context *ctx, fz_display_list *list);
 
+/*
+	fz_display_list_size: Returns the number of bytes used by a display
+	list (not counting resources such as images and fonts which are
+	shared with the store).
+
+	SumatraPDF: report memory usage
+*/
+size_t fz_display_list_size(fz_context *ctx, fz_display_list *list);
+
 #endif
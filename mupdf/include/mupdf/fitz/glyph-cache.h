@@ -17,6 +17,30 @@ void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 void fz_purge_glyph_cache(fz_context *ctx);
+/* SumatraPDF: report memory usage */
+unsigned int fz_glyph_cache_size(fz_context *ctx);
+
+/*
+	fz_set_glyph_cache_limit: Set how much memory rendered glyphs
+	may use before the least recently used ones are evicted
+	(the default is 1 MB).
+*/
+void fz_set_glyph_cache_limit(fz_context *ctx, unsigned int max_size);
+
+typedef struct fz_glyph_cache_stats_s fz_glyph_cache_stats;
+
+struct fz_glyph_cache_stats_s
+{
+	unsigned int size;
+	unsigned int max_size;
+	int count;
+	int hits;
+	int misses;
+	int evictions;
+	unsigned int evicted;
+};
+
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
 
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm);
 fz_path *fz_outline_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *ctm);
@@ -81,10 +81,13 @@ struct fz_image_s
 };
 
 fz_pixmap *fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed);
+/* SumatraPDF: decode at 1/2^l2factor of the full size (as far as the image allows) */
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed, int l2factor);
 fz_pixmap *fz_load_png(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_tiff(fz_context *ctx, unsigned char *data, int size);
 fz_pixmap *fz_load_jxr(fz_context *ctx, unsigned char *data, int size);
 
+void fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_jpeg_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_png_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_tiff_info(fz_context *ctx, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
@@ -194,6 +194,12 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/*
+	fz_store_size: Returns the total size of the objects in the store.
+	SumatraPDF: report memory usage
+*/
+unsigned int fz_store_size(fz_context *ctx);
+
 /*
 	fz_print_store: Dump the contents of the store for debugging.
 */
@@ -200,6 +200,13 @@ void fz_free_argv(int argc, char **argv);
 */
 #define UNUSED(x) do { x = x; } while (0)
 
+/* SumatraPDF: SSE2 is always available on x64 and in x86 builds targeting it.
+ * Define FZ_NO_SSE2 to build the scalar code only (e.g. to compare mudraw -5
+ * checksums of both builds) */
+#if !defined(FZ_NO_SSE2) && !defined(ARCH_ARM) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FZ_HAVE_SSE2
+#endif
+
 /* ARM assembly specific defines */
 
 #ifdef ARCH_ARM
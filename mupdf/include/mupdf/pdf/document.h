@@ -6,6 +6,10 @@ typedef struct pdf_lexbuf_large_s pdf_lexbuf_large;
 typedef struct pdf_xref_s pdf_xref;
 typedef struct pdf_crypt_s pdf_crypt;
 typedef struct pdf_ocg_descriptor_s pdf_ocg_descriptor;
+/* SumatraPDF: intern name objects per document */
+typedef struct pdf_name_table_s pdf_name_table;
+/* SumatraPDF: object streams inflated ahead of time */
+typedef struct pdf_obj_stm_preload_s pdf_obj_stm_preload;
 
 typedef struct pdf_page_s pdf_page;
 typedef struct pdf_annot_s pdf_annot;
@@ -286,6 +290,13 @@ struct pdf_document_s
 	int num_type3_fonts;
 	int max_type3_fonts;
 	fz_font **type3_fonts;
+
+	/* SumatraPDF: intern name objects per document */
+	pdf_name_table *names;
+	/* SumatraPDF: allocate objects from object streams from an arena */
+	pdf_obj_arena *obj_arena;
+	/* SumatraPDF: inflated object streams not yet parsed */
+	pdf_obj_stm_preload *obj_stm_preload;
 };
 
 /*
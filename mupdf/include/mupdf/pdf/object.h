@@ -11,6 +11,20 @@ typedef struct pdf_document_s pdf_document;
 
 typedef struct pdf_obj_s pdf_obj;
 
+/* SumatraPDF: name objects are unique per document and the most common
+ * ones are static objects shared by all documents, so that names can be
+ * compared by pointer (use PDF_NAME(Type) instead of "Type") */
+enum
+{
+#define PDF_MAKE_NAME(STRING, NAME) PDF_ENUM_NAME_##NAME,
+#include "mupdf/pdf/name-table.h"
+#undef PDF_MAKE_NAME
+	PDF_ENUM_LIMIT
+};
+
+extern pdf_obj *const pdf_static_name_objs[PDF_ENUM_LIMIT];
+#define PDF_NAME(X) (pdf_static_name_objs[PDF_ENUM_NAME_##X])
+
 pdf_obj *pdf_new_null(pdf_document *doc);
 pdf_obj *pdf_new_bool(pdf_document *doc, int b);
 pdf_obj *pdf_new_int(pdf_document *doc, int i);
@@ -27,6 +41,20 @@ pdf_obj *pdf_copy_dict(pdf_obj *dict);
 
 pdf_obj *pdf_new_obj_from_str(pdf_document *doc, const char *src);
 
+/* SumatraPDF: returns the name object for str (not kept) without ever adding
+ * it to doc's name table or NULL if it isn't known (callers must then fall back
+ * to comparing names by string) */
+pdf_obj *pdf_find_name(pdf_document *doc, const char *str);
+void pdf_drop_name_table(pdf_document *doc);
+
+/* SumatraPDF: while doc->obj_arena is set, new objects are allocated in
+ * chunks from that arena. Chunks are freed once all objects allocated
+ * from them have been dropped (and the arena has been dropped as well). */
+typedef struct pdf_obj_arena_s pdf_obj_arena;
+
+pdf_obj_arena *pdf_new_obj_arena(pdf_document *doc);
+void pdf_drop_obj_arena(pdf_obj_arena *arena);
+
 pdf_obj *pdf_keep_obj(pdf_obj *obj);
 void pdf_drop_obj(pdf_obj *obj);
 
@@ -44,6 +72,8 @@ int pdf_is_indirect(pdf_obj *obj);
 int pdf_is_stream(pdf_document *doc, int num, int gen);
 
 int pdf_objcmp(pdf_obj *a, pdf_obj *b);
+/* SumatraPDF: returns 1 if both a and b are the same name */
+int pdf_name_eq(pdf_obj *a, pdf_obj *b);
 
 /* obj marking and unmarking functions - to avoid infinite recursions. */
 int pdf_obj_marked(pdf_obj *obj);
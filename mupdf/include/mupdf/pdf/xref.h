@@ -86,6 +86,34 @@ void pdf_replace_xref(pdf_document *doc, pdf_xref_entry *entries, int n);
 void pdf_xref_ensure_incremental_object(pdf_document *doc, int num);
 int pdf_xref_is_incremental(pdf_document *doc, int num);
 
+/*
+	SumatraPDF: pdf_new_obj_stm_preload: Read all not yet loaded object
+	streams of a document (returns NULL if there are fewer than min_count).
+	Reading stops once the inflated object streams are expected to take
+	up more than max_size bytes.
+
+	pdf_inflate_obj_stm_preload inflates the object stream at index i
+	(0 <= i < pdf_count_obj_stm_preload) and may be called concurrently
+	from several threads, as long as each thread uses its own clone of
+	the document's context.
+
+	pdf_finish_obj_stm_preload hands the inflated object streams over to
+	the document, which parses each of them when one of its objects is
+	first accessed (and then drops the inflated data). Object streams
+	which couldn't be preloaded (or exceed max_size) are loaded on demand
+	as usual.
+
+	pdf_preloaded_obj_stms_size returns how many bytes the inflated object
+	streams still held by the document take up and
+	pdf_drop_preloaded_obj_stms drops them (e.g. when memory is low).
+*/
+pdf_obj_stm_preload *pdf_new_obj_stm_preload(pdf_document *doc, int min_count, size_t max_size);
+int pdf_count_obj_stm_preload(pdf_obj_stm_preload *preload);
+void pdf_inflate_obj_stm_preload(fz_context *ctx, pdf_obj_stm_preload *preload, int i);
+void pdf_finish_obj_stm_preload(pdf_obj_stm_preload *preload);
+size_t pdf_preloaded_obj_stms_size(pdf_document *doc);
+void pdf_drop_preloaded_obj_stms(pdf_document *doc);
+
 void pdf_repair_xref(pdf_document *doc, pdf_lexbuf *buf);
 void pdf_repair_obj_stms(pdf_document *doc);
 pdf_obj *pdf_new_ref(pdf_document *doc, pdf_obj *obj);
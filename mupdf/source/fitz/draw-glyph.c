@@ -4,9 +4,16 @@
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
-#define GLYPH_HASH_LEN 509
+/* SumatraPDF: the glyph cache is split into FZ_GLYPH_CACHE_SHARDS shards
+ * (selected by a glyph's hash) which each have their own lock, hash table,
+ * LRU list and share of the cache's size limit, so that several threads
+ * rendering text don't all have to wait for a single lock. Each shard's
+ * hash table grows as needed. */
+#define GLYPH_HASH_INITIAL_LEN 64
+#define GLYPH_SHARD_FROM_HASH(hash) (((hash) >> 24) % FZ_GLYPH_CACHE_SHARDS)
 
 typedef struct fz_glyph_cache_entry_s fz_glyph_cache_entry;
+typedef struct fz_glyph_cache_shard_s fz_glyph_cache_shard;
 typedef struct fz_glyph_key_s fz_glyph_key;
 
 struct fz_glyph_key_s
@@ -30,95 +37,192 @@ struct fz_glyph_cache_entry_s
 	fz_glyph *val;
 };
 
-struct fz_glyph_cache_s
+struct fz_glyph_cache_shard_s
 {
-	int refs;
 	int total;
-#ifndef NDEBUG
-	int num_evictions;
-	int evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	int max_size;
+	int count;
+	int hash_len; /* always a power of 2 */
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	int hits;
+	int misses;
+	int num_evictions;
+	int evicted;
+};
+
+struct fz_glyph_cache_s
+{
+	int refs; /* protected by the first shard's lock */
+	fz_glyph_cache_shard shard[FZ_GLYPH_CACHE_SHARDS];
 };
 
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
+	fz_try(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		{
+			cache->shard[i].max_size = MAX_CACHE_SIZE / FZ_GLYPH_CACHE_SHARDS;
+			cache->shard[i].hash_len = GLYPH_HASH_INITIAL_LEN;
+			cache->shard[i].entry = fz_calloc(ctx, GLYPH_HASH_INITIAL_LEN, sizeof(fz_glyph_cache_entry *));
+		}
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+			fz_free(ctx, cache->shard[i].entry);
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
+	shard->count--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash & (shard->hash_len - 1)] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard's lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+evict_glyphs(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	while (shard->total > shard->max_size && shard->lru_tail)
+	{
+		shard->num_evictions++;
+		shard->evicted += fz_glyph_size(ctx, shard->lru_tail->val);
+		drop_glyph_cache_entry(ctx, shard, shard->lru_tail);
+	}
+}
+
+/* The shard's lock is always held when this function is called. */
+static void
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	while (shard->lru_head)
+		drop_glyph_cache_entry(ctx, shard, shard->lru_head);
+
+	shard->total = 0;
+}
+
+void
+fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		do_purge(ctx, &ctx->glyph_cache->shard[i]);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
 	}
+}
 
-	cache->total = 0;
+/* SumatraPDF: report memory usage */
+unsigned int
+fz_glyph_cache_size(fz_context *ctx)
+{
+	unsigned int size = 0;
+	int i;
+
+	if (!ctx->glyph_cache)
+		return 0;
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		size += ctx->glyph_cache->shard[i].total;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+	return size;
 }
 
+/* SumatraPDF: make the glyph cache's size limit configurable */
 void
-fz_purge_glyph_cache(fz_context *ctx)
+fz_set_glyph_cache_limit(fz_context *ctx, unsigned int max_size)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		shard->max_size = max_size / FZ_GLYPH_CACHE_SHARDS;
+		evict_glyphs(ctx, shard);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		stats->size += shard->total;
+		stats->max_size += shard->max_size;
+		stats->count += shard->count;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->num_evictions;
+		stats->evicted += shard->evicted;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
-	if (!ctx->glyph_cache)
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i, refs;
+
+	if (!cache)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	refs = --cache->refs;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache = NULL;
+	if (refs == 0)
 	{
-		do_purge(ctx);
-		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
+		/* no other context can access the cache anymore */
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		{
+			do_purge(ctx, &cache->shard[i]);
+			fz_free(ctx, cache->shard[i].entry);
+		}
+		fz_free(ctx, cache);
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
 fz_glyph_cache *
@@ -221,7 +325,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -231,25 +335,72 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = shard->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	shard->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
+/* The shard's lock is always held when this function is called. */
+static fz_glyph_cache_entry *
+find_glyph_cache_entry(fz_glyph_cache_shard *shard, fz_glyph_key *key, unsigned hash)
+{
+	fz_glyph_cache_entry *entry = shard->entry[hash & (shard->hash_len - 1)];
+	while (entry)
+	{
+		if (entry->hash == hash && memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+		entry = entry->bucket_next;
+	}
+	return NULL;
+}
+
+/* The shard's lock is always held when this function is called. */
+static void
+grow_glyph_hash(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	int i, new_len = shard->hash_len * 2;
+	fz_glyph_cache_entry **new_entry;
+
+	/* a table that's too small just makes lookups slower */
+	new_entry = fz_calloc_no_throw(ctx, new_len, sizeof(fz_glyph_cache_entry *));
+	if (!new_entry)
+		return;
+
+	for (i = 0; i < shard->hash_len; i++)
+	{
+		fz_glyph_cache_entry *entry = shard->entry[i];
+		while (entry)
+		{
+			fz_glyph_cache_entry *next = entry->bucket_next;
+			int idx = entry->hash & (new_len - 1);
+			entry->bucket_prev = NULL;
+			entry->bucket_next = new_entry[idx];
+			if (entry->bucket_next)
+				entry->bucket_next->bucket_prev = entry;
+			new_entry[idx] = entry;
+			entry = next;
+		}
+	}
+	fz_free(ctx, shard->entry);
+	shard->entry = new_entry;
+	shard->hash_len = new_len;
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *shard;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
 	float size;
 	fz_glyph *val;
-	int do_cache, locked, caching;
+	int do_cache, locked, caching, lock;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 
@@ -287,22 +438,32 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = fz_aa_level(ctx);
 
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	entry = cache->entry[hash];
-	while (entry)
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	lock = FZ_LOCK_GLYPHCACHE + GLYPH_SHARD_FROM_HASH(hash);
+	shard = &cache->shard[GLYPH_SHARD_FROM_HASH(hash)];
+	fz_lock(ctx, lock);
+	entry = find_glyph_cache_entry(shard, &key, hash);
+	if (entry)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		shard->hits++;
+		move_to_front(shard, entry);
+		val = fz_keep_glyph(ctx, entry->val);
+		fz_unlock(ctx, lock);
+		return val;
 	}
-
-	locked = 1;
+	shard->misses++;
+
+	/* We drop the shard's lock while rendering the glyph so that
+	 * other threads can still use the cache. The danger here is
+	 * that some other thread will come along, and want the same
+	 * glyph too. If it does, we may both end up rendering pixmaps.
+	 * We cope with this later on, by ensuring that only one gets
+	 * inserted into the cache. If we insert ours to find one
+	 * already there, we abandon ours, and use the one there already.
+	 * (Type 3 glyphs may even need the cache for rendering.)
+	 */
+	fz_unlock(ctx, lock);
+	locked = 0;
 	caching = 0;
 	val = NULL;
 
@@ -314,20 +475,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		}
 		else if (font->t3procs)
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
 		}
 		else
 		{
@@ -337,54 +485,45 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		{
 			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
 			{
+				fz_lock(ctx, lock);
+				locked = 1;
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!font->ft_face)
+				/* We had to unlock. Someone else might
+				 * have rendered in the meantime */
+				entry = find_glyph_cache_entry(shard, &key, hash);
+				if (entry)
 				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
+					fz_drop_glyph(ctx, val);
+					move_to_front(shard, entry);
+					val = fz_keep_glyph(ctx, entry->val);
+					goto unlock_and_return_val;
 				}
 
+				if (shard->count >= shard->hash_len)
+					grow_glyph_hash(ctx, shard);
+
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = shard->entry[hash & (shard->hash_len - 1)];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				shard->entry[hash & (shard->hash_len - 1)] = entry;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
-				entry->lru_next = cache->lru_head;
+				entry->lru_next = shard->lru_head;
 				if (entry->lru_next)
 					entry->lru_next->lru_prev = entry;
 				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
-
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+					shard->lru_tail = entry;
+				shard->lru_head = entry;
 
+				shard->total += fz_glyph_size(ctx, val);
+				shard->count++;
+				evict_glyphs(ctx, shard);
 			}
 		}
 unlock_and_return_val:
@@ -394,7 +533,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 	}
 	fz_catch(ctx)
 	{
@@ -452,10 +591,12 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 void
 fz_dump_glyph_cache_stats(fz_context *ctx)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
-	printf("Glyph Cache Size: %d\n", cache->total);
-#ifndef NDEBUG
-	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_glyph_cache_stats stats;
+	int lookups;
+
+	fz_get_glyph_cache_stats(ctx, &stats);
+	lookups = stats.hits + stats.misses;
+	printf("Glyph Cache Size: %u (limit: %u, %d glyphs)\n", stats.size, stats.max_size, stats.count);
+	printf("Glyph Cache Hits: %d of %d (%d%%)\n", stats.hits, lookups, lookups ? (int)(stats.hits * 100.0 / lookups) : 0);
+	printf("Glyph Cache Evictions: %d (%u bytes)\n", stats.evictions, stats.evicted);
 }
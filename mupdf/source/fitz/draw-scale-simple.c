@@ -50,6 +50,12 @@ static void debug_print(const char *fmt, ...)
 #define DBUG(A) do {} while(0==1)
 #endif
 
+/* SumatraPDF: scale rows with SSE2 where it's always available (x64 and
+ * x86 builds targeting SSE2) */
+#ifdef FZ_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 /*
 Consider a row of source samples, src, of width src_w, positioned at x,
 scaled to width dst_w.
@@ -230,11 +236,10 @@ struct fz_scale_cache_s
 	fz_weights *weights;
 };
 
-static fz_weights *
-new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, int patch_w, int n, int flip, int patch_l)
+static int
+weights_max_len(fz_scale_filter *filter, int src_w, float dst_w)
 {
 	int max_len;
-	fz_weights *weights;
 
 	if (src_w > dst_w)
 	{
@@ -252,6 +257,15 @@ new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, in
 		 */
 		max_len = 2 * filter->width;
 	}
+	return max_len;
+}
+
+static fz_weights *
+new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, int patch_w, int n, int flip, int patch_l)
+{
+	int max_len = weights_max_len(filter, src_w, dst_w);
+	fz_weights *weights;
+
 	/* We need the size of the struct,
 	 * plus patch_w*sizeof(int) for the index
 	 * plus (2+max_len)*sizeof(int) for the weights
@@ -450,37 +464,13 @@ check_weights(fz_weights *weights, int j, int w, float x, float wf)
 }
 
 static fz_weights *
-make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache)
+compute_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip)
 {
 	fz_weights *weights;
 	float F, G;
 	float window;
 	int j;
 
-	if (cache)
-	{
-		if (cache->src_w == src_w && cache->x == x && cache->dst_w == dst_w &&
-			cache->filter == filter && cache->vertical == vertical &&
-			cache->dst_w_int == dst_w_int &&
-			cache->patch_l == patch_l && cache->patch_r == patch_r &&
-			cache->n == n && cache->flip == flip)
-		{
-			return cache->weights;
-		}
-		cache->src_w = src_w;
-		cache->x = x;
-		cache->dst_w = dst_w;
-		cache->filter = filter;
-		cache->vertical = vertical;
-		cache->dst_w_int = dst_w_int;
-		cache->patch_l = patch_l;
-		cache->patch_r = patch_r;
-		cache->n = n;
-		cache->flip = flip;
-		fz_free(ctx, cache->weights);
-		cache->weights = NULL;
-	}
-
 	if (dst_w < src_w)
 	{
 		/* Scaling down */
@@ -518,10 +508,261 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		}
 	}
 	weights->count++; /* weights->count = dst_w_int now */
-	if (cache)
+	return weights;
+}
+
+/* SumatraPDF: the tiles of an image are drawn by different draw devices
+ * (with their own scale caches) and with different clip rectangles. So
+ * the weights for an image's entire scaled width (or height) are kept in
+ * the store and the weights for each tile's patch are copied from there,
+ * as the weights of an output pixel don't depend on the patch. */
+
+/* Weights for wider images are rather computed anew for every patch */
+#define MAX_STORED_WEIGHTS_SIZE (1 << 20)
+
+typedef struct fz_weights_key_s fz_weights_key;
+
+struct fz_weights_key_s
+{
+	int refs;
+	int src_w;
+	float x;
+	float dst_w;
+	fz_scale_filter *filter;
+	int vertical;
+	int dst_w_int;
+};
+
+typedef struct fz_weights_record_s fz_weights_record;
+
+struct fz_weights_record_s
+{
+	fz_storable storable;
+	fz_weights *weights;
+};
+
+static int
+fz_make_hash_weights_key(fz_store_hash *hash, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+
+	/* The hash must identify the key completely */
+	if (key->filter != &fz_scale_filter_simple)
+		return 0;
+	hash->u.im.id = key->src_w;
+	hash->u.im.m[0] = key->x;
+	hash->u.im.m[1] = key->dst_w;
+	hash->u.im.m[2] = (float)key->dst_w_int;
+	hash->u.im.m[3] = (float)key->vertical;
+	return 1;
+}
+
+static void *
+fz_keep_weights_key(fz_context *ctx, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+fz_drop_weights_key(fz_context *ctx, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+	int drop;
+
+	if (!key)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+	{
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_weights_key(void *k0_, void *k1_)
+{
+	fz_weights_key *k0 = (fz_weights_key *)k0_;
+	fz_weights_key *k1 = (fz_weights_key *)k1_;
+
+	return k0->src_w == k1->src_w && k0->x == k1->x && k0->dst_w == k1->dst_w && k0->filter == k1->filter && k0->vertical == k1->vertical && k0->dst_w_int == k1->dst_w_int;
+}
+
+#ifndef NDEBUG
+static void
+fz_debug_weights(FILE *out, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+
+	fprintf(out, "(weights src_w=%d x=%g dst_w=%g vertical=%d) ", key->src_w, key->x, key->dst_w, key->vertical);
+}
+#endif
+
+static fz_store_type fz_weights_store_type =
+{
+	fz_make_hash_weights_key,
+	fz_keep_weights_key,
+	fz_drop_weights_key,
+	fz_cmp_weights_key,
+#ifndef NDEBUG
+	fz_debug_weights
+#endif
+};
+
+static void
+fz_free_weights_record_imp(fz_context *ctx, fz_storable *storable)
+{
+	fz_weights_record *record = (fz_weights_record *)(void *)storable;
+
+	if (record == NULL)
+		return;
+	fz_free(ctx, record->weights);
+	fz_free(ctx, record);
+}
+
+static unsigned int
+weights_size(fz_weights *weights)
+{
+	int last = weights->index[weights->count-1];
+
+	return sizeof(*weights) + (last + 2 + weights->index[last+1]) * sizeof(int);
+}
+
+static fz_weights_record *
+find_stored_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int n, int flip)
+{
+	fz_weights_key key = { 0 };
+	fz_weights_key *new_key = NULL;
+	fz_weights_record *record = NULL;
+	fz_weights_record *existing;
+
+	key.refs = 1;
+	key.src_w = src_w;
+	key.x = x;
+	key.dst_w = dst_w;
+	key.filter = filter;
+	key.vertical = vertical;
+	key.dst_w_int = dst_w_int;
+
+	record = fz_find_item(ctx, fz_free_weights_record_imp, &key, &fz_weights_store_type);
+	if (record)
+		return record;
+
+	record = fz_malloc_struct(ctx, fz_weights_record);
+	FZ_INIT_STORABLE(record, 1, fz_free_weights_record_imp);
+
+	fz_var(new_key);
+	fz_var(record);
+	fz_try(ctx)
+	{
+		record->weights = compute_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, 0, dst_w_int, n, flip);
+		new_key = fz_malloc_struct(ctx, fz_weights_key);
+		*new_key = key;
+		existing = fz_store_item(ctx, new_key, record, weights_size(record->weights), &fz_weights_store_type);
+		if (existing)
+		{
+			/* Another thread has been faster */
+			fz_drop_storable(ctx, &record->storable);
+			record = existing;
+		}
+	}
+	fz_always(ctx)
 	{
-		cache->weights = weights;
+		fz_drop_weights_key(ctx, new_key);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_storable(ctx, &record->storable);
+		fz_rethrow(ctx);
 	}
+	return record;
+}
+
+/* Copies the weights for the output pixels patch_l..patch_r */
+static fz_weights *
+copy_weights(fz_context *ctx, fz_weights *full, int patch_l, int patch_r, int n, int flip)
+{
+	int patch_w = patch_r - patch_l;
+	int first = full->index[patch_l - full->patch_l];
+	int last = full->index[patch_r - 1 - full->patch_l];
+	int len = last + 2 + full->index[last+1] - first;
+	fz_weights *weights;
+	int j;
+
+	weights = fz_malloc(ctx, sizeof(*weights) + (patch_w + len) * sizeof(int));
+	weights->flip = flip;
+	weights->count = patch_w;
+	weights->max_len = full->max_len;
+	weights->n = n;
+	weights->new_line = 0;
+	weights->patch_l = patch_l;
+	for (j = 0; j < patch_w; j++)
+		weights->index[j] = full->index[patch_l - full->patch_l + j] - first + patch_w;
+	memcpy(&weights->index[patch_w], &full->index[first], len * sizeof(int));
+	return weights;
+}
+
+static fz_weights *
+make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache)
+{
+	fz_weights_record *record;
+	fz_weights *weights;
+
+	if (!cache)
+		return compute_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, patch_l, patch_r, n, flip);
+
+	if (cache->src_w == src_w && cache->x == x && cache->dst_w == dst_w &&
+		cache->filter == filter && cache->vertical == vertical &&
+		cache->dst_w_int == dst_w_int &&
+		cache->patch_l == patch_l && cache->patch_r == patch_r &&
+		cache->n == n && cache->flip == flip)
+	{
+		return cache->weights;
+	}
+	fz_free(ctx, cache->weights);
+	cache->weights = NULL;
+	cache->src_w = 0;
+
+	/* Same size as allocated by new_weights */
+	if ((size_t)weights_max_len(filter, src_w, dst_w) + 3 > MAX_STORED_WEIGHTS_SIZE / sizeof(int) / (dst_w_int + 1))
+	{
+		weights = compute_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, patch_l, patch_r, n, flip);
+	}
+	else
+	{
+		record = find_stored_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, n, flip);
+		fz_try(ctx)
+		{
+			weights = copy_weights(ctx, record->weights, patch_l, patch_r, n, flip);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_storable(ctx, &record->storable);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
+		}
+	}
+
+	cache->src_w = src_w;
+	cache->x = x;
+	cache->dst_w = dst_w;
+	cache->filter = filter;
+	cache->vertical = vertical;
+	cache->dst_w_int = dst_w_int;
+	cache->patch_l = patch_l;
+	cache->patch_r = patch_r;
+	cache->n = n;
+	cache->flip = flip;
+	cache->weights = weights;
 	return weights;
 }
 
@@ -890,6 +1131,224 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 	ENTER_THUMB
 	);
 }
+#elif defined(FZ_HAVE_SSE2)
+
+/* SumatraPDF: these produce the same results as the C code below.
+ * _mm_madd_epi16 multiplies the 16 bit samples of two source pixels (or
+ * rows) with their weights (which always fit into 16 bits) and adds the
+ * products in 32 bits, so nothing can overflow; the sums are then truncated
+ * to 8 bits just as by the casts of the C code. */
+
+static inline __m128i
+weight_pair(int w0, int w1)
+{
+	return _mm_set1_epi32((int)(((unsigned int)w1 << 16) | (w0 & 0xFFFF)));
+}
+
+/* (unsigned char)(val>>8) for four 32 bit values */
+static inline __m128i
+weighted_sums_to_u8(__m128i lo, __m128i hi)
+{
+	const __m128i mask = _mm_set1_epi32(0xFF);
+
+	lo = _mm_and_si128(_mm_srai_epi32(lo, 8), mask);
+	hi = _mm_and_si128(_mm_srai_epi32(hi, 8), mask);
+	lo = _mm_packs_epi32(lo, hi);
+	return _mm_packus_epi16(lo, lo);
+}
+
+static void
+scale_row_to_temp1(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step;
+	unsigned char *min;
+
+	assert(weights->n == 1);
+	step = 1;
+	if (weights->flip)
+	{
+		dst += weights->count - 1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		int val = 128;
+		min = &src[*contrib++];
+		len = *contrib++;
+		if (len >= 8)
+		{
+			__m128i sum = zero;
+			for (; len >= 8; len -= 8)
+			{
+				__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+				__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), _mm_loadu_si128((__m128i *)(contrib + 4)));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(s, w));
+				min += 8;
+				contrib += 8;
+			}
+			sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+			sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+			val += _mm_cvtsi128_si32(sum);
+		}
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step;
+	unsigned char *min;
+
+	assert(weights->n == 2);
+	step = 2;
+	if (weights->flip)
+	{
+		dst += 2*(weights->count - 1);
+		step = -2;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		int c1 = 128;
+		int c2 = 128;
+		min = &src[2 * *contrib++];
+		len = *contrib++;
+		if (len >= 4)
+		{
+			/* sums for the colors and alphas of pixels 0/1 and 2/3 */
+			__m128i sum = zero;
+			for (; len >= 4; len -= 4)
+			{
+				__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+				__m128i w = _mm_loadu_si128((__m128i *)contrib);
+				s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+				s = _mm_shufflehi_epi16(s, _MM_SHUFFLE(3, 1, 2, 0));
+				w = _mm_packs_epi32(w, w);
+				w = _mm_unpacklo_epi32(w, w);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(s, w));
+				min += 8;
+				contrib += 4;
+			}
+			sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+			c1 += _mm_cvtsi128_si32(sum);
+			c2 += _mm_cvtsi128_si32(_mm_srli_si128(sum, 4));
+		}
+		while (len-- > 0)
+		{
+			c1 += *min++ * *contrib;
+			c2 += *min++ * *contrib++;
+		}
+		dst[0] = (unsigned char)(c1>>8);
+		dst[1] = (unsigned char)(c2>>8);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step, val;
+	unsigned char *min;
+
+	assert(weights->n == 4);
+	step = 4;
+	if (weights->flip)
+	{
+		dst += 4*(weights->count - 1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i sum = round;
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2)
+		{
+			/* r0 r1 g0 g1 b0 b1 a0 a1 */
+			__m128i s = _mm_loadl_epi64((__m128i *)min);
+			s = _mm_unpacklo_epi8(_mm_unpacklo_epi8(s, _mm_srli_si128(s, 4)), zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(s, weight_pair(contrib[0], contrib[1])));
+			min += 8;
+			contrib += 2;
+		}
+		if (len > 0)
+		{
+			__m128i s;
+			memcpy(&val, min, 4);
+			s = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(val), zero), zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(s, weight_pair(contrib[0], 0)));
+			contrib++;
+		}
+		val = _mm_cvtsi128_si32(weighted_sums_to_u8(sum, sum));
+		memcpy(dst, &val, 4);
+		dst += step;
+	}
+}
+
+static void
+scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+	int *contrib = &weights->index[weights->index[row]];
+	int len, x, k;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x=width; x >= 8; x -= 8)
+	{
+		/* 8 pixels at a time from two rows at a time */
+		__m128i lo = round;
+		__m128i hi = round;
+		unsigned char *min = src;
+
+		for (k = 0; k + 1 < len; k += 2)
+		{
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(min + width)), zero);
+			__m128i w = weight_pair(contrib[k], contrib[k+1]);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+			min += 2 * width;
+		}
+		if (k < len)
+		{
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = weight_pair(contrib[k], 0);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), w));
+		}
+		_mm_storel_epi64((__m128i *)dst, weighted_sums_to_u8(lo, hi));
+		dst += 8;
+		src += 8;
+	}
+	for (; x > 0; x--)
+	{
+		unsigned char *min = src;
+		int val = 128;
+
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
 #else
 
 static void
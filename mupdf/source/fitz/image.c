@@ -382,6 +382,18 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	case FZ_IMAGE_JXR:
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
+	/* SumatraPDF: let OpenJPEG skip resolution levels that aren't needed */
+	case FZ_IMAGE_JPX:
+		indexed = fz_colorspace_is_indexed(image->colorspace);
+		tile = fz_load_jpx_reduced(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->colorspace, indexed, l2factor);
+		/* FIXME: We can't handle decode arrays for indexed images currently */
+		if (!indexed && fz_maxi(1, tile->n - 1) == image->n)
+			fz_decode_tile(tile, image->decode);
+		/* subsample whatever OpenJPEG couldn't reduce (e.g. for too few resolution levels) */
+		for (native_l2factor = 0; native_l2factor < l2factor && tile->w <= (image->w + (2 << native_l2factor) - 1) >> (native_l2factor + 1); native_l2factor++);
+		if (l2factor > native_l2factor)
+			fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
+		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
 		{
@@ -31,10 +31,15 @@ typedef enum fz_display_command_e
 	, FZ_CMD_APPLY_TRANSFER_FUNCTION, /* SumatraPDF: support transfer functions */
 } fz_display_command;
 
+/* SumatraPDF: store display nodes as variable sized records in contiguous
+   chunks; the ctm and color are only stored when they differ from the
+   previous node's (and are tracked by fz_display_cursor during replay) */
 struct fz_display_node_s
 {
-	fz_display_command cmd;
-	fz_display_node *next;
+	unsigned char cmd;
+	unsigned char has; /* NODE_HAS_* for the data following the node */
+	unsigned short size; /* size of the node including following data */
+	int flag; /* even_odd, accumulate, isolated/knockout... */
 	fz_rect rect;
 	union {
 		fz_path *path;
@@ -45,18 +50,68 @@ struct fz_display_node_s
 		fz_transfer_function *tr; /* SumatraPDF: support transfer functions */
 	} item;
 	fz_stroke_state *stroke;
-	int flag; /* even_odd, accumulate, isolated/knockout... */
-	fz_matrix ctm;
-	fz_colorspace *colorspace;
 	float alpha;
-	float color[FZ_MAX_COLORS];
 };
 
+enum
+{
+	NODE_HAS_CTM = 1, /* followed by an fz_matrix */
+	NODE_HAS_COLOR = 2, /* followed by an fz_colorspace * and colorspace->n floats */
+	NODE_HAS_TILE = 4, /* followed by xstep, ystep and the view rect */
+};
+
+#define NODE_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+#define MIN_CHUNK_SIZE 1024
+#define MAX_CHUNK_SIZE (64 * 1024)
+
+typedef struct fz_display_chunk_s fz_display_chunk;
+
+struct fz_display_chunk_s
+{
+	fz_display_chunk *next;
+	size_t len;
+	size_t cap;
+	/* followed by cap bytes of nodes */
+};
+
+#define CHUNK_DATA(chunk) ((unsigned char *)((chunk) + 1))
+
+/* SumatraPDF: for display lists with at least INDEX_MIN_NODES nodes, a grid
+   of INDEX_GRID_SIZE x INDEX_GRID_SIZE cells over the nodes' bounds is built
+   when the list device is freed, so that fz_run_display_list only has to
+   visit the nodes intersecting the scissor (instead of culling all nodes) */
+#define INDEX_MIN_NODES 1024
+#define INDEX_GRID_SIZE 32
+/* nodes covering more cells are always visited */
+#define INDEX_MAX_CELLS 64
+
+typedef struct fz_display_index_node_s
+{
+	fz_display_node *node;
+	fz_display_node *ctm_node; /* last node (up to this one) with NODE_HAS_CTM */
+	fz_display_node *color_node; /* last node (up to this one) with NODE_HAS_COLOR */
+	int parent; /* innermost clip, mask or group containing this node (or -1) */
+	int end; /* for clips, masks and groups: the matching pop_clip or end_group (or -1) */
+} fz_display_index_node;
+
+typedef struct fz_display_index_s
+{
+	fz_display_index_node *nodes;
+	fz_rect bounds; /* of all nodes in the grid */
+	int *always; /* nodes visited for any scissor */
+	int always_count;
+	int cells[INDEX_GRID_SIZE * INDEX_GRID_SIZE + 1]; /* start of each cell's entries */
+	int *entries;
+} fz_display_index;
+
+static void fz_free_display_index(fz_context *ctx, fz_display_index *index);
+
 struct fz_display_list_s
 {
 	fz_storable storable;
-	fz_display_node *first;
-	fz_display_node *last;
+	fz_display_chunk *first;
+	fz_display_chunk *last;
 	int len;
 
 	int top;
@@ -65,46 +120,286 @@ struct fz_display_list_s
 		fz_rect rect;
 	} stack[STACK_SIZE];
 	int tiled;
+
+	/* the ctm and color last written to the list */
+	fz_matrix ctm;
+	fz_colorspace *colorspace;
+	float color[FZ_MAX_COLORS];
+
+	fz_display_index *index;
 };
 
+typedef struct fz_display_cursor_s
+{
+	fz_display_chunk *chunk;
+	size_t pos;
+	fz_matrix ctm;
+	fz_colorspace *colorspace;
+	float color[FZ_MAX_COLORS];
+	float *tile;
+	/* if visit is set, only the nodes i with visit[i] != 0 are returned */
+	fz_display_index *index;
+	unsigned char *visit;
+	int count;
+	int i;
+} fz_display_cursor;
+
 enum { ISOLATED = 1, KNOCKOUT = 2 };
 
+static void
+fz_init_display_cursor(fz_display_list *list, fz_display_cursor *cur)
+{
+	cur->chunk = list->first;
+	cur->pos = 0;
+	cur->ctm = fz_identity;
+	cur->colorspace = NULL;
+	memset(cur->color, 0, sizeof(cur->color));
+	cur->tile = NULL;
+	cur->index = NULL;
+	cur->visit = NULL;
+	cur->count = list->len;
+	cur->i = 0;
+}
+
 static fz_display_node *
-fz_new_display_node(fz_context *ctx, fz_display_command cmd, const fz_matrix *ctm,
-	fz_colorspace *colorspace, float *color, float alpha)
+fz_peek_display_node(fz_display_cursor *cur)
 {
-	fz_display_node *node;
-	int i;
+	if (cur->visit)
+	{
+		while (cur->i < cur->count && !cur->visit[cur->i])
+			cur->i++;
+		if (cur->i == cur->count)
+			return NULL;
+		return cur->index->nodes[cur->i].node;
+	}
+	while (cur->chunk && cur->pos >= cur->chunk->len)
+	{
+		cur->chunk = cur->chunk->next;
+		cur->pos = 0;
+	}
+	if (!cur->chunk)
+		return NULL;
+	return (fz_display_node *)(CHUNK_DATA(cur->chunk) + cur->pos);
+}
 
-	node = fz_malloc_struct(ctx, fz_display_node);
+/* updates the cursor's state with the parts of node's data selected by has */
+static void
+fz_read_display_node_data(fz_display_cursor *cur, fz_display_node *node, int has)
+{
+	unsigned char *data = (unsigned char *)(node + 1);
+
+	if (node->has & NODE_HAS_CTM)
+	{
+		if (has & NODE_HAS_CTM)
+			memcpy(&cur->ctm, data, sizeof(fz_matrix));
+		data += sizeof(fz_matrix);
+	}
+	if (node->has & NODE_HAS_COLOR)
+	{
+		fz_colorspace *colorspace = *(fz_colorspace **)data;
+		data += sizeof(fz_colorspace *);
+		if (has & NODE_HAS_COLOR)
+		{
+			cur->colorspace = colorspace;
+			memset(cur->color, 0, sizeof(cur->color));
+			if (colorspace)
+				memcpy(cur->color, data, colorspace->n * sizeof(float));
+		}
+		if (colorspace)
+			data += colorspace->n * sizeof(float);
+	}
+	cur->tile = (node->has & NODE_HAS_TILE) ? (float *)data : NULL;
+}
+
+/* returns the next node and updates the cursor's ctm and color */
+static fz_display_node *
+fz_next_display_node(fz_display_cursor *cur)
+{
+	fz_display_node *node = fz_peek_display_node(cur);
+	fz_display_index_node *entry;
+
+	if (!node)
+		return NULL;
+	if (!cur->visit)
+	{
+		cur->pos += node->size;
+		fz_read_display_node_data(cur, node, node->has);
+		return node;
+	}
+
+	/* nodes are skipped, so the ctm and color are looked up in the index */
+	entry = &cur->index->nodes[cur->i++];
+	cur->ctm = fz_identity;
+	if (entry->ctm_node)
+		fz_read_display_node_data(cur, entry->ctm_node, NODE_HAS_CTM);
+	cur->colorspace = NULL;
+	memset(cur->color, 0, sizeof(cur->color));
+	if (entry->color_node)
+		fz_read_display_node_data(cur, entry->color_node, NODE_HAS_COLOR);
+	fz_read_display_node_data(cur, node, 0);
+
+	return node;
+}
+
+static void
+fz_init_display_node(fz_context *ctx, fz_display_node *node, fz_display_command cmd, float alpha)
+{
 	node->cmd = cmd;
-	node->next = NULL;
+	node->has = 0;
+	node->size = 0;
+	node->flag = (cmd == FZ_CMD_BEGIN_TILE ? fz_gen_id(ctx) : 0);
 	node->rect = fz_empty_rect;
 	node->item.path = NULL;
 	node->stroke = NULL;
-	node->flag = (cmd == FZ_CMD_BEGIN_TILE ? fz_gen_id(ctx) : 0);
-	node->ctm = *ctm;
-	if (colorspace)
+	node->alpha = alpha;
+}
+
+static void
+fz_drop_display_node_data(fz_context *ctx, fz_display_node *node)
+{
+	switch (node->cmd)
 	{
-		node->colorspace = fz_keep_colorspace(ctx, colorspace);
-		if (color)
-		{
-			for (i = 0; i < node->colorspace->n; i++)
-				node->color[i] = color[i];
-		}
+	case FZ_CMD_FILL_PATH:
+	case FZ_CMD_STROKE_PATH:
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+		fz_free_path(ctx, node->item.path);
+		break;
+	case FZ_CMD_FILL_TEXT:
+	case FZ_CMD_STROKE_TEXT:
+	case FZ_CMD_CLIP_TEXT:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_IGNORE_TEXT:
+		fz_free_text(ctx, node->item.text);
+		break;
+	case FZ_CMD_FILL_SHADE:
+		fz_drop_shade(ctx, node->item.shade);
+		break;
+	case FZ_CMD_FILL_IMAGE:
+	case FZ_CMD_FILL_IMAGE_MASK:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+		fz_drop_image(ctx, node->item.image);
+		break;
+	case FZ_CMD_POP_CLIP:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_END_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+	case FZ_CMD_END_GROUP:
+	case FZ_CMD_BEGIN_TILE:
+	case FZ_CMD_END_TILE:
+	case FZ_CMD_BEGIN_PAGE:
+	case FZ_CMD_END_PAGE:
+		break;
+	/* SumatraPDF: support transfer functions */
+	case FZ_CMD_APPLY_TRANSFER_FUNCTION:
+		fz_drop_transfer_function(ctx, node->item.tr);
+		break;
 	}
-	else
+	if (node->stroke)
+		fz_drop_stroke_state(ctx, node->stroke);
+}
+
+static unsigned char *
+fz_alloc_display_node(fz_context *ctx, fz_display_list *list, size_t size)
+{
+	fz_display_chunk *chunk = list->last;
+	unsigned char *data;
+
+	if (!chunk || chunk->len + size > chunk->cap)
 	{
-		node->colorspace = NULL;
+		/* start small for short lists (e.g. annotations) and grow from there */
+		size_t cap = chunk ? chunk->cap * 2 : MIN_CHUNK_SIZE;
+		if (cap > MAX_CHUNK_SIZE)
+			cap = MAX_CHUNK_SIZE;
+		if (cap < size)
+			cap = size;
+		chunk = fz_malloc(ctx, sizeof(fz_display_chunk) + cap);
+		chunk->next = NULL;
+		chunk->len = 0;
+		chunk->cap = cap;
+		if (!list->first)
+			list->first = chunk;
+		else
+			list->last->next = chunk;
+		list->last = chunk;
 	}
-	node->alpha = alpha;
 
-	return node;
+	data = CHUNK_DATA(chunk) + chunk->len;
+	chunk->len += size;
+	return data;
 }
 
+/* copies node into the list (followed by ctm and color, if they are used
+   by node and have changed since the last node, and tile data) */
 static void
-fz_append_display_node(fz_display_list *list, fz_display_node *node)
+fz_append_display_node(fz_context *ctx, fz_display_list *list, fz_display_node *node,
+	const fz_matrix *ctm, int uses_color, fz_colorspace *colorspace, float *color, const float *tile)
 {
+	float node_color[FZ_MAX_COLORS] = { 0 };
+	int n = colorspace ? colorspace->n : 0;
+	size_t size = sizeof(fz_display_node);
+	unsigned char *data;
+
+	if (uses_color && color)
+		memcpy(node_color, color, n * sizeof(float));
+
+	if (ctm && memcmp(ctm, &list->ctm, sizeof(fz_matrix)) != 0)
+	{
+		node->has |= NODE_HAS_CTM;
+		size += sizeof(fz_matrix);
+	}
+	if (uses_color && (colorspace != list->colorspace || memcmp(node_color, list->color, n * sizeof(float)) != 0))
+	{
+		node->has |= NODE_HAS_COLOR;
+		size += sizeof(fz_colorspace *) + n * sizeof(float);
+	}
+	if (tile)
+	{
+		node->has |= NODE_HAS_TILE;
+		size += 6 * sizeof(float);
+	}
+	size = NODE_ALIGN(size);
+	node->size = (unsigned short)size;
+
+	fz_try(ctx)
+	{
+		data = fz_alloc_display_node(ctx, list, size);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_node_data(ctx, node);
+		fz_rethrow(ctx);
+	}
+
+	/* the index is only valid for complete lists */
+	if (list->index)
+	{
+		fz_free_display_index(ctx, list->index);
+		list->index = NULL;
+	}
+
+	memcpy(data, node, sizeof(fz_display_node));
+	node = (fz_display_node *)data;
+	data += sizeof(fz_display_node);
+	if (node->has & NODE_HAS_CTM)
+	{
+		memcpy(data, ctm, sizeof(fz_matrix));
+		data += sizeof(fz_matrix);
+		list->ctm = *ctm;
+	}
+	if (node->has & NODE_HAS_COLOR)
+	{
+		fz_colorspace *kept = fz_keep_colorspace(ctx, colorspace);
+		memcpy(data, &kept, sizeof(fz_colorspace *));
+		data += sizeof(fz_colorspace *);
+		memcpy(data, node_color, n * sizeof(float));
+		data += n * sizeof(float);
+		list->colorspace = colorspace;
+		memcpy(list->color, node_color, sizeof(list->color));
+	}
+	if (node->has & NODE_HAS_TILE)
+		memcpy(data, tile, 6 * sizeof(float));
+
 	switch (node->cmd)
 	{
 	case FZ_CMD_CLIP_PATH:
@@ -173,403 +468,485 @@ fz_append_display_node(fz_display_list *list, fz_display_node *node)
 			fz_union_rect(&list->stack[list->top-1].rect, &node->rect);
 		break;
 	}
-	if (!list->first)
-	{
-		list->first = node;
-		list->last = node;
-	}
-	else
-	{
-		list->last->next = node;
-		list->last = node;
-	}
 	list->len++;
 }
 
-static void
-fz_free_display_node(fz_context *ctx, fz_display_node *node)
-{
-	switch (node->cmd)
-	{
-	case FZ_CMD_FILL_PATH:
-	case FZ_CMD_STROKE_PATH:
-	case FZ_CMD_CLIP_PATH:
-	case FZ_CMD_CLIP_STROKE_PATH:
-		fz_free_path(ctx, node->item.path);
-		break;
-	case FZ_CMD_FILL_TEXT:
-	case FZ_CMD_STROKE_TEXT:
-	case FZ_CMD_CLIP_TEXT:
-	case FZ_CMD_CLIP_STROKE_TEXT:
-	case FZ_CMD_IGNORE_TEXT:
-		fz_free_text(ctx, node->item.text);
-		break;
-	case FZ_CMD_FILL_SHADE:
-		fz_drop_shade(ctx, node->item.shade);
-		break;
-	case FZ_CMD_FILL_IMAGE:
-	case FZ_CMD_FILL_IMAGE_MASK:
-	case FZ_CMD_CLIP_IMAGE_MASK:
-		fz_drop_image(ctx, node->item.image);
-		break;
-	case FZ_CMD_POP_CLIP:
-	case FZ_CMD_BEGIN_MASK:
-	case FZ_CMD_END_MASK:
-	case FZ_CMD_BEGIN_GROUP:
-	case FZ_CMD_END_GROUP:
-	case FZ_CMD_BEGIN_TILE:
-	case FZ_CMD_END_TILE:
-	case FZ_CMD_BEGIN_PAGE:
-	case FZ_CMD_END_PAGE:
-		break;
-	/* SumatraPDF: support transfer functions */
-	case FZ_CMD_APPLY_TRANSFER_FUNCTION:
-		fz_drop_transfer_function(ctx, node->item.tr);
-		break;
-	}
-	if (node->stroke)
-		fz_drop_stroke_state(ctx, node->stroke);
-	if (node->colorspace)
-		fz_drop_colorspace(ctx, node->colorspace);
-	fz_free(ctx, node);
-}
-
 static void
 fz_list_begin_page(fz_device *dev, const fz_rect *mediabox, const fz_matrix *ctm)
 {
 	fz_context *ctx = dev->ctx;
-	fz_display_node *node = fz_new_display_node(ctx, FZ_CMD_BEGIN_PAGE, ctm, NULL, NULL, 0);
-	node->rect = *mediabox;
-	fz_transform_rect(&node->rect, ctm);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_BEGIN_PAGE, 0);
+	node.rect = *mediabox;
+	fz_transform_rect(&node.rect, ctm);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_end_page(fz_device *dev)
 {
 	fz_context *ctx = dev->ctx;
-	fz_display_node *node = fz_new_display_node(ctx, FZ_CMD_END_PAGE, &fz_identity, NULL, NULL, 0);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_END_PAGE, 0);
+	fz_append_display_node(ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_fill_path(fz_device *dev, fz_path *path, int even_odd, const fz_matrix *ctm,
 	fz_colorspace *colorspace, float *color, float alpha)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_FILL_PATH, ctm, colorspace, color, alpha);
-	fz_try(ctx)
-	{
-		fz_bound_path(dev->ctx, path, NULL, ctm, &node->rect);
-		node->item.path = fz_clone_path(dev->ctx, path);
-		node->flag = even_odd;
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_FILL_PATH, alpha);
+	fz_bound_path(ctx, path, NULL, ctm, &node.rect);
+	node.item.path = fz_clone_path(ctx, path);
+	node.flag = even_odd;
+	fz_append_display_node(ctx, dev->user, &node, ctm, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_stroke_path(fz_device *dev, fz_path *path, fz_stroke_state *stroke,
 	const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_STROKE_PATH, ctm, colorspace, color, alpha);
-	fz_try(ctx)
-	{
-		fz_bound_path(dev->ctx, path, stroke, ctm, &node->rect);
-		node->item.path = fz_clone_path(dev->ctx, path);
-		node->stroke = fz_keep_stroke_state(dev->ctx, stroke);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_STROKE_PATH, alpha);
+	fz_bound_path(ctx, path, stroke, ctm, &node.rect);
+	node.item.path = fz_clone_path(ctx, path);
+	node.stroke = fz_keep_stroke_state(ctx, stroke);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_clip_path(fz_device *dev, fz_path *path, const fz_rect *rect, int even_odd, const fz_matrix *ctm)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_CLIP_PATH, ctm, NULL, NULL, 0);
-	fz_try(ctx)
-	{
-		fz_bound_path(dev->ctx, path, NULL, ctm, &node->rect);
-		if (rect)
-			fz_intersect_rect(&node->rect, rect);
-		node->item.path = fz_clone_path(dev->ctx, path);
-		node->flag = even_odd;
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_CLIP_PATH, 0);
+	fz_bound_path(ctx, path, NULL, ctm, &node.rect);
+	if (rect)
+		fz_intersect_rect(&node.rect, rect);
+	node.item.path = fz_clone_path(ctx, path);
+	node.flag = even_odd;
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_clip_stroke_path(fz_device *dev, fz_path *path, const fz_rect *rect, fz_stroke_state *stroke, const fz_matrix *ctm)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_CLIP_STROKE_PATH, ctm, NULL, NULL, 0);
-	fz_try(ctx)
-	{
-		fz_bound_path(dev->ctx, path, stroke, ctm, &node->rect);
-		if (rect)
-			fz_intersect_rect(&node->rect, rect);
-		node->item.path = fz_clone_path(dev->ctx, path);
-		node->stroke = fz_keep_stroke_state(dev->ctx, stroke);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_CLIP_STROKE_PATH, 0);
+	fz_bound_path(ctx, path, stroke, ctm, &node.rect);
+	if (rect)
+		fz_intersect_rect(&node.rect, rect);
+	node.item.path = fz_clone_path(ctx, path);
+	node.stroke = fz_keep_stroke_state(ctx, stroke);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_fill_text(fz_device *dev, fz_text *text, const fz_matrix *ctm,
 	fz_colorspace *colorspace, float *color, float alpha)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_FILL_TEXT, ctm, colorspace, color, alpha);
-	fz_try(ctx)
-	{
-		fz_bound_text(dev->ctx, text, NULL, ctm, &node->rect);
-		node->item.text = fz_clone_text(dev->ctx, text);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_FILL_TEXT, alpha);
+	fz_bound_text(ctx, text, NULL, ctm, &node.rect);
+	node.item.text = fz_clone_text(ctx, text);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm,
 	fz_colorspace *colorspace, float *color, float alpha)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_STROKE_TEXT, ctm, colorspace, color, alpha);
-	node->item.text = NULL;
-	fz_try(ctx)
-	{
-		fz_bound_text(dev->ctx, text, stroke, ctm, &node->rect);
-		node->item.text = fz_clone_text(dev->ctx, text);
-		node->stroke = fz_keep_stroke_state(dev->ctx, stroke);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_STROKE_TEXT, alpha);
+	fz_bound_text(ctx, text, stroke, ctm, &node.rect);
+	node.item.text = fz_clone_text(ctx, text);
+	node.stroke = fz_keep_stroke_state(ctx, stroke);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_clip_text(fz_device *dev, fz_text *text, const fz_matrix *ctm, int accumulate)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_CLIP_TEXT, ctm, NULL, NULL, 0);
-	fz_try(ctx)
-	{
-		fz_bound_text(dev->ctx, text, NULL, ctm, &node->rect);
-		node->item.text = fz_clone_text(dev->ctx, text);
-		node->flag = accumulate;
-		/* when accumulating, be conservative about culling */
-		if (accumulate)
-			node->rect = fz_infinite_rect;
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_CLIP_TEXT, 0);
+	fz_bound_text(ctx, text, NULL, ctm, &node.rect);
+	node.item.text = fz_clone_text(ctx, text);
+	node.flag = accumulate;
+	/* when accumulating, be conservative about culling */
+	if (accumulate)
+		node.rect = fz_infinite_rect;
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_CLIP_STROKE_TEXT, ctm, NULL, NULL, 0);
-	fz_try(ctx)
-	{
-		fz_bound_text(dev->ctx, text, stroke, ctm, &node->rect);
-		node->item.text = fz_clone_text(dev->ctx, text);
-		node->stroke = fz_keep_stroke_state(dev->ctx, stroke);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_CLIP_STROKE_TEXT, 0);
+	fz_bound_text(ctx, text, stroke, ctm, &node.rect);
+	node.item.text = fz_clone_text(ctx, text);
+	node.stroke = fz_keep_stroke_state(ctx, stroke);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_ignore_text(fz_device *dev, fz_text *text, const fz_matrix *ctm)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_IGNORE_TEXT, ctm, NULL, NULL, 0);
-	fz_try(ctx)
-	{
-		fz_bound_text(dev->ctx, text, NULL, ctm, &node->rect);
-		node->item.text = fz_clone_text(dev->ctx, text);
-	}
-	fz_catch(ctx)
-	{
-		fz_free_display_node(ctx, node);
-		fz_rethrow(ctx);
-	}
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_IGNORE_TEXT, 0);
+	fz_bound_text(ctx, text, NULL, ctm, &node.rect);
+	node.item.text = fz_clone_text(ctx, text);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_pop_clip(fz_device *dev)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_POP_CLIP, &fz_identity, NULL, NULL, 0);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_POP_CLIP, 0);
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_fill_shade(fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha)
 {
-	fz_display_node *node;
 	fz_context *ctx = dev->ctx;
-	node = fz_new_display_node(ctx, FZ_CMD_FILL_SHADE, ctm, NULL, NULL, alpha);
-	fz_bound_shade(ctx, shade, ctm, &node->rect);
-	node->item.shade = fz_keep_shade(ctx, shade);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(ctx, &node, FZ_CMD_FILL_SHADE, alpha);
+	fz_bound_shade(ctx, shade, ctm, &node.rect);
+	node.item.shade = fz_keep_shade(ctx, shade);
+	fz_append_display_node(ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_FILL_IMAGE, ctm, NULL, NULL, alpha);
-	node->rect = fz_unit_rect;
-	fz_transform_rect(&node->rect, ctm);
-	node->item.image = fz_keep_image(dev->ctx, image);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_FILL_IMAGE, alpha);
+	node.rect = fz_unit_rect;
+	fz_transform_rect(&node.rect, ctm);
+	node.item.image = fz_keep_image(dev->ctx, image);
+	fz_append_display_node(dev->ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_fill_image_mask(fz_device *dev, fz_image *image, const fz_matrix *ctm,
 	fz_colorspace *colorspace, float *color, float alpha)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_FILL_IMAGE_MASK, ctm, colorspace, color, alpha);
-	node->rect = fz_unit_rect;
-	fz_transform_rect(&node->rect, ctm);
-	node->item.image = fz_keep_image(dev->ctx, image);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_FILL_IMAGE_MASK, alpha);
+	node.rect = fz_unit_rect;
+	fz_transform_rect(&node.rect, ctm);
+	node.item.image = fz_keep_image(dev->ctx, image);
+	fz_append_display_node(dev->ctx, dev->user, &node, ctm, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_clip_image_mask(fz_device *dev, fz_image *image, const fz_rect *rect, const fz_matrix *ctm)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_CLIP_IMAGE_MASK, ctm, NULL, NULL, 0);
-	node->rect = fz_unit_rect;
-	fz_transform_rect(&node->rect, ctm);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_CLIP_IMAGE_MASK, 0);
+	node.rect = fz_unit_rect;
+	fz_transform_rect(&node.rect, ctm);
 	if (rect)
-		fz_intersect_rect(&node->rect, rect);
-	node->item.image = fz_keep_image(dev->ctx, image);
-	fz_append_display_node(dev->user, node);
+		fz_intersect_rect(&node.rect, rect);
+	node.item.image = fz_keep_image(dev->ctx, image);
+	fz_append_display_node(dev->ctx, dev->user, &node, ctm, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_begin_mask(fz_device *dev, const fz_rect *rect, int luminosity, fz_colorspace *colorspace, float *color)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_BEGIN_MASK, &fz_identity, colorspace, color, 0);
-	node->rect = *rect;
-	node->flag = luminosity;
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_BEGIN_MASK, 0);
+	node.rect = *rect;
+	node.flag = luminosity;
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 1, colorspace, color, NULL);
 }
 
 static void
 fz_list_end_mask(fz_device *dev)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_END_MASK, &fz_identity, NULL, NULL, 0);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_END_MASK, 0);
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_begin_group(fz_device *dev, const fz_rect *rect, int isolated, int knockout, int blendmode, float alpha)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_BEGIN_GROUP, &fz_identity, NULL, NULL, alpha);
-	node->rect = *rect;
-	node->item.blendmode = blendmode;
-	node->flag |= isolated ? ISOLATED : 0;
-	node->flag |= knockout ? KNOCKOUT : 0;
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_BEGIN_GROUP, alpha);
+	node.rect = *rect;
+	node.item.blendmode = blendmode;
+	node.flag |= isolated ? ISOLATED : 0;
+	node.flag |= knockout ? KNOCKOUT : 0;
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 static void
 fz_list_end_group(fz_device *dev)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_END_GROUP, &fz_identity, NULL, NULL, 0);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_END_GROUP, 0);
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 static int
 fz_list_begin_tile(fz_device *dev, const fz_rect *area, const fz_rect *view, float xstep, float ystep, const fz_matrix *ctm, int id)
 {
 	/* We ignore id here, as we will pass on our own id */
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_BEGIN_TILE, ctm, NULL, NULL, 0);
-	node->rect = *area;
-	node->color[0] = xstep;
-	node->color[1] = ystep;
-	node->color[2] = view->x0;
-	node->color[3] = view->y0;
-	node->color[4] = view->x1;
-	node->color[5] = view->y1;
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	float tile[6];
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_BEGIN_TILE, 0);
+	node.rect = *area;
+	tile[0] = xstep;
+	tile[1] = ystep;
+	tile[2] = view->x0;
+	tile[3] = view->y0;
+	tile[4] = view->x1;
+	tile[5] = view->y1;
+	fz_append_display_node(dev->ctx, dev->user, &node, ctm, 0, NULL, NULL, tile);
 	return 0;
 }
 
 static void
 fz_list_end_tile(fz_device *dev)
 {
-	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_END_TILE, &fz_identity, NULL, NULL, 0);
-	fz_append_display_node(dev->user, node);
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_END_TILE, 0);
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
 }
 
 /* SumatraPDF: support transfer functions */
 static void
 fz_list_apply_transfer_function(fz_device *dev, fz_transfer_function *tr, int for_mask)
 {
+	fz_display_node node;
+	fz_init_display_node(dev->ctx, &node, FZ_CMD_APPLY_TRANSFER_FUNCTION, 0);
+	node.item.tr = fz_keep_transfer_function(dev->ctx, tr);
+	node.flag = for_mask;
+	node.rect = fz_infinite_rect;
+	fz_append_display_node(dev->ctx, dev->user, &node, NULL, 0, NULL, NULL, NULL);
+}
+
+static int
+fz_is_clip_node(fz_display_node *node)
+{
+	switch (node->cmd)
+	{
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+		return 1;
+	case FZ_CMD_CLIP_TEXT:
+		/* Accumulated text has no extra pops */
+		return node->flag != 2;
+	default:
+		return 0;
+	}
+}
+
+static void
+fz_get_index_cells(fz_display_index *index, const fz_rect *rect, fz_irect *cells)
+{
+	float cw = (index->bounds.x1 - index->bounds.x0) / INDEX_GRID_SIZE;
+	float ch = (index->bounds.y1 - index->bounds.y0) / INDEX_GRID_SIZE;
+	cells->x0 = cw > 0 ? (int)((rect->x0 - index->bounds.x0) / cw) : 0;
+	cells->y0 = ch > 0 ? (int)((rect->y0 - index->bounds.y0) / ch) : 0;
+	cells->x1 = cw > 0 ? (int)((rect->x1 - index->bounds.x0) / cw) : 0;
+	cells->y1 = ch > 0 ? (int)((rect->y1 - index->bounds.y0) / ch) : 0;
+	cells->x0 = fz_clampi(cells->x0, 0, INDEX_GRID_SIZE - 1);
+	cells->y0 = fz_clampi(cells->y0, 0, INDEX_GRID_SIZE - 1);
+	cells->x1 = fz_clampi(cells->x1, 0, INDEX_GRID_SIZE - 1);
+	cells->y1 = fz_clampi(cells->y1, 0, INDEX_GRID_SIZE - 1);
+}
+
+static void
+fz_free_display_index(fz_context *ctx, fz_display_index *index)
+{
+	if (!index)
+		return;
+	fz_free(ctx, index->nodes);
+	fz_free(ctx, index->always);
+	fz_free(ctx, index->entries);
+	fz_free(ctx, index);
+}
+
+enum { INDEX_NEVER, INDEX_ALWAYS, INDEX_GRID };
+
+static fz_display_index *
+fz_new_display_index(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_index *index;
+	fz_display_cursor cur;
 	fz_display_node *node;
-	node = fz_new_display_node(dev->ctx, FZ_CMD_APPLY_TRANSFER_FUNCTION, &fz_identity, NULL, NULL, 0);
-	node->item.tr = fz_keep_transfer_function(dev->ctx, tr);
-	node->flag = for_mask;
-	node->rect = fz_infinite_rect;
-	fz_append_display_node(dev->user, node);
+	fz_display_node *ctm_node = NULL, *color_node = NULL;
+	unsigned char *kind = NULL;
+	int *stack = NULL;
+	int top = 0, tiled = 0, i, x, y;
+	fz_irect cells;
+
+	index = fz_malloc_struct(ctx, fz_display_index);
+	fz_var(kind);
+	fz_var(stack);
+
+	fz_try(ctx)
+	{
+		index->nodes = fz_malloc_array(ctx, list->len, sizeof(fz_display_index_node));
+		kind = fz_malloc(ctx, list->len);
+		stack = fz_malloc_array(ctx, list->len, sizeof(int));
+
+		/* determine the nesting of all nodes and which can be culled */
+		index->bounds = fz_empty_rect;
+		fz_init_display_cursor(list, &cur);
+		for (i = 0; (node = fz_next_display_node(&cur)) != NULL; i++)
+		{
+			fz_display_index_node *entry = &index->nodes[i];
+			if (node->has & NODE_HAS_CTM)
+				ctm_node = node;
+			if (node->has & NODE_HAS_COLOR)
+				color_node = node;
+			entry->node = node;
+			entry->ctm_node = ctm_node;
+			entry->color_node = color_node;
+			entry->parent = top > 0 ? stack[top - 1] : -1;
+			entry->end = -1;
+
+			if (node->cmd == FZ_CMD_BEGIN_TILE)
+				tiled++;
+			if (tiled > 0 || fz_is_infinite_rect(&node->rect))
+				kind[i] = INDEX_ALWAYS;
+			else if (fz_is_empty_rect(&node->rect))
+				kind[i] = INDEX_NEVER;
+			else
+				kind[i] = INDEX_GRID;
+			if (node->cmd == FZ_CMD_END_TILE && tiled > 0)
+				tiled--;
+
+			if (fz_is_clip_node(node))
+			{
+				stack[top++] = i;
+			}
+			else if (node->cmd == FZ_CMD_POP_CLIP || node->cmd == FZ_CMD_END_GROUP)
+			{
+				/* visited along with the matching clip, mask or group */
+				if (top > 0)
+				{
+					index->nodes[stack[--top]].end = i;
+					kind[i] = INDEX_NEVER;
+				}
+				else
+					kind[i] = INDEX_ALWAYS;
+			}
+			else switch (node->cmd)
+			{
+			case FZ_CMD_FILL_PATH:
+			case FZ_CMD_STROKE_PATH:
+			case FZ_CMD_FILL_TEXT:
+			case FZ_CMD_STROKE_TEXT:
+			case FZ_CMD_IGNORE_TEXT:
+			case FZ_CMD_FILL_SHADE:
+			case FZ_CMD_FILL_IMAGE:
+			case FZ_CMD_FILL_IMAGE_MASK:
+				break;
+			default:
+				kind[i] = INDEX_ALWAYS;
+				break;
+			}
+			if (kind[i] == INDEX_GRID)
+				fz_union_rect(&index->bounds, &node->rect);
+		}
+
+		/* nodes covering too much of the grid are always visited */
+		for (i = 0; i < list->len; i++)
+		{
+			if (kind[i] == INDEX_GRID)
+			{
+				fz_get_index_cells(index, &index->nodes[i].node->rect, &cells);
+				if ((cells.x1 - cells.x0 + 1) * (cells.y1 - cells.y0 + 1) > INDEX_MAX_CELLS)
+					kind[i] = INDEX_ALWAYS;
+			}
+			if (kind[i] == INDEX_ALWAYS)
+				stack[index->always_count++] = i;
+		}
+		index->always = fz_malloc_array(ctx, index->always_count, sizeof(int));
+		memcpy(index->always, stack, index->always_count * sizeof(int));
+
+		/* count the entries per cell and then fill them in */
+		for (i = 0; i < list->len; i++)
+		{
+			if (kind[i] != INDEX_GRID)
+				continue;
+			fz_get_index_cells(index, &index->nodes[i].node->rect, &cells);
+			for (y = cells.y0; y <= cells.y1; y++)
+				for (x = cells.x0; x <= cells.x1; x++)
+					index->cells[y * INDEX_GRID_SIZE + x + 1]++;
+		}
+		for (i = 0; i < INDEX_GRID_SIZE * INDEX_GRID_SIZE; i++)
+			index->cells[i + 1] += index->cells[i];
+		index->entries = fz_malloc_array(ctx, index->cells[INDEX_GRID_SIZE * INDEX_GRID_SIZE], sizeof(int));
+		/* stack counts the entries already filled in per cell
+		   (list->len >= INDEX_MIN_NODES >= number of cells) */
+		memset(stack, 0, INDEX_GRID_SIZE * INDEX_GRID_SIZE * sizeof(int));
+		for (i = 0; i < list->len; i++)
+		{
+			if (kind[i] != INDEX_GRID)
+				continue;
+			fz_get_index_cells(index, &index->nodes[i].node->rect, &cells);
+			for (y = cells.y0; y <= cells.y1; y++)
+			{
+				for (x = cells.x0; x <= cells.x1; x++)
+				{
+					int cell = y * INDEX_GRID_SIZE + x;
+					index->entries[index->cells[cell] + stack[cell]++] = i;
+				}
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, kind);
+		fz_free(ctx, stack);
+	}
+	fz_catch(ctx)
+	{
+		fz_free_display_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
+static void
+fz_list_free_user(fz_device *dev)
+{
+	fz_display_list *list = dev->user;
+	fz_context *ctx = dev->ctx;
+
+	if (list->len < INDEX_MIN_NODES || list->index)
+		return;
+	fz_try(ctx)
+	{
+		list->index = fz_new_display_index(ctx, list);
+	}
+	fz_catch(ctx)
+	{
+		/* the list is fully walked when run */
+		fz_warn(ctx, "cannot build display list index");
+	}
 }
 
 fz_device *
@@ -609,6 +986,8 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	/* SumatraPDF: support transfer functions */
 	dev->apply_transfer_function = fz_list_apply_transfer_function;
 
+	dev->free_user = fz_list_free_user;
+
 	return dev;
 }
 
@@ -616,17 +995,27 @@ static void
 fz_free_display_list(fz_context *ctx, fz_storable *list_)
 {
 	fz_display_list *list = (fz_display_list *)list_;
+	fz_display_cursor cur;
 	fz_display_node *node;
+	fz_display_chunk *chunk;
 
 	if (list == NULL)
 		return;
-	node = list->first;
-	while (node)
+	fz_init_display_cursor(list, &cur);
+	while ((node = fz_next_display_node(&cur)) != NULL)
 	{
-		fz_display_node *next = node->next;
-		fz_free_display_node(ctx, node);
-		node = next;
+		fz_drop_display_node_data(ctx, node);
+		if ((node->has & NODE_HAS_COLOR) && cur.colorspace)
+			fz_drop_colorspace(ctx, cur.colorspace);
 	}
+	chunk = list->first;
+	while (chunk)
+	{
+		fz_display_chunk *next = chunk->next;
+		fz_free(ctx, chunk);
+		chunk = next;
+	}
+	fz_free_display_index(ctx, list->index);
 	fz_free(ctx, list);
 }
 
@@ -640,6 +1029,9 @@ fz_new_display_list(fz_context *ctx)
 	list->len = 0;
 	list->top = 0;
 	list->tiled = 0;
+	list->ctm = fz_identity;
+	list->colorspace = NULL;
+	list->index = NULL;
 	return list;
 }
 
@@ -655,39 +1047,134 @@ fz_drop_display_list(fz_context *ctx, fz_display_list *list)
 	fz_drop_storable(ctx, &list->storable);
 }
 
-static fz_display_node *
-skip_to_end_tile(fz_display_node *node, int *progress)
+/* SumatraPDF: report memory usage */
+size_t
+fz_display_list_size(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_cursor cur;
+	fz_display_node *node;
+	fz_display_chunk *chunk;
+	size_t size = sizeof(fz_display_list);
+
+	for (chunk = list->first; chunk; chunk = chunk->next)
+		size += sizeof(fz_display_chunk) + chunk->cap;
+
+	fz_init_display_cursor(list, &cur);
+	while ((node = fz_next_display_node(&cur)) != NULL)
+	{
+		switch (node->cmd)
+		{
+		case FZ_CMD_FILL_PATH:
+		case FZ_CMD_STROKE_PATH:
+		case FZ_CMD_CLIP_PATH:
+		case FZ_CMD_CLIP_STROKE_PATH:
+			size += sizeof(fz_path) + node->item.path->cmd_cap + node->item.path->coord_cap * sizeof(float);
+			break;
+		case FZ_CMD_FILL_TEXT:
+		case FZ_CMD_STROKE_TEXT:
+		case FZ_CMD_CLIP_TEXT:
+		case FZ_CMD_CLIP_STROKE_TEXT:
+		case FZ_CMD_IGNORE_TEXT:
+			size += sizeof(fz_text) + node->item.text->cap * sizeof(fz_text_item);
+			break;
+		}
+	}
+
+	if (list->index)
+	{
+		size += sizeof(fz_display_index) + list->len * sizeof(fz_display_index_node);
+		size += (list->index->always_count + list->index->cells[INDEX_GRID_SIZE * INDEX_GRID_SIZE]) * sizeof(int);
+	}
+
+	return size;
+}
+
+/* restricts the cursor to the nodes which might intersect the scissor */
+static void
+fz_init_display_cursor_visit(fz_context *ctx, fz_display_list *list, fz_display_cursor *cur,
+	const fz_matrix *top_ctm, const fz_rect *scissor)
+{
+	fz_display_index *index = list->index;
+	fz_display_index_node *nodes = index->nodes;
+	fz_matrix inverse;
+	fz_rect rect;
+	fz_irect cells;
+	int i, x, y;
+
+	/* only for axis aligned transformations the cells to visit match
+	   the nodes fz_run_display_list wouldn't cull anyway */
+	if ((top_ctm->b != 0 || top_ctm->c != 0) && (top_ctm->a != 0 || top_ctm->d != 0))
+		return;
+	if (fz_try_invert_matrix(&inverse, top_ctm))
+		return;
+	cur->visit = fz_calloc_no_throw(ctx, list->len, 1);
+	if (!cur->visit)
+		return;
+	cur->index = index;
+
+	for (i = 0; i < index->always_count; i++)
+		cur->visit[index->always[i]] = 1;
+
+	rect = *scissor;
+	fz_transform_rect(&rect, &inverse);
+	/* be conservative about rounding errors */
+	rect.x0 -= 1; rect.y0 -= 1;
+	rect.x1 += 1; rect.y1 += 1;
+	fz_intersect_rect(&rect, &index->bounds);
+	if (!fz_is_empty_rect(&rect))
+	{
+		fz_get_index_cells(index, &rect, &cells);
+		for (y = cells.y0; y <= cells.y1; y++)
+		{
+			for (x = cells.x0; x <= cells.x1; x++)
+			{
+				int cell = y * INDEX_GRID_SIZE + x;
+				for (i = index->cells[cell]; i < index->cells[cell + 1]; i++)
+					cur->visit[index->entries[i]] = 1;
+			}
+		}
+	}
+
+	/* nodes inside a culled clip, mask or group are culled as well
+	   and clips are popped if they have been visited */
+	for (i = 0; i < list->len; i++)
+	{
+		if (!cur->visit[i])
+			continue;
+		if (nodes[i].parent >= 0 && !cur->visit[nodes[i].parent])
+			cur->visit[i] = 0;
+		else if (nodes[i].end >= 0)
+			cur->visit[nodes[i].end] = 1;
+	}
+}
+
+static void
+skip_to_end_tile(fz_display_cursor *cur, int *progress)
 {
 	fz_display_node *next;
 	int depth = 1;
 
-	/* Skip through until we find the matching end_tile. Note that
-	 * (somewhat nastily) we return the PREVIOUS node to this to help
-	 * the calling routine. */
-	do
+	/* Skip through until the matching end_tile is the next node
+	 * (which is then run by the calling routine). */
+	while ((next = fz_peek_display_node(cur)) != NULL)
 	{
-		next = node->next;
-		if (next == NULL)
-			break;
 		if (next->cmd == FZ_CMD_BEGIN_TILE)
 			depth++;
 		else if (next->cmd == FZ_CMD_END_TILE)
 		{
 			depth--;
 			if (depth == 0)
-				return node;
+				return;
 		}
 		(*progress)++;
-		node = next;
+		fz_next_display_node(cur);
 	}
-	while (1);
-
-	return NULL;
 }
 
 void
 fz_run_display_list(fz_display_list *list, fz_device *dev, const fz_matrix *top_ctm, const fz_rect *scissor, fz_cookie *cookie)
 {
+	fz_display_cursor cur;
 	fz_display_node *node;
 	fz_matrix ctm;
 	int clipped = 0;
@@ -704,7 +1191,11 @@ fz_run_display_list(fz_display_list *list, fz_device *dev, const fz_matrix *top_
 		cookie->progress = 0;
 	}
 
-	for (node = list->first; node; node = node->next)
+	fz_init_display_cursor(list, &cur);
+	if (list->index && !fz_is_infinite_rect(scissor))
+		fz_init_display_cursor_visit(ctx, list, &cur, top_ctm, scissor);
+
+	while ((node = fz_next_display_node(&cur)) != NULL)
 	{
 		int empty;
 
@@ -767,7 +1258,7 @@ fz_run_display_list(fz_display_list *list, fz_device *dev, const fz_matrix *top_
 		}
 
 visible:
-		fz_concat(&ctm, &node->ctm, top_ctm);
+		fz_concat(&ctm, &cur.ctm, top_ctm);
 
 		fz_try(ctx)
 		{
@@ -781,11 +1272,11 @@ visible:
 				break;
 			case FZ_CMD_FILL_PATH:
 				fz_fill_path(dev, node->item.path, node->flag, &ctm,
-					node->colorspace, node->color, node->alpha);
+					cur.colorspace, cur.color, node->alpha);
 				break;
 			case FZ_CMD_STROKE_PATH:
 				fz_stroke_path(dev, node->item.path, node->stroke, &ctm,
-					node->colorspace, node->color, node->alpha);
+					cur.colorspace, cur.color, node->alpha);
 				break;
 			case FZ_CMD_CLIP_PATH:
 				fz_clip_path(dev, node->item.path, &node_rect, node->flag, &ctm);
@@ -795,11 +1286,11 @@ visible:
 				break;
 			case FZ_CMD_FILL_TEXT:
 				fz_fill_text(dev, node->item.text, &ctm,
-					node->colorspace, node->color, node->alpha);
+					cur.colorspace, cur.color, node->alpha);
 				break;
 			case FZ_CMD_STROKE_TEXT:
 				fz_stroke_text(dev, node->item.text, node->stroke, &ctm,
-					node->colorspace, node->color, node->alpha);
+					cur.colorspace, cur.color, node->alpha);
 				break;
 			case FZ_CMD_CLIP_TEXT:
 				fz_clip_text(dev, node->item.text, &ctm, node->flag);
@@ -821,7 +1312,7 @@ visible:
 			case FZ_CMD_FILL_IMAGE_MASK:
 				if ((dev->hints & FZ_IGNORE_IMAGE) == 0)
 					fz_fill_image_mask(dev, node->item.image, &ctm,
-						node->colorspace, node->color, node->alpha);
+						cur.colorspace, cur.color, node->alpha);
 				break;
 			case FZ_CMD_CLIP_IMAGE_MASK:
 				if ((dev->hints & FZ_IGNORE_IMAGE) == 0)
@@ -831,7 +1322,7 @@ visible:
 				fz_pop_clip(dev);
 				break;
 			case FZ_CMD_BEGIN_MASK:
-				fz_begin_mask(dev, &node_rect, node->flag, node->colorspace, node->color);
+				fz_begin_mask(dev, &node_rect, node->flag, cur.colorspace, cur.color);
 				break;
 			case FZ_CMD_END_MASK:
 				fz_end_mask(dev);
@@ -849,13 +1340,13 @@ visible:
 				int cached;
 				fz_rect tile_rect;
 				tiled++;
-				tile_rect.x0 = node->color[2];
-				tile_rect.y0 = node->color[3];
-				tile_rect.x1 = node->color[4];
-				tile_rect.y1 = node->color[5];
-				cached = fz_begin_tile_id(dev, &node->rect, &tile_rect, node->color[0], node->color[1], &ctm, node->flag);
+				tile_rect.x0 = cur.tile[2];
+				tile_rect.y0 = cur.tile[3];
+				tile_rect.x1 = cur.tile[4];
+				tile_rect.y1 = cur.tile[5];
+				cached = fz_begin_tile_id(dev, &node->rect, &tile_rect, cur.tile[0], cur.tile[1], &ctm, node->flag);
 				if (cached)
-					node = skip_to_end_tile(node, &progress);
+					skip_to_end_tile(&cur, &progress);
 				break;
 			}
 			case FZ_CMD_END_TILE:
@@ -878,4 +1369,6 @@ visible:
 			fz_warn(ctx, "Ignoring error during interpretation");
 		}
 	}
+
+	fz_free(ctx, cur.visit);
 }
@@ -79,20 +79,116 @@ static inline unsigned int read_value(const unsigned char *data, int bytes)
 	return value;
 }
 
-fz_pixmap *
-fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+/* SumatraPDF: extract image resolution (TODO: make openjpeg do this) */
+static void
+jpx_read_resolution(fz_context *ctx, unsigned char *data, int size, int *xres, int *yres)
+{
+	unsigned char *base = data;
+	int rest = size, ix = 0, level = 0;
+
+	/* bare J2K streams don't contain any resolution */
+	if (size < 2 || (data[0] == 0xFF && data[1] == 0x4F))
+		return;
+
+	while (ix < rest - 8)
+	{
+		int lbox = read_value(base + ix, 4);
+		unsigned int tbox = read_value(base + ix + 4, 4);
+		if (lbox < 8 || lbox > rest - ix)
+		{
+			fz_warn(ctx, "impossibly small or large JP2 box (%x, %d)", tbox, lbox);
+			break;
+		}
+		if (level == 0 && tbox == 0x6A703268 /* jp2h */ || level == 1 && tbox == 0x72657320 /* res  */)
+		{
+			base += ix + 8;
+			rest = lbox - 8;
+			ix = 0;
+			level++;
+		}
+		else if (level == 2 && tbox == 0x72657363 /* resc */ && lbox == 18 && rest - ix >= 18)
+		{
+			int vrn = read_value((base += ix + 8), 2);
+			int vrd = read_value(base + 2, 2);
+			int hrn = read_value(base + 4, 2);
+			int hrd = read_value(base + 6, 2);
+			int vre = (char)base[8], hre = (char)base[9];
+			*xres = (int)((float)hrn / hrd * pow(10, hre - 2) * 2.54f);
+			*yres = (int)((float)vrn / vrd * pow(10, vre - 2) * 2.54f);
+			if (*xres <= 0 || *yres <= 0)
+			{
+				fz_warn(ctx, "invalid image resolution (%d, %d)", *xres, *yres);
+				*xres = *yres = 96;
+			}
+			break;
+		}
+		else
+		{
+			ix += lbox;
+		}
+	}
+}
+
+/* SumatraPDF: palette and color space are only applied when decoding, so
+ * fz_load_jpx_info has to read them from the pclr and colr boxes itself */
+static void
+jpx_read_color_boxes(unsigned char *data, int size, int *ncols, OPJ_COLOR_SPACE *cs)
+{
+	unsigned char *base = data;
+	int rest = size, ix = 0, level = 0;
+
+	*ncols = 0;
+	*cs = OPJ_CLRSPC_UNKNOWN;
+	if (size < 2 || (data[0] == 0xFF && data[1] == 0x4F))
+		return;
+
+	while (ix < rest - 8)
+	{
+		int lbox = read_value(base + ix, 4);
+		unsigned int tbox = read_value(base + ix + 4, 4);
+		if (lbox < 8 || lbox > rest - ix)
+			break;
+		if (level == 0 && tbox == 0x6A703268 /* jp2h */)
+		{
+			base += ix + 8;
+			rest = lbox - 8;
+			ix = 0;
+			level++;
+		}
+		else if (level == 1 && tbox == 0x70636C72 /* pclr */ && lbox >= 11)
+		{
+			*ncols = base[ix + 8 + 2];
+			ix += lbox;
+		}
+		else if (level == 1 && tbox == 0x636F6C72 /* colr */ && lbox >= 15 && *cs == OPJ_CLRSPC_UNKNOWN)
+		{
+			/* only the first colr box counts (and only for enumerated color spaces) */
+			unsigned int enumcs = base[ix + 8] == 1 ? read_value(base + ix + 11, 4) : 0;
+			if (enumcs == 16)
+				*cs = OPJ_CLRSPC_SRGB;
+			else if (enumcs == 17)
+				*cs = OPJ_CLRSPC_GRAY;
+			else if (enumcs == 18)
+				*cs = OPJ_CLRSPC_SYCC;
+			ix += lbox;
+		}
+		else
+		{
+			ix += lbox;
+		}
+	}
+}
+
+/* SumatraPDF: opens the codec and reads the image header (shared between
+ * fz_load_jpx_info and fz_load_jpx_reduced) */
+static opj_image_t *
+jpx_read_header(fz_context *ctx, unsigned char *data, int size, int indexed, opj_codec_t **codecp, opj_stream_t **streamp, stream_block *sb)
 {
-	fz_pixmap *img;
 	opj_dparameters_t params;
 	opj_codec_t *codec;
 	opj_image_t *jpx;
 	opj_stream_t *stream;
-	fz_colorspace *colorspace;
-	unsigned char *p;
 	OPJ_CODEC_FORMAT format;
-	int a, n, w, h, depth, sgnd;
-	int x, y, k, v;
-	stream_block sb;
 
 	if (size < 2)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not enough data to determine image format");
@@ -118,14 +214,14 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	}
 
 	stream = opj_stream_default_create(OPJ_TRUE);
-	sb.data = data;
-	sb.pos = 0;
-	sb.size = size;
+	sb->data = data;
+	sb->pos = 0;
+	sb->size = size;
 
 	opj_stream_set_read_function(stream, fz_opj_stream_read);
 	opj_stream_set_skip_function(stream, fz_opj_stream_skip);
 	opj_stream_set_seek_function(stream, fz_opj_stream_seek);
-	opj_stream_set_user_data(stream, &sb, NULL);
+	opj_stream_set_user_data(stream, sb, NULL);
 	/* Set the length to avoid an assert */
 	opj_stream_set_user_data_length(stream, size);
 
@@ -136,11 +232,123 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	*codecp = codec;
+	*streamp = stream;
+	return jpx;
+}
+
+/* SumatraPDF: determines the number of color and alpha components */
+static void
+jpx_components(int n, OPJ_COLOR_SPACE cs, int *np, int *ap)
+{
+	int a;
+
+	if (cs == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
+	else if (cs == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
+	else if (n == 2) { n = 1; a = 1; }
+	else if (n > 4) { n = 4; a = 1; }
+	else { a = 0; }
+
+	*np = n;
+	*ap = a;
+}
+
+void
+fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
+{
+	opj_codec_t *codec;
+	opj_stream_t *stream;
+	opj_image_t *jpx;
+	OPJ_COLOR_SPACE cs;
+	stream_block sb;
+	int n, a;
+
+	jpx = jpx_read_header(ctx, data, size, 0, &codec, &stream, &sb);
+	opj_stream_destroy(stream);
+	opj_destroy_codec(codec);
+
+	if (!jpx || jpx->numcomps < 1)
+	{
+		opj_image_destroy(jpx);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
+	}
+
+	jpx_read_color_boxes(data, size, &n, &cs);
+	if (n <= 0)
+		n = jpx->numcomps;
+	jpx_components(n, cs, &n, &a);
+	/* CMYK images with alpha are converted to RGB (see below) */
+	if (n == 4 && a)
+		n = 3;
+	switch (n)
+	{
+	case 1: *cspacep = fz_device_gray(ctx); break;
+	case 3: *cspacep = fz_device_rgb(ctx); break;
+	default: *cspacep = fz_device_cmyk(ctx); break;
+	}
+	*wp = jpx->comps[0].w;
+	*hp = jpx->comps[0].h;
+	opj_image_destroy(jpx);
+
+	*xresp = *yresp = 96;
+	jpx_read_resolution(ctx, data, size, xresp, yresp);
+}
+
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+{
+	return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, 0);
+}
+
+/* SumatraPDF: decode at a resolution reduced by 2^l2factor (as far as
+ * the image's resolution levels allow) */
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int l2factor)
+{
+	fz_pixmap *img;
+	opj_codec_t *codec;
+	opj_image_t *jpx;
+	opj_stream_t *stream;
+	fz_colorspace *colorspace;
+	unsigned char *p;
+	int a, n, w, h, depth, sgnd;
+	int x, y, k, v;
+	stream_block sb;
+
+	jpx = jpx_read_header(ctx, data, size, indexed, &codec, &stream, &sb);
+
+	if (l2factor > 0)
+	{
+		/* at least one resolution level has to remain for each component */
+		opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+		for (k = 0; info && k < (int)info->nbcomps; k++)
+			l2factor = fz_mini(l2factor, (int)info->m_default_tile_info.tccp_info[k].numresolutions - 1);
+		opj_destroy_cstr_info(&info);
+		if (l2factor > 0 && !opj_set_decoded_resolution_factor(codec, l2factor))
+		{
+			opj_set_decoded_resolution_factor(codec, 0);
+			l2factor = 0;
+		}
+		/* openjpeg 2.1 doesn't update the dimensions of the image it decodes
+		 * into (cf. opj_j2k_set_decode_area), so the data would be misplaced */
+		for (k = 0; l2factor > 0 && k < (int)jpx->numcomps; k++)
+		{
+			opj_image_comp_t *comp = &jpx->comps[k];
+			int x1 = comp->x0 + comp->w, y1 = comp->y0 + comp->h;
+			comp->factor = l2factor;
+			comp->w = ((x1 + (1 << l2factor) - 1) >> l2factor) - ((comp->x0 + (1 << l2factor) - 1) >> l2factor);
+			comp->h = ((y1 + (1 << l2factor) - 1) >> l2factor) - ((comp->y0 + (1 << l2factor) - 1) >> l2factor);
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* retry at full resolution, in case a tile has fewer resolution levels */
+		if (l2factor > 0)
+			return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, 0);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
 
@@ -181,11 +389,7 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	depth = jpx->comps[0].prec;
 	sgnd = jpx->comps[0].sgnd;
 
-	if (jpx->color_space == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
-	else if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
-	else if (n == 2) { n = 1; a = 1; }
-	else if (n > 4) { n = 4; a = 1; }
-	else { a = 0; }
+	jpx_components(n, jpx->color_space, &n, &a);
 
 	if (defcs)
 	{
@@ -253,49 +457,7 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_premultiply_pixmap(ctx, img);
 	}
 
-	/* SumatraPDF: extract image resolution (TODO: make openjpeg do this) */
-	if (format == OPJ_CODEC_JP2)
-	{
-		unsigned char *base = data;
-		int rest = size, ix = 0, level = 0;
-		while (ix < rest - 8)
-		{
-			int lbox = read_value(base + ix, 4);
-			unsigned int tbox = read_value(base + ix + 4, 4);
-			if (lbox < 8 || lbox > rest - ix)
-			{
-				fz_warn(ctx, "impossibly small or large JP2 box (%x, %d)", tbox, lbox);
-				break;
-			}
-			if (level == 0 && tbox == 0x6A703268 /* jp2h */ || level == 1 && tbox == 0x72657320 /* res  */)
-			{
-				base += ix + 8;
-				rest = lbox - 8;
-				ix = 0;
-				level++;
-			}
-			else if (level == 2 && tbox == 0x72657363 /* resc */ && lbox == 18 && rest - ix >= 18)
-			{
-				int vrn = read_value((base += ix + 8), 2);
-				int vrd = read_value(base + 2, 2);
-				int hrn = read_value(base + 4, 2);
-				int hrd = read_value(base + 6, 2);
-				int vre = (char)base[8], hre = (char)base[9];
-				img->xres = (int)((float)hrn / hrd * pow(10, hre - 2) * 2.54f);
-				img->yres = (int)((float)vrn / vrd * pow(10, vre - 2) * 2.54f);
-				if (img->xres <= 0 || img->yres <= 0)
-				{
-					fz_warn(ctx, "invalid image resolution (%d, %d)", img->xres, img->yres);
-					img->xres = img->yres = 96;
-				}
-				break;
-			}
-			else
-			{
-				ix += lbox;
-			}
-		}
-	}
+	jpx_read_resolution(ctx, data, size, &img->xres, &img->yres);
 
 	return img;
 }
@@ -637,6 +637,21 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase)
 	return 0;
 }
 
+/* SumatraPDF: report memory usage */
+unsigned int
+fz_store_size(fz_context *ctx)
+{
+	unsigned int size;
+
+	if (ctx == NULL || ctx->store == NULL)
+		return 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	size = ctx->store->size;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return size;
+}
+
 int
 fz_shrink_store(fz_context *ctx, unsigned int percent)
 {
@@ -203,6 +203,79 @@ pdf_is_jpx_image(fz_context *ctx, pdf_obj *dict)
 	return 0;
 }
 
+/* SumatraPDF: only the header is read here, fz_image_get_pixmap decodes
+ * the image at the resolution needed for rendering it */
+static fz_image *
+pdf_load_jpx_lazy(pdf_document *doc, pdf_obj *dict)
+{
+	fz_context *ctx = doc->ctx;
+	fz_buffer *buf = NULL;
+	fz_colorspace *colorspace = NULL;
+	fz_compressed_buffer *bc = NULL;
+	fz_image *mask = NULL;
+	fz_image *image = NULL;
+	float decode[FZ_MAX_COLORS * 2];
+	int indexed = 0, usedecode = 0;
+	int w, h, xres, yres, i;
+	pdf_obj *obj;
+
+	fz_var(buf);
+	fz_var(colorspace);
+	fz_var(mask);
+	fz_var(bc);
+
+	buf = pdf_load_stream(doc, pdf_to_num(dict), pdf_to_gen(dict));
+
+	fz_try(ctx)
+	{
+		fz_load_jpx_info(ctx, buf->data, buf->len, &w, &h, &xres, &yres, &colorspace);
+
+		obj = pdf_dict_gets(dict, "ColorSpace");
+		if (obj)
+		{
+			colorspace = pdf_load_colorspace(doc, obj);
+			indexed = fz_colorspace_is_indexed(colorspace);
+		}
+
+		obj = pdf_dict_getsa(dict, "SMask", "Mask");
+		if (pdf_is_dict(obj))
+			mask = pdf_load_image_imp(doc, NULL, obj, NULL, 1);
+
+		/* FIXME: We can't handle decode arrays for indexed images currently */
+		obj = pdf_dict_getsa(dict, "Decode", "D");
+		if (obj && !indexed)
+		{
+			int n = colorspace ? colorspace->n : 1;
+			for (i = 0; i < n * 2; i++)
+				decode[i] = pdf_to_real(pdf_array_get(obj, i));
+			usedecode = 1;
+		}
+
+		bc = fz_malloc_struct(ctx, fz_compressed_buffer);
+		bc->buffer = fz_keep_buffer(ctx, buf);
+		bc->params.type = FZ_IMAGE_JPX;
+		bc->params.u.jpx.smask_in_data = pdf_to_int(pdf_dict_gets(dict, "SMaskInData"));
+
+		/* fz_new_image frees its buffer when it fails, so only hand bc over afterwards */
+		image = fz_new_image(ctx, w, h, 8, colorspace, xres, yres, 0, 0, usedecode ? decode : NULL, NULL, NULL, mask);
+		image->buffer = bc;
+		bc = NULL;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_free_compressed_buffer(ctx, bc);
+		fz_drop_colorspace(ctx, colorspace);
+		fz_drop_image(ctx, mask);
+		fz_rethrow(ctx);
+	}
+
+	return image;
+}
+
 static fz_image *
 pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 {
@@ -219,6 +292,10 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 	fz_var(colorspace);
 	fz_var(mask);
 
+	/* SumatraPDF: decode JPX images on demand (and at reduced resolution) */
+	if (!forcemask)
+		return pdf_load_jpx_lazy(doc, dict);
+
 	buf = pdf_load_stream(doc, pdf_to_num(dict), pdf_to_gen(dict));
 
 	/* FIXME: We can't handle decode arrays for indexed images currently */
@@ -41,10 +41,88 @@ static inline int unhex(int ch)
 	return 0;
 }
 
+/* SumatraPDF: the common cases (whitespace, comments, names, numbers and
+ * literal strings) are scanned directly within the stream's buffer using
+ * a character class table, falling back to reading byte by byte only at
+ * the end of the buffer and for the less common characters */
+
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_HASH = 4,
+	LEX_STRING_SPECIAL = 8, /* '(', ')' and '\\' */
+	LEX_EOL = 16,
+	LEX_NAME_END = LEX_WHITE | LEX_DELIM | LEX_HASH
+};
+
+static const unsigned char lex_class[256] =
+{
+	1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 17, 0, 1, 17, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 0, 0, 4, 0, 2, 0, 0, 10, 10, 0, 0, 0, 0, 0, 2,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 8, 2, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static inline unsigned char *
+lex_find_class(unsigned char *p, unsigned char *e, int cls)
+{
+	while (p < e && !(lex_class[*p] & cls))
+		p++;
+	return p;
+}
+
+#ifdef FZ_HAVE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int lex_ctz(unsigned int x) { unsigned long i; _BitScanForward(&i, x); return (int)i; }
+#else
+#define lex_ctz(x) __builtin_ctz(x)
+#endif
+
+/* returns the first position in [p, e) containing c1, c2 or c3 (or e) */
+static unsigned char *
+lex_find_any3(unsigned char *p, unsigned char *e, int c1, int c2, int c3)
+{
+	__m128i n1 = _mm_set1_epi8((char)c1);
+	__m128i n2 = _mm_set1_epi8((char)c2);
+	__m128i n3 = _mm_set1_epi8((char)c3);
+
+	while (e - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, n1), _mm_cmpeq_epi8(v, n2)), _mm_cmpeq_epi8(v, n3));
+		int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return p + lex_ctz(mask);
+		p += 16;
+	}
+	while (p < e && *p != c1 && *p != c2 && *p != c3)
+		p++;
+	return p;
+}
+#endif
+
 static void
 lex_white(fz_stream *f)
 {
 	int c;
+	/* SumatraPDF: skip whitespace within the buffer first */
+	while (f->rp < f->wp && (lex_class[*f->rp] & LEX_WHITE))
+		f->rp++;
 	do {
 		c = fz_read_byte(f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -56,6 +134,18 @@ static void
 lex_comment(fz_stream *f)
 {
 	int c;
+	/* SumatraPDF: find the end of line within the buffer first */
+#ifdef FZ_HAVE_SSE2
+	unsigned char *p = lex_find_any3(f->rp, f->wp, '\012', '\015', '\015');
+#else
+	unsigned char *p = lex_find_class(f->rp, f->wp, LEX_EOL);
+#endif
+	if (p < f->wp)
+	{
+		f->rp = p + 1;
+		return;
+	}
+	f->rp = p;
 	do {
 		c = fz_read_byte(f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -87,6 +177,11 @@ lex_number(fz_stream *f, pdf_lexbuf *buf, int c)
 
 	while (1)
 	{
+		/* SumatraPDF: accumulate digits within the buffer first */
+		unsigned char *p = f->rp;
+		while (p < f->wp && (unsigned int)(*p - '0') < 10)
+			i = 10*i + (*p++ - '0');
+		f->rp = p;
 		c = fz_read_byte(f);
 		switch (c)
 		{
@@ -113,6 +208,13 @@ loop_after_dot:
 	d = 1;
 	while (1)
 	{
+		unsigned char *p = f->rp;
+		while (p < f->wp && (unsigned int)(*p - '0') < 10 && d < INT_MAX/10)
+		{
+			n = n*10 + (*p++ - '0');
+			d *= 10;
+		}
+		f->rp = p;
 		c = fz_read_byte(f);
 		switch (c)
 		{
@@ -161,6 +263,16 @@ lex_name(fz_stream *f, pdf_lexbuf *buf)
 {
 	char *s = buf->scratch;
 	int n = buf->size;
+	/* SumatraPDF: copy the name up to the first delimiter or escape
+	 * from within the buffer first */
+	unsigned char *p = f->rp;
+	unsigned char *e = f->wp - p > n - 1 ? p + n - 1 : f->wp;
+
+	p = lex_find_class(p, e, LEX_NAME_END);
+	memcpy(s, f->rp, p - f->rp);
+	s += p - f->rp;
+	n -= (int)(p - f->rp);
+	f->rp = p;
 
 	while (n > 1)
 	{
@@ -246,11 +358,24 @@ lex_string(fz_stream *f, pdf_lexbuf *lb)
 
 	while (1)
 	{
+		unsigned char *p, *pe;
 		if (s == e)
 		{
 			s += pdf_lexbuf_grow(lb);
 			e = lb->scratch + lb->size;
 		}
+		/* SumatraPDF: copy runs of ordinary characters from within the buffer */
+		pe = f->wp - f->rp > e - s ? f->rp + (e - s) : f->wp;
+#ifdef FZ_HAVE_SSE2
+		p = lex_find_any3(f->rp, pe, '(', ')', '\\');
+#else
+		p = lex_find_class(f->rp, pe, LEX_STRING_SPECIAL);
+#endif
+		memcpy(s, f->rp, p - f->rp);
+		s += p - f->rp;
+		f->rp = p;
+		if (s == e)
+			continue;
 		c = fz_read_byte(f);
 		switch (c)
 		{
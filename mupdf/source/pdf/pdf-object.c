@@ -25,7 +25,11 @@ enum
 	PDF_FLAGS_SORTED = 2,
 	PDF_FLAGS_MEMO = 4,
 	PDF_FLAGS_MEMO_BOOL = 8,
-	PDF_FLAGS_DIRTY = 16
+	PDF_FLAGS_DIRTY = 16,
+	/* SumatraPDF: static names are shared between documents and threads */
+	PDF_FLAGS_STATIC = 32,
+	/* SumatraPDF: array or dictionary items are allocated from an arena */
+	PDF_FLAGS_ARENA_ITEMS = 64
 };
 
 struct pdf_obj_s
@@ -33,10 +37,14 @@ struct pdf_obj_s
 	int refs;
 	unsigned char kind;
 	unsigned char flags;
+	/* SumatraPDF: offset within the arena chunk (0 if allocated from the heap) */
+	unsigned short arena_ofs;
 	pdf_document *doc;
 	int parent_num;
 	union
 	{
+		/* SumatraPDF: n must come first so that static names can be initialized */
+		char *n;
 		int b;
 		int i;
 		float f;
@@ -44,7 +52,6 @@ struct pdf_obj_s
 			unsigned short len;
 			char buf[1];
 		} s;
-		char n[1];
 		struct {
 			int len;
 			int cap;
@@ -62,12 +69,158 @@ struct pdf_obj_s
 	} u;
 };
 
+/* SumatraPDF: objects parsed from an object stream are allocated in
+ * chunks from an arena. A chunk is freed once all objects (and item
+ * arrays) allocated from it have been dropped, so objects escaping
+ * from the arena can be kept and dropped as usual. */
+
+/* offsets within a chunk must fit into pdf_obj.arena_ofs. Chunks are
+ * kept small, as a partially used chunk stays alive as long as any
+ * of its objects does (larger and growing chunks increased the peak
+ * memory usage for documents with many object streams) */
+#define PDF_ARENA_CHUNK 4096
+#define PDF_ARENA_ALIGN 8
+
+typedef struct pdf_arena_chunk_s
+{
+	int refs; /* one per allocation plus one while the chunk is being filled */
+	int size;
+} pdf_arena_chunk;
+
+struct pdf_obj_arena_s
+{
+	pdf_document *doc;
+	pdf_arena_chunk *chunk;
+	int pos;
+};
+
+pdf_obj_arena *
+pdf_new_obj_arena(pdf_document *doc)
+{
+	pdf_obj_arena *arena = fz_malloc_struct(doc->ctx, pdf_obj_arena);
+	arena->doc = doc;
+	return arena;
+}
+
+static void
+pdf_drop_arena_chunk(fz_context *ctx, pdf_arena_chunk *chunk)
+{
+	if (chunk && --chunk->refs == 0)
+		fz_free(ctx, chunk);
+}
+
+void
+pdf_drop_obj_arena(pdf_obj_arena *arena)
+{
+	if (!arena)
+		return;
+	pdf_drop_arena_chunk(arena->doc->ctx, arena->chunk);
+	fz_free(arena->doc->ctx, arena);
+}
+
+/* returns NULL if the memory is to be allocated from the heap instead */
+static void *
+pdf_arena_alloc(pdf_document *doc, unsigned int size, unsigned short *ofs)
+{
+	pdf_obj_arena *arena = doc->obj_arena;
+	void *ptr;
+
+	if (!arena || size > PDF_ARENA_CHUNK / 4)
+		return NULL;
+	size = (size + PDF_ARENA_ALIGN - 1) & ~(PDF_ARENA_ALIGN - 1);
+
+	if (!arena->chunk || arena->pos + size > arena->chunk->size)
+	{
+		pdf_arena_chunk *chunk = fz_malloc_no_throw(doc->ctx, PDF_ARENA_CHUNK);
+		if (!chunk)
+			return NULL;
+		chunk->refs = 1;
+		chunk->size = PDF_ARENA_CHUNK;
+		pdf_drop_arena_chunk(doc->ctx, arena->chunk);
+		arena->chunk = chunk;
+		arena->pos = (sizeof(pdf_arena_chunk) + PDF_ARENA_ALIGN - 1) & ~(PDF_ARENA_ALIGN - 1);
+	}
+
+	ptr = (char *)arena->chunk + arena->pos;
+	*ofs = (unsigned short)arena->pos;
+	arena->pos += size;
+	arena->chunk->refs++;
+
+	return ptr;
+}
+
+static pdf_obj *
+pdf_alloc_obj(pdf_document *doc, unsigned int size, const char *label)
+{
+	unsigned short ofs = 0;
+	pdf_obj *obj = pdf_arena_alloc(doc, size, &ofs);
+	if (!obj)
+		obj = Memento_label(fz_malloc(doc->ctx, size), label);
+	obj->arena_ofs = ofs;
+	return obj;
+}
+
+static void
+pdf_free_obj_mem(pdf_obj *obj)
+{
+	fz_context *ctx = obj->doc->ctx;
+	if (obj->arena_ofs)
+		pdf_drop_arena_chunk(ctx, (pdf_arena_chunk *)((char *)obj - obj->arena_ofs));
+	else
+		fz_free(ctx, obj);
+}
+
+/* item arrays allocated from the arena are preceded by their offset */
+static void *
+pdf_alloc_items(pdf_obj *obj, int count, int size)
+{
+	unsigned short ofs;
+	char *items = pdf_arena_alloc(obj->doc, count * size + PDF_ARENA_ALIGN, &ofs);
+
+	if (!items)
+	{
+		items = fz_malloc_array(obj->doc->ctx, count, size);
+		obj->flags &= ~PDF_FLAGS_ARENA_ITEMS;
+		return items;
+	}
+
+	*(unsigned short *)items = ofs;
+	obj->flags |= PDF_FLAGS_ARENA_ITEMS;
+	return items + PDF_ARENA_ALIGN;
+}
+
+static void
+pdf_free_items(fz_context *ctx, void *items, int in_arena)
+{
+	if (in_arena)
+	{
+		char *ptr = (char *)items - PDF_ARENA_ALIGN;
+		pdf_drop_arena_chunk(ctx, (pdf_arena_chunk *)(ptr - *(unsigned short *)ptr));
+	}
+	else
+		fz_free(ctx, items);
+}
+
+static void *
+pdf_resize_items(pdf_obj *obj, void *items, int len, int new_cap, int size)
+{
+	int in_arena = obj->flags & PDF_FLAGS_ARENA_ITEMS;
+	void *new_items;
+
+	if (!in_arena && !obj->doc->obj_arena)
+		return fz_resize_array(obj->doc->ctx, items, new_cap, size);
+
+	new_items = pdf_alloc_items(obj, new_cap, size);
+	memcpy(new_items, items, len * size);
+	pdf_free_items(obj->doc->ctx, items, in_arena);
+	return new_items;
+}
+
 pdf_obj *
 pdf_new_null(pdf_document *doc)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(null)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(null)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_NULL;
@@ -80,8 +233,7 @@ pdf_obj *
 pdf_new_bool(pdf_document *doc, int b)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(bool)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(bool)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_BOOL;
@@ -95,8 +247,7 @@ pdf_obj *
 pdf_new_int(pdf_document *doc, int i)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(int)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(int)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_INT;
@@ -110,8 +261,7 @@ pdf_obj *
 pdf_new_real(pdf_document *doc, float f)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(real)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(real)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_REAL;
@@ -125,8 +275,7 @@ pdf_obj *
 pdf_new_string(pdf_document *doc, const char *str, int len)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj, u.s.buf) + len + 1), "pdf_obj(string)");
+	obj = pdf_alloc_obj(doc, offsetof(pdf_obj, u.s.buf) + len + 1, "pdf_obj(string)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_STRING;
@@ -138,27 +287,192 @@ pdf_new_string(pdf_document *doc, const char *str, int len)
 	return obj;
 }
 
+/* SumatraPDF: intern names so that they can be compared by pointer */
+
+static pdf_obj pdf_static_names[] =
+{
+#define PDF_MAKE_NAME(STRING, NAME) { 0, PDF_NAME, PDF_FLAGS_STATIC, 0, NULL, 0, { STRING } },
+#include "mupdf/pdf/name-table.h"
+#undef PDF_MAKE_NAME
+};
+
+pdf_obj *const pdf_static_name_objs[PDF_ENUM_LIMIT] =
+{
+#define PDF_MAKE_NAME(STRING, NAME) &pdf_static_names[PDF_ENUM_NAME_##NAME],
+#include "mupdf/pdf/name-table.h"
+#undef PDF_MAKE_NAME
+};
+
+struct pdf_name_table_s
+{
+	int len;
+	int cap; /* always a power of 2 */
+	pdf_obj **items;
+};
+
+static pdf_obj *
+pdf_lookup_static_name(const char *str)
+{
+	int l = 0;
+	int r = nelem(pdf_static_names) - 1;
+
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		int c = strcmp(str, pdf_static_names[m].u.n);
+		if (c < 0)
+			r = m - 1;
+		else if (c > 0)
+			l = m + 1;
+		else
+			return &pdf_static_names[m];
+	}
+
+	return NULL;
+}
+
+static unsigned int
+pdf_name_hash(const char *str)
+{
+	unsigned int h = 2166136261U;
+	while (*str)
+		h = (h ^ (unsigned char)*str++) * 16777619U;
+	return h;
+}
+
+/* returns either the slot containing the name or the empty slot where it belongs */
+static pdf_obj **
+pdf_name_slot(pdf_name_table *table, const char *str)
+{
+	unsigned int mask = table->cap - 1;
+	unsigned int pos = pdf_name_hash(str) & mask;
+
+	while (table->items[pos] && strcmp(table->items[pos]->u.n, str) != 0)
+		pos = (pos + 1) & mask;
+
+	return &table->items[pos];
+}
+
+static void
+pdf_grow_name_table(fz_context *ctx, pdf_name_table *table)
+{
+	pdf_obj **items = table->items;
+	int i, cap = table->cap;
+
+	table->items = fz_calloc(ctx, cap ? cap * 2 : 256, sizeof(pdf_obj *));
+	table->cap = cap ? cap * 2 : 256;
+
+	for (i = 0; i < cap; i++)
+		if (items[i])
+			*pdf_name_slot(table, items[i]->u.n) = items[i];
+	fz_free(ctx, items);
+}
+
+/* returns the single name object for str in doc (not kept) */
+static pdf_obj *
+pdf_intern_name(pdf_document *doc, const char *str)
+{
+	fz_context *ctx = doc->ctx;
+	pdf_name_table *table = doc->names;
+	pdf_obj **slot = NULL;
+	pdf_obj *obj;
+	int len;
+
+	if (!table)
+	{
+		table = fz_malloc_struct(ctx, pdf_name_table);
+		doc->names = table;
+	}
+
+	if (table->cap)
+	{
+		slot = pdf_name_slot(table, str);
+		if (*slot)
+			return *slot;
+	}
+
+	/* make sure that the table is at most half full after adding the name */
+	if (table->len + 1 > table->cap / 2)
+	{
+		pdf_grow_name_table(ctx, table);
+		slot = pdf_name_slot(table, str);
+	}
+
+	/* static names are registered when they're first used in a document */
+	obj = pdf_lookup_static_name(str);
+	if (!obj)
+	{
+		len = strlen(str);
+		obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj) + len + 1), "pdf_obj(name)");
+		obj->doc = doc;
+		obj->refs = 1; /* owned by the name table */
+		obj->kind = PDF_NAME;
+		obj->flags = 0;
+		obj->arena_ofs = 0;
+		obj->parent_num = 0;
+		obj->u.n = (char *)(obj + 1);
+		memcpy(obj->u.n, str, len + 1);
+	}
+
+	*slot = obj;
+	table->len++;
+
+	return obj;
+}
+
+/* a name is canonical for a document if pdf_intern_name returns it */
+static inline int
+pdf_is_canonical_name(pdf_obj *name, pdf_document *doc)
+{
+	return (name->flags & PDF_FLAGS_STATIC) || name->doc == doc;
+}
+
 pdf_obj *
 pdf_new_name(pdf_document *doc, const char *str)
 {
+	return pdf_keep_obj(pdf_intern_name(doc, str));
+}
+
+/* only looks the name up (so that it's safe to call for any string,
+ * e.g. while only reading a document) */
+pdf_obj *
+pdf_find_name(pdf_document *doc, const char *str)
+{
+	pdf_name_table *table = doc->names;
 	pdf_obj *obj;
+
+	if (table && table->cap)
+	{
+		obj = *pdf_name_slot(table, str);
+		if (obj)
+			return obj;
+	}
+
+	return pdf_lookup_static_name(str);
+}
+
+void
+pdf_drop_name_table(pdf_document *doc)
+{
 	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj, u.n) + strlen(str) + 1), "pdf_obj(name)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_NAME;
-	obj->flags = 0;
-	obj->parent_num = 0;
-	strcpy(obj->u.n, str);
-	return obj;
+	pdf_name_table *table = doc->names;
+	int i;
+
+	if (!table)
+		return;
+
+	for (i = 0; i < table->cap; i++)
+		pdf_drop_obj(table->items[i]);
+	fz_free(ctx, table->items);
+	fz_free(ctx, table);
+	doc->names = NULL;
 }
 
 pdf_obj *
 pdf_new_indirect(pdf_document *doc, int num, int gen)
 {
 	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(indirect)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(indirect)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_INDIRECT;
@@ -172,7 +486,7 @@ pdf_new_indirect(pdf_document *doc, int num, int gen)
 pdf_obj *
 pdf_keep_obj(pdf_obj *obj)
 {
-	if (obj)
+	if (obj && !(obj->flags & PDF_FLAGS_STATIC))
 		obj->refs ++;
 	return obj;
 }
@@ -232,6 +546,21 @@ int pdf_is_name(pdf_obj *obj)
 	return obj ? obj->kind == PDF_NAME : 0;
 }
 
+/* SumatraPDF: compare names by pointer where possible */
+int pdf_name_eq(pdf_obj *a, pdf_obj *b)
+{
+	RESOLVE(a);
+	RESOLVE(b);
+	if (!a || !b || a->kind != PDF_NAME || b->kind != PDF_NAME)
+		return 0;
+	if (a == b)
+		return 1;
+	/* two distinct canonical names in the same document can't be equal */
+	if (pdf_is_canonical_name(a, b->doc) || pdf_is_canonical_name(b, a->doc))
+		return 0;
+	return !strcmp(a->u.n, b->u.n);
+}
+
 int pdf_is_array(pdf_obj *obj)
 {
 	RESOLVE(obj);
@@ -451,7 +780,7 @@ pdf_new_array(pdf_document *doc, int initialcap)
 	int i;
 	fz_context *ctx = doc->ctx;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(array)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(array)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_ARRAY;
@@ -463,11 +792,11 @@ pdf_new_array(pdf_document *doc, int initialcap)
 
 	fz_try(ctx)
 	{
-		obj->u.a.items = Memento_label(fz_malloc_array(ctx, obj->u.a.cap, sizeof(pdf_obj*)), "pdf_obj(array items)");
+		obj->u.a.items = pdf_alloc_items(obj, obj->u.a.cap, sizeof(pdf_obj*));
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		pdf_free_obj_mem(obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->u.a.cap; i++)
@@ -482,7 +811,7 @@ pdf_array_grow(pdf_obj *obj)
 	int i;
 	int new_cap = (obj->u.a.cap * 3) / 2;
 
-	obj->u.a.items = fz_resize_array(obj->doc->ctx, obj->u.a.items, new_cap, sizeof(pdf_obj*));
+	obj->u.a.items = pdf_resize_items(obj, obj->u.a.items, obj->u.a.len, new_cap, sizeof(pdf_obj*));
 	obj->u.a.cap = new_cap;
 
 	for (i = obj->u.a.len ; i < obj->u.a.cap; i++)
@@ -795,7 +1124,7 @@ pdf_new_dict(pdf_document *doc, int initialcap)
 	int i;
 	fz_context *ctx = doc->ctx;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(dict)");
+	obj = pdf_alloc_obj(doc, sizeof(pdf_obj), "pdf_obj(dict)");
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_DICT;
@@ -807,11 +1136,11 @@ pdf_new_dict(pdf_document *doc, int initialcap)
 
 	fz_try(ctx)
 	{
-		obj->u.d.items = Memento_label(fz_malloc_array(ctx, obj->u.d.cap, sizeof(struct keyval)), "pdf_obj(dict items)");
+		obj->u.d.items = pdf_alloc_items(obj, obj->u.d.cap, sizeof(struct keyval));
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		pdf_free_obj_mem(obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->u.d.cap; i++)
@@ -829,7 +1158,7 @@ pdf_dict_grow(pdf_obj *obj)
 	int i;
 	int new_cap = (obj->u.d.cap * 3) / 2;
 
-	obj->u.d.items = fz_resize_array(obj->doc->ctx, obj->u.d.items, new_cap, sizeof(struct keyval));
+	obj->u.d.items = pdf_resize_items(obj, obj->u.d.items, obj->u.d.len, new_cap, sizeof(struct keyval));
 	obj->u.d.cap = new_cap;
 
 	for (i = obj->u.d.len; i < obj->u.d.cap; i++)
@@ -941,16 +1270,41 @@ pdf_dict_finds(pdf_obj *obj, const char *key, int *location)
 	return -1;
 }
 
+/* SumatraPDF: key must be canonical for obj->doc (cf. pdf_is_canonical_name) */
+static int
+pdf_dict_find(pdf_obj *obj, pdf_obj *key, int *location)
+{
+	int i;
+
+	if (obj->flags & PDF_FLAGS_SORTED)
+		return pdf_dict_finds(obj, key->u.n, location);
+
+	for (i = 0; i < obj->u.d.len; i++)
+		if (obj->u.d.items[i].k == key)
+			return i;
+
+	if (location)
+		*location = obj->u.d.len;
+
+	return -1;
+}
+
 pdf_obj *
 pdf_dict_gets(pdf_obj *obj, const char *key)
 {
+	pdf_obj *keyobj;
 	int i;
 
 	RESOLVE(obj);
 	if (!obj || obj->kind != PDF_DICT)
 		return NULL;
 
-	i = pdf_dict_finds(obj, key, NULL);
+	/* SumatraPDF: compare keys by pointer if the name is known to the document */
+	keyobj = pdf_find_name(obj->doc, key);
+	if (keyobj)
+		i = pdf_dict_find(obj, keyobj, NULL);
+	else
+		i = pdf_dict_finds(obj, key, NULL);
 	if (i >= 0)
 		return obj->u.d.items[i].v;
 
@@ -990,9 +1344,23 @@ pdf_dict_getp(pdf_obj *obj, const char *keys)
 pdf_obj *
 pdf_dict_get(pdf_obj *obj, pdf_obj *key)
 {
+	int i;
+
 	if (!key || key->kind != PDF_NAME)
 		return NULL;
-	return pdf_dict_gets(obj, pdf_to_name(key));
+
+	RESOLVE(obj);
+	if (!obj || obj->kind != PDF_DICT)
+		return NULL;
+
+	if (!pdf_is_canonical_name(key, obj->doc))
+		return pdf_dict_gets(obj, key->u.n);
+
+	i = pdf_dict_find(obj, key, NULL);
+	if (i >= 0)
+		return obj->u.d.items[i].v;
+
+	return NULL;
 }
 
 pdf_obj *
@@ -1011,6 +1379,7 @@ pdf_dict_put(pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 	int location;
 	char *s;
 	int i;
+	pdf_obj *newkey = NULL;
 
 	RESOLVE(obj);
 	if (!obj)
@@ -1039,7 +1408,11 @@ pdf_dict_put(pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 	if (obj->u.d.len > 100 && !(obj->flags & PDF_FLAGS_SORTED))
 		pdf_sort_dict(obj);
 
-	i = pdf_dict_finds(obj, s, &location);
+	/* SumatraPDF: keys of a dictionary must all be canonical for its document */
+	if (!pdf_is_canonical_name(key, obj->doc))
+		key = newkey = pdf_new_name(obj->doc, s);
+
+	i = pdf_dict_find(obj, key, &location);
 	if (i >= 0 && i < obj->u.d.len)
 	{
 		if (obj->u.d.items[i].v != val)
@@ -1064,6 +1437,7 @@ pdf_dict_put(pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 		obj->u.d.items[i].v = pdf_keep_obj(val);
 		obj->u.d.len ++;
 	}
+	pdf_drop_obj(newkey);
 
 	object_altered(obj, val);
 }
@@ -1205,7 +1579,8 @@ pdf_dict_dels(pdf_obj *obj, const char *key)
 		fz_warn(obj->doc->ctx, "assert: not a dict (%s)", pdf_objkindstr(obj));
 	else
 	{
-		int i = pdf_dict_finds(obj, key, NULL);
+		pdf_obj *keyobj = pdf_find_name(obj->doc, key);
+		int i = keyobj ? pdf_dict_find(obj, keyobj, NULL) : pdf_dict_finds(obj, key, NULL);
 		if (i >= 0)
 		{
 			pdf_drop_obj(obj->u.d.items[i].k);
@@ -1256,7 +1631,8 @@ pdf_mark_obj(pdf_obj *obj)
 {
 	int marked;
 	RESOLVE(obj);
-	if (!obj)
+	/* SumatraPDF: names are shared and can't contain other objects */
+	if (!obj || obj->kind == PDF_NAME)
 		return 0;
 	marked = !!(obj->flags & PDF_FLAGS_MARKED);
 	obj->flags |= PDF_FLAGS_MARKED;
@@ -1267,7 +1643,7 @@ void
 pdf_unmark_obj(pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (!obj)
+	if (!obj || obj->kind == PDF_NAME)
 		return;
 	obj->flags &= ~PDF_FLAGS_MARKED;
 }
@@ -1275,6 +1651,9 @@ pdf_unmark_obj(pdf_obj *obj)
 void
 pdf_set_obj_memo(pdf_obj *obj, int memo)
 {
+	/* SumatraPDF: names are shared */
+	if (obj->kind == PDF_NAME)
+		return;
 	obj->flags |= PDF_FLAGS_MEMO;
 	if (memo)
 		obj->flags |= PDF_FLAGS_MEMO_BOOL;
@@ -1302,14 +1681,15 @@ int pdf_obj_is_dirty(pdf_obj *obj)
 void pdf_dirty_obj(pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (!obj)
+	/* SumatraPDF: names are shared */
+	if (!obj || obj->kind == PDF_NAME)
 		return;
 	obj->flags |= PDF_FLAGS_DIRTY;
 }
 
 void pdf_clean_obj(pdf_obj *obj)
 {
-	if (!obj)
+	if (!obj || obj->kind == PDF_NAME)
 		return;
 	obj->flags &= ~PDF_FLAGS_DIRTY;
 }
@@ -1323,8 +1703,8 @@ pdf_free_array(pdf_obj *obj)
 	for (i = 0; i < obj->u.a.len; i++)
 		pdf_drop_obj(obj->u.a.items[i]);
 
-	fz_free(ctx, obj->u.a.items);
-	fz_free(ctx, obj);
+	pdf_free_items(ctx, obj->u.a.items, obj->flags & PDF_FLAGS_ARENA_ITEMS);
+	pdf_free_obj_mem(obj);
 }
 
 static void
@@ -1338,14 +1718,14 @@ pdf_free_dict(pdf_obj *obj)
 		pdf_drop_obj(obj->u.d.items[i].v);
 	}
 
-	fz_free(ctx, obj->u.d.items);
-	fz_free(ctx, obj);
+	pdf_free_items(ctx, obj->u.d.items, obj->flags & PDF_FLAGS_ARENA_ITEMS);
+	pdf_free_obj_mem(obj);
 }
 
 void
 pdf_drop_obj(pdf_obj *obj)
 {
-	if (!obj)
+	if (!obj || (obj->flags & PDF_FLAGS_STATIC))
 		return;
 	if (--obj->refs)
 		return;
@@ -1354,7 +1734,7 @@ pdf_drop_obj(pdf_obj *obj)
 	else if (obj->kind == PDF_DICT)
 		pdf_free_dict(obj);
 	else
-		fz_free(obj->doc->ctx, obj);
+		pdf_free_obj_mem(obj);
 }
 
 void
@@ -1362,7 +1742,8 @@ pdf_set_obj_parent(pdf_obj *obj, int num)
 {
 	int n, i;
 
-	if (!obj)
+	/* SumatraPDF: names are shared */
+	if (!obj || obj->kind == PDF_NAME)
 		return;
 
 	obj->parent_num = num;
@@ -164,7 +164,7 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 	/* If we've been handed a name, look it up in the properties. */
 	if (pdf_is_name(ocg))
 	{
-		ocg = pdf_dict_gets(pdf_dict_gets(rdb, "Properties"), pdf_to_name(ocg));
+		ocg = pdf_dict_gets(pdf_dict_get(rdb, PDF_NAME(Properties)), pdf_to_name(ocg));
 	}
 	/* If we haven't been given an ocg at all, then we're visible */
 	if (!ocg)
@@ -173,7 +173,7 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 	fz_strlcpy(event_state, pr->event, sizeof event_state);
 	fz_strlcat(event_state, "State", sizeof event_state);
 
-	type = pdf_to_name(pdf_dict_gets(ocg, "Type"));
+	type = pdf_to_name(pdf_dict_get(ocg, PDF_NAME(Type)));
 
 	if (strcmp(type, "OCG") == 0)
 	{
@@ -196,7 +196,7 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 
 		/* Check Intents; if our intent is not part of the set given
 		 * by the current config, we should ignore it. */
-		obj = pdf_dict_gets(ocg, "Intent");
+		obj = pdf_dict_get(ocg, PDF_NAME(Intent));
 		if (pdf_is_name(obj))
 		{
 			/* If it doesn't match, it's hidden */
@@ -232,7 +232,7 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 		 * correspond to entries in the AS list in the OCG config.
 		 * Given that we don't handle Zoom or User, or Language
 		 * dicts, this is not really a problem. */
-		obj = pdf_dict_gets(ocg, "Usage");
+		obj = pdf_dict_get(ocg, PDF_NAME(Usage));
 		if (!pdf_is_dict(obj))
 			return default_value;
 		/* FIXME: Should look at Zoom (and return hidden if out of
@@ -256,12 +256,12 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 		char *name;
 		int combine, on;
 
-		obj = pdf_dict_gets(ocg, "VE");
+		obj = pdf_dict_get(ocg, PDF_NAME(VE));
 		if (pdf_is_array(obj)) {
 			/* FIXME: Calculate visibility from array */
 			return 0;
 		}
-		name = pdf_to_name(pdf_dict_gets(ocg, "P"));
+		name = pdf_to_name(pdf_dict_get(ocg, PDF_NAME(P)));
 		/* Set combine; Bit 0 set => AND, Bit 1 set => true means
 		 * Off, otherwise true means On */
 		if (strcmp(name, "AllOn") == 0)
@@ -285,7 +285,7 @@ pdf_is_hidden_ocg(pdf_obj *ocg, pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb)
 			return 0; /* Should never happen */
 		fz_try(ctx)
 		{
-			obj = pdf_dict_gets(ocg, "OCGs");
+			obj = pdf_dict_get(ocg, PDF_NAME(OCGs));
 			on = combine & 1;
 			if (pdf_is_array(obj)) {
 				int i, len;
@@ -1559,9 +1559,8 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 	{
 		pdf_obj *key = pdf_dict_get_key(extgstate, i);
 		pdf_obj *val = pdf_dict_get_val(extgstate, i);
-		char *s = pdf_to_name(key);
 
-		if (!strcmp(s, "Font"))
+		if (pdf_name_eq(key, PDF_NAME(Font)))
 		{
 			if (pdf_is_array(val) && pdf_array_len(val) == 2)
 			{
@@ -1582,7 +1581,7 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed /Font dictionary");
 		}
 
-		else if (!strcmp(s, "LC"))
+		else if (pdf_name_eq(key, PDF_NAME(LC)))
 		{
 			pr->dev->flags &= ~(FZ_DEVFLAG_STARTCAP_UNDEFINED | FZ_DEVFLAG_DASHCAP_UNDEFINED | FZ_DEVFLAG_ENDCAP_UNDEFINED);
 			gstate->stroke_state = fz_unshare_stroke_state(ctx, gstate->stroke_state);
@@ -1590,26 +1589,26 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 			gstate->stroke_state->dash_cap = pdf_to_int(val);
 			gstate->stroke_state->end_cap = pdf_to_int(val);
 		}
-		else if (!strcmp(s, "LW"))
+		else if (pdf_name_eq(key, PDF_NAME(LW)))
 		{
 			pr->dev->flags &= ~FZ_DEVFLAG_LINEWIDTH_UNDEFINED;
 			gstate->stroke_state = fz_unshare_stroke_state(ctx, gstate->stroke_state);
 			gstate->stroke_state->linewidth = pdf_to_real(val);
 		}
-		else if (!strcmp(s, "LJ"))
+		else if (pdf_name_eq(key, PDF_NAME(LJ)))
 		{
 			pr->dev->flags &= ~FZ_DEVFLAG_LINEJOIN_UNDEFINED;
 			gstate->stroke_state = fz_unshare_stroke_state(ctx, gstate->stroke_state);
 			gstate->stroke_state->linejoin = pdf_to_int(val);
 		}
-		else if (!strcmp(s, "ML"))
+		else if (pdf_name_eq(key, PDF_NAME(ML)))
 		{
 			pr->dev->flags &= ~FZ_DEVFLAG_MITERLIMIT_UNDEFINED;
 			gstate->stroke_state = fz_unshare_stroke_state(ctx, gstate->stroke_state);
 			gstate->stroke_state->miterlimit = pdf_to_real(val);
 		}
 
-		else if (!strcmp(s, "D"))
+		else if (pdf_name_eq(key, PDF_NAME(D)))
 		{
 			if (pdf_is_array(val) && pdf_array_len(val) == 2)
 			{
@@ -1625,13 +1624,13 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed /D");
 		}
 
-		else if (!strcmp(s, "CA"))
+		else if (pdf_name_eq(key, PDF_NAME(CA)))
 			gstate->stroke.alpha = fz_clamp(pdf_to_real(val), 0, 1);
 
-		else if (!strcmp(s, "ca"))
+		else if (pdf_name_eq(key, PDF_NAME(ca)))
 			gstate->fill.alpha = fz_clamp(pdf_to_real(val), 0, 1);
 
-		else if (!strcmp(s, "BM"))
+		else if (pdf_name_eq(key, PDF_NAME(BM)))
 		{
 			if (pdf_is_array(val))
 			{
@@ -1647,7 +1646,7 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 			gstate->blendmode = fz_lookup_blendmode(pdf_to_name(val));
 		}
 
-		else if (!strcmp(s, "SMask"))
+		else if (pdf_name_eq(key, PDF_NAME(SMask)))
 		{
 			if (pdf_is_dict(val))
 			{
@@ -1666,7 +1665,7 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 					gstate->softmask_tr = NULL;
 				}
 
-				group = pdf_dict_gets(val, "G");
+				group = pdf_dict_get(val, PDF_NAME(G));
 				if (!group)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot load softmask xobject (%d %d R)", pdf_to_num(val), pdf_to_gen(val));
 				xobj = pdf_load_xobject(csi->doc, group);
@@ -1682,25 +1681,25 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 				for (k = 0; k < colorspace->n; k++)
 					gstate->softmask_bc[k] = 0;
 
-				bc = pdf_dict_gets(val, "BC");
+				bc = pdf_dict_get(val, PDF_NAME(BC));
 				if (pdf_is_array(bc))
 				{
 					for (k = 0; k < colorspace->n; k++)
 						gstate->softmask_bc[k] = pdf_to_real(pdf_array_get(bc, k));
 				}
 
-				luminosity = pdf_dict_gets(val, "S");
-				if (pdf_is_name(luminosity) && !strcmp(pdf_to_name(luminosity), "Luminosity"))
+				luminosity = pdf_dict_get(val, PDF_NAME(S));
+				if (pdf_name_eq(luminosity, PDF_NAME(Luminosity)))
 					gstate->luminosity = 1;
 				else
 					gstate->luminosity = 0;
 
-				tr = pdf_dict_gets(val, "TR");
+				tr = pdf_dict_get(val, PDF_NAME(TR));
 				/* SumatraPDF: support transfer functions */
 				if (tr)
 					gstate->softmask_tr = pdf_load_transfer_function(csi->doc, tr, 0);
 			}
-			else if (pdf_is_name(val) && !strcmp(pdf_to_name(val), "None"))
+			else if (pdf_name_eq(val, PDF_NAME(None)))
 			{
 				if (gstate->softmask)
 				{
@@ -1711,11 +1710,11 @@ pdf_run_extgstate(pdf_csi *csi, pdf_run_state *pr, pdf_obj *rdb, pdf_obj *extgst
 		}
 
 		/* SumatraPDF: support transfer functions */
-		else if ((!strcmp(s, "TR") && !pdf_dict_gets(extgstate, "TR2")) || !strcmp(s, "TR2"))
+		else if ((pdf_name_eq(key, PDF_NAME(TR)) && !pdf_dict_get(extgstate, PDF_NAME(TR2))) || pdf_name_eq(key, PDF_NAME(TR2)))
 		{
 			fz_drop_transfer_function(ctx, gstate->tr);
 			gstate->tr = NULL;
-			gstate->tr = pdf_load_transfer_function(csi->doc, val, !strcmp(s, "TR2"));
+			gstate->tr = pdf_load_transfer_function(csi->doc, val, pdf_name_eq(key, PDF_NAME(TR2)));
 		}
 	}
 }
@@ -1881,7 +1880,7 @@ static void pdf_run_BDC(pdf_csi *csi, void *state)
 
 	if (pdf_is_name(csi->obj))
 	{
-		ocg = pdf_dict_gets(pdf_dict_gets(rdb, "Properties"), pdf_to_name(csi->obj));
+		ocg = pdf_dict_gets(pdf_dict_get(rdb, PDF_NAME(Properties)), pdf_to_name(csi->obj));
 	}
 	else
 		ocg = csi->obj;
@@ -1892,7 +1891,7 @@ static void pdf_run_BDC(pdf_csi *csi, void *state)
 		 * means visible. */
 		return;
 	}
-	if (strcmp(pdf_to_name(pdf_dict_gets(ocg, "Type")), "OCG") != 0)
+	if (strcmp(pdf_to_name(pdf_dict_get(ocg, PDF_NAME(Type))), "OCG") != 0)
 	{
 		/* Wrong type of property */
 		return;
@@ -1968,7 +1967,7 @@ static void pdf_run_cs_imp(pdf_csi *csi, pdf_run_state *pr, int what)
 			colorspace = fz_device_cmyk(ctx); /* No fz_keep_colorspace as static */
 		else
 		{
-			dict = pdf_dict_gets(rdb, "ColorSpace");
+			dict = pdf_dict_get(rdb, PDF_NAME(ColorSpace));
 			if (!dict)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find ColorSpace dictionary");
 			obj = pdf_dict_gets(dict, csi->name);
@@ -2014,7 +2013,7 @@ static void pdf_run_Do(pdf_csi *csi, void *state)
 	pdf_obj *subtype;
 	pdf_obj *rdb = csi->rdb;
 
-	dict = pdf_dict_gets(rdb, "XObject");
+	dict = pdf_dict_get(rdb, PDF_NAME(XObject));
 	if (!dict)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find XObject dictionary when looking for: '%s'", csi->name);
 
@@ -2022,17 +2021,17 @@ static void pdf_run_Do(pdf_csi *csi, void *state)
 	if (!obj)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find xobject resource: '%s'", csi->name);
 
-	subtype = pdf_dict_gets(obj, "Subtype");
+	subtype = pdf_dict_get(obj, PDF_NAME(Subtype));
 	if (!pdf_is_name(subtype))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "no XObject subtype specified");
 
-	if (pdf_is_hidden_ocg(pdf_dict_gets(obj, "OC"), csi, pr, rdb))
+	if (pdf_is_hidden_ocg(pdf_dict_get(obj, PDF_NAME(OC)), csi, pr, rdb))
 		return;
 
-	if (!strcmp(pdf_to_name(subtype), "Form") && pdf_dict_gets(obj, "Subtype2"))
-		subtype = pdf_dict_gets(obj, "Subtype2");
+	if (pdf_name_eq(subtype, PDF_NAME(Form)) && pdf_dict_get(obj, PDF_NAME(Subtype2)))
+		subtype = pdf_dict_get(obj, PDF_NAME(Subtype2));
 
-	if (!strcmp(pdf_to_name(subtype), "Form"))
+	if (pdf_name_eq(subtype, PDF_NAME(Form)))
 	{
 		pdf_xobject *xobj;
 
@@ -2056,7 +2055,7 @@ static void pdf_run_Do(pdf_csi *csi, void *state)
 		}
 	}
 
-	else if (!strcmp(pdf_to_name(subtype), "Image"))
+	else if (pdf_name_eq(subtype, PDF_NAME(Image)))
 	{
 		if ((pr->dev->hints & FZ_IGNORE_IMAGE) == 0)
 		{
@@ -2077,7 +2076,7 @@ static void pdf_run_Do(pdf_csi *csi, void *state)
 		}
 	}
 
-	else if (!strcmp(pdf_to_name(subtype), "PS"))
+	else if (pdf_name_eq(subtype, PDF_NAME(PS)))
 	{
 		fz_warn(ctx, "ignoring XObject with subtype PS");
 	}
@@ -2205,7 +2204,7 @@ static void pdf_run_SC_imp(pdf_csi *csi, pdf_run_state *pr, int what, pdf_materi
 		break;
 
 	case PDF_MAT_PATTERN:
-		dict = pdf_dict_gets(rdb, "Pattern");
+		dict = pdf_dict_get(rdb, PDF_NAME(Pattern));
 		if (!dict)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find Pattern dictionary");
 
@@ -2213,7 +2212,7 @@ static void pdf_run_SC_imp(pdf_csi *csi, pdf_run_state *pr, int what, pdf_materi
 		if (!obj)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find pattern resource '%s'", csi->name);
 
-		patterntype = pdf_dict_gets(obj, "PatternType");
+		patterntype = pdf_dict_get(obj, PDF_NAME(PatternType));
 
 		if (pdf_to_int(patterntype) == 1)
 		{
@@ -2307,7 +2306,7 @@ static void pdf_run_Tf(pdf_csi *csi, void *state)
 		pdf_drop_font(ctx, gstate->font);
 	gstate->font = NULL;
 
-	dict = pdf_dict_gets(rdb, "Font");
+	dict = pdf_dict_get(rdb, PDF_NAME(Font));
 	if (!dict)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find Font dictionary");
 
@@ -2529,7 +2528,7 @@ static void pdf_run_gs(pdf_csi *csi, void *state)
 	fz_context *ctx = csi->doc->ctx;
 	pdf_obj *rdb = csi->rdb;
 
-	dict = pdf_dict_gets(rdb, "ExtGState");
+	dict = pdf_dict_get(rdb, PDF_NAME(ExtGState));
 	if (!dict)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find ExtGState dictionary");
 
@@ -2651,7 +2650,7 @@ static void pdf_run_sh(pdf_csi *csi, void *state)
 	pdf_obj *obj;
 	fz_shade *shd;
 
-	dict = pdf_dict_gets(rdb, "Shading");
+	dict = pdf_dict_get(rdb, PDF_NAME(Shading));
 	if (!dict)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find shading dictionary");
 
@@ -2780,10 +2779,10 @@ process_annot(pdf_csi *csi, void *state, pdf_obj *resources, pdf_annot *annot)
 	fz_context *ctx = pr->ctx;
 	int flags;
 
-	if (pdf_is_hidden_ocg(pdf_dict_gets(annot->obj, "OC"), csi, pr, resources))
+	if (pdf_is_hidden_ocg(pdf_dict_get(annot->obj, PDF_NAME(OC)), csi, pr, resources))
 		return;
 
-	flags = pdf_to_int(pdf_dict_gets(annot->obj, "F"));
+	flags = pdf_to_int(pdf_dict_get(annot->obj, PDF_NAME(F)));
 	if (!strcmp(pr->event, "Print") && !(flags & (1 << 2))) /* Print */
 		return;
 	if (!strcmp(pr->event, "View") && (flags & (1 << 5))) /* NoView */
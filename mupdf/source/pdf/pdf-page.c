@@ -37,7 +37,7 @@ pdf_lookup_page_loc_imp(pdf_document *doc, pdf_obj *node, int *skip, pdf_obj **p
 	{
 		do
 		{
-			kids = pdf_dict_gets(node, "Kids");
+			kids = pdf_dict_get(node, PDF_NAME(Kids));
 			len = pdf_array_len(kids);
 
 			if (len == 0)
@@ -63,8 +63,8 @@ pdf_lookup_page_loc_imp(pdf_document *doc, pdf_obj *node, int *skip, pdf_obj **p
 			for (i = 0; i < len; i++)
 			{
 				pdf_obj *kid = pdf_array_get(kids, i);
-				char *type = pdf_to_name(pdf_dict_gets(kid, "Type"));
-				if (!strcmp(type, "Page") || (!*type && pdf_dict_gets(kid, "MediaBox")))
+				pdf_obj *type = pdf_dict_get(kid, PDF_NAME(Type));
+				if (pdf_name_eq(type, PDF_NAME(Page)) || (!*pdf_to_name(type) && pdf_dict_get(kid, PDF_NAME(MediaBox))))
 				{
 tolerate_broken_page_tree:
 					if (*skip == 0)
@@ -79,9 +79,9 @@ tolerate_broken_page_tree:
 						(*skip)--;
 					}
 				}
-				else if (!strcmp(type, "Pages") || (!*type && pdf_dict_gets(kid, "Kids")))
+				else if (pdf_name_eq(type, PDF_NAME(Pages)) || (!*pdf_to_name(type) && pdf_dict_get(kid, PDF_NAME(Kids))))
 				{
-					int count = pdf_to_int(pdf_dict_gets(kid, "Count"));
+					int count = pdf_to_int(pdf_dict_get(kid, PDF_NAME(Count)));
 					if (*skip < count)
 					{
 						node = kid;
@@ -96,7 +96,7 @@ tolerate_broken_page_tree:
 				{
 					/* cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2582 */
 					/* cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2608 */
-					fz_warn(ctx, "non-page object in page tree (%s)", type);
+					fz_warn(ctx, "non-page object in page tree (%s)", pdf_to_name(type));
 					goto tolerate_broken_page_tree;
 				}
 			}
@@ -121,8 +121,8 @@ tolerate_broken_page_tree:
 pdf_obj *
 pdf_lookup_page_loc(pdf_document *doc, int needle, pdf_obj **parentp, int *indexp)
 {
-	pdf_obj *root = pdf_dict_gets(pdf_trailer(doc), "Root");
-	pdf_obj *node = pdf_dict_gets(root, "Pages");
+	pdf_obj *root = pdf_dict_get(pdf_trailer(doc), PDF_NAME(Root));
+	pdf_obj *node = pdf_dict_get(root, PDF_NAME(Pages));
 	int skip = needle;
 	pdf_obj *hit;
 
@@ -144,16 +144,16 @@ pdf_lookup_page_obj(pdf_document *doc, int needle)
 static int
 pdf_count_pages_before_kid(pdf_document *doc, pdf_obj *parent, int kid_num)
 {
-	pdf_obj *kids = pdf_dict_gets(parent, "Kids");
+	pdf_obj *kids = pdf_dict_get(parent, PDF_NAME(Kids));
 	int i, total = 0, len = pdf_array_len(kids);
 	for (i = 0; i < len; i++)
 	{
 		pdf_obj *kid = pdf_array_get(kids, i);
 		if (pdf_to_num(kid) == kid_num)
 			return total;
-		if (!strcmp(pdf_to_name(pdf_dict_gets(kid, "Type")), "Pages"))
+		if (pdf_name_eq(pdf_dict_get(kid, PDF_NAME(Type)), PDF_NAME(Pages)))
 		{
-			pdf_obj *count = pdf_dict_gets(kid, "Count");
+			pdf_obj *count = pdf_dict_get(kid, PDF_NAME(Count));
 			int n = pdf_to_int(count);
 			/* SumatraPDF: tolerate nodes with /Count 0 /Kids [ ] */
 			if (!pdf_is_int(count) || n < 0)
@@ -174,10 +174,10 @@ pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
 	int total = 0;
 	pdf_obj *parent, *parent2;
 
-	if (strcmp(pdf_to_name(pdf_dict_gets(node, "Type")), "Page") != 0)
+	if (!pdf_name_eq(pdf_dict_get(node, PDF_NAME(Type)), PDF_NAME(Page)))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid page object");
 
-	parent2 = parent = pdf_dict_gets(node, "Parent");
+	parent2 = parent = pdf_dict_get(node, PDF_NAME(Parent));
 	fz_var(parent);
 	fz_try(ctx)
 	{
@@ -187,7 +187,7 @@ pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree (parents)");
 			total += pdf_count_pages_before_kid(doc, parent, needle);
 			needle = pdf_to_num(parent);
-			parent = pdf_dict_gets(parent, "Parent");
+			parent = pdf_dict_get(parent, PDF_NAME(Parent));
 		}
 	}
 	fz_always(ctx)
@@ -198,7 +198,7 @@ pdf_lookup_page_number(pdf_document *doc, pdf_obj *node)
 			pdf_unmark_obj(parent2);
 			if (parent2 == parent)
 				break;
-			parent2 = pdf_dict_gets(parent2, "Parent");
+			parent2 = pdf_dict_get(parent2, PDF_NAME(Parent));
 		}
 	}
 	fz_catch(ctx)
@@ -228,7 +228,7 @@ pdf_lookup_inherited_page_item(pdf_document *doc, pdf_obj *node, const char *key
 				break;
 			if (pdf_mark_obj(node))
 				fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree (parents)");
-			node = pdf_dict_gets(node, "Parent");
+			node = pdf_dict_get(node, PDF_NAME(Parent));
 		}
 		while (node);
 	}
@@ -239,7 +239,7 @@ pdf_lookup_inherited_page_item(pdf_document *doc, pdf_obj *node, const char *key
 			pdf_unmark_obj(node2);
 			if (node2 == node)
 				break;
-			node2 = pdf_dict_gets(node2, "Parent");
+			node2 = pdf_dict_get(node2, PDF_NAME(Parent));
 		}
 		while (node2);
 	}
@@ -258,7 +258,7 @@ static int pdf_resources_use_blending(pdf_document *doc, pdf_obj *rdb);
 static int
 pdf_extgstate_uses_blending(pdf_document *doc, pdf_obj *dict)
 {
-	pdf_obj *obj = pdf_dict_gets(dict, "BM");
+	pdf_obj *obj = pdf_dict_get(dict, PDF_NAME(BM));
 	/* SumatraPDF: properly support /BM arrays */
 	if (pdf_is_array(obj))
 	{
@@ -284,17 +284,17 @@ static int
 pdf_pattern_uses_blending(pdf_document *doc, pdf_obj *dict)
 {
 	pdf_obj *obj;
-	obj = pdf_dict_gets(dict, "Resources");
+	obj = pdf_dict_get(dict, PDF_NAME(Resources));
 	if (pdf_resources_use_blending(doc, obj))
 		return 1;
-	obj = pdf_dict_gets(dict, "ExtGState");
+	obj = pdf_dict_get(dict, PDF_NAME(ExtGState));
 	return pdf_extgstate_uses_blending(doc, obj);
 }
 
 static int
 pdf_xobject_uses_blending(pdf_document *doc, pdf_obj *dict)
 {
-	pdf_obj *obj = pdf_dict_gets(dict, "Resources");
+	pdf_obj *obj = pdf_dict_get(dict, PDF_NAME(Resources));
 	if (!strcmp(pdf_to_name(pdf_dict_getp(dict, "Group/S")), "Transparency"))
 		return 1;
 	return pdf_resources_use_blending(doc, obj);
@@ -320,19 +320,19 @@ pdf_resources_use_blending(pdf_document *doc, pdf_obj *rdb)
 
 	fz_try(ctx)
 	{
-		obj = pdf_dict_gets(rdb, "ExtGState");
+		obj = pdf_dict_get(rdb, PDF_NAME(ExtGState));
 		n = pdf_dict_len(obj);
 		for (i = 0; i < n; i++)
 			if (pdf_extgstate_uses_blending(doc, pdf_dict_get_val(obj, i)))
 				goto found;
 
-		obj = pdf_dict_gets(rdb, "Pattern");
+		obj = pdf_dict_get(rdb, PDF_NAME(Pattern));
 		n = pdf_dict_len(obj);
 		for (i = 0; i < n; i++)
 			if (pdf_pattern_uses_blending(doc, pdf_dict_get_val(obj, i)))
 				goto found;
 
-		obj = pdf_dict_gets(rdb, "XObject");
+		obj = pdf_dict_get(rdb, PDF_NAME(XObject));
 		n = pdf_dict_len(obj);
 		for (i = 0; i < n; i++)
 			if (pdf_xobject_uses_blending(doc, pdf_dict_get_val(obj, i)))
@@ -363,18 +363,18 @@ pdf_load_transition(pdf_document *doc, pdf_page *page, pdf_obj *transdict)
 	pdf_obj *obj;
 	int type;
 
-	obj = pdf_dict_gets(transdict, "D");
+	obj = pdf_dict_get(transdict, PDF_NAME(D));
 	page->transition.duration = (obj ? pdf_to_real(obj) : 1);
 
-	page->transition.vertical = (pdf_to_name(pdf_dict_gets(transdict, "Dm"))[0] != 'H');
-	page->transition.outwards = (pdf_to_name(pdf_dict_gets(transdict, "M"))[0] != 'I');
+	page->transition.vertical = (pdf_to_name(pdf_dict_get(transdict, PDF_NAME(Dm)))[0] != 'H');
+	page->transition.outwards = (pdf_to_name(pdf_dict_get(transdict, PDF_NAME(M)))[0] != 'I');
 	/* FIXME: If 'Di' is None, it should be handled differently, but
 	 * this only affects Fly, and we don't implement that currently. */
-	page->transition.direction = (pdf_to_int(pdf_dict_gets(transdict, "Di")));
+	page->transition.direction = (pdf_to_int(pdf_dict_get(transdict, PDF_NAME(Di))));
 	/* FIXME: Read SS for Fly when we implement it */
 	/* FIXME: Read B for Fly when we implement it */
 
-	name = pdf_to_name(pdf_dict_gets(transdict, "S"));
+	name = pdf_to_name(pdf_dict_get(transdict, PDF_NAME(S)));
 	if (!strcmp(name, "Split"))
 		type = FZ_TRANSITION_SPLIT;
 	else if (!strcmp(name, "Blinds"))
@@ -447,7 +447,7 @@ pdf_load_page_by_obj(pdf_document *doc, int number, pdf_obj *pageref)
 	page->me = pdf_keep_obj(pageobj);
 	page->incomplete = 0;
 
-	obj = pdf_dict_gets(pageobj, "UserUnit");
+	obj = pdf_dict_get(pageobj, PDF_NAME(UserUnit));
 	if (pdf_is_real(obj))
 		userunit = pdf_to_real(obj);
 	else
@@ -496,7 +496,7 @@ pdf_load_page_by_obj(pdf_document *doc, int number, pdf_obj *pageref)
 
 	fz_try(ctx)
 	{
-		obj = pdf_dict_gets(pageobj, "Annots");
+		obj = pdf_dict_get(pageobj, PDF_NAME(Annots));
 		if (obj)
 		{
 			page->links = pdf_load_link_annots(doc, obj, &page->ctm);
@@ -511,9 +511,9 @@ pdf_load_page_by_obj(pdf_document *doc, int number, pdf_obj *pageref)
 		page->incomplete |= PDF_PAGE_INCOMPLETE_ANNOTS;
 	}
 
-	page->duration = pdf_to_real(pdf_dict_gets(pageobj, "Dur"));
+	page->duration = pdf_to_real(pdf_dict_get(pageobj, PDF_NAME(Dur)));
 
-	obj = pdf_dict_gets(pageobj, "Trans");
+	obj = pdf_dict_get(pageobj, PDF_NAME(Trans));
 	page->transition_present = (obj != NULL);
 	if (obj)
 	{
@@ -525,7 +525,7 @@ pdf_load_page_by_obj(pdf_document *doc, int number, pdf_obj *pageref)
 	if (page->resources)
 		pdf_keep_obj(page->resources);
 
-	obj = pdf_dict_gets(pageobj, "Contents");
+	obj = pdf_dict_get(pageobj, PDF_NAME(Contents));
 	fz_try(ctx)
 	{
 		page->contents = pdf_keep_obj(obj);
@@ -601,14 +601,14 @@ pdf_delete_page(pdf_document *doc, int at)
 	int i;
 
 	pdf_lookup_page_loc(doc, at, &parent, &i);
-	kids = pdf_dict_gets(parent, "Kids");
+	kids = pdf_dict_get(parent, PDF_NAME(Kids));
 	pdf_array_delete(kids, i);
 
 	while (parent)
 	{
-		int count = pdf_to_int(pdf_dict_gets(parent, "Count"));
+		int count = pdf_to_int(pdf_dict_get(parent, PDF_NAME(Count)));
 		pdf_dict_puts_drop(parent, "Count", pdf_new_int(doc, count - 1));
-		parent = pdf_dict_gets(parent, "Parent");
+		parent = pdf_dict_get(parent, PDF_NAME(Parent));
 	}
 
 	doc->page_count = 0; /* invalidate cached value */
@@ -629,12 +629,12 @@ pdf_insert_page(pdf_document *doc, pdf_page *page, int at)
 	{
 		if (count == 0)
 		{
-			pdf_obj *root = pdf_dict_gets(pdf_trailer(doc), "Root");
-			parent = pdf_dict_gets(root, "Pages");
+			pdf_obj *root = pdf_dict_get(pdf_trailer(doc), PDF_NAME(Root));
+			parent = pdf_dict_get(root, PDF_NAME(Pages));
 			if (!parent)
 				fz_throw(doc->ctx, FZ_ERROR_GENERIC, "cannot find page tree");
 
-			kids = pdf_dict_gets(parent, "Kids");
+			kids = pdf_dict_get(parent, PDF_NAME(Kids));
 			if (!kids)
 				fz_throw(doc->ctx, FZ_ERROR_GENERIC, "malformed page tree");
 
@@ -650,14 +650,14 @@ pdf_insert_page(pdf_document *doc, pdf_page *page, int at)
 
 			/* append after last page */
 			pdf_lookup_page_loc(doc, count - 1, &parent, &i);
-			kids = pdf_dict_gets(parent, "Kids");
+			kids = pdf_dict_get(parent, PDF_NAME(Kids));
 			pdf_array_insert(kids, page_ref, i + 1);
 		}
 		else
 		{
 			/* insert before found page */
 			pdf_lookup_page_loc(doc, at, &parent, &i);
-			kids = pdf_dict_gets(parent, "Kids");
+			kids = pdf_dict_get(parent, PDF_NAME(Kids));
 			pdf_array_insert(kids, page_ref, i);
 		}
 
@@ -666,9 +666,9 @@ pdf_insert_page(pdf_document *doc, pdf_page *page, int at)
 		/* Adjust page counts */
 		while (parent)
 		{
-			int count = pdf_to_int(pdf_dict_gets(parent, "Count"));
+			int count = pdf_to_int(pdf_dict_get(parent, PDF_NAME(Count)));
 			pdf_dict_puts_drop(parent, "Count", pdf_new_int(doc, count + 1));
-			parent = pdf_dict_gets(parent, "Parent");
+			parent = pdf_dict_get(parent, PDF_NAME(Parent));
 		}
 
 	}
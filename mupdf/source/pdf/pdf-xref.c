@@ -1206,6 +1206,9 @@ pdf_init_document(pdf_document *doc)
 	fz_catch(ctx) { }
 }
 
+/* SumatraPDF: object streams inflated ahead of time */
+static void pdf_drop_obj_stm_preload(fz_context *ctx, pdf_obj_stm_preload *preload);
+
 void
 pdf_close_document(pdf_document *doc)
 {
@@ -1267,6 +1270,12 @@ pdf_close_document(pdf_document *doc)
 
 	fz_empty_store(ctx);
 
+	/* SumatraPDF: intern name objects per document */
+	pdf_drop_name_table(doc);
+
+	/* SumatraPDF: object streams inflated ahead of time */
+	pdf_drop_obj_stm_preload(ctx, doc->obj_stm_preload);
+
 	pdf_lexbuf_fin(&doc->lexbuf.base);
 
 	fz_free(ctx, doc);
@@ -1294,10 +1303,15 @@ pdf_print_xref(pdf_document *doc)
  * compressed object streams
  */
 
+/* SumatraPDF: object streams inflated ahead of time */
+static fz_buffer *pdf_take_preloaded_obj_stm(pdf_document *doc, int num);
+
 static void
 pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 {
 	fz_stream *stm = NULL;
+	/* SumatraPDF: the object stream might already have been inflated */
+	fz_buffer *data = pdf_take_preloaded_obj_stm(doc, num);
 	pdf_obj *objstm = NULL;
 	int *numbuf = NULL;
 	int *ofsbuf = NULL;
@@ -1308,11 +1322,16 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 	int i;
 	pdf_token tok;
 	fz_context *ctx = doc->ctx;
+	/* SumatraPDF: allocate the contained objects from an arena */
+	pdf_obj_arena *prev_arena = doc->obj_arena;
+	pdf_obj_arena *arena = NULL;
 
 	fz_var(numbuf);
 	fz_var(ofsbuf);
 	fz_var(objstm);
 	fz_var(stm);
+	fz_var(arena);
+	fz_var(data);
 
 	fz_try(ctx)
 	{
@@ -1329,7 +1348,10 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 		numbuf = fz_calloc(ctx, count, sizeof(int));
 		ofsbuf = fz_calloc(ctx, count, sizeof(int));
 
-		stm = pdf_open_stream(doc, num, gen);
+		if (data)
+			stm = fz_open_buffer(ctx, data);
+		else
+			stm = pdf_open_stream(doc, num, gen);
 		for (i = 0; i < count; i++)
 		{
 			tok = pdf_lex(stm, buf);
@@ -1345,6 +1367,9 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 
 		fz_seek(stm, first, SEEK_SET);
 
+		arena = pdf_new_obj_arena(doc);
+		doc->obj_arena = arena;
+
 		for (i = 0; i < count; i++)
 		{
 			int xref_len = pdf_xref_len(doc);
@@ -1398,7 +1423,13 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 	}
 	fz_always(ctx)
 	{
+		if (arena)
+		{
+			doc->obj_arena = prev_arena;
+			pdf_drop_obj_arena(arena);
+		}
 		fz_close(stm);
+		fz_drop_buffer(ctx, data);
 		fz_free(ctx, ofsbuf);
 		fz_free(ctx, numbuf);
 		pdf_drop_obj(objstm);
@@ -1409,6 +1440,253 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 	}
 }
 
+/* SumatraPDF: preload all object streams at once, so that the expensive
+ * inflating can happen on several threads */
+struct pdf_obj_stm_preload_s
+{
+	pdf_document *doc;
+	int count;
+	int *nums; /* sorted */
+	fz_compressed_buffer **raw;
+	fz_buffer **data;
+	/* upper bound for the size of all inflated object streams */
+	size_t max_size;
+	/* number and total size of inflated object streams not yet parsed */
+	int left;
+	size_t size;
+};
+
+static void
+pdf_drop_obj_stm_preload(fz_context *ctx, pdf_obj_stm_preload *preload)
+{
+	int i;
+
+	if (!preload)
+		return;
+
+	for (i = 0; i < preload->count; i++)
+	{
+		fz_free_compressed_buffer(ctx, preload->raw[i]);
+		fz_drop_buffer(ctx, preload->data[i]);
+	}
+	fz_free(ctx, preload->nums);
+	fz_free(ctx, preload->raw);
+	fz_free(ctx, preload->data);
+	fz_free(ctx, preload);
+}
+
+/* returns the inflated data of object stream num, if it's been preloaded */
+static fz_buffer *
+pdf_take_preloaded_obj_stm(pdf_document *doc, int num)
+{
+	pdf_obj_stm_preload *preload = doc->obj_stm_preload;
+	fz_buffer *data = NULL;
+	int l, r;
+
+	if (!preload)
+		return NULL;
+
+	l = 0;
+	r = preload->count - 1;
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		if (num < preload->nums[m])
+			r = m - 1;
+		else if (num > preload->nums[m])
+			l = m + 1;
+		else
+		{
+			data = preload->data[m];
+			preload->data[m] = NULL;
+			break;
+		}
+	}
+
+	if (data)
+		preload->size -= data->len;
+
+	/* free the preload as soon as all object streams have been parsed */
+	if (data && --preload->left == 0)
+	{
+		pdf_drop_obj_stm_preload(doc->ctx, preload);
+		doc->obj_stm_preload = NULL;
+	}
+
+	return data;
+}
+
+pdf_obj_stm_preload *
+pdf_new_obj_stm_preload(pdf_document *doc, int min_count, size_t max_size)
+{
+	fz_context *ctx = doc->ctx;
+	pdf_obj_stm_preload *preload = NULL;
+	unsigned char *seen = NULL;
+	int xref_len = pdf_xref_len(doc);
+	int count = 0;
+	size_t raw_size = 0;
+	int i, j;
+
+	/* objects of progressively loaded documents might not be available yet */
+	if (doc->file_length || doc->obj_stm_preload)
+		return NULL;
+
+	fz_var(preload);
+	fz_var(seen);
+
+	fz_try(ctx)
+	{
+		seen = fz_calloc(ctx, xref_len, 1);
+		for (i = 1; i < xref_len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(doc, i);
+			if (entry->type == 'o' && !entry->obj && entry->ofs > 0 && entry->ofs < xref_len && !seen[entry->ofs])
+			{
+				seen[entry->ofs] = 1;
+				count++;
+			}
+		}
+
+		if (count >= min_count && count > 0)
+		{
+			preload = fz_malloc_struct(ctx, pdf_obj_stm_preload);
+			preload->doc = doc;
+			preload->nums = fz_malloc_array(ctx, count, sizeof(int));
+			preload->raw = fz_calloc(ctx, count, sizeof(fz_compressed_buffer *));
+			preload->data = fz_calloc(ctx, count, sizeof(fz_buffer *));
+			for (i = 1, j = 0; i < xref_len; i++)
+			{
+				if (seen[i])
+					preload->nums[j++] = i;
+			}
+			preload->count = count;
+			preload->max_size = max_size;
+
+			/* reading the raw data requires access to the document */
+			/* (assume that inflating triples the size, as for fz_read_all below) */
+			for (i = 0; i < count && raw_size * 3 <= max_size; i++)
+			{
+				fz_try(ctx)
+				{
+					preload->raw[i] = pdf_load_compressed_stream(doc, preload->nums[i], 0);
+					raw_size += preload->raw[i]->buffer->len;
+				}
+				fz_catch(ctx)
+				{
+					/* the object stream will be loaded on demand */
+					fz_warn(ctx, "cannot preload object stream (%d 0 R)", preload->nums[i]);
+				}
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, seen);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj_stm_preload(ctx, preload);
+		fz_rethrow(ctx);
+	}
+
+	return preload;
+}
+
+int
+pdf_count_obj_stm_preload(pdf_obj_stm_preload *preload)
+{
+	return preload ? preload->count : 0;
+}
+
+void
+pdf_inflate_obj_stm_preload(fz_context *ctx, pdf_obj_stm_preload *preload, int i)
+{
+	fz_compressed_buffer *raw;
+	fz_stream *stm = NULL;
+	int l2factor = 0;
+
+	if (!preload || i < 0 || i >= preload->count || !preload->raw[i])
+		return;
+	raw = preload->raw[i];
+
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		stm = fz_open_image_decomp_stream_from_buffer(ctx, raw, &l2factor);
+		preload->data[i] = fz_read_all(stm, raw->buffer->len * 3);
+	}
+	fz_always(ctx)
+	{
+		fz_close(stm);
+		fz_free_compressed_buffer(ctx, raw);
+		preload->raw[i] = NULL;
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot inflate object stream (%d 0 R)", preload->nums[i]);
+	}
+}
+
+/* the inflated object streams are only parsed on demand (cf. pdf_load_obj_stm),
+ * as parsing is far more expensive than inflating and most objects might
+ * never be needed */
+void
+pdf_finish_obj_stm_preload(pdf_obj_stm_preload *preload)
+{
+	pdf_document *doc;
+	fz_context *ctx;
+	int i;
+
+	if (!preload)
+		return;
+	doc = preload->doc;
+	ctx = doc->ctx;
+
+	preload->left = 0;
+	preload->size = 0;
+	for (i = 0; i < preload->count; i++)
+	{
+		fz_free_compressed_buffer(ctx, preload->raw[i]);
+		preload->raw[i] = NULL;
+		/* the size estimate might have been too low */
+		if (preload->data[i] && preload->size + preload->data[i]->len > preload->max_size)
+		{
+			fz_drop_buffer(ctx, preload->data[i]);
+			preload->data[i] = NULL;
+		}
+		if (preload->data[i])
+		{
+			preload->left++;
+			preload->size += preload->data[i]->len;
+		}
+	}
+
+	if (!preload->left)
+	{
+		pdf_drop_obj_stm_preload(ctx, preload);
+		return;
+	}
+	pdf_drop_obj_stm_preload(ctx, doc->obj_stm_preload);
+	doc->obj_stm_preload = preload;
+}
+
+size_t
+pdf_preloaded_obj_stms_size(pdf_document *doc)
+{
+	return doc && doc->obj_stm_preload ? doc->obj_stm_preload->size : 0;
+}
+
+/* the dropped object streams will be loaded on demand */
+void
+pdf_drop_preloaded_obj_stms(pdf_document *doc)
+{
+	if (!doc)
+		return;
+	pdf_drop_obj_stm_preload(doc->ctx, doc->obj_stm_preload);
+	doc->obj_stm_preload = NULL;
+}
+
 /*
  * object loading
  */
@@ -13,6 +13,8 @@ int pdfextract_main(int argc, char *argv[]);
 int pdfinfo_main(int argc, char *argv[]);
 int pdfposter_main(int argc, char *argv[]);
 int pdfshow_main(int argc, char *argv[]);
+/* SumatraPDF: benchmark and check the span and glyph painters */
+int paintbench_main(int argc, char *argv[]);
 
 static struct {
 	int (*func)(int argc, char *argv[]);
@@ -24,6 +26,7 @@ static struct {
 	{ pdfinfo_main, "info", "show information about pdf resources" },
 	{ pdfposter_main, "poster", "split large page into many tiles" },
 	{ pdfshow_main, "show", "show internal pdf objects" },
+	{ paintbench_main, "paint", "benchmark and check the span and glyph painters" },
 };
 
 static int
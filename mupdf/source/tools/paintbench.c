@@ -0,0 +1,262 @@
+/*
+ * SumatraPDF: span and glyph painter benchmark.
+ * Times the span and glyph painters used by the draw device and checks
+ * that they paint exactly what the scalar code paints. The SIMD paths in
+ * draw-paint.c only handle spans in groups of four pixels and leave the
+ * remainder to the scalar code, so painting one pixel at a time gives the
+ * scalar reference for every span painter. Glyphs are checked against
+ * their mask painted one pixel at a time with fz_paint_span_with_color.
+ */
+
+#include "mupdf/fitz.h"
+#include "../fitz/draw-imp.h"
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#define SPAN_WIDTH 1027
+#define GLYPH_WIDTH 40
+#define GLYPH_HEIGHT 48
+
+static unsigned char src[SPAN_WIDTH * 4];
+static unsigned char dst1[SPAN_WIDTH * 4];
+static unsigned char dst2[SPAN_WIDTH * 4];
+static unsigned char msk[SPAN_WIDTH];
+static unsigned char color[4];
+
+static const char *span_names[] =
+{
+	"span_with_color_4", "span_with_mask_4", "span_4_with_alpha", "span_4"
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mutool paint [options]\n"
+		"\t-t\tonly check the painters against the scalar code\n"
+		"\t-b\tonly benchmark the painters\n"
+		"\t-n -\tnumber of iterations (default 20000)\n"
+		"\t-w -\tspan width in pixels for the benchmark (default 1027)\n"
+		);
+	exit(1);
+}
+
+static double now_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* masks and alphas are mostly 0 and 255 with a few partial values, as in rendered pages */
+static int random_coverage(void)
+{
+	int r = rand() % 8;
+	return r == 0 ? 0 : r == 1 ? 255 : rand() & 255;
+}
+
+static void randomize(int premultiplied)
+{
+	int i, k;
+
+	for (i = 0; i < SPAN_WIDTH; i++)
+	{
+		msk[i] = random_coverage();
+		src[i * 4 + 3] = random_coverage();
+		for (k = 0; k < 3; k++)
+			src[i * 4 + k] = premultiplied ? rand() % (src[i * 4 + 3] + 1) : rand() & 255;
+		for (k = 0; k < 4; k++)
+			dst1[i * 4 + k] = dst2[i * 4 + k] = rand() & 255;
+	}
+	for (k = 0; k < 4; k++)
+		color[k] = rand() & 255;
+	if (rand() % 3 == 0)
+		color[3] = 255;
+}
+
+static void paint_span_kind(int kind, unsigned char *dp, int off, int w, int alpha)
+{
+	switch (kind)
+	{
+	case 0:
+		fz_paint_span_with_color(dp + off * 4, msk + off, 4, w, color);
+		break;
+	case 1:
+		fz_paint_span_with_mask(dp + off * 4, src + off * 4, msk + off, 4, w);
+		break;
+	case 2:
+		fz_paint_span(dp + off * 4, src + off * 4, 4, w, alpha);
+		break;
+	default:
+		fz_paint_span(dp + off * 4, src + off * 4, 4, w, 255);
+		break;
+	}
+}
+
+static int check_spans(int iterations)
+{
+	int iter, i, fails = 0;
+
+	for (iter = 0; iter < iterations; iter++)
+	{
+		int kind = iter % 4;
+		int off = rand() % 4;
+		int w = SPAN_WIDTH - off - rand() % 4;
+		int alpha = rand() % 3 == 0 ? 255 : rand() & 255;
+
+		randomize(iter & 4);
+		paint_span_kind(kind, dst1, off, w, alpha);
+		for (i = 0; i < w; i++)
+			paint_span_kind(kind, dst2, off + i, 1, alpha);
+		if (memcmp(dst1, dst2, sizeof(dst1)) != 0 && fails++ < 10)
+			fprintf(stderr, "mismatch: %s alpha %d color %d %d %d %d\n", span_names[kind], alpha, color[0], color[1], color[2], color[3]);
+	}
+	printf("spans: %d iterations, %d mismatches\n", iterations, fails);
+	return fails;
+}
+
+/* a glyph-like mask: runs of empty and solid pixels with anti-aliased edges */
+static void make_glyph_mask(unsigned char *mask, int w, int h)
+{
+	int x, y;
+
+	for (y = 0; y < h; y++)
+	{
+		int solid = 0;
+		for (x = 0; x < w; x++)
+		{
+			if (rand() % 6 == 0)
+			{
+				solid = !solid;
+				mask[y * w + x] = rand() & 255;
+			}
+			else
+				mask[y * w + x] = solid ? 255 : 0;
+		}
+	}
+}
+
+static int check_glyphs(fz_context *ctx, int iterations)
+{
+	unsigned char mask[GLYPH_WIDTH * GLYPH_HEIGHT];
+	unsigned char colorbv[4];
+	fz_irect bbox = { 0, 0, GLYPH_WIDTH, GLYPH_HEIGHT };
+	fz_pixmap *pix1, *pix2;
+	int iter, x, y, k, fails = 0;
+
+	pix1 = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &bbox);
+	pix2 = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &bbox);
+	for (iter = 0; iter < iterations; iter++)
+	{
+		fz_glyph *glyph;
+		int len = pix1->w * pix1->h * pix1->n;
+
+		make_glyph_mask(mask, GLYPH_WIDTH, GLYPH_HEIGHT);
+		glyph = fz_new_glyph_from_8bpp_data(ctx, 0, 0, GLYPH_WIDTH, GLYPH_HEIGHT, mask, GLYPH_WIDTH);
+		for (k = 0; k < len; k++)
+			pix1->samples[k] = pix2->samples[k] = rand() & 255;
+		for (k = 0; k < 4; k++)
+			colorbv[k] = rand() & 255;
+		if (iter & 1)
+			colorbv[3] = 255;
+
+		fz_paint_glyph(colorbv, pix1, pix1->samples, glyph, GLYPH_WIDTH, GLYPH_HEIGHT, 0, 0);
+		for (y = 0; y < GLYPH_HEIGHT; y++)
+			for (x = 0; x < GLYPH_WIDTH; x++)
+				fz_paint_span_with_color(pix2->samples + (y * pix2->w + x) * 4, mask + y * GLYPH_WIDTH + x, 4, 1, colorbv);
+		if (memcmp(pix1->samples, pix2->samples, len) != 0 && fails++ < 10)
+			fprintf(stderr, "mismatch: glyph color %d %d %d %d\n", colorbv[0], colorbv[1], colorbv[2], colorbv[3]);
+		fz_drop_glyph(ctx, glyph);
+	}
+	printf("glyphs: %d iterations, %d mismatches\n", iterations, fails);
+	fz_drop_pixmap(ctx, pix1);
+	fz_drop_pixmap(ctx, pix2);
+	return fails;
+}
+
+static void bench_spans(int iterations, int chunk)
+{
+	int kind, iter, x;
+	double start;
+
+	randomize(1);
+	for (kind = 0; kind < 4; kind++)
+	{
+		start = now_ms();
+		for (iter = 0; iter < iterations; iter++)
+			for (x = 0; x + chunk <= SPAN_WIDTH; x += chunk)
+				paint_span_kind(kind, dst1, x, chunk, 128);
+		printf("%-18s %.3f ns/pixel\n", span_names[kind], (now_ms() - start) * 1e6 / iterations / (SPAN_WIDTH / chunk * chunk));
+	}
+}
+
+static void bench_glyphs(fz_context *ctx, int iterations)
+{
+	unsigned char mask[GLYPH_WIDTH * GLYPH_HEIGHT];
+	unsigned char colorbv[4] = { 0x20, 0x40, 0x60, 0xFF };
+	fz_irect bbox = { 0, 0, GLYPH_WIDTH, GLYPH_HEIGHT };
+	fz_pixmap *pix;
+	fz_glyph *glyph;
+	int alpha, iter;
+	double start;
+
+	pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &bbox);
+	fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+	make_glyph_mask(mask, GLYPH_WIDTH, GLYPH_HEIGHT);
+	glyph = fz_new_glyph_from_8bpp_data(ctx, 0, 0, GLYPH_WIDTH, GLYPH_HEIGHT, mask, GLYPH_WIDTH);
+	for (alpha = 0; alpha < 2; alpha++)
+	{
+		colorbv[3] = alpha ? 0x80 : 0xFF;
+		start = now_ms();
+		for (iter = 0; iter < iterations; iter++)
+			fz_paint_glyph(colorbv, pix, pix->samples, glyph, GLYPH_WIDTH, GLYPH_HEIGHT, 0, 0);
+		printf("%-18s %.3f ns/pixel\n", alpha ? "glyph_alpha_4" : "glyph_solid_4", (now_ms() - start) * 1e6 / iterations / (GLYPH_WIDTH * GLYPH_HEIGHT));
+	}
+	fz_drop_glyph(ctx, glyph);
+	fz_drop_pixmap(ctx, pix);
+}
+
+int paintbench_main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int check = 1, bench = 1;
+	int iterations = 20000, chunk = SPAN_WIDTH;
+	int fails = 0;
+	int c;
+
+	while ((c = fz_getopt(argc, argv, "tbn:w:")) != -1)
+	{
+		switch (c)
+		{
+		case 't': bench = 0; break;
+		case 'b': check = 0; break;
+		case 'n': iterations = fz_atoi(fz_optarg); break;
+		case 'w': chunk = fz_atoi(fz_optarg); break;
+		default: usage(); break;
+		}
+	}
+	if (fz_optind != argc || iterations < 1 || chunk < 1 || chunk > SPAN_WIDTH)
+		usage();
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	if (check)
+	{
+		fails += check_spans(iterations);
+		fails += check_glyphs(ctx, iterations / 10 + 1);
+	}
+	if (bench)
+	{
+		bench_spans(iterations, chunk);
+		bench_glyphs(ctx, iterations);
+	}
+
+	fz_free_context(ctx);
+	return fails != 0;
+}
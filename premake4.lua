@@ -99,10 +99,12 @@ solution "all_tests"
       "src/utils/HtmlPrettyPrint*",
       "src/utils/HtmlPullParser*",
       "src/utils/JsonParser*",
+      "src/utils/MemoryBudget*",
       "src/utils/Scoped.*",
       "src/utils/SettingsUtil*",
       "src/utils/SimpleLog*",
       "src/utils/StrFormat*",
+      "src/utils/StrHash*",
       "src/utils/StrUtil*",
       "src/utils/SquareTreeParser*",
       "src/utils/TrivialHtmlParser*",
@@ -116,12 +118,13 @@ solution "all_tests"
       --"src/ParseCommandLine.*",
       --"src/StressTesting.*",
       "src/AppUtil*",
+      "src/TextIndex.*",
       "src/UnitTests.cpp",
       "src/mui/SvgPath*",
       "tools/tests/UnitMain.cpp"
     }
     defines { "NO_LIBMUPDF" }
-    includedirs { "src/utils", "src/utils/msvc" }
+    includedirs { "src/utils", "src/utils/msvc", "src" }
     links { "gdiplus", "comctl32", "shlwapi", "Version" }
 
 solution "plugin-test"
@@ -0,0 +1,78 @@
+"""
+Measures how the time for opening a comic book archive grows with its
+page count: creates .cbz files with 10, 100 and 1000 copies of a given
+image and runs SumatraPDF's benchmark mode on each (3 times each).
+
+Note: If SumatraPDF.exe can't be found in either ..\obj-rel\ or %PATH%,
+      pass a path to it as the first argument.
+
+cbx-open-benchmark.py obj-rel\SumatraPDF.exe page.jpg [10 100 1000]
+"""
+
+import os, re, shutil, sys, tempfile, zipfile
+from subprocess import Popen, PIPE
+
+def log(str):
+	sys.stderr.write(str + "\n")
+
+def createComic(path, image, pageCount):
+	ext = os.path.splitext(image)[1]
+	data = open(image, "rb").read()
+	zip = zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED)
+	for i in range(pageCount):
+		zip.writestr("page%05d%s" % (i, ext), data)
+	zip.close()
+
+def runBenchmark(SumatraPDFExe, file, repeats):
+	log("-> %s (%d times)" % (file, repeats))
+	proc = Popen([SumatraPDFExe] + ["-bench", file, "loadonly"] * repeats, stdout=PIPE, stderr=PIPE)
+	return proc.communicate()[1]
+
+def parseBenchOutput(output):
+	result = []
+	for line in output.replace("\r", "\n").split("\n"):
+		match = re.findall(r"page sizes: (\d+(?:\.\d+)?) ms \((\d+(?:\.\d+)?) ms per page\), open: (\d+(?:\.\d+)?) ms", line)
+		if match:
+			result.append([float(value) for value in match[0]])
+	return result
+
+def main():
+	if not sys.argv[1:]:
+		log("Usage: %s [<SumatraPDF.exe>] <page image> [<page count> ...]" % (os.path.split(sys.argv[0])[1]))
+		sys.exit(0)
+
+	if sys.argv[1].lower().endswith(".exe"):
+		SumatraPDFExe = sys.argv.pop(1)
+	else:
+		SumatraPDFExe = os.path.join(os.path.dirname(__file__), "..", "obj-rel", "SumatraPDF.exe")
+		if not os.path.exists(SumatraPDFExe):
+			SumatraPDFExe = "SumatraPDF.exe"
+	image = sys.argv[1]
+	pageCounts = [int(count) for count in sys.argv[2:]] or [10, 100, 1000]
+
+	tempDir = tempfile.mkdtemp()
+	results = []
+	try:
+		log("Running benchmark with %s..." % os.path.relpath(SumatraPDFExe))
+		for pageCount in pageCounts:
+			file = os.path.join(tempDir, "pages%d.cbz" % pageCount)
+			createComic(file, image, pageCount)
+			try:
+				data = parseBenchOutput(runBenchmark(SumatraPDFExe, file, 3))
+			except:
+				log("Error: %s not found" % os.path.relpath(SumatraPDFExe))
+				return
+			if data:
+				results.append((pageCount, data))
+	finally:
+		shutil.rmtree(tempDir)
+	log("")
+
+	print "Pages\tOpen time (in ms)\tPage sizes (in ms per page)\tRuns"
+	for (pageCount, data) in results:
+		openMin = min([item[2] for item in data])
+		perPageMin = min([item[1] for item in data])
+		print "%d\t%.2f\t%.3f\t%d" % (pageCount, openMin, perPageMin, len(data))
+
+if __name__ == "__main__":
+	main()
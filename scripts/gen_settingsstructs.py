@@ -398,6 +398,15 @@ GlobalPrefs = [
 		"actual resolution of the main screen in DPI (if this value " +
 		" isn't positive, the system's UI setting is used)",
 		expert=True, version="2.5"),
+	Field("RenderThreadCount", Int, 0,
+		"number of threads used for rendering pages (if this value isn't positive, " +
+		"one thread per processor core is used)",
+		expert=True, version="3.1"),
+	Field("CacheMemoryLimit", Int, 0,
+		"maximum amount of memory in MB used for caching rendered pages, page content, " +
+		"images and glyphs of all open documents (if this value isn't positive, " +
+		"a limit depending on the amount of installed memory is used)",
+		expert=True, version="3.1"),
 	EmptyLine(),
 
 	Field("RememberStatePerDocument", Bool, True,
@@ -222,11 +222,20 @@ public:
     virtual ~BaseEngine() { }
     // creates a clone of this engine (e.g. for printing on a different thread)
     virtual BaseEngine *Clone() = 0;
+    // true if cloning is cheap compared to extracting the text of all pages and
+    // clones can extract text in parallel (cf. TextSearch's ParallelSearch)
+    virtual bool SupportsParallelTextExtraction() const { return false; }
 
     // the name of the file this engine handles
     virtual const WCHAR *FileName() const = 0;
     // number of pages the loaded document contains
     virtual int PageCount() const = 0;
+    // true while further pages are still being layed out in the background
+    // (PageCount will grow until this returns false, cf. EbookEngine)
+    virtual bool IsLayoutPending() const { return false; }
+    // blocks until at least pageCount pages have been layed out
+    // or until no more pages are to be expected
+    virtual void WaitForPages(int pageCount) { }
 
     // the box containing the visible page content (usually RectD(0, 0, pageWidth, pageHeight))
     virtual RectD PageMediabox(int pageNo) = 0;
@@ -245,6 +254,10 @@ public:
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
                          RenderTarget target=Target_View, AbortCookie **cookie_out=NULL) = 0;
     // for both rendering methods: *cookie_out must be deleted after the call returns
+    // tells the engine which page is currently being viewed, so that engines
+    // which load pages in the background can predict the pages to load next
+    // (cf. DisplayModel::CurrentPageNo, RenderPage is also called for pages around it)
+    virtual void SetCurrentPage(int pageNo) { }
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
@@ -18,6 +18,7 @@
 #include "Selection.h"
 #include "SumatraAbout.h"
 #include "SumatraPDF.h"
+#include "TableOfContents.h"
 #include "Tabs.h"
 #include "Timer.h"
 #include "Toolbar.h"
@@ -1360,6 +1361,14 @@ static void OnTimer(WindowInfo& win, HWND hwnd, WPARAM timerId)
         else if (win.AsEbook())
             win.AsEbook()->TriggerLayout();
         break;
+
+    case UPDATE_PAGE_COUNT_TIMER_ID:
+        if (!UpdatePageCount(&win)) {
+            KillTimer(hwnd, UPDATE_PAGE_COUNT_TIMER_ID);
+            // the ToC might link to pages which hadn't been layed out before
+            ReloadTocTree(&win);
+        }
+        break;
     }
 }
 
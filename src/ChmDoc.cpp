@@ -16,6 +16,7 @@
 ChmDoc::~ChmDoc()
 {
     chm_close(chmHandle);
+    DeleteCriticalSection(&chmAccess);
 }
 
 bool ChmDoc::HasData(const char *fileName)
@@ -31,6 +32,7 @@ bool ChmDoc::HasData(const char *fileName)
     else if (str::StartsWith(fileName, "///"))
         fileName += 2;
 
+    ScopedCritSec scope(&chmAccess);
     struct chmUnitInfo info;
     return chm_resolve_object(chmHandle, fileName, &info) == CHM_RESOLVE_SUCCESS;
 }
@@ -45,6 +47,7 @@ unsigned char *ChmDoc::GetData(const char *fileName, size_t *lenOut)
         fileName += 2;
     }
 
+    ScopedCritSec scope(&chmAccess);
     struct chmUnitInfo info;
     int res = chm_resolve_object(chmHandle, fileName, &info);
     if (CHM_RESOLVE_SUCCESS != res)
@@ -281,6 +284,7 @@ static int ChmEnumerateEntry(struct chmFile *chmHandle, struct chmUnitInfo *info
 Vec<char *> *ChmDoc::GetAllPaths()
 {
     Vec<char *> *paths = new Vec<char *>();
+    ScopedCritSec scope(&chmAccess);
     chm_enumerate(chmHandle, CHM_ENUMERATE_FILES | CHM_ENUMERATE_NORMAL, ChmEnumerateEntry, paths);
     return paths;
 }
@@ -10,6 +10,9 @@ class EbookTocVisitor;
 
 class ChmDoc {
     struct chmFile *chmHandle;
+    // chmHandle might be used concurrently (e.g. for laying
+    // out pages in the background while parsing the ToC)
+    CRITICAL_SECTION chmAccess;
 
     // Data parsed from /#WINDOWS, /#STRINGS, /#SYSTEM files inside CHM file
     ScopedMem<char> title;
@@ -26,7 +29,7 @@ class ChmDoc {
     bool Load(const WCHAR *fileName);
 
 public:
-    ChmDoc() : chmHandle(NULL), codepage(0) { }
+    ChmDoc() : chmHandle(NULL), codepage(0) { InitializeCriticalSection(&chmAccess); }
     ~ChmDoc();
 
     bool HasData(const char *fileName);
@@ -144,7 +144,7 @@ static int LastPageInARowNo(int pageNo, int columns, bool showCover, int pageCou
 DisplayModel::DisplayModel(BaseEngine *engine, EngineType type, ControllerCallback *cb) :
     Controller(cb), engine(engine),
     userAnnots(NULL), userAnnotsModified(false), engineType(type), pdfSync(NULL),
-    pagesInfo(NULL), displayMode(DM_AUTOMATIC), startPage(1),
+    pagesInfo(NULL), pageCount(engine->PageCount()), pagesInfoCap(0), displayMode(DM_AUTOMATIC), startPage(1),
     zoomReal(INVALID_ZOOM), zoomVirtual(INVALID_ZOOM),
     rotation(0), dpiFactor(1.0f), displayR2L(false),
     presentationMode(false), presZoomVirtual(INVALID_ZOOM),
@@ -184,15 +184,19 @@ DisplayModel::~DisplayModel()
     delete textCache;
     delete engine;
     free(pagesInfo);
+    FreeVecMembers(oldPagesInfo);
 }
 
 PageInfo *DisplayModel::GetPageInfo(int pageNo) const
 {
+    // pageCount is read before pagesInfo, so that render threads
+    // never index an array smaller than pageCount (cf. UpdatePageCount)
     if (!ValidPageNo(pageNo))
         return NULL;
-    assert(pagesInfo);
-    if (!pagesInfo) return NULL;
-    return &(pagesInfo[pageNo-1]);
+    PageInfo *info = pagesInfo;
+    assert(info);
+    if (!info) return NULL;
+    return &(info[pageNo-1]);
 }
 
 // Call this before the first Relayout
@@ -200,6 +204,9 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
 {
     totalViewPortSize = viewPort;
     dpiFactor = 1.0f * screenDPI / engine->GetFileDPI();
+    // the start page might still be being layed out
+    engine->WaitForPages(newStartPage);
+    pageCount = engine->PageCount();
     if (ValidPageNo(newStartPage))
         startPage = newStartPage;
 
@@ -223,9 +230,20 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
 void DisplayModel::BuildPagesInfo()
 {
     assert(!pagesInfo);
-    int pageCount = PageCount();
-    pagesInfo = AllocArray<PageInfo>(pageCount);
+    pagesInfo = AllocArray<PageInfo>(PageCount());
+    pagesInfoCap = PageCount();
 
+    int columns = ColumnsFromDisplayMode(displayMode);
+    int newStartPage = startPage;
+    if (IsBookView(displayMode) && newStartPage == 1 && columns > 1)
+        newStartPage--;
+    InitPagesInfo(1, newStartPage);
+}
+
+// initializes the PageInfo of all pages from firstPageNo on (in non-continuous
+// modes, only the pages of the row starting at shownPageNo are shown)
+void DisplayModel::InitPagesInfo(int firstPageNo, int shownPageNo)
+{
     WCHAR unitSystem[2] = { 0 };
     GetLocaleInfo(LOCALE_USER_DEFAULT, LOCALE_IMEASURE, unitSystem, dimof(unitSystem));
     RectD defaultRect;
@@ -235,10 +253,7 @@ void DisplayModel::BuildPagesInfo()
         defaultRect = RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
 
     int columns = ColumnsFromDisplayMode(displayMode);
-    int newStartPage = startPage;
-    if (IsBookView(displayMode) && newStartPage == 1 && columns > 1)
-        newStartPage--;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+    for (int pageNo = firstPageNo; pageNo <= PageCount(); pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
         // layout pages with an empty mediabox as A4 size (resp. letter size)
@@ -248,11 +263,44 @@ void DisplayModel::BuildPagesInfo()
         pageInfo->shown = false;
         if (IsContinuous(displayMode))
             pageInfo->shown = true;
-        else if (newStartPage <= pageNo && pageNo < newStartPage + columns)
+        else if (shownPageNo <= pageNo && pageNo < shownPageNo + columns)
             pageInfo->shown = true;
     }
 }
 
+bool DisplayModel::UpdatePageCount()
+{
+    // check this first so that no page added in the meantime is missed
+    bool pending = engine->IsLayoutPending();
+    int newPageCount = engine->PageCount();
+    if (newPageCount <= pageCount)
+        return pending;
+
+    ScrollState ss = GetScrollState();
+    int firstNewPageNo = pageCount + 1;
+    if (newPageCount > pagesInfoCap) {
+        // render threads read pagesInfo without a lock, so the previous array
+        // is kept alive instead of being reallocated (growing geometrically
+        // so that the kept arrays are at most as large as the current one)
+        int newCap = std::max(newPageCount, 2 * pagesInfoCap);
+        PageInfo *newPagesInfo = AllocArray<PageInfo>(newCap);
+        CrashIf(!newPagesInfo); // TODO: use infallible allocation
+        memcpy(newPagesInfo, pagesInfo, sizeof(PageInfo) * pageCount);
+        oldPagesInfo.Append(pagesInfo);
+        pagesInfo = newPagesInfo;
+        pagesInfoCap = newCap;
+    }
+    // pagesInfo must hold newPageCount items before pageCount is updated (cf. GetPageInfo)
+    pageCount = newPageCount;
+    // the current row might have been incomplete so far
+    int columns = ColumnsFromDisplayMode(displayMode);
+    InitPagesInfo(firstNewPageNo, FirstPageInARowNo(ss.page, columns, IsBookView(displayMode)));
+
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+    return pending;
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
 bool DisplayModel::PageShown(int pageNo) const
@@ -843,6 +891,10 @@ void DisplayModel::RenderVisibleParts()
     if (0 == firstVisiblePage)
         return;
 
+    // let the engine prefetch the pages following the current one
+    // (before requesting any page so that they aren't evicted again)
+    engine->SetCurrentPage(CurrentPageNo());
+
     // rendering happens LIFO except if the queue is currently
     // empty, so request the visible pages first and last to
     // make sure they're rendered before the predicted pages
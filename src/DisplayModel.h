@@ -71,7 +71,7 @@ public:
     // meta data
     virtual const WCHAR *FilePath() const { return engine->FileName(); }
     virtual const WCHAR *DefaultFileExt() const { return engine->GetDefaultFileExt(); }
-    virtual int PageCount() const { return engine->PageCount(); }
+    virtual int PageCount() const { return pageCount; }
     virtual WCHAR *GetProperty(DocumentProperty prop) { return engine->GetProperty(prop); }
 
     // page navigation (stateful)
@@ -106,7 +106,7 @@ public:
     virtual int GetPageByLabel(const WCHAR *label) const { return engine->GetPageByLabel(label); }
 
     // common shortcuts
-    virtual bool ValidPageNo(int pageNo) const { return 1 <= pageNo && pageNo <= engine->PageCount(); }
+    virtual bool ValidPageNo(int pageNo) const { return 1 <= pageNo && pageNo <= pageCount; }
     virtual bool GoToNextPage();
     virtual bool GoToPrevPage(bool toBottom=false) { return GoToPrevPage(toBottom ? -1 : 0); }
     virtual bool GoToFirstPage();
@@ -179,6 +179,9 @@ public:
     void            CopyNavHistory(DisplayModel& orig);
 
     void            SetInitialViewSettings(DisplayMode displayMode, int newStartPage, SizeI viewPort, int screenDPI);
+    // picks up pages the engine has layed out in the background since the last
+    // call (cf. BaseEngine::IsLayoutPending) and returns false once there'll be no more
+    bool            UpdatePageCount();
     void            SetDisplayR2L(bool r2l) { displayR2L = r2l; }
     bool            GetDisplayR2L() const { return displayR2L; }
 
@@ -194,6 +197,7 @@ public:
 protected:
 
     void            BuildPagesInfo();
+    void            InitPagesInfo(int firstPageNo, int shownPageNo);
     float           ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeD           PageSizeAfterRotation(int pageNo, bool fitToContent=false) const;
     void            ChangeStartPage(int startPage);
@@ -209,8 +213,16 @@ protected:
 
     BaseEngine *    engine;
 
-    /* an array of PageInfo, len of array is pageCount */
-    PageInfo *      pagesInfo;
+    /* an array of PageInfo, len of array is pageCount (volatile because render
+       threads read both while UpdatePageCount grows them, cf. GetPageInfo) */
+    PageInfo * volatile pagesInfo;
+    /* engine->PageCount() as of the last call to BuildPagesInfo resp. UpdatePageCount */
+    volatile int    pageCount;
+    /* number of PageInfo allocated for pagesInfo */
+    int             pagesInfoCap;
+    /* arrays replaced by UpdatePageCount which render threads might still be
+       reading from (freed along with the DisplayModel) */
+    Vec<PageInfo *> oldPagesInfo;
 
     DisplayMode     displayMode;
     /* In non-continuous mode is the first page from a file that we're
@@ -227,18 +227,26 @@ const char *EPUB_ENC_NS = "http://www.w3.org/2001/04/xmlenc#";
 
 EpubDoc::EpubDoc(const WCHAR *fileName) :
     zip(fileName, true), fileName(str::Dup(fileName)),
-    isNcxToc(false), isRtlDoc(false) { }
+    isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&zipAccess);
+}
 
 EpubDoc::EpubDoc(IStream *stream) :
     zip(stream, true), fileName(NULL),
-    isNcxToc(false), isRtlDoc(false) { }
+    isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&zipAccess);
+}
 
 EpubDoc::~EpubDoc()
 {
     for (size_t i = 0; i < images.Count(); i++) {
-        free(images.At(i).base.data);
-        free(images.At(i).id);
+        free(images.At(i)->base.data);
+        free(images.At(i)->id);
     }
+    FreeVecMembers(images);
+    DeleteCriticalSection(&zipAccess);
 }
 
 bool EpubDoc::Load()
@@ -307,9 +315,9 @@ bool EpubDoc::Load()
             if (encList.Contains(imgPath))
                 continue;
             // load the image lazily
-            ImageData2 data = { 0 };
-            data.id = str::conv::ToUtf8(imgPath);
-            data.idx = zip.GetFileIndex(imgPath);
+            ImageData2 *data = AllocStruct<ImageData2>();
+            data->id = str::conv::ToUtf8(imgPath);
+            data->idx = zip.GetFileIndex(imgPath);
             images.Append(data);
         }
         else if (str::Eq(mediatype, L"application/xhtml+xml") ||
@@ -367,6 +375,7 @@ bool EpubDoc::Load()
         ScopedMem<char> utf8_path(str::conv::ToUtf8(fullPath));
         CrashIfDebugOnly(str::FindChar(utf8_path, '"'));
         str::TransChars(utf8_path, "\"", "'");
+        spineItemOffsets.Append(htmlData.Size());
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path.Get());
         htmlData.Append(html);
     }
@@ -427,8 +436,22 @@ size_t EpubDoc::GetHtmlDataSize() const
     return htmlData.Size();
 }
 
+size_t EpubDoc::GetSpineItemCount() const
+{
+    return spineItemOffsets.Count();
+}
+
+void EpubDoc::GetSpineItemRange(size_t idx, size_t *startOut, size_t *endOut) const
+{
+    CrashIf(idx >= spineItemOffsets.Count());
+    *startOut = spineItemOffsets.At(idx);
+    *endOut = idx + 1 < spineItemOffsets.Count() ? spineItemOffsets.At(idx + 1) : htmlData.Size();
+}
+
 ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
 {
+    ScopedCritSec scope(&zipAccess);
+
     if (!pagePath) {
         CrashIf(true);
         // if we're reparsing, we might not have pagePath, which is needed to
@@ -439,7 +462,7 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
         // format specific state such as hiddenDepth and titleCount) and store it
         // in every HtmlPage, but this should work well enough for now
         for (size_t i = 0; i < images.Count(); i++) {
-            ImageData2 *img = &images.At(i);
+            ImageData2 *img = images.At(i);
             if (str::EndsWithI(img->id, id)) {
                 if (!img->base.data)
                     img->base.data = zip.GetFileDataByIdx(img->idx, &img->base.len);
@@ -455,7 +478,7 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
     if (str::FindChar(url, '\\'))
         str::TransChars(url, "\\", "/");
     for (size_t i = 0; i < images.Count(); i++) {
-        ImageData2 *img = &images.At(i);
+        ImageData2 *img = images.At(i);
         if (str::Eq(img->id, url)) {
             if (!img->base.data)
                 img->base.data = zip.GetFileDataByIdx(img->idx, &img->base.len);
@@ -465,16 +488,18 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
     }
 
     // try to also load images which aren't registered in the manifest
-    ImageData2 data = { 0 };
     ScopedMem<WCHAR> imgPath(str::conv::FromUtf8(url));
-    data.idx = zip.GetFileIndex(imgPath);
-    if (data.idx != (size_t)-1) {
-        data.base.data = zip.GetFileDataByIdx(data.idx, &data.base.len);
-        if (data.base.data) {
-            data.id = str::Dup(url);
+    size_t idx = zip.GetFileIndex(imgPath);
+    if (idx != (size_t)-1) {
+        ImageData2 *data = AllocStruct<ImageData2>();
+        data->idx = idx;
+        data->base.data = zip.GetFileDataByIdx(idx, &data->base.len);
+        if (data->base.data) {
+            data->id = str::Dup(url);
             images.Append(data);
-            return &images.Last().base;
+            return &data->base;
         }
+        free(data);
     }
 
     return NULL;
@@ -489,6 +514,7 @@ char *EpubDoc::GetFileData(const char *relPath, const char *pagePath, size_t *le
 
     ScopedMem<char> url(NormalizeURL(relPath, pagePath));
     ScopedMem<WCHAR> zipPath(str::conv::FromUtf8(url));
+    ScopedCritSec scope(&zipAccess);
     return zip.GetFileDataByName(zipPath, lenOut);
 }
 
@@ -614,7 +640,11 @@ bool EpubDoc::ParseToc(EbookTocVisitor *visitor)
     if (!tocPath)
         return false;
     size_t tocDataLen;
-    ScopedMem<char> tocData(zip.GetFileDataByName(tocPath, &tocDataLen));
+    ScopedMem<char> tocData;
+    {
+        ScopedCritSec scope(&zipAccess);
+        tocData.Set(zip.GetFileDataByName(tocPath, &tocDataLen));
+    }
     if (!tocData)
         return false;
 
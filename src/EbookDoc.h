@@ -30,8 +30,15 @@ public:
 
 class EpubDoc {
     ZipFile zip;
+    // zip and images might be accessed concurrently (e.g. for
+    // laying out pages in the background while parsing the ToC)
+    CRITICAL_SECTION zipAccess;
     str::Str<char> htmlData;
-    Vec<ImageData2> images;
+    // offsets into htmlData at which the individual spine items start
+    Vec<size_t> spineItemOffsets;
+    // GetImageData returns pointers into the items which must remain
+    // valid while other threads add more images
+    Vec<ImageData2 *> images;
     ScopedMem<WCHAR> tocPath;
     ScopedMem<WCHAR> fileName;
     PropertyMap props;
@@ -50,6 +57,9 @@ public:
 
     const char *GetHtmlData(size_t *lenOut) const;
     size_t GetHtmlDataSize() const;
+    // spine items always start on a new page, so they can be layed out independently
+    size_t GetSpineItemCount() const;
+    void GetSpineItemRange(size_t idx, size_t *startOut, size_t *endOut) const;
     ImageData *GetImageData(const char *id, const char *pagePath);
     char *GetFileData(const char *relPath, const char *pagePath, size_t *lenOut);
 
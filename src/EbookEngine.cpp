@@ -15,6 +15,7 @@
 #include "HtmlPullParser.h"
 #include "Mui.h"
 #include "PalmDbReader.h"
+#include "ThreadUtil.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -52,6 +53,27 @@ struct PageAnchor {
     explicit PageAnchor(DrawInstr *instr=NULL, int pageNo=-1) : instr(instr), pageNo(pageNo) { }
 };
 
+// number of pages layed out before a document is considered loaded so that
+// the first screen can be displayed (the rest is layed out in the background)
+#define EBOOK_INITIAL_PAGES 4
+// maximum time GetNamedDest waits for a destination which hasn't been layed out yet
+#define NAMED_DEST_MAX_WAIT_MS 500
+
+// PoolAllocator which can be shared between formatters laying out
+// different sections of a document concurrently
+class LockedPoolAllocator : public PoolAllocator {
+    CRITICAL_SECTION access;
+
+public:
+    LockedPoolAllocator() { InitializeCriticalSection(&access); }
+    virtual ~LockedPoolAllocator() { DeleteCriticalSection(&access); }
+
+    virtual void *Alloc(size_t size) {
+        ScopedCritSec scope(&access);
+        return PoolAllocator::Alloc(size);
+    }
+};
+
 class EbookAbortCookie : public AbortCookie {
 public:
     bool abort;
@@ -59,13 +81,24 @@ public:
     virtual void Abort() { abort = true; }
 };
 
+class EbookLayoutThread;
+
 class EbookEngine : public BaseEngine {
+    friend class EbookLayoutThread;
+
 public:
     EbookEngine();
     virtual ~EbookEngine();
 
     virtual const WCHAR *FileName() const { return fileName; };
     virtual int PageCount() const { return pages ? (int)pages->Count() : 0; }
+    virtual bool IsLayoutPending() const {
+        return WaitForSingleObject(layoutDone, 0) == WAIT_TIMEOUT;
+    }
+    virtual void WaitForPages(int pageCount);
+    // same as WaitForPages but returns after at most timeout ms
+    // (possibly with fewer than pageCount pages)
+    void WaitForPages(int pageCount, DWORD timeout);
 
     virtual RectD PageMediabox(int pageNo) { return pageRect; }
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View) {
@@ -101,7 +134,14 @@ public:
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
 
+    // note: this waits for the destination's page to have been layed out,
+    // so it mustn't be called while holding pagesAccess
     virtual PageDestination *GetNamedDest(const WCHAR *name);
+    // same as GetNamedDest but doesn't wait for pages which are still
+    // to be layed out (returns NULL if the destination might be on one)
+    PageDestination *GetLayedOutDest(const WCHAR *name) {
+        return FindNamedDest(name, !IsLayoutPending());
+    }
 
     virtual bool BenchLoadPage(int pageNo) { return true; }
 
@@ -113,23 +153,48 @@ protected:
     // a break between two merged documents
     Vec<DrawInstr *> baseAnchors;
     // needed so that memory allocated by ResolveHtmlEntities isn't leaked
-    PoolAllocator allocator;
+    LockedPoolAllocator allocator;
     // needed since pages::IterStart/IterNext aren't thread-safe
+    // and since pages, anchors and baseAnchors grow during layout
     CRITICAL_SECTION pagesAccess;
     // access to userAnnots is protected by pagesAccess
     Vec<PageAnnotation> userAnnots;
     // page dimensions can vary between filetypes
     RectD pageRect;
     float pageBorder;
+    // the default font at the time the layout was started
+    ScopedMem<WCHAR> fontName;
+    float fontSize;
+    // lays out all pages in the background
+    EbookLayoutThread *layoutThread;
+    // pageAdded is signaled whenever another page has been layed out
+    // and layoutDone once no more pages are to be expected
+    HANDLE pageAdded, layoutDone;
 
     void GetTransform(Matrix& m, float zoom, int rotation) {
         GetBaseTransform(m, pageRect.ToGdipRectF(), zoom, rotation);
     }
-    bool ExtractPageAnchors();
+    // lays out the document (split into sectionCount sections which are layed out
+    // in parallel) and returns false if there are no pages once the first few
+    // pages are ready. Each section must start on a new page.
+    bool StartLayout(bool skipEmptyPages=true, size_t sectionCount=1);
+    // must be called by subclasses before destroying anything the formatters use
+    void StopLayout();
+    // called by the layout threads for every section of the document. mui's
+    // Graphics objects for measuring text are per thread, so the formatter
+    // is only used on and deleted by the thread which created it
+    virtual HtmlFormatter *CreateFormatter(size_t section) = 0;
+    // sets the arguments which are the same for all formatters
+    void InitFormatterArgs(HtmlFormatterArgs& args);
+    void AppendPage(HtmlPage *page);
     WCHAR *ExtractFontList();
 
     virtual PageElement *CreatePageLink(DrawInstr *link, RectI rect, int pageNo);
+    // isFinal is false while pages are still being layed out, in which case
+    // NULL is returned for destinations which might be on a page still to come
+    virtual PageDestination *FindNamedDest(const WCHAR *name, bool isFinal);
 
+    // caller must hold pagesAccess
     Vec<DrawInstr> *GetHtmlPage(int pageNo) {
         CrashIf(pageNo < 1 || PageCount() < pageNo);
         if (pageNo < 1 || PageCount() < pageNo)
@@ -138,6 +203,132 @@ protected:
     }
 };
 
+struct EbookSection {
+    // set by the thread which lays out this section
+    LONG claimed;
+    // signaled once the section has been layed out
+    HANDLE done;
+    // pages layed out by a helper thread (to be appended by the layout thread)
+    Vec<HtmlPage *> pages;
+};
+
+// The layout thread lays out all sections in order and appends their pages
+// to the engine as soon as they're ready. Helper threads lay out sections
+// further ahead in parallel, and the layout thread just appends their pages
+// once it gets to them.
+class EbookLayoutThread : public ThreadBase {
+    EbookEngine *engine;
+    bool skipEmptyPages;
+    EbookSection *sections;
+    size_t sectionCount;
+
+public:
+    EbookLayoutThread(EbookEngine *engine, size_t sectionCount, bool skipEmptyPages);
+    virtual ~EbookLayoutThread();
+
+    bool IsCancelled() { return WasCancelRequested(); }
+    // returns false if another thread has already claimed this section
+    bool ClaimSection(size_t idx) {
+        return InterlockedCompareExchange(&sections[idx].claimed, 1, 0) == 0;
+    }
+    // formats a claimed section and either appends its pages to the engine
+    // or collects them for being appended later
+    void LayoutSection(size_t idx, bool appendPages);
+    size_t SectionCount() const { return sectionCount; }
+
+    virtual void Run();
+};
+
+class EbookSectionThread : public ThreadBase {
+    EbookLayoutThread *layout;
+
+public:
+    explicit EbookSectionThread(EbookLayoutThread *layout) :
+        ThreadBase("EbookSectionThread"), layout(layout) { }
+    virtual ~EbookSectionThread() { }
+
+    virtual void Run() {
+        // the first section is always layed out by the layout thread itself
+        for (size_t i = 1; i < layout->SectionCount() && !layout->IsCancelled(); i++) {
+            if (layout->ClaimSection(i))
+                layout->LayoutSection(i, false);
+        }
+    }
+};
+
+EbookLayoutThread::EbookLayoutThread(EbookEngine *engine, size_t sectionCount, bool skipEmptyPages) :
+    ThreadBase("EbookLayoutThread"), engine(engine), skipEmptyPages(skipEmptyPages),
+    sectionCount(sectionCount)
+{
+    sections = new EbookSection[sectionCount];
+    for (size_t i = 0; i < sectionCount; i++) {
+        sections[i].claimed = 0;
+        sections[i].done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+}
+
+EbookLayoutThread::~EbookLayoutThread()
+{
+    for (size_t i = 0; i < sectionCount; i++) {
+        // pages left over from a cancelled layout
+        DeleteVecMembers(sections[i].pages);
+        CloseHandle(sections[i].done);
+    }
+    delete[] sections;
+}
+
+void EbookLayoutThread::LayoutSection(size_t idx, bool appendPages)
+{
+    HtmlFormatter *formatter = engine->CreateFormatter(idx);
+    HtmlPage *page;
+    while (!WasCancelRequested() && (page = formatter->Next(skipEmptyPages)) != NULL) {
+        if (appendPages)
+            engine->AppendPage(page);
+        else
+            sections[idx].pages.Append(page);
+    }
+    delete formatter;
+    SetEvent(sections[idx].done);
+}
+
+void EbookLayoutThread::Run()
+{
+    // this thread lays out sections as well, so only start as
+    // many helpers as there are further processors
+    int helperCount = std::min(GetProcessorCount() - 1, (int)std::min(sectionCount - 1, (size_t)INT_MAX));
+    Vec<EbookSectionThread *> helpers;
+    for (int i = 0; i < helperCount; i++) {
+        EbookSectionThread *helper = new EbookSectionThread(this);
+        helper->Start();
+        helpers.Append(helper);
+    }
+
+    for (size_t i = 0; i < sectionCount && !WasCancelRequested(); i++) {
+        if (ClaimSection(i)) {
+            LayoutSection(i, true);
+            continue;
+        }
+        WaitForSingleObject(sections[i].done, INFINITE);
+        Vec<HtmlPage *>& pages = sections[i].pages;
+        size_t appended = 0;
+        for (; appended < pages.Count() && !WasCancelRequested(); appended++) {
+            engine->AppendPage(pages.At(appended));
+        }
+        // pages which haven't been appended are deleted in the destructor
+        pages.RemoveAt(0, appended);
+    }
+
+    for (size_t i = 0; i < helpers.Count(); i++) {
+        // helpers stop as soon as they notice that we've been cancelled
+        bool ok = helpers.At(i)->Join();
+        CrashIf(!ok);
+        delete helpers.At(i);
+    }
+
+    SetEvent(engine->layoutDone);
+    SetEvent(engine->pageAdded);
+}
+
 class SimpleDest2 : public PageDestination {
 protected:
     int pageNo;
@@ -223,13 +414,20 @@ public:
 
 EbookEngine::EbookEngine() : fileName(NULL), pages(NULL),
     pageRect(0, 0, 5.12 * GetFileDPI(), 7.8 * GetFileDPI()), // "B Format" paperback
-    pageBorder(0.4f * GetFileDPI())
+    pageBorder(0.4f * GetFileDPI()), fontSize(0), layoutThread(NULL)
 {
     InitializeCriticalSection(&pagesAccess);
+    pageAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
+    // nothing's pending until StartLayout has been called
+    layoutDone = CreateEvent(NULL, TRUE, TRUE, NULL);
 }
 
 EbookEngine::~EbookEngine()
 {
+    StopLayout();
+    CloseHandle(pageAdded);
+    CloseHandle(layoutDone);
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages)
@@ -241,29 +439,82 @@ EbookEngine::~EbookEngine()
     DeleteCriticalSection(&pagesAccess);
 }
 
-bool EbookEngine::ExtractPageAnchors()
+bool EbookEngine::StartLayout(bool skipEmptyPages, size_t sectionCount)
 {
-    ScopedCritSec scope(&pagesAccess);
+    CrashIf(pages || layoutThread || 0 == sectionCount);
+    pages = new Vec<HtmlPage *>();
+    // the default font might change while the layout threads are running
+    fontName.Set(str::Dup(GetDefaultFontName()));
+    fontSize = GetDefaultFontSize();
+    layoutThread = new EbookLayoutThread(this, sectionCount, skipEmptyPages);
 
-    DrawInstr *baseAnchor = NULL;
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs)
-            return false;
+    ResetEvent(layoutDone);
+    layoutThread->Start();
+    WaitForPages(EBOOK_INITIAL_PAGES);
+    // short documents are completely layed out at this point
+    return PageCount() > 0;
+}
 
-        for (size_t k = 0; k < pageInstrs->Count(); k++) {
-            DrawInstr *i = &pageInstrs->At(k);
-            if (InstrAnchor != i->type)
-                continue;
-            anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />"))
-                baseAnchor = i;
-        }
-        baseAnchors.Append(baseAnchor);
-    }
+void EbookEngine::InitFormatterArgs(HtmlFormatterArgs& args)
+{
+    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args.SetFontName(fontName);
+    args.fontSize = fontSize;
+    args.textAllocator = &allocator;
+    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
+}
 
+void EbookEngine::StopLayout()
+{
+    if (!layoutThread)
+        return;
+    layoutThread->RequestCancel();
+    bool ok = layoutThread->Join();
+    CrashIf(!ok);
+    delete layoutThread;
+    layoutThread = NULL;
+}
+
+void EbookEngine::AppendPage(HtmlPage *page)
+{
+    ScopedCritSec scope(&pagesAccess);
+
+    pages->Append(page);
+    int pageNo = PageCount();
+    DrawInstr *baseAnchor = baseAnchors.Count() > 0 ? baseAnchors.Last() : NULL;
+    for (size_t k = 0; k < page->instructions.Count(); k++) {
+        DrawInstr *i = &page->instructions.At(k);
+        if (InstrAnchor != i->type)
+            continue;
+        anchors.Append(PageAnchor(i, pageNo));
+        if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />"))
+            baseAnchor = i;
+    }
+    baseAnchors.Append(baseAnchor);
     CrashIf(baseAnchors.Count() != pages->Count());
-    return true;
+
+    SetEvent(pageAdded);
+}
+
+void EbookEngine::WaitForPages(int pageCount)
+{
+    WaitForPages(pageCount, INFINITE);
+}
+
+void EbookEngine::WaitForPages(int pageCount, DWORD timeout)
+{
+    HANDLE events[] = { pageAdded, layoutDone };
+    DWORD start = GetTickCount();
+    while (PageCount() < pageCount && IsLayoutPending()) {
+        DWORD elapsed = GetTickCount() - start;
+        if (timeout != INFINITE && elapsed >= timeout)
+            break;
+        ResetEvent(pageAdded);
+        // check again so that no page added in the meantime is missed
+        if (PageCount() < pageCount && IsLayoutPending())
+            WaitForMultipleObjects(dimof(events), events, FALSE, timeout == INFINITE ? INFINITE : timeout - elapsed);
+    }
 }
 
 PointD EbookEngine::Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse)
@@ -512,7 +763,9 @@ PageElement *EbookEngine::CreatePageLink(DrawInstr *link, RectI rect, int pageNo
         url.Set(str::conv::FromUtf8(absPath));
     }
 
-    PageDestination *dest = GetNamedDest(url);
+    // links to pages which haven't been layed out yet
+    // only become available once they have been
+    PageDestination *dest = GetLayedOutDest(url);
     if (!dest)
         return NULL;
     return new EbookLink(link, rect, dest, pageNo);
@@ -520,10 +773,12 @@ PageElement *EbookEngine::CreatePageLink(DrawInstr *link, RectI rect, int pageNo
 
 Vec<PageElement *> *EbookEngine::GetElements(int pageNo)
 {
+    ScopedCritSec scope(&pagesAccess);
+
     Vec<PageElement *> *els = new Vec<PageElement *>();
 
     Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
-    // CreatePageLink -> GetNamedDest might use pageInstrs->IterStart()
+    // CreatePageLink -> FindNamedDest might use pageInstrs->IterStart()
     for (size_t k = 0; k < pageInstrs->Count(); k++) {
         DrawInstr *i = &pageInstrs->At(k);
         if (InstrImage == i->type)
@@ -559,6 +814,29 @@ PageElement *EbookEngine::GetElementAtPos(int pageNo, PointD pt)
 
 PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
 {
+    // this is called from the UI thread, so don't wait for the whole layout
+    DWORD start = GetTickCount();
+    for (;;) {
+        // check this first so that no page added in the meantime is missed
+        bool isFinal = !IsLayoutPending();
+        int pageCount = PageCount();
+        PageDestination *dest = FindNamedDest(name, isFinal);
+        if (dest || isFinal)
+            return dest;
+        DWORD elapsed = GetTickCount() - start;
+        if (elapsed >= NAMED_DEST_MAX_WAIT_MS) {
+            // fall back to the start of the destination's document
+            // for merged documents (or fail if it isn't known yet)
+            return FindNamedDest(name, true);
+        }
+        WaitForPages(pageCount + 1, NAMED_DEST_MAX_WAIT_MS - elapsed);
+    }
+}
+
+PageDestination *EbookEngine::FindNamedDest(const WCHAR *name, bool isFinal)
+{
+    ScopedCritSec scope(&pagesAccess);
+
     ScopedMem<char> name_utf8(str::conv::ToUtf8(name));
     const char *id = name_utf8;
     if (str::FindChar(id, '#'))
@@ -601,7 +879,7 @@ PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
     }
 
     // don't fail if an ID doesn't exist in a merged document
-    if (basePageNo != 0) {
+    if (basePageNo != 0 && isFinal) {
         RectD rect(0, pageBorder, pageRect.dx, 10);
         rect.Inflate(-pageBorder, 0);
         return new SimpleDest2(basePageNo, rect);
@@ -612,6 +890,7 @@ PageDestination *EbookEngine::GetNamedDest(const WCHAR *name)
 
 WCHAR *EbookEngine::ExtractFontList()
 {
+    WaitForPages(INT_MAX);
     ScopedCritSec scope(&pagesAccess);
 
     Vec<mui::CachedFont *> seenFonts;
@@ -672,13 +951,13 @@ static void AppendTocItem(EbookTocItem *& root, EbookTocItem *item, int level)
 }
 
 class EbookTocBuilder : public EbookTocVisitor {
-    BaseEngine *engine;
+    EbookEngine *engine;
     EbookTocItem *root;
     int idCounter;
     bool isIndex;
 
 public:
-    explicit EbookTocBuilder(BaseEngine *engine) :
+    explicit EbookTocBuilder(EbookEngine *engine) :
         engine(engine), root(NULL), idCounter(0), isIndex(false) { }
 
     virtual void Visit(const WCHAR *name, const WCHAR *url, int level) {
@@ -688,11 +967,13 @@ public:
         else if (url::IsAbsolute(url))
             dest = new SimpleDest2(0, RectD(), str::Dup(url));
         else {
-            dest = engine->GetNamedDest(url);
+            // don't wait for the whole document to be layed out (the ToC
+            // should be reloaded once IsLayoutPending returns false)
+            dest = engine->GetLayedOutDest(url);
             if (!dest && str::FindChar(url, '%')) {
                 ScopedMem<WCHAR> decodedUrl(str::Dup(url));
                 url::DecodeInPlace(decodedUrl);
-                dest = engine->GetNamedDest(decodedUrl);
+                dest = engine->GetLayedOutDest(decodedUrl);
             }
         }
 
@@ -744,10 +1025,12 @@ protected:
     bool Load(const WCHAR *fileName);
     bool Load(IStream *stream);
     bool FinishLoading();
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 };
 
 EpubEngineImpl::~EpubEngineImpl()
 {
+    StopLayout();
     delete doc;
     if (stream)
         stream->Release();
@@ -780,20 +1063,24 @@ bool EpubEngineImpl::FinishLoading()
     if (!doc)
         return false;
 
+    // spine items are layed out in parallel
+    return StartLayout(false, doc->GetSpineItemCount());
+}
+
+HtmlFormatter *EpubEngineImpl::CreateFormatter(size_t section)
+{
+    size_t start, end;
+    doc->GetSpineItemRange(section, &start, &end);
+    CrashIf(start > INT_MAX);
+
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
+    // parse from the start of the spine item up to the start of the next one
     args.htmlStr = doc->GetHtmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
+    args.htmlStrLen = end;
+    args.reparseIdx = (int)start;
 
-    return pages->Count() > 0;
+    return new EpubFormatter(&args, doc);
 }
 
 unsigned char *EpubEngineImpl::GetFileData(size_t *cbCount)
@@ -886,7 +1173,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class Fb2EngineImpl : public EbookEngine {
 public:
     Fb2EngineImpl() : EbookEngine(), doc(NULL) { }
-    virtual ~Fb2EngineImpl() { delete doc; }
+    virtual ~Fb2EngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
@@ -910,6 +1200,7 @@ protected:
     bool Load(const WCHAR *fileName);
     bool Load(IStream *stream);
     bool FinishLoading();
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 };
 
 bool Fb2EngineImpl::Load(const WCHAR *fileName)
@@ -930,20 +1221,16 @@ bool Fb2EngineImpl::FinishLoading()
     if (!doc)
         return false;
 
+    return StartLayout(false);
+}
+
+HtmlFormatter *Fb2EngineImpl::CreateFormatter(size_t section)
+{
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
     args.htmlStr = doc->GetXmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
-
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
 
-    return pages->Count() > 0;
+    return new Fb2Formatter(&args, doc);
 }
 
 DocTocItem *Fb2EngineImpl::GetTocTree()
@@ -1002,7 +1289,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class MobiEngineImpl : public EbookEngine {
 public:
     MobiEngineImpl() : EbookEngine(), doc(NULL) { }
-    virtual ~MobiEngineImpl() { delete doc; }
+    virtual ~MobiEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
@@ -1012,7 +1302,6 @@ public:
     }
     virtual const WCHAR *GetDefaultFileExt() const { return L".mobi"; }
 
-    virtual PageDestination *GetNamedDest(const WCHAR *name);
     virtual bool HasTocTree() const { return doc->HasToc(); }
     virtual DocTocItem *GetTocTree();
 
@@ -1022,9 +1311,12 @@ public:
 protected:
     MobiDoc *doc;
 
+    virtual PageDestination *FindNamedDest(const WCHAR *name, bool isFinal);
+
     bool Load(const WCHAR *fileName);
     bool Load(IStream *stream);
     bool FinishLoading();
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 };
 
 bool MobiEngineImpl::Load(const WCHAR *fileName)
@@ -1045,40 +1337,41 @@ bool MobiEngineImpl::FinishLoading()
     if (!doc || Pdb_Mobipocket != doc->GetDocType())
         return false;
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData(args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
+    return StartLayout();
+}
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    if (!ExtractPageAnchors())
-        return false;
+HtmlFormatter *MobiEngineImpl::CreateFormatter(size_t section)
+{
+    HtmlFormatterArgs args;
+    InitFormatterArgs(args);
+    // MobiFormatter decompresses the remaining text as needed
+    args.htmlStr = doc->GetHtmlDataPrefix(0, args.htmlStrLen);
 
-    return pages->Count() > 0;
+    return new MobiFormatter(&args, doc);
 }
 
-PageDestination *MobiEngineImpl::GetNamedDest(const WCHAR *name)
+PageDestination *MobiEngineImpl::FindNamedDest(const WCHAR *name, bool isFinal)
 {
     int filePos = _wtoi(name);
     if (filePos < 0 || 0 == filePos && *name != '0')
         return NULL;
+    // text beyond what's been decompressed so far hasn't been laid out, either
+    size_t htmlLen;
+    char *start = doc->GetHtmlDataPrefix(0, htmlLen);
+    if ((size_t)filePos > htmlLen)
+        return NULL;
+
+    ScopedCritSec scope(&pagesAccess);
     int pageNo;
     for (pageNo = 1; pageNo < PageCount(); pageNo++) {
         if (pages->At(pageNo)->reparseIdx > filePos)
             break;
     }
     CrashIf(pageNo < 1 || pageNo > PageCount());
-
-    size_t htmlLen;
-    char *start = doc->GetHtmlData(htmlLen);
-    if ((size_t)filePos > htmlLen)
+    // filePos might be on a page that's still to be layed out
+    if (pageNo == PageCount() && !isFinal)
         return NULL;
 
-    ScopedCritSec scope(&pagesAccess);
     Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
     // link to the bottom of the page, if filePos points
     // beyond the last visible DrawInstr of a page
@@ -1150,7 +1443,10 @@ BaseEngine *CreateFromStream(IStream *stream)
 class PdbEngineImpl : public EbookEngine {
 public:
     PdbEngineImpl() : EbookEngine(), doc(NULL) { }
-    virtual ~PdbEngineImpl() { delete doc; }
+    virtual ~PdbEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
@@ -1169,6 +1465,7 @@ protected:
     PalmDoc *doc;
 
     bool Load(const WCHAR *fileName);
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 };
 
 bool PdbEngineImpl::Load(const WCHAR *fileName)
@@ -1179,20 +1476,16 @@ bool PdbEngineImpl::Load(const WCHAR *fileName)
     if (!doc)
         return false;
 
+    return StartLayout();
+}
+
+HtmlFormatter *PdbEngineImpl::CreateFormatter(size_t section)
+{
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
     args.htmlStr = doc->GetHtmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
-
-    pages = HtmlFormatter(&args).FormatAllPages();
-    if (!ExtractPageAnchors())
-        return false;
 
-    return pages->Count() > 0;
+    return new HtmlFormatter(&args);
 }
 
 DocTocItem *PdbEngineImpl::GetTocTree()
@@ -1352,6 +1645,7 @@ public:
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
     virtual ~Chm2EngineImpl() {
+        StopLayout();
         delete dataCache;
         delete doc;
     }
@@ -1376,6 +1670,7 @@ protected:
     ChmDataCache *dataCache;
 
     bool Load(const WCHAR *fileName);
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 
     virtual PageElement *CreatePageLink(DrawInstr *link, RectI rect, int pageNo);
     bool SaveEmbedded(LinkSaverUI& saveUI, const char *path);
@@ -1482,20 +1777,16 @@ bool Chm2EngineImpl::Load(const WCHAR *fileName)
     char *html = ChmHtmlCollector(doc).GetHtml();
     dataCache = new ChmDataCache(doc, html);
 
+    return StartLayout(false);
+}
+
+HtmlFormatter *Chm2EngineImpl::CreateFormatter(size_t section)
+{
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
     args.htmlStr = dataCache->GetHtmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
-
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
 
-    return pages->Count() > 0;
+    return new ChmFormatter(&args, dataCache);
 }
 
 DocTocItem *Chm2EngineImpl::GetTocTree()
@@ -1534,7 +1825,8 @@ public:
 PageElement *Chm2EngineImpl::CreatePageLink(DrawInstr *link, RectI rect, int pageNo)
 {
     PageElement *linkEl = EbookEngine::CreatePageLink(link, rect, pageNo);
-    if (linkEl)
+    // the link's target might not have been layed out yet
+    if (linkEl || IsLayoutPending())
         return linkEl;
 
     DrawInstr *baseAnchor = baseAnchors.At(pageNo-1);
@@ -1591,6 +1883,7 @@ public:
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
     virtual ~HtmlEngineImpl() {
+        StopLayout();
         delete doc;
     }
     virtual BaseEngine *Clone() {
@@ -1609,6 +1902,7 @@ protected:
     HtmlDoc *doc;
 
     bool Load(const WCHAR *fileName);
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 
     virtual PageElement *CreatePageLink(DrawInstr *link, RectI rect, int pageNo);
 };
@@ -1621,20 +1915,17 @@ bool HtmlEngineImpl::Load(const WCHAR *fileName)
     if (!doc)
         return false;
 
+    return StartLayout(false);
+}
+
+HtmlFormatter *HtmlEngineImpl::CreateFormatter(size_t section)
+{
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
     args.htmlStr = doc->GetHtmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return new HtmlFileFormatter(&args, doc);
 }
 
 class RemoteHtmlDest : public SimpleDest2 {
@@ -1700,7 +1991,10 @@ public:
         // ISO 216 A4 (210mm x 297mm)
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
-    virtual ~TxtEngineImpl() { delete doc; }
+    virtual ~TxtEngineImpl() {
+        StopLayout();
+        delete doc;
+    }
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
@@ -1722,6 +2016,7 @@ protected:
     TxtDoc *doc;
 
     bool Load(const WCHAR *fileName);
+    virtual HtmlFormatter *CreateFormatter(size_t section);
 };
 
 bool TxtEngineImpl::Load(const WCHAR *fileName)
@@ -1737,20 +2032,17 @@ bool TxtEngineImpl::Load(const WCHAR *fileName)
         pageRect = RectD(0, 0, 8.5 * GetFileDPI(), 11 * GetFileDPI());
     }
 
+    return StartLayout(false);
+}
+
+HtmlFormatter *TxtEngineImpl::CreateFormatter(size_t section)
+{
     HtmlFormatterArgs args;
+    InitFormatterArgs(args);
     args.htmlStr = doc->GetHtmlData(&args.htmlStrLen);
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    if (!ExtractPageAnchors())
-        return false;
-
-    return pages->Count() > 0;
+    return new TxtFormatter(&args);
 }
 
 DocTocItem *TxtEngineImpl::GetTocTree()
@@ -14,7 +14,7 @@ using namespace mui;
 /* Mobi-specific formatting methods */
 
 MobiFormatter::MobiFormatter(HtmlFormatterArgs* args, MobiDoc *doc) :
-    HtmlFormatter(args), doc(doc)
+    HtmlFormatter(args), doc(doc), textComplete(!doc)
 {
     bool fromBeginning = (0 == args->reparseIdx);
     if (!doc || !fromBeginning)
@@ -100,6 +100,13 @@ void MobiFormatter::HandleTagImg(HtmlToken *t)
         HandleText(attr->val, attr->valLen);
 }
 
+HtmlToken *MobiFormatter::NextHtmlToken()
+{
+    if (!doc)
+        return HtmlFormatter::NextHtmlToken();
+    return doc->NextHtmlToken(htmlParser, textComplete);
+}
+
 void MobiFormatter::HandleHtmlTag(HtmlToken *t)
 {
     CrashIf(!t->IsTag());
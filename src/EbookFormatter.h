@@ -14,10 +14,13 @@ class MobiFormatter : public HtmlFormatter {
     // accessor to images (and other format-specific data)
     // it can be NULL (enables testing by feeding raw html)
     MobiDoc *           doc;
+    // the text is decompressed while it's being laid out
+    bool                textComplete;
 
     void HandleSpacing_Mobi(HtmlToken *t);
     virtual void HandleTagImg(HtmlToken *t);
     virtual void HandleHtmlTag(HtmlToken *t);
+    virtual HtmlToken *NextHtmlToken();
 
 public:
     MobiFormatter(HtmlFormatterArgs *args, MobiDoc *doc);
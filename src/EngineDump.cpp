@@ -499,6 +499,8 @@ Usage:
         ErrOut("Error: Couldn't create an engine for %s!", path::GetBaseName(filePath));
         return 1;
     }
+    // dump all pages, even if they're layed out in the background
+    engine->WaitForPages(INT_MAX);
     Vec<PageAnnotation> *userAnnots = LoadFileModifications(engine->FileName());
     engine->UpdateUserAnnotations(userAnnots);
     delete userAnnots;
@@ -9,12 +9,13 @@
 #include "FileHistory.h"
 #include "FileUtil.h"
 #include "GdiPlusUtil.h"
+#include "TextIndex.h"
 #include "WinUtil.h"
 
 #define THUMBNAILS_DIR_NAME L"sumatrapdfcache"
 
 // TODO: create in TEMP directory instead?
-static WCHAR *GetThumbnailPath(const WCHAR *filePath)
+static WCHAR *GetCacheFilePath(const WCHAR *filePath, const WCHAR *ext)
 {
     // create a fingerprint of a (normalized) path for the file name
     // I'd have liked to also include the file's last modification time
@@ -37,39 +38,58 @@ static WCHAR *GetThumbnailPath(const WCHAR *filePath)
         return NULL;
     ScopedMem<WCHAR> fname(str::conv::FromAnsi(fingerPrint));
 
-    return str::Format(L"%s\\%s.png", thumbsPath.Get(), fname.Get());
+    return str::Format(L"%s\\%s%s", thumbsPath.Get(), fname.Get(), ext);
+}
+
+static WCHAR *GetThumbnailPath(const WCHAR *filePath)
+{
+    return GetCacheFilePath(filePath, L".png");
+}
+
+// text indices are kept next to the thumbnails (for the same files)
+static WCHAR *GetTextIndexPath(const WCHAR *filePath)
+{
+    return GetCacheFilePath(filePath, L".idx");
 }
 
-// removes thumbnails that don't belong to any frequently used item in file history
+// removes thumbnails and text indices that don't belong to
+// any frequently used item in file history
 void CleanUpThumbnailCache(FileHistory& fileHistory)
 {
     ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
     if (!thumbsPath)
         return;
-    ScopedMem<WCHAR> pattern(path::Join(thumbsPath, L"*.png"));
 
     WStrVec files;
     WIN32_FIND_DATA fdata;
 
-    HANDLE hfind = FindFirstFile(pattern, &fdata);
-    if (INVALID_HANDLE_VALUE == hfind)
-        return;
-    do {
-        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-            files.Append(str::Dup(fdata.cFileName));
-    } while (FindNextFile(hfind, &fdata));
-    FindClose(hfind);
+    const WCHAR *patterns[] = { L"*.png", L"*.idx" };
+    for (size_t i = 0; i < dimof(patterns); i++) {
+        ScopedMem<WCHAR> pattern(path::Join(thumbsPath, patterns[i]));
+        HANDLE hfind = FindFirstFile(pattern, &fdata);
+        if (INVALID_HANDLE_VALUE == hfind)
+            continue;
+        do {
+            if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                files.Append(str::Dup(fdata.cFileName));
+        } while (FindNextFile(hfind, &fdata));
+        FindClose(hfind);
+    }
 
     Vec<DisplayState *> list;
     fileHistory.GetFrequencyOrder(list);
     for (size_t i = 0; i < list.Count() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
         ScopedMem<WCHAR> bmpPath(GetThumbnailPath(list.At(i)->filePath));
-        if (!bmpPath)
-            continue;
-        int idx = files.Find(path::GetBaseName(bmpPath));
-        if (idx != -1) {
-            CrashIf(idx < 0 || files.Count() <= (size_t)idx);
-            free(files.PopAt(idx));
+        ScopedMem<WCHAR> indexPath(GetTextIndexPath(list.At(i)->filePath));
+        const WCHAR *paths[] = { bmpPath, indexPath };
+        for (size_t j = 0; j < dimof(paths); j++) {
+            if (!paths[j])
+                continue;
+            int idx = files.Find(path::GetBaseName(paths[j]));
+            if (idx != -1) {
+                CrashIf(idx < 0 || files.Count() <= (size_t)idx);
+                free(files.PopAt(idx));
+            }
         }
     }
 
@@ -165,6 +185,39 @@ void SaveThumbnail(DisplayState& ds)
     }
 }
 
+// the index is keyed on the file's size and exact modification time (as it
+// was when the file was loaded), so an index for an older version of the file
+// is ignored (hashing the file's content would be too expensive for large files)
+PageTextIndex *LoadTextIndex(const WCHAR *filePath, int pageCount)
+{
+    int64 fileSize = file::GetSize(filePath);
+    FILETIME fileTime = file::GetModificationTime(filePath);
+    ScopedMem<WCHAR> indexPath(GetTextIndexPath(filePath));
+    if (!indexPath || !file::Exists(indexPath) || fileSize < 0)
+        return new PageTextIndex(pageCount, fileSize, fileTime);
+
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(indexPath, &len));
+    PageTextIndex *index = data ? PageTextIndex::Deserialize(data, len, pageCount, fileSize, fileTime) : NULL;
+    if (!index)
+        index = new PageTextIndex(pageCount, fileSize, fileTime);
+    return index;
+}
+
+void SaveTextIndex(const WCHAR *filePath, PageTextIndex *index)
+{
+    ScopedMem<WCHAR> indexPath(GetTextIndexPath(filePath));
+    if (!indexPath)
+        return;
+    ScopedMem<WCHAR> thumbsPath(path::GetDir(indexPath));
+    if (!dir::Create(thumbsPath))
+        return;
+    size_t len;
+    ScopedMem<char> data(index->Serialize(&len));
+    if (data)
+        file::WriteAll(indexPath, data, len);
+}
+
 void RemoveThumbnail(DisplayState& ds)
 {
     if (!HasThumbnail(ds))
@@ -7,6 +7,8 @@
 #include "DisplayState.h"
 #include "FileHistory.h"
 
+class PageTextIndex;
+
 // thumbnails are 150px high and have a ratio of sqrt(2) : 1
 #define THUMBNAIL_DX        212
 #define THUMBNAIL_DY        150
@@ -20,4 +22,8 @@ void    SetThumbnail(DisplayState *ds, RenderedBitmap *bmp);
 void    SaveThumbnail(DisplayState& ds);
 void    RemoveThumbnail(DisplayState& ds);
 
+// returns an empty index if there's no (up-to-date) saved index for the file
+PageTextIndex * LoadTextIndex(const WCHAR *filePath, int pageCount);
+void    SaveTextIndex(const WCHAR *filePath, PageTextIndex *index);
+
 #endif
@@ -9,6 +9,7 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 #include "Mui.h"
+#include "StrHash.h"
 #include "Timer.h"
 
 #define NOLOG 1
@@ -721,6 +722,59 @@ void HtmlFormatter::EmitElasticSpace()
     AppendInstr(DrawInstr(InstrElasticSpace));
 }
 
+// Measuring text is the most expensive part of the layout and most text runs
+// are words which repeat often, so measurements are cached across formatters
+// (and thus across re-layouts at different page sizes). Fonts are never freed
+// (cf. mui::GetCachedFont), so CachedFont pointers are stable keys.
+// Only whole text runs are cached, as breaking them up depends on the page width.
+#define MEASURE_CACHE_MAX_RUN_LEN   64
+#define MEASURE_CACHE_MAX_KEY_LEN   (sizeof(mui::CachedFont *) + 1 + MEASURE_CACHE_MAX_RUN_LEN)
+#define MEASURE_CACHE_MAX_MEMORY    (4 * 1024 * 1024)
+
+class TextMeasureCache {
+    CRITICAL_SECTION    access;
+    StrHash<RectF>      measurements;
+
+    // key consists of font, render method and the UTF-8 text run
+    static size_t MakeKey(char *key, mui::CachedFont *font, mui::TextRenderMethod method, const char *s, size_t len) {
+        memcpy(key, &font, sizeof(font));
+        key[sizeof(font)] = (char)method;
+        memcpy(key + sizeof(font) + 1, s, len);
+        return sizeof(font) + 1 + len;
+    }
+
+public:
+    TextMeasureCache() : measurements(4096) { InitializeCriticalSection(&access); }
+    ~TextMeasureCache() { DeleteCriticalSection(&access); }
+
+    bool Get(mui::ITextRender *textMeasure, mui::CachedFont *font, const char *s, size_t len, RectF& bbox) {
+        if (len > MEASURE_CACHE_MAX_RUN_LEN)
+            return false;
+        char key[MEASURE_CACHE_MAX_KEY_LEN];
+        size_t keyLen = MakeKey(key, font, textMeasure->method, s, len);
+        ScopedCritSec scope(&access);
+        RectF *cached = measurements.Get(key, keyLen);
+        if (!cached)
+            return false;
+        bbox = *cached;
+        return true;
+    }
+
+    void Set(mui::ITextRender *textMeasure, mui::CachedFont *font, const char *s, size_t len, RectF bbox) {
+        if (len > MEASURE_CACHE_MAX_RUN_LEN)
+            return;
+        char key[MEASURE_CACHE_MAX_KEY_LEN];
+        size_t keyLen = MakeKey(key, font, textMeasure->method, s, len);
+        ScopedCritSec scope(&access);
+        if (measurements.MemoryUsed() > MEASURE_CACHE_MAX_MEMORY)
+            measurements.Reset();
+        bool created;
+        *measurements.Lookup(key, keyLen, true, created) = bbox;
+    }
+};
+
+static TextMeasureCache gTextMeasureCache;
+
 // a text run is a string of consecutive text with uniform style
 void HtmlFormatter::EmitTextRun(const char *s, const char *end)
 {
@@ -739,9 +793,14 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
         if (!resolved)
             currReparseIdx = s - htmlParser->Start();
 
-        size_t strLen = str::Utf8ToWcharBuf(s, end - s, buf, dimof(buf));
-        textMeasure->SetFont(CurrFont());
-        RectF bbox = textMeasure->Measure(buf, strLen);
+        size_t strLen = 0;
+        RectF bbox;
+        if (!gTextMeasureCache.Get(textMeasure, CurrFont(), s, end - s, bbox)) {
+            strLen = str::Utf8ToWcharBuf(s, end - s, buf, dimof(buf));
+            textMeasure->SetFont(CurrFont());
+            bbox = textMeasure->Measure(buf, strLen);
+            gTextMeasureCache.Set(textMeasure, CurrFont(), s, end - s, bbox);
+        }
         EnsureDx(bbox.Width);
         if (bbox.Width <= pageDx - currX) {
             AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
@@ -749,6 +808,10 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
             break;
         }
 
+        if (0 == strLen)
+            strLen = str::Utf8ToWcharBuf(s, end - s, buf, dimof(buf));
+        // the font isn't set when the measurement came from gTextMeasureCache
+        textMeasure->SetFont(CurrFont());
         size_t lenThatFits = StringLenForWidth(textMeasure, buf, strLen, pageDx - NewLineX());
         // try to prevent a break in the middle of a word
         if (iswalnum(buf[lenThatFits])) {
@@ -759,7 +822,6 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
                 }
             }
         }
-        textMeasure->SetFont(CurrFont());
         bbox = textMeasure->Measure(buf, lenThatFits);
         CrashIf(bbox.Width > pageDx);
         // s is UTF-8 and buf is UTF-16, so one
@@ -1028,12 +1090,14 @@ void HtmlFormatter::HandleTagStyle(HtmlToken *t)
     if (attr && !attr->ValIs("text/css"))
         return;
 
-    const char *start = t->s + t->sLen + 1;
+    // the parser's text might move while we look for the end tag
+    size_t startOff = t->s + t->sLen + 1 - htmlParser->Start();
     while (t && !t->IsError() && (!t->IsEndTag() || t->tag != Tag_Style)) {
-        t = htmlParser->Next();
+        t = NextHtmlToken();
     }
     if (!t || !t->IsEndTag() || Tag_Style != t->tag)
         return;
+    const char *start = htmlParser->Start() + startOff;
     const char *end = t->s - 2;
     CrashIf(start > end);
     ParseStyleSheet(start, end - start);
@@ -1275,6 +1339,13 @@ bool HtmlFormatter::IgnoreText()
     return false;
 }
 
+// formatters for text which is still being decompressed
+// make sure that the next token is complete (cf. MobiFormatter)
+HtmlToken *HtmlFormatter::NextHtmlToken()
+{
+    return htmlParser->Next();
+}
+
 // empty page is one that consists of only invisible instructions
 static bool IsEmptyPage(HtmlPage *p)
 {
@@ -1317,7 +1388,7 @@ HtmlPage *HtmlFormatter::Next(bool skipEmptyPages)
         // that case and really end parsing
         if (finishedParsing)
             return NULL;
-        HtmlToken *t = htmlParser->Next();
+        HtmlToken *t = NextHtmlToken();
         if (!t || t->IsError())
             break;
 
@@ -198,6 +198,7 @@ protected:
     void  AppendInstr(DrawInstr di);
     bool  IsCurrLineEmpty();
     virtual bool IgnoreText();
+    virtual HtmlToken *NextHtmlToken();
 
     void DumpLineDebugInfo();
 
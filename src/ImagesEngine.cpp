@@ -11,10 +11,19 @@
 #include "HtmlPullParser.h"
 #include "JsonParser.h"
 #include "PdfCreator.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE    10
+// number of bytes of decoded bitmaps to cache for quicker rendering
+// (the most recently used page is always kept, though)
+#define MAX_IMAGE_PAGE_CACHE_SIZE   (128 * 1024 * 1024)
+// number of pages to load in the background in reading direction
+// and in the opposite direction
+#define PREFETCH_PAGES_AHEAD        2
+#define PREFETCH_PAGES_BEHIND       1
+// how much of an image to unpack for determining its size
+#define IMAGE_HEADER_PROBE_LEN      (4 * 1024)
+#define IMAGE_HEADER_PROBE_MAX_LEN  (1024 * 1024)
 
 ///// ImagesEngine methods apply to all types of engines handling full-page images /////
 
@@ -23,15 +32,26 @@ struct ImagePage {
     Bitmap *bmp;
     bool ownBmp;
     int refs;
+    // size of the decoded bitmap in bytes
+    size_t size;
 
     ImagePage(int pageNo, Bitmap *bmp) :
-        pageNo(pageNo), bmp(bmp), ownBmp(true), refs(1) { }
+        pageNo(pageNo), bmp(bmp), ownBmp(true), refs(1), size(0) { }
 };
 
+static size_t GetBitmapSize(Bitmap *bmp)
+{
+    if (!bmp)
+        return 0;
+    return (size_t)bmp->GetWidth() * bmp->GetHeight() * GetPixelFormatSize(bmp->GetPixelFormat()) / 8;
+}
+
 class ImageElement;
+class ImagePrefetcher;
 
 class ImagesEngine : public BaseEngine {
     friend ImageElement;
+    friend ImagePrefetcher;
 
 public:
     ImagesEngine();
@@ -47,6 +67,7 @@ public:
                          RenderTarget target=Target_View, AbortCookie **cookie_out=NULL);
     virtual bool RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom, int rotation,
                          RectD *pageRect=NULL, RenderTarget target=Target_View, AbortCookie **cookie_out=NULL);
+    virtual void SetCurrentPage(int pageNo);
 
     virtual PointD Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse=false);
     virtual RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse=false);
@@ -80,22 +101,296 @@ protected:
     Vec<ImagePage *> pageCache;
     Vec<RectD> mediaboxes;
 
+    // set by engines which can load pages in the background
+    // (i.e. which implement LoadImageData)
+    ImagePrefetcher *prefetcher;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
-    virtual Bitmap *LoadBitmap(int pageNo, bool& deleteAfterUse) = 0;
+    // returns the undecoded image data for a page (must be thread-safe)
+    virtual char *LoadImageData(int pageNo, size_t& len) { return NULL; }
+    virtual Bitmap *LoadBitmap(int pageNo, bool& deleteAfterUse);
     virtual RectD LoadMediabox(int pageNo) = 0;
 
     ImagePage *GetPage(int pageNo, bool tryOnly=false);
     void DropPage(ImagePage *page, bool forceRemove=false);
+
+    // the following require cacheAccess to be held
+    ImagePage *FindPage(int pageNo);
+    size_t GetCacheSize();
+    void TrimCache();
+    bool AddPrefetchedPage(int pageNo, Bitmap *bmp);
+
+    // must be called from the destructor of engines which set prefetcher
+    void StopPrefetching();
+};
+
+// Pages likely to be viewed next are loaded in the background in two stages:
+// one thread unpacks the pages' image data (e.g. from a comic book archive)
+// while another thread decodes the data unpacked before. Decoded pages are
+// only cached if they fit into the cache's byte budget without evicting the
+// pages around the current one (so that a few huge pages can't crowd out
+// all the others).
+class ImagePrefetchThread : public ThreadBase {
+    ImagePrefetcher *prefetcher;
+    bool decode;
+
+public:
+    ImagePrefetchThread(ImagePrefetcher *prefetcher, bool decode) :
+        ThreadBase(decode ? "ImageDecodeThread" : "ImageUnpackThread"),
+        prefetcher(prefetcher), decode(decode) { }
+    virtual ~ImagePrefetchThread() { }
+
+    bool IsCancelled() { return WasCancelRequested(); }
+
+    virtual void Run();
 };
 
-ImagesEngine::ImagesEngine() : fileName(NULL)
+class ImagePrefetcher {
+    struct UnpackedPage {
+        int pageNo;
+        char *data;
+        size_t len;
+    };
+
+    ImagesEngine *engine;
+
+    // must be acquired after the engine's cacheAccess, if both are needed
+    CRITICAL_SECTION access;
+    // pages to unpack in order of priority
+    Vec<int> toUnpack;
+    Vec<UnpackedPage> toDecode;
+    // pages currently being unpacked resp. decoded (0 if none)
+    int unpacking, decoding;
+    // the page currently viewed and the direction in which it was last changed
+    int currPageNo, readingDir;
+
+    HANDLE unpackEvent, decodeEvent;
+    // signaled whenever a page has been unpacked or decoded
+    HANDLE progressEvent;
+    ImagePrefetchThread *unpackThread, *decodeThread;
+
+    bool IsUnpacked(int pageNo);
+
+public:
+    explicit ImagePrefetcher(ImagesEngine *engine);
+    ~ImagePrefetcher();
+
+    // determines which pages to load next (call whenever the current page changes)
+    void SetCurrentPage(int pageNo);
+    // whether the page is currently being unpacked or decoded
+    bool IsLoading(int pageNo);
+    // returns the page's image data, if it's been unpacked but not yet decoded
+    char *TakeUnpackedData(int pageNo, size_t& len);
+    void WaitForProgress() { WaitForSingleObject(progressEvent, 100); }
+    // whether the page is one that's currently viewed or will be prefetched
+    bool IsKept(int pageNo);
+
+    void UnpackPages(ImagePrefetchThread *thread);
+    void DecodePages(ImagePrefetchThread *thread);
+};
+
+void ImagePrefetchThread::Run()
+{
+    if (decode)
+        prefetcher->DecodePages(this);
+    else
+        prefetcher->UnpackPages(this);
+}
+
+ImagePrefetcher::ImagePrefetcher(ImagesEngine *engine) : engine(engine),
+    unpacking(0), decoding(0), currPageNo(0), readingDir(1),
+    unpackThread(NULL), decodeThread(NULL)
+{
+    InitializeCriticalSection(&access);
+    unpackEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    decodeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    progressEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    ImagePrefetchThread *threads[] = { unpackThread, decodeThread };
+    for (size_t i = 0; i < dimof(threads); i++) {
+        if (threads[i])
+            threads[i]->RequestCancel();
+    }
+    SetEvent(unpackEvent);
+    SetEvent(decodeEvent);
+    for (size_t i = 0; i < dimof(threads); i++) {
+        if (threads[i]) {
+            bool ok = threads[i]->Join();
+            CrashIf(!ok);
+            delete threads[i];
+        }
+    }
+
+    for (size_t i = 0; i < toDecode.Count(); i++) {
+        free(toDecode.At(i).data);
+    }
+    CloseHandle(unpackEvent);
+    CloseHandle(decodeEvent);
+    CloseHandle(progressEvent);
+    DeleteCriticalSection(&access);
+}
+
+bool ImagePrefetcher::IsKept(int pageNo)
+{
+    ScopedCritSec scope(&access);
+    if (readingDir > 0)
+        return currPageNo - PREFETCH_PAGES_BEHIND <= pageNo && pageNo <= currPageNo + PREFETCH_PAGES_AHEAD;
+    return currPageNo - PREFETCH_PAGES_AHEAD <= pageNo && pageNo <= currPageNo + PREFETCH_PAGES_BEHIND;
+}
+
+void ImagePrefetcher::SetCurrentPage(int pageNo)
+{
+    ScopedCritSec scope(&access);
+    if (pageNo == currPageNo)
+        return;
+    if (currPageNo)
+        readingDir = pageNo < currPageNo ? -1 : 1;
+    currPageNo = pageNo;
+
+    toUnpack.Reset();
+    for (int i = 1; i <= PREFETCH_PAGES_AHEAD; i++) {
+        int next = pageNo + i * readingDir;
+        if (1 <= next && next <= engine->PageCount())
+            toUnpack.Append(next);
+    }
+    for (int i = 1; i <= PREFETCH_PAGES_BEHIND; i++) {
+        int prev = pageNo - i * readingDir;
+        if (1 <= prev && prev <= engine->PageCount())
+            toUnpack.Append(prev);
+    }
+    // discard data which is no longer needed
+    for (size_t i = toDecode.Count(); i > 0; i--) {
+        if (!IsKept(toDecode.At(i - 1).pageNo)) {
+            free(toDecode.At(i - 1).data);
+            toDecode.RemoveAt(i - 1);
+        }
+    }
+
+    if (!unpackThread) {
+        unpackThread = new ImagePrefetchThread(this, false);
+        unpackThread->Start();
+        decodeThread = new ImagePrefetchThread(this, true);
+        decodeThread->Start();
+    }
+    SetEvent(unpackEvent);
+}
+
+bool ImagePrefetcher::IsLoading(int pageNo)
+{
+    ScopedCritSec scope(&access);
+    return pageNo == unpacking || pageNo == decoding;
+}
+
+bool ImagePrefetcher::IsUnpacked(int pageNo)
+{
+    ScopedCritSec scope(&access);
+    for (size_t i = 0; i < toDecode.Count(); i++) {
+        if (toDecode.At(i).pageNo == pageNo)
+            return true;
+    }
+    return false;
+}
+
+char *ImagePrefetcher::TakeUnpackedData(int pageNo, size_t& len)
+{
+    ScopedCritSec scope(&access);
+    for (size_t i = 0; i < toDecode.Count(); i++) {
+        if (toDecode.At(i).pageNo == pageNo) {
+            char *data = toDecode.At(i).data;
+            len = toDecode.At(i).len;
+            toDecode.RemoveAt(i);
+            return data;
+        }
+    }
+    return NULL;
+}
+
+void ImagePrefetcher::UnpackPages(ImagePrefetchThread *thread)
+{
+    for (;;) {
+        WaitForSingleObject(unpackEvent, INFINITE);
+        while (!thread->IsCancelled()) {
+            int pageNo = 0;
+            {
+                ScopedCritSec cacheScope(&engine->cacheAccess);
+                ScopedCritSec scope(&access);
+                while (!pageNo && toUnpack.Count() > 0) {
+                    int next = toUnpack.At(0);
+                    toUnpack.RemoveAt(0);
+                    if (!engine->FindPage(next) && !IsLoading(next) && !IsUnpacked(next))
+                        pageNo = next;
+                }
+                unpacking = pageNo;
+            }
+            if (!pageNo)
+                break;
+
+            size_t len;
+            char *data = engine->LoadImageData(pageNo, len);
+            {
+                ScopedCritSec scope(&access);
+                unpacking = 0;
+                if (data && IsKept(pageNo)) {
+                    UnpackedPage page = { pageNo, data, len };
+                    toDecode.Append(page);
+                    SetEvent(decodeEvent);
+                }
+                else {
+                    free(data);
+                }
+            }
+            SetEvent(progressEvent);
+        }
+        if (thread->IsCancelled())
+            return;
+    }
+}
+
+void ImagePrefetcher::DecodePages(ImagePrefetchThread *thread)
+{
+    for (;;) {
+        WaitForSingleObject(decodeEvent, INFINITE);
+        while (!thread->IsCancelled()) {
+            UnpackedPage page;
+            {
+                ScopedCritSec scope(&access);
+                if (0 == toDecode.Count())
+                    break;
+                page = toDecode.At(0);
+                toDecode.RemoveAt(0);
+                decoding = page.pageNo;
+            }
+
+            Bitmap *bmp = BitmapFromData(page.data, page.len);
+            free(page.data);
+            {
+                ScopedCritSec cacheScope(&engine->cacheAccess);
+                ScopedCritSec scope(&access);
+                decoding = 0;
+                if (bmp && engine->AddPrefetchedPage(page.pageNo, bmp))
+                    bmp = NULL;
+            }
+            delete bmp;
+            SetEvent(progressEvent);
+        }
+        if (thread->IsCancelled())
+            return;
+    }
+}
+
+ImagesEngine::ImagesEngine() : fileName(NULL), prefetcher(NULL)
 {
     InitializeCriticalSection(&cacheAccess);
 }
 
 ImagesEngine::~ImagesEngine()
 {
+    StopPrefetching();
+
     EnterCriticalSection(&cacheAccess);
     while (pageCache.Count() > 0) {
         CrashIf(pageCache.Last()->refs != 1);
@@ -138,6 +433,12 @@ RenderedBitmap *ImagesEngine::RenderBitmap(int pageNo, float zoom, int rotation,
     return new RenderedBitmap(hbmp, screen.Size(), hMap);
 }
 
+void ImagesEngine::SetCurrentPage(int pageNo)
+{
+    if (prefetcher)
+        prefetcher->SetCurrentPage(pageNo);
+}
+
 bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
     ImagePage *page = GetPage(pageNo);
@@ -270,30 +571,109 @@ bool ImagesEngine::SaveFileAs(const WCHAR *copyFileName, bool includeUserAnnots)
     return false;
 }
 
-ImagePage *ImagesEngine::GetPage(int pageNo, bool tryOnly)
+Bitmap *ImagesEngine::LoadBitmap(int pageNo, bool& deleteAfterUse)
 {
-    ScopedCritSec scope(&cacheAccess);
+    size_t len;
+    ScopedMem<char> bmpData(LoadImageData(pageNo, len));
+    if (bmpData) {
+        deleteAfterUse = true;
+        return BitmapFromData(bmpData, len);
+    }
+    return NULL;
+}
 
-    ImagePage *result = NULL;
+ImagePage *ImagesEngine::FindPage(int pageNo)
+{
+    for (size_t i = 0; i < pageCache.Count(); i++) {
+        if (pageCache.At(i)->pageNo == pageNo)
+            return pageCache.At(i);
+    }
+    return NULL;
+}
 
+size_t ImagesEngine::GetCacheSize()
+{
+    ScopedCritSec scope(&cacheAccess);
+    size_t size = 0;
     for (size_t i = 0; i < pageCache.Count(); i++) {
-        if (pageCache.At(i)->pageNo == pageNo) {
-            result = pageCache.At(i);
-            break;
+        size += pageCache.At(i)->size;
+    }
+    return size;
+}
+
+// drops the least recently used pages until the cache is within its budget
+// (except for the most recently used page and for the pages around the current
+// one, so that rendering neighboring pages doesn't evict prefetched pages)
+void ImagesEngine::TrimCache()
+{
+    size_t cacheSize = GetCacheSize();
+    for (size_t i = pageCache.Count(); i > 1 && cacheSize > MAX_IMAGE_PAGE_CACHE_SIZE; i--) {
+        ImagePage *page = pageCache.At(i - 1);
+        if (!prefetcher || !prefetcher->IsKept(page->pageNo)) {
+            cacheSize -= page->size;
+            DropPage(page, true);
         }
     }
+}
+
+// takes ownership of bmp, if the page fits into the cache
+bool ImagesEngine::AddPrefetchedPage(int pageNo, Bitmap *bmp)
+{
+    if (FindPage(pageNo))
+        return false;
+
+    size_t size = GetBitmapSize(bmp);
+    size_t cacheSize = GetCacheSize();
+    // only make room by dropping pages that are neither viewed nor about to be
+    for (size_t i = pageCache.Count(); i > 0 && cacheSize + size > MAX_IMAGE_PAGE_CACHE_SIZE; i--) {
+        ImagePage *page = pageCache.At(i - 1);
+        if (!prefetcher->IsKept(page->pageNo)) {
+            cacheSize -= page->size;
+            DropPage(page, true);
+        }
+    }
+    if (cacheSize + size > MAX_IMAGE_PAGE_CACHE_SIZE)
+        return false;
+
+    ImagePage *page = new ImagePage(pageNo, bmp);
+    page->size = size;
+    pageCache.InsertAt(0, page);
+    return true;
+}
+
+void ImagesEngine::StopPrefetching()
+{
+    // stops the background threads (which call into the derived engine)
+    delete prefetcher;
+    prefetcher = NULL;
+}
+
+ImagePage *ImagesEngine::GetPage(int pageNo, bool tryOnly)
+{
+    ScopedCritSec scope(&cacheAccess);
+
+    ImagePage *result = FindPage(pageNo);
+    // rather wait for a page being loaded in the background than load it twice
+    while (!result && !tryOnly && prefetcher && prefetcher->IsLoading(pageNo)) {
+        LeaveCriticalSection(&cacheAccess);
+        prefetcher->WaitForProgress();
+        EnterCriticalSection(&cacheAccess);
+        result = FindPage(pageNo);
+    }
     if (!result && tryOnly)
         return NULL;
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        // (i.e. formats which aren't IsGdiPlusNativeFormat)?
-        if (pageCache.Count() >= MAX_IMAGE_PAGE_CACHE) {
-            CrashIf(pageCache.Count() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
         result = new ImagePage(pageNo, NULL);
-        result->bmp = LoadBitmap(pageNo, result->ownBmp);
+        // the page's data might already have been unpacked in the background
+        size_t len;
+        ScopedMem<char> bmpData(prefetcher ? prefetcher->TakeUnpackedData(pageNo, len) : NULL);
+        if (bmpData)
+            result->bmp = BitmapFromData(bmpData, len);
+        else
+            result->bmp = LoadBitmap(pageNo, result->ownBmp);
+        result->size = GetBitmapSize(result->bmp);
         pageCache.InsertAt(0, result);
+        TrimCache();
     }
     else if (result != pageCache.At(0)) {
         // keep the list Most Recently Used first
@@ -508,7 +888,7 @@ RectD ImageEngineImpl::LoadMediabox(int pageNo)
         return RectD(0, 0, image->GetWidth(), image->GetHeight());
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage *page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.Count());
+    ImagePage *page = GetPage(pageNo, GetCacheSize() >= MAX_IMAGE_PAGE_CACHE_SIZE);
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page);
@@ -615,6 +995,7 @@ BaseEngine *CreateFromStream(IStream *stream)
 class ImageDirEngineImpl : public ImagesEngine {
 public:
     ImageDirEngineImpl() : fileDPI(96.0f) { }
+    virtual ~ImageDirEngineImpl() { StopPrefetching(); }
 
     virtual BaseEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
@@ -644,7 +1025,7 @@ public:
 protected:
     bool LoadImageDir(const WCHAR *dirName);
 
-    virtual Bitmap *LoadBitmap(int pageNo, bool& deleteAfterUse);
+    virtual char *LoadImageData(int pageNo, size_t& len);
     virtual RectD LoadMediabox(int pageNo);
 
     WStrVec pageFileNames;
@@ -682,6 +1063,8 @@ bool ImageDirEngineImpl::LoadImageDir(const WCHAR *dirName)
         DropPage(page);
     }
 
+    prefetcher = new ImagePrefetcher(this);
+
     return true;
 }
 
@@ -740,15 +1123,9 @@ bool ImageDirEngineImpl::SaveFileAs(const WCHAR *copyFileName, bool includeUserA
     return ok;
 }
 
-Bitmap *ImageDirEngineImpl::LoadBitmap(int pageNo, bool& deleteAfterUse)
+char *ImageDirEngineImpl::LoadImageData(int pageNo, size_t& len)
 {
-    size_t len;
-    ScopedMem<char> bmpData(file::ReadAll(pageFileNames.At(pageNo - 1), &len));
-    if (bmpData) {
-        deleteAfterUse = true;
-        return BitmapFromData(bmpData, len);
-    }
-    return NULL;
+    return file::ReadAll(pageFileNames.At(pageNo - 1), &len);
 }
 
 RectD ImageDirEngineImpl::LoadMediabox(int pageNo)
@@ -808,8 +1185,14 @@ enum CbxFormat { Arch_Zip, Arch_Rar, Arch_7z, Arch_Tar };
 
 class CbxEngineImpl : public ImagesEngine, public json::ValueVisitor {
 public:
-    CbxEngineImpl(ArchFile *arch, CbxFormat cbxFormat) : cbxFile(arch), cbxFormat(cbxFormat) { }
-    virtual ~CbxEngineImpl() { delete cbxFile; }
+    CbxEngineImpl(ArchFile *arch, CbxFormat cbxFormat) : cbxFile(arch), cbxFormat(cbxFormat) {
+        InitializeCriticalSection(&archiveAccess);
+    }
+    virtual ~CbxEngineImpl() {
+        StopPrefetching();
+        delete cbxFile;
+        DeleteCriticalSection(&archiveAccess);
+    }
 
     virtual BaseEngine *Clone() {
         if (fileStream) {
@@ -840,17 +1223,19 @@ public:
     static BaseEngine *CreateFromStream(IStream *stream);
 
 protected:
-    virtual Bitmap *LoadBitmap(int pageNo, bool& deleteAfterUse);
+    virtual char *LoadImageData(int pageNo, size_t& len) { return GetImageData(pageNo, len); }
     virtual RectD LoadMediabox(int pageNo);
 
     bool LoadFromFile(const WCHAR *fileName);
     bool LoadFromStream(IStream *stream);
     bool FinishLoading();
 
-    char *GetImageData(int pageNo, size_t& len);
+    char *GetImageData(int pageNo, size_t& len, size_t maxLen=SIZE_MAX);
     void ParseComicInfoXml(const char *xmlData);
 
     ArchFile *cbxFile;
+    // archives are read from both the UI and the background threads
+    CRITICAL_SECTION archiveAccess;
     CbxFormat cbxFormat;
     Vec<size_t> fileIdxs;
 
@@ -932,15 +1317,16 @@ bool CbxEngineImpl::FinishLoading()
         return false;
 
     mediaboxes.AppendBlanks(fileIdxs.Count());
+    prefetcher = new ImagePrefetcher(this);
 
     return true;
 }
 
-char *CbxEngineImpl::GetImageData(int pageNo, size_t& len)
+char *CbxEngineImpl::GetImageData(int pageNo, size_t& len, size_t maxLen)
 {
     AssertCrash(1 <= pageNo && pageNo <= PageCount());
-    ScopedCritSec scope(&cacheAccess);
-    return cbxFile->GetFileDataByIdx(fileIdxs.At(pageNo - 1), &len);
+    ScopedCritSec scope(&archiveAccess);
+    return cbxFile->GetFileDataPrefixByIdx(fileIdxs.At(pageNo - 1), maxLen, &len);
 }
 
 static char *GetTextContent(HtmlPullParser& parser)
@@ -1081,34 +1467,37 @@ const WCHAR *CbxEngineImpl::GetDefaultFileExt() const
     }
 }
 
-Bitmap *CbxEngineImpl::LoadBitmap(int pageNo, bool& deleteAfterUse)
-{
-    size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData) {
-        deleteAfterUse = true;
-        return BitmapFromData(bmpData, len);
-    }
-    return NULL;
-}
-
 RectD CbxEngineImpl::LoadMediabox(int pageNo)
 {
-    // fill the cache to prevent the first few images from being unpacked twice
-    ImagePage *page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.Count());
+    ImagePage *page = GetPage(pageNo, true);
     if (page) {
         RectD mbox(0, 0, page->bmp->GetWidth(), page->bmp->GetHeight());
         DropPage(page);
         return mbox;
     }
 
+    // for most images, the size can be determined from the first few bytes
+    // (the header might be preceded by metadata, though, so unpack more as needed)
     size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData, len);
-        return RectD(0, 0, size.Width, size.Height);
+    ScopedMem<char> bmpData;
+    for (size_t maxLen = IMAGE_HEADER_PROBE_LEN; ; maxLen *= 16) {
+        if (maxLen > IMAGE_HEADER_PROBE_MAX_LEN)
+            maxLen = SIZE_MAX;
+        bmpData.Set(GetImageData(pageNo, len, maxLen));
+        if (!bmpData)
+            return RectD();
+        Size size = BitmapSizeFromHeader(bmpData, len);
+        if (!size.Empty())
+            return RectD(0, 0, size.Width, size.Height);
+        // stop once the entire image has been unpacked (right away
+        // for solid archives which can't be partially unpacked)
+        if (len != maxLen)
+            break;
     }
-    return RectD();
+
+    // let GDI+ decode the image, if its header can't be parsed
+    Size size = BitmapSizeFromData(bmpData, len);
+    return RectD(0, 0, size.Width, size.Height);
 }
 
 #define RAR_SIGNATURE       "Rar!\x1A\x07\x00"
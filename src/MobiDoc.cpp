@@ -12,6 +12,7 @@
 #include "GdiPlusUtil.h"
 #include "HtmlPullParser.h"
 #include "PalmDbReader.h"
+#include "StrHash.h"
 #include "TrivialHtmlParser.h"
 
 #include "DebugLog.h"
@@ -22,6 +23,11 @@
 #define PALMDOC_TYPE_CREATOR   "TEXtREAd"
 #define TEALDOC_TYPE_CREATOR   "TEXtTlDc"
 
+// text records are at most this large when uncompressed
+#define kMaxTextRecordSize 4096
+// how much text to decompress ahead of what's currently being parsed
+#define kTextLookahead (32 * 1024)
+
 #define COMPRESSION_NONE 1
 #define COMPRESSION_PALM 2
 #define COMPRESSION_HUFF 17480
@@ -191,11 +197,22 @@ STATIC_ASSERT(kCdicHeaderLen == sizeof(CdicHeader), validCdicHeader);
 
 #define kCdicsMax 32
 
+// codes of up to kFastTableBits bits are decoded with a single table lookup
+#define kFastTableBits      12
+#define kFastTableItemCount (1 << kFastTableBits)
+// don't cache more than this many bytes of expanded dictionary entries
+#define kMaxExpandedDataLen (8 * 1024 * 1024)
+
 class HuffDicDecompressor
 {
     uint32      cacheTable[kCacheItemCount];
     uint32      baseTable[kBaseTableItemCount];
 
+    // code and code length for all kFastTableBits bit prefixes
+    // (code length is 0 for codes that are longer)
+    uint32      fastCode[kFastTableItemCount];
+    uint8       fastCodeLen[kFastTableItemCount];
+
     size_t      dictsCount;
     // owned by the creator (in our case: by the PdbReader)
     uint8 *     dicts[kCdicsMax];
@@ -205,18 +222,71 @@ class HuffDicDecompressor
 
     Vec<uint32> recursionGuard;
 
+    // dictionary entries which refer to other entries are
+    // only expanded once (key is the code, data in expandedData)
+    struct ExpandedSym {
+        uint32  offset;
+        uint32  len;
+    };
+    StrHash<ExpandedSym> expanded;
+    str::Str<char> expandedData;
+
+    bool FindCode(uint32 bits, uint32& code, uint32& codeLen);
+    bool GetSymbol(uint32 code, uint8 *& sym, uint16& symLen);
+    bool DecodeOne(uint32 code, str::Str<char>& dst);
+    bool DecodeOneReference(uint32 code, str::Str<char>& dst);
+
 public:
     HuffDicDecompressor();
 
     bool SetHuffData(uint8 *huffData, size_t huffDataLen);
     bool AddCdicData(uint8 *cdicData, uint32 cdicDataLen);
     bool Decompress(uint8 *src, size_t octets, str::Str<char>& dst);
-    bool DecodeOne(uint32 code, str::Str<char>& dst);
+    // the original bit by bit decoder (for testing Decompress)
+    bool DecompressReference(uint8 *src, size_t octets, str::Str<char>& dst);
 };
 
 HuffDicDecompressor::HuffDicDecompressor() : codeLength(0), dictsCount(0) { }
 
-bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
+// keeps a code on the recursion guard while its dictionary entry is being
+// expanded (and removes it again even if the expansion fails)
+class ScopedRecursionGuard {
+    Vec<uint32>& guard;
+public:
+    ScopedRecursionGuard(Vec<uint32>& guard, uint32 code) : guard(guard) { guard.Push(code); }
+    ~ScopedRecursionGuard() { guard.Pop(); }
+};
+
+// determines the code (and its length) for the top bits of bits.
+// Returns false if the tables are corrupted
+bool HuffDicDecompressor::FindCode(uint32 bits, uint32& code, uint32& codeLen)
+{
+    uint32 v = cacheTable[bits >> 24];
+    codeLen = v & 0x1f;
+    if (!codeLen)
+        return false;
+    bool isTerminal = (v & 0x80) != 0;
+
+    if (isTerminal) {
+        code = (v >> 8) - (bits >> (32 - codeLen));
+        return true;
+    }
+
+    uint32 baseVal;
+    codeLen -= 1;
+    do {
+        codeLen++;
+        if (codeLen > 32)
+            return false;
+        baseVal = baseTable[codeLen * 2 - 2];
+        code = (bits >> (32 - codeLen));
+    } while (baseVal > code);
+    code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+    return true;
+}
+
+// returns the (validated) dictionary entry for a code
+bool HuffDicDecompressor::GetSymbol(uint32 code, uint8 *& sym, uint16& symLen)
 {
     uint16 dict = (uint16)(code >> codeLength);
     if (dict >= dictsCount) {
@@ -230,34 +300,127 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
         lf("invalid offset");
         return false;
     }
-    uint16 symLen = UInt16BE(dicts[dict] + offset);
-    uint8 *p = dicts[dict] + offset + 2;
+    symLen = UInt16BE(dicts[dict] + offset);
+    sym = dicts[dict] + offset + 2;
     if ((uint32)(symLen & 0x7fff) > dictSize[dict] - offset - 2) {
         lf("invalid symLen");
         return false;
     }
+    if ((symLen & 0x8000) && (symLen & 0x7fff) > 127) {
+        lf("symLen too big");
+        return false;
+    }
+    return true;
+}
+
+bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
+{
+    uint8 *p;
+    uint16 symLen;
+    if (!GetSymbol(code, p, symLen))
+        return false;
+
+    if ((symLen & 0x8000)) {
+        dst.Append((char *)p, symLen & 0x7fff);
+        return true;
+    }
+
+    ExpandedSym *exp = expanded.Get((const char *)&code, sizeof(code));
+    if (exp) {
+        dst.Append(expandedData.Get() + exp->offset, exp->len);
+        return true;
+    }
+
+    if (recursionGuard.Contains(code)) {
+        lf("infinite recursion");
+        return false;
+    }
+    size_t start = dst.Size();
+    {
+        ScopedRecursionGuard scope(recursionGuard, code);
+        if (!Decompress(p, symLen, dst))
+            return false;
+    }
+
+    size_t len = dst.Size() - start;
+    if (expandedData.Size() + len <= kMaxExpandedDataLen) {
+        bool created;
+        exp = expanded.Lookup((const char *)&code, sizeof(code), true, created);
+        exp->offset = (uint32)expandedData.Size();
+        exp->len = (uint32)len;
+        expandedData.Append(dst.Get() + start, len);
+    }
+    return true;
+}
+
+// returns the 32 bits starting at bitPos (bits beyond the end of src are 0)
+static inline uint32 PeekBits(const uint8 *src, size_t srcSize, size_t bitPos)
+{
+    size_t pos = bitPos / 8;
+    uint64 v = 0;
+    if (pos + 5 <= srcSize) {
+        v = ((uint64)src[pos] << 32) | ((uint64)src[pos + 1] << 24) |
+            ((uint64)src[pos + 2] << 16) | ((uint64)src[pos + 3] << 8) | src[pos + 4];
+    } else {
+        for (size_t i = pos; i < pos + 5; i++) {
+            v = (v << 8) | (i < srcSize ? src[i] : 0);
+        }
+    }
+    return (uint32)(v >> (8 - bitPos % 8));
+}
+
+bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst)
+{
+    size_t bitsCount = srcSize * 8;
+    size_t bitPos = 0;
+    uint32 bits = 0;
+
+    while (bitPos < bitsCount) {
+        bits = PeekBits(src, srcSize, bitPos);
+        if (bitsCount - bitPos < 8 && 0 == bits)
+            break;
+
+        uint32 idx = bits >> (32 - kFastTableBits);
+        uint32 codeLen = fastCodeLen[idx];
+        uint32 code = fastCode[idx];
+        if (!codeLen && !FindCode(bits, code, codeLen)) {
+            lf("corrupted table");
+            return false;
+        }
+
+        if (!DecodeOne(code, dst))
+            return false;
+        if (codeLen > bitsCount - bitPos) {
+            lf("not enough data");
+            return false;
+        }
+        bitPos += codeLen;
+    }
+    return true;
+}
+
+bool HuffDicDecompressor::DecodeOneReference(uint32 code, str::Str<char>& dst)
+{
+    uint8 *p;
+    uint16 symLen;
+    if (!GetSymbol(code, p, symLen))
+        return false;
 
     if (!(symLen & 0x8000)) {
         if (recursionGuard.Contains(code)) {
             lf("infinite recursion");
             return false;
         }
-        recursionGuard.Push(code);
-        if (!Decompress(p, symLen, dst))
+        ScopedRecursionGuard scope(recursionGuard, code);
+        if (!DecompressReference(p, symLen, dst))
             return false;
-        recursionGuard.Pop();
     } else {
-        symLen &= 0x7fff;
-        if (symLen > 127) {
-            lf("symLen too big");
-            return false;
-        }
-        dst.Append((char *)p, symLen);
+        dst.Append((char *)p, symLen & 0x7fff);
     }
     return true;
 }
 
-bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>& dst)
+bool HuffDicDecompressor::DecompressReference(uint8 *src, size_t srcSize, str::Str<char>& dst)
 {
     uint32    bitsConsumed = 0;
     uint32    bits = 0;
@@ -276,33 +439,13 @@ bool HuffDicDecompressor::Decompress(uint8 *src, size_t srcSize, str::Str<char>&
         bits = br.Peek(32);
         if (br.BitsLeft() < 8 && 0 == bits)
             break;
-        uint32 v = cacheTable[bits >> 24];
-        uint32 codeLen = v & 0x1f;
-        if (!codeLen) {
-            lf("corrupted table, zero code len");
+        uint32 code, codeLen;
+        if (!FindCode(bits, code, codeLen)) {
+            lf("corrupted table");
             return false;
         }
-        bool isTerminal = (v & 0x80) != 0;
-
-        uint32 code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
-        } else {
-            uint32 baseVal;
-            codeLen -= 1;
-            do {
-                codeLen++;
-                if (codeLen > 32) {
-                    lf("code len > 32 bits");
-                    return false;
-                }
-                baseVal = baseTable[codeLen * 2 - 2];
-                code = (bits >> (32 - codeLen));
-            } while (baseVal > code);
-            code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
-        }
 
-        if (!DecodeOne(code, dst))
+        if (!DecodeOneReference(code, dst))
             return false;
         bitsConsumed = codeLen;
     }
@@ -350,6 +493,15 @@ bool HuffDicDecompressor::SetHuffData(uint8 *huffData, size_t huffDataLen)
         baseTable[i] = d.UInt32();
     }
     CrashIf(d.Offset() != kHuffRecordMinLen);
+
+    for (uint32 i = 0; i < kFastTableItemCount; i++) {
+        uint32 code, codeLen;
+        bool ok = FindCode(i << (32 - kFastTableBits), code, codeLen);
+        if (!ok || codeLen > kFastTableBits)
+            code = codeLen = 0;
+        fastCode[i] = code;
+        fastCodeLen[i] = (uint8)codeLen;
+    }
     return true;
 }
 
@@ -463,9 +615,11 @@ static bool IsValidCompression(int comprType)
 MobiDoc::MobiDoc(const WCHAR *filePath) :
     fileName(str::Dup(filePath)), pdbReader(NULL),
     docType(Pdb_Unknown), docRecCount(0), compressionType(0), docUncompressedSize(0),
-    doc(NULL), multibyte(false), trailersCount(0), imageFirstRec(0), coverImageRec(0),
-    imagesCount(0), images(NULL), huffDic(NULL), textEncoding(CP_UTF8), docTocIndex((size_t)-1)
+    multibyte(false), trailersCount(0), imageFirstRec(0), coverImageRec(0),
+    imagesCount(0), images(NULL), huffDic(NULL), textEncoding(CP_UTF8), docTocIndex((size_t)-1),
+    text(NULL), textLen(0), textCap(0), nextTextRec(1)
 {
+    InitializeCriticalSection(&textAccess);
 }
 
 MobiDoc::~MobiDoc()
@@ -473,11 +627,13 @@ MobiDoc::~MobiDoc()
     free(fileName);
     free(images);
     delete huffDic;
-    delete doc;
+    free(text);
+    FreeVecMembers(retiredText);
     delete pdbReader;
     for (size_t i = 0; i < props.Count(); i++) {
         free(props.At(i).value);
     }
+    DeleteCriticalSection(&textAccess);
 }
 
 bool MobiDoc::ParseHeader()
@@ -775,7 +931,7 @@ static size_t GetRealRecordSize(uint8 *recData, size_t recLen, size_t trailersCo
 
 // Load a given record of a document into strOut, uncompressing if necessary.
 // Returns false if error.
-bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
+bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut, bool useReferenceDecoder)
 {
     size_t recSize;
     const char *recData = pdbReader->GetRecord(recNo, &recSize);
@@ -796,7 +952,11 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
         return ok;
     }
     if (COMPRESSION_HUFF == compressionType && huffDic) {
-        bool ok = huffDic->Decompress((uint8*)recData, recSize, strOut);
+        bool ok;
+        if (useReferenceDecoder)
+            ok = huffDic->DecompressReference((uint8*)recData, recSize, strOut);
+        else
+            ok = huffDic->Decompress((uint8*)recData, recSize, strOut);
         if (!ok)
             lf("HuffDic decompression failed");
         return ok;
@@ -812,32 +972,119 @@ bool MobiDoc::LoadDocument(PdbReader *pdbReader)
     if (!ParseHeader())
         return false;
 
-    assert(!doc);
-    doc = new str::Str<char>(docUncompressedSize);
+    assert(!text);
+    // don't trust an (overly) large uncompressedDocSize of broken documents
+    textCap = min(docUncompressedSize, docRecCount * kMaxTextRecordSize);
+    // leave some room for the conversion of non-ASCII characters to UTF-8
+    if (textEncoding != CP_UTF8)
+        textCap += textCap / 8;
+    textCap += 1;
+    text = AllocArray<char>(textCap);
+    if (!text)
+        return false;
+
+    // the remaining records are decompressed on demand (which can save
+    // a lot of time for huge documents, e.g. HuffDic compressed dictionaries)
+    return DecompressText(1);
+}
+
+// decompresses all text records into dst (without any conversion)
+bool MobiDoc::DecompressHuffDicRecords(str::Str<char>& dst, bool useReferenceDecoder)
+{
+    if (COMPRESSION_HUFF != compressionType)
+        return false;
+    ScopedCritSec scope(&textAccess);
     for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc))
+        if (!LoadDocRecordIntoBuffer(i, dst, useReferenceDecoder))
             return false;
     }
+    return true;
+}
+
+static bool IsSingleByteCodePage(UINT codePage)
+{
+    CPINFO info;
+    return GetCPInfo(codePage, &info) && 1 == info.MaxCharSize;
+}
+
+// appends decompressed record data to text (data is modified in the process)
+void MobiDoc::AppendText(str::Str<char>& data)
+{
     // replace unexpected \0 with spaces
     // cf. https://code.google.com/p/sumatrapdf/issues/detail?id=2529
-    char *s = doc->Get(), *end = s + doc->Size();
+    char *s = data.Get(), *end = s + data.Size();
     while ((s = (char *)memchr(s, '\0', end - s)) != NULL) {
         *s = ' ';
     }
     if (textEncoding != CP_UTF8) {
-        char *docUtf8 = str::ToMultiByte(doc->Get(), textEncoding, CP_UTF8);
-        if (docUtf8) {
-            doc->Reset();
-            doc->AppendAndFree(docUtf8);
+        char *dataUtf8 = str::ToMultiByte(data.Get(), textEncoding, CP_UTF8);
+        if (dataUtf8) {
+            data.Reset();
+            data.AppendAndFree(dataUtf8);
         }
     }
-    return true;
+
+    if (textLen + data.Size() + 1 > textCap) {
+        size_t newCap = max(textCap * 2, textLen + data.Size() + 1);
+        char *newText = AllocArray<char>(newCap);
+        if (!newText)
+            return;
+        memcpy(newText, text, textLen);
+        retiredText.Append(text);
+        text = newText;
+        textCap = newCap;
+    }
+    memcpy(text + textLen, data.Get(), data.Size());
+    textLen += data.Size();
+    text[textLen] = '\0';
+}
+
+// decompresses text records until there are at least minLen bytes of text
+// (or until all records have been decompressed). Caller must hold textAccess.
+// Returns false if a record couldn't be decompressed
+bool MobiDoc::DecompressText(size_t minLen)
+{
+    // multi-byte code pages other than UTF-8 can't be converted record by record
+    bool convertAll = textEncoding != CP_UTF8 && !IsSingleByteCodePage(textEncoding);
+    str::Str<char> data(4096);
+    bool ok = true;
+    while ((textLen < minLen || convertAll) && nextTextRec <= docRecCount) {
+        ok = LoadDocRecordIntoBuffer(nextTextRec++, data);
+        if (!ok) {
+            // show as much of a broken document as we can
+            nextTextRec = docRecCount + 1;
+            break;
+        }
+        if (!convertAll) {
+            AppendText(data);
+            data.Reset();
+        }
+    }
+    if (data.Size() > 0)
+        AppendText(data);
+    return ok;
+}
+
+char *MobiDoc::GetHtmlDataPrefix(size_t minLen, size_t& lenOut, bool *isCompleteOut)
+{
+    ScopedCritSec scope(&textAccess);
+    DecompressText(minLen);
+    lenOut = textLen;
+    if (isCompleteOut)
+        *isCompleteOut = nextTextRec > docRecCount;
+    return text;
+}
+
+char *MobiDoc::GetHtmlData(size_t& lenOut)
+{
+    return GetHtmlDataPrefix((size_t)-1, lenOut);
 }
 
-char *MobiDoc::GetHtmlData(size_t& lenOut) const
+size_t MobiDoc::GetHtmlDataSize()
 {
-    lenOut = doc->Size();
-    return doc->Get();
+    size_t len;
+    GetHtmlData(len);
+    return len;
 }
 
 WCHAR *MobiDoc::GetProperty(DocumentProperty prop)
@@ -849,16 +1096,52 @@ WCHAR *MobiDoc::GetProperty(DocumentProperty prop)
     return NULL;
 }
 
+// returns true if the token at s is followed by a complete tag (text runs
+// end at the next '<' and tags end at the latest at the following '>')
+static bool HasCompleteToken(const char *s, const char *end)
+{
+    const char *tagStart = (const char *)memchr(s, '<', end - s);
+    return tagStart && memchr(tagStart, '>', end - tagStart);
+}
+
+// returns the parser's next token after making sure that it has been
+// decompressed completely (parser must have been created for data
+// returned by GetHtmlDataPrefix and isComplete must initially be false)
+HtmlToken *MobiDoc::NextHtmlToken(HtmlPullParser *parser, bool& isComplete)
+{
+    if (isComplete)
+        return parser->Next();
+
+    size_t off = parser->CurrPosOff();
+    while (parser->Len() < off + kTextLookahead ||
+           !HasCompleteToken(parser->Start() + off, parser->Start() + parser->Len())) {
+        size_t len;
+        // decompress at least one more record per iteration
+        size_t minLen = max(off + kTextLookahead, parser->Len() + 1);
+        const char *data = GetHtmlDataPrefix(minLen, len, &isComplete);
+        parser->ExtendData(data, len);
+        if (isComplete)
+            break;
+    }
+    return parser->Next();
+}
+
 bool MobiDoc::HasToc()
 {
+    // note: filepos values are offsets into the uncompressed text (before conversion to UTF-8)
     if (docTocIndex != (size_t)-1)
-        return docTocIndex < doc->Size();
-    docTocIndex = doc->Size(); // no ToC
-
-    // search for <reference type=toc filepos=\d+/>
-    HtmlPullParser parser(doc->Get(), doc->Size());
+        return docTocIndex != (size_t)-2;
+
+    // search for <reference type=toc filepos=\d+/> (these are part of the
+    // <guide> in the <head>, so there's no need to decompress any further)
+    size_t len;
+    bool isComplete = false;
+    const char *data = GetHtmlDataPrefix(0, len, &isComplete);
+    HtmlPullParser parser(data, len);
     HtmlToken *tok;
-    while ((tok = parser.Next()) != NULL && !tok->IsError()) {
+    while ((tok = NextHtmlToken(&parser, isComplete)) != NULL && !tok->IsError()) {
+        if (tok->IsStartTag() && Tag_Body == tok->tag)
+            break;
         if (!tok->IsStartTag() && !tok->IsEmptyElementEndTag() || !tok->NameIs("reference"))
             continue;
         AttrInfo *attr = tok->GetAttrByName("type");
@@ -871,10 +1154,15 @@ bool MobiDoc::HasToc()
         val.Set(str::conv::FromHtmlUtf8(attr->val, attr->valLen));
         unsigned int pos;
         if (str::Parse(val, L"%u%$", &pos)) {
-            docTocIndex = pos;
-            return docTocIndex < doc->Size();
+            // the ToC is only valid if it lies within the text (checking against
+            // the header's size instead of decompressing everything up to pos;
+            // ParseToc fails if the text turns out to be shorter)
+            size_t textSize = min(docUncompressedSize, docRecCount * kMaxTextRecordSize);
+            docTocIndex = pos < textSize ? pos : (size_t)-2;
+            return pos < textSize;
         }
     }
+    docTocIndex = (size_t)-2; // no ToC
     return false;
 }
 
@@ -889,9 +1177,16 @@ bool MobiDoc::ParseToc(EbookTocVisitor *visitor)
 
     // there doesn't seem to be a standard for Mobi ToCs, so we try to
     // determine the author's intentions by looking at commonly used tags
-    HtmlPullParser parser(doc->Get() + docTocIndex, doc->Size() - docTocIndex);
+    // (only decompressing text up to the end of the ToC)
+    size_t len;
+    bool isComplete = false;
+    const char *data = GetHtmlDataPrefix(docTocIndex + kTextLookahead, len, &isComplete);
+    if (docTocIndex >= len)
+        return false;
+    HtmlPullParser parser(data, len);
+    parser.SetCurrPosOff(docTocIndex);
     HtmlToken *tok;
-    while ((tok = parser.Next()) != NULL && !tok->IsError()) {
+    while ((tok = NextHtmlToken(&parser, isComplete)) != NULL && !tok->IsError()) {
         if (itemLink && tok->IsText()) {
             ScopedMem<WCHAR> linkText(str::conv::FromHtmlUtf8(tok->s, tok->sLen));
             if (itemText)
@@ -7,7 +7,9 @@
 #include "BaseEngine.h"
 
 class EbookTocVisitor;
+class HtmlPullParser;
 class HuffDicDecompressor;
+struct HtmlToken;
 class PdbReader;
 struct ImageData;
 
@@ -35,6 +37,16 @@ class MobiDoc
 
     HuffDicDecompressor *huffDic;
 
+    // text records are only decompressed when their text is needed
+    // (the buffer is reallocated as needed, but old buffers are kept
+    // alive since laid out pages point into them)
+    CRITICAL_SECTION    textAccess;
+    char *              text;
+    size_t              textLen;
+    size_t              textCap;
+    size_t              nextTextRec;
+    Vec<char *>         retiredText;
+
     struct Metadata {
         DocumentProperty    prop;
         char *              value;
@@ -44,21 +56,30 @@ class MobiDoc
     explicit MobiDoc(const WCHAR *filePath);
 
     bool    ParseHeader();
-    bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut);
+    bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut, bool useReferenceDecoder=false);
+    bool    DecompressText(size_t minLen);
+    void    AppendText(str::Str<char>& data);
     void    LoadImages();
     bool    LoadImage(size_t imageNo);
     bool    LoadDocument(PdbReader *pdbReader);
     bool    DecodeExthHeader(const char *data, size_t dataLen);
 
 public:
-    str::Str<char> *    doc;
-
     size_t              imagesCount;
 
     ~MobiDoc();
 
-    char *              GetHtmlData(size_t& lenOut) const;
-    size_t              GetHtmlDataSize() const { return doc->Size(); }
+    // decompresses the whole text (if it hasn't been already)
+    char *              GetHtmlData(size_t& lenOut);
+    size_t              GetHtmlDataSize();
+    // decompresses only as much text as needed for at least minLen bytes
+    // (returned data stays valid even after more text has been decompressed)
+    char *              GetHtmlDataPrefix(size_t minLen, size_t& lenOut, bool *isCompleteOut=NULL);
+    HtmlToken *         NextHtmlToken(HtmlPullParser *parser, bool& isComplete);
+    // for testing and benchmarking the HuffDic decoder
+    bool                DecompressHuffDicRecords(str::Str<char>& dst, bool useReferenceDecoder=false);
+    // for testing: how many text records have been decompressed so far
+    size_t              GetDecompressedRecordCount() const { return nextTextRec - 1; }
     ImageData *         GetCoverImage();
     ImageData *         GetImage(size_t imgRecIndex) const;
     const WCHAR *       GetFileName() const { return fileName; }
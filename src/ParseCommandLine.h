@@ -13,7 +13,9 @@ public:
     // - name of the file to benchmark
     // - optional (NULL if not available) string that represents which pages
     //   to benchmark. It can also be a string "loadonly" which means we'll
-    //   only benchmark loading of the catalog
+    //   only benchmark loading of the catalog, "tiles" which means we'll
+    //   benchmark tile rendering throughput for an increasing number of threads
+    //   or "text" which does the same for text extraction
     WStrVec     pathsToBenchmark;
     bool        makeDefault;
     bool        exitWhenDone;
@@ -352,6 +352,7 @@ bool PdfCreator::RenderToFile(const WCHAR *pdfFileName, BaseEngine *engine, int
     bool ok = true;
     // render all pages to images
     float zoom = dpi / engine->GetFileDPI();
+    engine->WaitForPages(INT_MAX);
     for (int i = 1; ok && i <= engine->PageCount(); i++) {
         RenderedBitmap *bmp = engine->RenderBitmap(i, zoom, 0, NULL, Target_Export);
         if (bmp)
@@ -15,6 +15,9 @@ extern "C" {
 #include "ArchUtil.h"
 #include "FileUtil.h"
 #include "HtmlPullParser.h"
+#include "MemoryBudget.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -25,12 +28,27 @@ extern "C" {
 #define MAX_MEMORY_FILE_SIZE (10 * 1024 * 1024)
 
 // number of page content trees to cache for quicker rendering
-#define MAX_PAGE_RUN_CACHE  8
-// maximum estimated memory requirement allowed for the run cache of one document
-#define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// (how much memory they may use is up to the shared memory budget)
+#define MAX_PAGE_RUN_CACHE  16
 
-// maximum amount of memory that MuPDF should use per fz_context store
-#define MAX_CONTEXT_MEMORY  (256 * 1024 * 1024)
+// maximum amount of memory that MuPDF should use for caching rendered glyphs
+// (MuPDF's default of 1 MB is too small for text-heavy documents at larger zoom levels)
+#define MAX_GLYPH_CACHE_MEMORY  (16 * 1024 * 1024)
+
+// large renderings are split into horizontal bands of at least
+// MIN_RENDER_BAND_PIXELS which are rendered on separate threads
+// (at most one per processor and never more than MAX_RENDER_BANDS)
+#define MAX_RENDER_BANDS        8
+#define MIN_RENDER_BAND_PIXELS  (1024 * 1024)
+
+enum BandRenderResult { Bands_NotUsed, Bands_Rendered, Bands_Failed };
+
+// documents with at least MIN_PRELOAD_OBJ_STMS object streams have them
+// inflated on up to MAX_PRELOAD_THREADS threads right after loading the xref
+// (keeping at most 1/PRELOAD_BUDGET_SHARE of the memory budget inflated)
+#define MAX_PRELOAD_THREADS     8
+#define MIN_PRELOAD_OBJ_STMS    32
+#define PRELOAD_BUDGET_SHARE    8
 
 // normally, GDI+ is mainly used for zoom levels above 4000% and for
 // rendering directly into an HDC; if gDebugGdiPlusDevice is true,
@@ -626,12 +644,11 @@ struct FitzImagePos {
 struct ListInspectionData {
     Vec<FitzImagePos> *images;
     bool req_t3_fonts;
-    size_t mem_estimate;
     size_t path_len;
     size_t clip_path_len;
 
     explicit ListInspectionData(Vec<FitzImagePos>& images) : images(&images),
-        req_t3_fonts(false), mem_estimate(0), path_len(0), clip_path_len(0) { }
+        req_t3_fonts(false), path_len(0), clip_path_len(0) { }
 };
 
 extern "C" static void
@@ -650,18 +667,12 @@ static void fz_inspection_handle_path(fz_device *dev, fz_path *path, bool clippi
         data->path_len += path->cmd_len + path->coord_len;
     else
         data->clip_path_len += path->cmd_len + path->coord_len;
-    data->mem_estimate += sizeof(fz_path) + path->cmd_cap + path->coord_cap * sizeof(float);
 }
 
 static void fz_inspection_handle_text(fz_device *dev, fz_text *text)
 {
-    ((ListInspectionData *)dev->user)->req_t3_fonts = text->font->t3procs != NULL;
-}
-
-static void fz_inspection_handle_image(fz_device *dev, fz_image *image)
-{
-    int n = image->colorspace ? image->colorspace->n + 1 : 1;
-    ((ListInspectionData *)dev->user)->mem_estimate += sizeof(fz_image) + image->w * image->h * n;
+    if (text->font->t3procs)
+        ((ListInspectionData *)dev->user)->req_t3_fonts = true;
 }
 
 extern "C" static void
@@ -712,16 +723,9 @@ fz_inspection_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *s
     fz_inspection_handle_text(dev, text);
 }
 
-extern "C" static void
-fz_inspection_fill_shade(fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha)
-{
-    ((ListInspectionData *)dev->user)->mem_estimate += sizeof(fz_shade);
-}
-
 extern "C" static void
 fz_inspection_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
 {
-    fz_inspection_handle_image(dev, image);
     // extract rectangles for images a user might want to extract
     // TODO: try to better distinguish images a user might actually want to extract
     if (image->w < 16 || image->h < 16)
@@ -732,18 +736,6 @@ fz_inspection_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm,
         ((ListInspectionData *)dev->user)->images->Append(FitzImagePos(image, rect));
 }
 
-extern "C" static void
-fz_inspection_fill_image_mask(fz_device *dev, fz_image *image, const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
-{
-    fz_inspection_handle_image(dev, image);
-}
-
-extern "C" static void
-fz_inspection_clip_image_mask(fz_device *dev, fz_image *image, const fz_rect *rect, const fz_matrix *ctm)
-{
-    fz_inspection_handle_image(dev, image);
-}
-
 static fz_device *fz_new_inspection_device(fz_context *ctx, ListInspectionData *data)
 {
     fz_device *dev = fz_new_device(ctx, data);
@@ -759,10 +751,7 @@ static fz_device *fz_new_inspection_device(fz_context *ctx, ListInspectionData *
     dev->clip_text = fz_inspection_clip_text;
     dev->clip_stroke_text = fz_inspection_clip_stroke_text;
 
-    dev->fill_shade = fz_inspection_fill_shade;
     dev->fill_image = fz_inspection_fill_image;
-    dev->fill_image_mask = fz_inspection_fill_image_mask;
-    dev->clip_image_mask = fz_inspection_clip_image_mask;
 
     return dev;
 }
@@ -770,10 +759,105 @@ static fz_device *fz_new_inspection_device(fz_context *ctx, ListInspectionData *
 class FitzAbortCookie : public AbortCookie {
 public:
     fz_cookie cookie;
-    FitzAbortCookie() { memset(&cookie, 0, sizeof(cookie)); }
-    virtual void Abort() { cookie.abort = 1; }
+    // signaled on Abort so that threads rendering in bands can be
+    // aborted without polling (cf. PdfEngineImpl::RunPageListInBands)
+    HANDLE aborted;
+    FitzAbortCookie() : aborted(CreateEvent(NULL, TRUE, FALSE, NULL)) { memset(&cookie, 0, sizeof(cookie)); }
+    virtual ~FitzAbortCookie() { if (aborted) CloseHandle(aborted); }
+    virtual void Abort() {
+        cookie.abort = 1;
+        if (aborted)
+            SetEvent(aborted);
+    }
 };
 
+// memory accounting shared by PdfEngineImpl and XpsEngineImpl which both cache
+// page runs in runCache (guarded by pagesAccess) and keep resources and glyphs
+// in ctx's store and glyph cache (guarded by ctxAccess and shared with all clones).
+// doc is only passed for PDF documents which might hold preloaded object streams
+
+// reports how much memory engine uses to the memory budget
+template <typename PageRun>
+static void UpdateFitzMemoryUsage(MemoryConsumer *engine, Vec<PageRun *>& runCache, CRITICAL_SECTION *pagesAccess,
+                                  CRITICAL_SECTION *ctxAccess, fz_context *ctx, pdf_document *doc=NULL)
+{
+    ScopedCritSec scope(pagesAccess);
+    size_t runsSize = 0;
+    for (size_t i = 0; i < runCache.Count(); i++) {
+        runsSize += runCache.At(i)->size;
+    }
+    size_t preloadSize = 0;
+    if (doc) {
+        ScopedCritSec ctxScope(ctxAccess);
+        preloadSize = pdf_preloaded_obj_stms_size(doc);
+    }
+    membudget::Update(engine, Mem_PageRuns, runsSize);
+    membudget::Update(engine, Mem_Resources, fz_store_size(ctx) + preloadSize);
+    membudget::Update(engine, Mem_Glyphs, fz_glyph_cache_size(ctx));
+}
+
+// must be called without holding pagesAccess or ctxAccess
+template <typename PageRun>
+static void EnforceFitzMemoryBudget(MemoryConsumer *engine, Vec<PageRun *>& runCache, CRITICAL_SECTION *pagesAccess,
+                                    CRITICAL_SECTION *ctxAccess, fz_context *ctx, pdf_document *doc=NULL)
+{
+    UpdateFitzMemoryUsage(engine, runCache, pagesAccess, ctxAccess, ctx, doc);
+    membudget::Enforce();
+}
+
+// implements MemoryConsumer::FreeMemory
+template <typename PageRun>
+static size_t FreeFitzMemory(MemoryConsumer *engine, Vec<PageRun *>& runCache, CRITICAL_SECTION *pagesAccess,
+                             CRITICAL_SECTION *ctxAccess, fz_context *ctx, pdf_document *doc,
+                             MemoryCategory cat, size_t bytes)
+{
+    // this might be called from any thread, so don't wait for locks
+    if (!TryEnterCriticalSection(pagesAccess))
+        return 0;
+    if (!TryEnterCriticalSection(ctxAccess)) {
+        LeaveCriticalSection(pagesAccess);
+        return 0;
+    }
+
+    size_t freed = 0;
+    switch (cat) {
+    case Mem_PageRuns:
+        // keep the most recently used runs (likely to be rendered again soon)
+        // and the ones currently in use
+        for (size_t i = runCache.Count(); i > 2 && freed < bytes; i--) {
+            PageRun *run = runCache.At(i - 1);
+            if (run->refs == 1) {
+                freed += run->size;
+                runCache.Remove(run);
+                fz_drop_display_list(ctx, run->list);
+                delete run;
+            }
+        }
+        break;
+    case Mem_Resources:
+        if (doc) {
+            // preloaded object streams can always be loaded again on demand
+            freed = pdf_preloaded_obj_stms_size(doc);
+            pdf_drop_preloaded_obj_stms(doc);
+        }
+        if (freed < bytes && fz_store_size(ctx) > 0) {
+            size_t size = fz_store_size(ctx);
+            fz_shrink_store(ctx, size > bytes - freed ? (unsigned int)((size - (bytes - freed)) * 100 / size) : 0);
+            freed += size - std::min(size, (size_t)fz_store_size(ctx));
+        }
+        break;
+    case Mem_Glyphs:
+        freed = fz_glyph_cache_size(ctx);
+        fz_purge_glyph_cache(ctx);
+        break;
+    }
+    UpdateFitzMemoryUsage(engine, runCache, pagesAccess, ctxAccess, ctx, doc);
+
+    LeaveCriticalSection(ctxAccess);
+    LeaveCriticalSection(pagesAccess);
+    return freed;
+}
+
 extern "C" static void
 fz_lock_context_cs(void *user, int lock)
 {
@@ -797,6 +881,23 @@ fz_unlock_context_cs(void *user, int lock)
     LeaveCriticalSection(cs);
 }
 
+extern "C" static void
+fz_lock_context_cs_array(void *user, int lock)
+{
+    // unlike fz_lock_context_cs, this uses a separate critical
+    // section per lock (as required for cloned fz_contexts
+    // which are used outside of ctxAccess)
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    EnterCriticalSection(&locks[lock]);
+}
+
+extern "C" static void
+fz_unlock_context_cs_array(void *user, int lock)
+{
+    CRITICAL_SECTION *locks = (CRITICAL_SECTION *)user;
+    LeaveCriticalSection(&locks[lock]);
+}
+
 static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo)
 {
     Vec<PageAnnotation> result;
@@ -1156,14 +1257,14 @@ tolerate_broken_page_tree:
 struct PdfPageRun {
     pdf_page *page;
     fz_display_list *list;
-    size_t size_est;
+    size_t size; // memory used by list
     bool req_t3_fonts;
     size_t path_len;
     size_t clip_path_len;
     int refs;
 
-    PdfPageRun(pdf_page *page, fz_display_list *list, ListInspectionData& data) :
-        page(page), list(list), size_est(data.mem_estimate), req_t3_fonts(data.req_t3_fonts),
+    PdfPageRun(pdf_page *page, fz_display_list *list, size_t size, ListInspectionData& data) :
+        page(page), list(list), size(size), req_t3_fonts(data.req_t3_fonts),
         path_len(data.path_len), clip_path_len(data.clip_path_len), refs(1) { }
 };
 
@@ -1171,7 +1272,7 @@ class PdfTocItem;
 class PdfLink;
 class PdfImage;
 
-class PdfEngineImpl : public BaseEngine {
+class PdfEngineImpl : public BaseEngine, public MemoryConsumer {
     friend PdfLink;
     friend PdfImage;
 
@@ -1179,6 +1280,7 @@ public:
     PdfEngineImpl();
     virtual ~PdfEngineImpl();
     virtual BaseEngine *Clone();
+    virtual bool SupportsParallelTextExtraction() const { return true; }
 
     virtual const WCHAR *FileName() const { return _fileName; };
     virtual int PageCount() const {
@@ -1243,9 +1345,14 @@ public:
     virtual bool IsPasswordProtected() const { return isProtected; }
     virtual char *GetDecryptionKey() const;
 
+    virtual size_t FreeMemory(MemoryCategory cat, size_t bytes);
+
     static BaseEngine *CreateFromFile(const WCHAR *fileName, PasswordUI *pwdUI);
     static BaseEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI);
 
+    bool BenchLexer(int iterations, size_t *tokensOut, size_t *bytesOut, double *bestMsOut);
+    bool BenchDisplayLists(int iterations, size_t *listBytesOut, double *recordMsOut, double *bestReplayMsOut);
+
 protected:
     WCHAR *_fileName;
     char *_decryptionKey;
@@ -1255,8 +1362,11 @@ protected:
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
+    CRITICAL_SECTION ctxLocks[FZ_LOCK_MAX];
     fz_locks_context fz_locks_ctx;
     pdf_document *  _doc;
+    // unused clones of ctx (protected by ctxAccess)
+    Vec<fz_context *> ctxClones;
 
     CRITICAL_SECTION pagesAccess;
     pdf_page **     _pages;
@@ -1267,6 +1377,7 @@ protected:
     bool            Load(fz_stream *stm, PasswordUI *pwdUI=NULL);
     bool            LoadFromStream(fz_stream *stm, PasswordUI *pwdUI=NULL);
     bool            FinishLoading();
+    void            PreloadObjectStreams();
 
     pdf_page      * GetPdfPage(int pageNo, bool failIfBusy=false);
     int             GetPageNo(pdf_page *page);
@@ -1292,7 +1403,23 @@ protected:
                             RenderTarget target=Target_View,
                             const fz_rect *cliprect=NULL, bool cacheRun=true,
                             FitzAbortCookie *cookie=NULL);
+    bool            RunPageList(PdfPageRun *run, pdf_page *page, fz_device *dev, const fz_matrix *ctm,
+                                const fz_rect *cliprect, FitzAbortCookie *cookie);
     void            DropPageRun(PdfPageRun *run, bool forceRemove=false);
+    void            UpdateMemoryUsage();
+    void            EnforceMemoryBudget();
+
+    BandRenderResult RunPageListInBands(PdfPageRun *run, pdf_page *page, fz_pixmap *image,
+                                       const fz_matrix *ctm, FitzAbortCookie *cookie);
+    static DWORD WINAPI RenderBandThread(LPVOID data);
+
+    fz_context    * AcquireRunContext(pdf_page *page, RenderTarget target, bool cacheRun, PdfPageRun **run);
+    void            ReleaseRunContext(fz_context *runCtx, PdfPageRun *run);
+    fz_context    * GetContextClone();
+    void            ReleaseContextClone(fz_context *clone);
+    // ctxAccess is only required when using ctx itself (and not a clone)
+    void            LockContext(fz_context *c) { if (c == ctx) EnterCriticalSection(&ctxAccess); }
+    void            UnlockContext(fz_context *c) { if (c == ctx) LeaveCriticalSection(&ctxAccess); }
 
     PdfTocItem    * BuildTocTree(fz_outline *entry, int& idCounter);
     void            LinkifyPageText(pdf_page *page);
@@ -1398,18 +1525,28 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
 {
     InitializeCriticalSection(&pagesAccess);
     InitializeCriticalSection(&ctxAccess);
+    for (int i = 0; i < dimof(ctxLocks); i++) {
+        InitializeCriticalSection(&ctxLocks[i]);
+    }
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    fz_locks_ctx.user = ctxLocks;
+    fz_locks_ctx.lock = fz_lock_context_cs_array;
+    fz_locks_ctx.unlock = fz_unlock_context_cs_array;
+    // the store is only limited by the shared memory budget (its size is reported
+    // as Mem_Resources so that membudget::Enforce evicts from it as needed)
+    ctx = fz_new_context(NULL, &fz_locks_ctx, (unsigned int)membudget::GetLimit());
 
-    if (ctx)
+    if (ctx) {
+        fz_set_glyph_cache_limit(ctx, MAX_GLYPH_CACHE_MEMORY);
         pdf_install_load_system_font_funcs(ctx);
+    }
+    membudget::Register(this);
 }
 
 PdfEngineImpl::~PdfEngineImpl()
 {
+    membudget::Unregister(this);
+
     EnterCriticalSection(&pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -1450,6 +1587,9 @@ PdfEngineImpl::~PdfEngineImpl()
 
     pdf_close_document(_doc);
     _doc = NULL;
+    for (size_t i = 0; i < ctxClones.Count(); i++) {
+        fz_free_context(ctxClones.At(i));
+    }
     fz_free_context(ctx);
     ctx = NULL;
 
@@ -1458,6 +1598,9 @@ PdfEngineImpl::~PdfEngineImpl()
     free(_fileName);
     free(_decryptionKey);
 
+    for (int i = 0; i < dimof(ctxLocks); i++) {
+        DeleteCriticalSection(&ctxLocks[i]);
+    }
     LeaveCriticalSection(&ctxAccess);
     DeleteCriticalSection(&ctxAccess);
     LeaveCriticalSection(&pagesAccess);
@@ -1678,8 +1821,80 @@ bool PdfEngineImpl::LoadFromStream(fz_stream *stm, PasswordUI *pwdUI)
     return ok;
 }
 
+struct PdfObjStmPreload {
+    pdf_obj_stm_preload *preload;
+    fz_context *ctx;
+    LONG *nextIdx;
+};
+
+static DWORD WINAPI InflateObjStmsThread(LPVOID data)
+{
+    PdfObjStmPreload *job = (PdfObjStmPreload *)data;
+    int count = pdf_count_obj_stm_preload(job->preload);
+    for (int i = InterlockedIncrement(job->nextIdx) - 1; i < count; i = InterlockedIncrement(job->nextIdx) - 1) {
+        pdf_inflate_obj_stm_preload(job->ctx, job->preload, i);
+    }
+    return 0;
+}
+
+// inflates all object streams of large documents concurrently (each thread
+// using its own clone of ctx) so that the page tree can afterwards be walked
+// without stalling on every object stream; the inflated data is kept by the
+// document and only parsed when an object is first accessed (parsing isn't
+// thread-safe and parsing all objects up front would cost more than it saves)
+void PdfEngineImpl::PreloadObjectStreams()
+{
+    int threadCount = std::min(GetProcessorCount(), MAX_PRELOAD_THREADS);
+    if (threadCount < 2)
+        return;
+
+    pdf_obj_stm_preload *preload = NULL;
+    fz_try(ctx) {
+        preload = pdf_new_obj_stm_preload(_doc, MIN_PRELOAD_OBJ_STMS, membudget::GetLimit() / PRELOAD_BUDGET_SHARE);
+    }
+    fz_catch(ctx) {
+        return;
+    }
+    if (!preload)
+        return;
+
+    PdfObjStmPreload jobs[MAX_PRELOAD_THREADS] = { 0 };
+    HANDLE threads[MAX_PRELOAD_THREADS] = { 0 };
+    LONG nextIdx = 0;
+
+    // inflate on the current thread and on temporary threads (as long as
+    // creating them succeeds) which all pick the next object stream to inflate
+    jobs[0].preload = preload;
+    jobs[0].ctx = ctx;
+    jobs[0].nextIdx = &nextIdx;
+    for (int i = 1; i < threadCount; i++) {
+        jobs[i] = jobs[0];
+        jobs[i].ctx = GetContextClone();
+        if (!jobs[i].ctx)
+            break;
+        threads[i] = CreateThread(NULL, 0, InflateObjStmsThread, &jobs[i], 0, 0);
+        if (!threads[i])
+            break;
+    }
+    InflateObjStmsThread(&jobs[0]);
+    for (int i = 1; i < threadCount; i++) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+        if (jobs[i].ctx)
+            ReleaseContextClone(jobs[i].ctx);
+    }
+
+    pdf_finish_obj_stm_preload(preload);
+    // the inflated data counts as resources until it's been parsed
+    EnforceMemoryBudget();
+}
+
 bool PdfEngineImpl::FinishLoading()
 {
+    PreloadObjectStreams();
+
     fz_try(ctx) {
         // this call might throw the first time
         pdf_count_pages(_doc);
@@ -1906,7 +2121,7 @@ PdfPageRun *PdfEngineImpl::CreatePageRun(pdf_page *page, fz_display_list *list)
         }
     }
 
-    return new PdfPageRun(page, list, data);
+    return new PdfPageRun(page, list, fz_display_list_size(ctx, list), data);
 }
 
 PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
@@ -1922,15 +2137,6 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
         }
     }
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
         if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
             assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
             DropPageRun(runCache.Last(), true);
@@ -1969,52 +2175,397 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
     return result;
 }
 
-bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm, RenderTarget target, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
+// returns a clone of ctx if the page's cached display list can be run
+// without holding ctxAccess (*run then holds a reference to that list)
+// or ctx itself if the page has to be run under ctxAccess (*run is NULL)
+fz_context *PdfEngineImpl::AcquireRunContext(pdf_page *page, RenderTarget target, bool cacheRun, PdfPageRun **run)
 {
-    bool ok = true;
+    *run = NULL;
+    if (Target_View != target)
+        return ctx;
 
-    PdfPageRun *run;
-    if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != NULL) {
-        EnterCriticalSection(&ctxAccess);
-        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
+    PdfPageRun *pageRun = GetPageRun(page, !cacheRun);
+    if (!pageRun)
+        return ctx;
+    // Type 3 glyphs which aren't cached are run from the document
+    if (pageRun->req_t3_fonts) {
+        DropPageRun(pageRun);
+        return ctx;
+    }
+
+    fz_context *runCtx = GetContextClone();
+    if (!runCtx) {
+        DropPageRun(pageRun);
+        return ctx;
+    }
+    *run = pageRun;
+    return runCtx;
+}
+
+void PdfEngineImpl::ReleaseRunContext(fz_context *runCtx, PdfPageRun *run)
+{
+    if (run)
+        DropPageRun(run);
+    if (runCtx != ctx)
+        ReleaseContextClone(runCtx);
+}
+
+fz_context *PdfEngineImpl::GetContextClone()
+{
+    ScopedCritSec scope(&ctxAccess);
+    if (ctxClones.Count() > 0)
+        return ctxClones.Pop();
+    return fz_clone_context(ctx);
+}
+
+void PdfEngineImpl::ReleaseContextClone(fz_context *clone)
+{
+    ScopedCritSec scope(&ctxAccess);
+    ctxClones.Append(clone);
+}
+
+// tokenizes the content streams of all pages (which are first loaded into
+// memory so that only the lexer is timed); returns the number of tokens
+// and bytes per iteration and the time of the fastest iteration
+bool PdfEngineImpl::BenchLexer(int iterations, size_t *tokensOut, size_t *bytesOut, double *bestMsOut)
+{
+    ScopedCritSec scope(&ctxAccess);
+
+    Vec<fz_buffer *> streams;
+    size_t bytes = 0;
+    for (int i = 0; i < PageCount(); i++) {
+        fz_stream *stm = NULL;
+        fz_var(stm);
         fz_try(ctx) {
-            fz_rect pagerect;
-            fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
-            fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
-            fz_run_display_list(run->list, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
-            fz_run_page_transparency(pageAnnots, dev, cliprect, true, page->transparency);
-            fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
-            fz_end_page(dev);
+            stm = pdf_open_contents_stream(_doc, pdf_dict_gets(_pageObjs[i], "Contents"));
+            fz_buffer *buf = fz_read_all(stm, 0);
+            streams.Append(buf);
+            bytes += buf->len;
+        }
+        fz_always(ctx) {
+            fz_close(stm);
         }
         fz_catch(ctx) {
-            ok = false;
+            fz_warn(ctx, "Couldn't load the content stream of page %d", i + 1);
         }
-        LeaveCriticalSection(&ctxAccess);
-        DropPageRun(run);
     }
-    else {
-        ScopedCritSec scope(&ctxAccess);
-        char *targetName = target == Target_Print ? "Print" :
-                           target == Target_Export ? "Export" : "View";
-        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
+
+    pdf_lexbuf lexbuf;
+    pdf_lexbuf_init(ctx, &lexbuf, PDF_LEXBUF_SMALL);
+    size_t tokens = 0;
+    double bestMs = 0;
+    bool ok = true;
+    fz_var(tokens);
+    for (int i = 0; i < iterations && ok; i++) {
+        Timer t;
+        tokens = 0;
+        for (size_t j = 0; j < streams.Count() && ok; j++) {
+            fz_stream *stm = NULL;
+            fz_var(stm);
+            fz_try(ctx) {
+                stm = fz_open_buffer(ctx, streams.At(j));
+                while (pdf_lex(stm, &lexbuf) != PDF_TOK_EOF) {
+                    tokens++;
+                }
+            }
+            fz_always(ctx) {
+                fz_close(stm);
+            }
+            fz_catch(ctx) {
+                ok = false;
+            }
+        }
+        double timeMs = t.Stop();
+        if (0 == i || timeMs < bestMs)
+            bestMs = timeMs;
+    }
+    pdf_lexbuf_fin(&lexbuf);
+
+    for (size_t i = 0; i < streams.Count(); i++) {
+        fz_drop_buffer(ctx, streams.At(i));
+    }
+
+    *tokensOut = tokens;
+    *bytesOut = bytes;
+    *bestMsOut = bestMs;
+    return ok;
+}
+
+bool PdfEngineImpl::BenchDisplayLists(int iterations, size_t *listBytesOut, double *recordMsOut, double *bestReplayMsOut)
+{
+    // load all pages first (GetPdfPage acquires pagesAccess before ctxAccess)
+    for (int i = 1; i <= PageCount(); i++) {
+        GetPdfPage(i);
+    }
+
+    ScopedCritSec scope(&ctxAccess);
+
+    Vec<fz_display_list *> lists;
+    size_t listBytes = 0;
+    bool ok = true;
+    Timer t;
+    for (int i = 0; i < PageCount(); i++) {
+        if (!_pages[i])
+            continue;
+        fz_display_list *list = NULL;
+        fz_device *dev = NULL;
+        fz_var(list);
+        fz_var(dev);
         fz_try(ctx) {
-            fz_rect pagerect;
-            fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
-            fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
-            pdf_run_page_with_usage(_doc, page, dev, ctm, targetName, cookie ? &cookie->cookie : NULL);
-            fz_run_page_transparency(pageAnnots, dev, cliprect, true, page->transparency);
-            fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
-            fz_end_page(dev);
+            list = fz_new_display_list(ctx);
+            dev = fz_new_list_device(ctx, list);
+            pdf_run_page(_doc, _pages[i], dev, &fz_identity, NULL);
+            listBytes += fz_display_list_size(ctx, list);
+            lists.Append(list);
         }
         fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            ok = false;
+        }
+        fz_free_device(dev);
+    }
+    double recordMs = t.Stop();
+
+    // replaying into a bbox device measures the cost of walking the lists
+    // rather than that of rendering
+    double bestMs = 0;
+    for (int i = 0; i < iterations && ok; i++) {
+        t.Start();
+        for (size_t j = 0; j < lists.Count() && ok; j++) {
+            fz_rect bbox = fz_empty_rect;
+            fz_device *dev = NULL;
+            fz_var(dev);
+            fz_try(ctx) {
+                dev = fz_new_bbox_device(ctx, &bbox);
+                fz_run_display_list(lists.At(j), dev, &fz_identity, NULL, NULL);
+            }
+            fz_catch(ctx) {
+                ok = false;
+            }
+            fz_free_device(dev);
+        }
+        double timeMs = t.Stop();
+        if (0 == i || timeMs < bestMs)
+            bestMs = timeMs;
+    }
+
+    for (size_t i = 0; i < lists.Count(); i++) {
+        fz_drop_display_list(ctx, lists.At(i));
+    }
+
+    *listBytesOut = listBytes;
+    *recordMsOut = recordMs;
+    *bestReplayMsOut = bestMs;
+    return ok;
+}
+
+struct PdfRenderBand {
+    PdfEngineImpl *engine;
+    PdfPageRun *run;
+    pdf_page *page;
+    fz_device *dev;
+    const fz_matrix *ctm;
+    fz_rect cliprect;
+    // each band has its own cookie (fz_cookie isn't synchronized)
+    FitzAbortCookie cookie;
+    bool ok;
+};
+
+DWORD WINAPI PdfEngineImpl::RenderBandThread(LPVOID data)
+{
+    PdfRenderBand *band = (PdfRenderBand *)data;
+    band->ok = band->engine->RunPageList(band->run, band->page, band->dev, band->ctm, &band->cliprect, &band->cookie);
+    return 0;
+}
+
+// renders a page's cached display list into image by splitting it into
+// horizontal bands which are rendered concurrently (each on its own clone
+// of ctx into a pixmap sharing image's samples). Returns Bands_NotUsed if
+// the image is too small for this to be worthwhile or the bands couldn't
+// be set up (in which case image hasn't been touched) and Bands_Failed if
+// rendering failed or was aborted (in which case image is incomplete)
+BandRenderResult PdfEngineImpl::RunPageListInBands(PdfPageRun *run, pdf_page *page, fz_pixmap *image, const fz_matrix *ctm, FitzAbortCookie *cookie)
+{
+    int bandCount = std::min(GetProcessorCount(), MAX_RENDER_BANDS);
+    bandCount = std::min(bandCount, (int)((size_t)image->w * image->h / MIN_RENDER_BAND_PIXELS));
+    bandCount = std::min(bandCount, image->h);
+    if (bandCount < 2)
+        return Bands_NotUsed;
+
+    PdfRenderBand bands[MAX_RENDER_BANDS];
+    fz_context *bandCtxs[MAX_RENDER_BANDS] = { 0 };
+    fz_pixmap *bandImages[MAX_RENDER_BANDS] = { 0 };
+    HANDLE threads[MAX_RENDER_BANDS] = { 0 };
+
+    bool ok = true;
+    int readyCount = 0;
+    for (int i = 0; i < bandCount; i++) {
+        fz_irect bbox;
+        bbox.x0 = image->x;
+        bbox.x1 = image->x + image->w;
+        bbox.y0 = image->y + image->h * i / bandCount;
+        bbox.y1 = image->y + image->h * (i + 1) / bandCount;
+        unsigned char *samples = image->samples + (size_t)(bbox.y0 - image->y) * image->w * image->n;
+
+        bandCtxs[i] = GetContextClone();
+        if (!bandCtxs[i]) {
+            ok = false;
+            break;
+        }
+        fz_context *bandCtx = bandCtxs[i];
+        fz_device *dev = NULL;
+        fz_try(bandCtx) {
+            bandImages[i] = fz_new_pixmap_with_bbox_and_data(bandCtx, image->colorspace, &bbox, samples);
+            dev = fz_new_draw_device(bandCtx, bandImages[i]);
+        }
+        fz_catch(bandCtx) {
             ok = false;
+            break;
+        }
+
+        PdfRenderBand *band = &bands[i];
+        band->engine = this;
+        band->run = run;
+        band->page = page;
+        band->dev = dev;
+        band->ctm = ctm;
+        fz_rect_from_irect(&band->cliprect, &bbox);
+        band->ok = false;
+        readyCount++;
+    }
+
+    BandRenderResult result = Bands_NotUsed;
+    if (ok) {
+        // all bands are rendered on temporary threads while this thread
+        // forwards an abort request to them (a band is rendered directly
+        // if its thread can't be created)
+        int threadCount = 0;
+        for (int i = 0; i < bandCount; i++) {
+            threads[threadCount] = CreateThread(NULL, 0, RenderBandThread, &bands[i], 0, 0);
+            if (threads[threadCount])
+                threadCount++;
+            else
+                RenderBandThread(&bands[i]);
+        }
+        // wait for the threads still running (and the abort event, if it
+        // hasn't been signaled yet) instead of polling for an abort request
+        HANDLE waitFor[MAX_RENDER_BANDS + 1];
+        memcpy(waitFor, threads, sizeof(HANDLE) * threadCount);
+        int running = threadCount;
+        bool aborted = false;
+        while (running > 0) {
+            int waitCount = running;
+            if (!aborted && cookie && cookie->aborted)
+                waitFor[waitCount++] = cookie->aborted;
+            DWORD idx = WaitForMultipleObjects(waitCount, waitFor, FALSE, INFINITE) - WAIT_OBJECT_0;
+            if (idx >= (DWORD)waitCount) {
+                // shouldn't happen, but the bands mustn't be freed while in use
+                for (int i = 0; i < running; i++) {
+                    WaitForSingleObject(waitFor[i], INFINITE);
+                }
+                break;
+            }
+            if ((int)idx == running) {
+                for (int j = 0; j < bandCount; j++) {
+                    bands[j].cookie.Abort();
+                }
+                aborted = true;
+            }
+            else
+                waitFor[idx] = waitFor[--running];
+        }
+        for (int i = 0; i < threadCount; i++) {
+            CloseHandle(threads[i]);
+        }
+
+        result = Bands_Rendered;
+        for (int i = 0; i < bandCount; i++) {
+            if (!bands[i].ok)
+                result = Bands_Failed;
+            if (cookie) {
+                cookie->cookie.progress += bands[i].cookie.cookie.progress;
+                cookie->cookie.errors += bands[i].cookie.cookie.errors;
+                if (bands[i].cookie.cookie.incomplete)
+                    cookie->cookie.incomplete = 1;
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < readyCount; i++) {
+            fz_free_device(bands[i].dev);
         }
     }
 
+    for (int i = 0; i < bandCount; i++) {
+        if (bandImages[i])
+            fz_drop_pixmap(bandCtxs[i], bandImages[i]);
+        if (bandCtxs[i])
+            ReleaseContextClone(bandCtxs[i]);
+    }
+
+    return result;
+}
+
+// runs a page's cached display list (outside of ctxAccess,
+// if dev has been created for a clone of ctx) and frees dev
+bool PdfEngineImpl::RunPageList(PdfPageRun *run, pdf_page *page, fz_device *dev, const fz_matrix *ctm, const fz_rect *cliprect, FitzAbortCookie *cookie)
+{
+    fz_context *runCtx = dev->ctx;
+    bool ok = true;
+
     EnterCriticalSection(&ctxAccess);
-    fz_free_device(dev);
+    Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
     LeaveCriticalSection(&ctxAccess);
 
+    LockContext(runCtx);
+    fz_try(runCtx) {
+        fz_rect pagerect;
+        fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
+        fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
+        fz_run_display_list(run->list, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
+        fz_run_page_transparency(pageAnnots, dev, cliprect, true, page->transparency);
+        fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
+        fz_end_page(dev);
+    }
+    fz_catch(runCtx) {
+        ok = false;
+    }
+    fz_free_device(dev);
+    UnlockContext(runCtx);
+
+    return ok && !(cookie && cookie->cookie.abort);
+}
+
+bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm, RenderTarget target, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
+{
+    bool ok = true;
+    CrashIf(dev->ctx != ctx);
+
+    PdfPageRun *run;
+    if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != NULL) {
+        ok = RunPageList(run, page, dev, ctm, cliprect, cookie);
+        DropPageRun(run);
+        return ok;
+    }
+
+    ScopedCritSec scope(&ctxAccess);
+    char *targetName = target == Target_Print ? "Print" :
+                       target == Target_Export ? "Export" : "View";
+    Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
+    fz_try(ctx) {
+        fz_rect pagerect;
+        fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
+        fz_run_page_transparency(pageAnnots, dev, cliprect, false, page->transparency);
+        pdf_run_page_with_usage(_doc, page, dev, ctm, targetName, cookie ? &cookie->cookie : NULL);
+        fz_run_page_transparency(pageAnnots, dev, cliprect, true, page->transparency);
+        fz_run_user_page_annots(pageAnnots, dev, ctm, cliprect, cookie ? &cookie->cookie : NULL);
+        fz_end_page(dev);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    fz_free_device(dev);
+
     return ok && !(cookie && cookie->cookie.abort);
 }
 
@@ -2033,6 +2584,21 @@ void PdfEngineImpl::DropPageRun(PdfPageRun *run, bool forceRemove)
     }
 }
 
+void PdfEngineImpl::UpdateMemoryUsage()
+{
+    UpdateFitzMemoryUsage(this, runCache, &pagesAccess, &ctxAccess, ctx, _doc);
+}
+
+void PdfEngineImpl::EnforceMemoryBudget()
+{
+    EnforceFitzMemoryBudget(this, runCache, &pagesAccess, &ctxAccess, ctx, _doc);
+}
+
+size_t PdfEngineImpl::FreeMemory(MemoryCategory cat, size_t bytes)
+{
+    return FreeFitzMemory(this, runCache, &pagesAccess, &ctxAccess, ctx, _doc, cat, bytes);
+}
+
 RectD PdfEngineImpl::PageMediabox(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
@@ -2177,7 +2743,9 @@ bool PdfEngineImpl::RenderPage(HDC hDC, pdf_page *page, RectI screenRect, const
     FitzAbortCookie *cookie = NULL;
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
-    return RunPage(page, dev, ctm, target, &cliprect, true, cookie);
+    bool ok = RunPage(page, dev, ctm, target, &cliprect, true, cookie);
+    EnforceMemoryBudget();
+    return ok;
 }
 
 // various heuristics for deciding when to use dev_gdiplus instead of fitz/draw
@@ -2250,41 +2818,61 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         return new RenderedBitmap(hbmp, SizeI(w, h), hMap);
     }
 
+    // if possible, render on a clone of ctx so that
+    // other threads don't have to wait for ctxAccess
+    PdfPageRun *run = NULL;
+    fz_context *renderCtx = AcquireRunContext(page, target, true, &run);
+
     fz_pixmap *image = NULL;
-    EnterCriticalSection(&ctxAccess);
-    fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
-        fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
-    }
-    fz_catch(ctx) {
-        LeaveCriticalSection(&ctxAccess);
+    LockContext(renderCtx);
+    fz_try(renderCtx) {
+        fz_colorspace *colorspace = fz_device_rgb(renderCtx);
+        image = fz_new_pixmap_with_bbox(renderCtx, colorspace, &bbox);
+        fz_clear_pixmap_with_value(renderCtx, image, 0xFF); // initialize white background
+    }
+    fz_catch(renderCtx) {
+        UnlockContext(renderCtx);
+        ReleaseRunContext(renderCtx, run);
         return NULL;
     }
 
-    fz_device *dev = NULL;
-    fz_try(ctx) {
-        dev = fz_new_draw_device(ctx, image);
-    }
-    fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
-        LeaveCriticalSection(&ctxAccess);
-        return NULL;
-    }
-    LeaveCriticalSection(&ctxAccess);
+    UnlockContext(renderCtx);
 
     FitzAbortCookie *cookie = NULL;
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
-    fz_rect cliprect;
-    bool ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
+    // bands use draw devices of their own, so only create one for image
+    // if the page isn't rendered in bands
+    BandRenderResult bandResult = run ? RunPageListInBands(run, page, image, &ctm, cookie) : Bands_NotUsed;
+    bool ok = Bands_Rendered == bandResult && !(cookie && cookie->cookie.abort);
+    if (Bands_NotUsed == bandResult) {
+        fz_device *dev = NULL;
+        LockContext(renderCtx);
+        fz_try(renderCtx) {
+            dev = fz_new_draw_device(renderCtx, image);
+        }
+        fz_catch(renderCtx) { }
+        UnlockContext(renderCtx);
 
-    ScopedCritSec scope(&ctxAccess);
+        fz_rect cliprect;
+        fz_rect_from_irect(&cliprect, &bbox);
+        if (!dev)
+            ok = false;
+        else if (run)
+            ok = RunPageList(run, page, dev, &ctm, &cliprect, cookie);
+        else
+            ok = RunPage(page, dev, &ctm, target, &cliprect, true, cookie);
+    }
 
+    LockContext(renderCtx);
     RenderedBitmap *bitmap = NULL;
     if (ok)
-        bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+        bitmap = new_rendered_fz_pixmap(renderCtx, image);
+    fz_drop_pixmap(renderCtx, image);
+    UnlockContext(renderCtx);
+
+    ReleaseRunContext(renderCtx, run);
+    EnforceMemoryBudget();
     return bitmap;
 }
 
@@ -2494,25 +3082,31 @@ WCHAR *PdfEngineImpl::ExtractPageText(pdf_page *page, const WCHAR *lineSep, Rect
     if (!page)
         return NULL;
 
+    // if the page's display list is cached, extract the text on a clone of
+    // ctx so that rendering and text extraction can happen concurrently
+    PdfPageRun *run = NULL;
+    fz_context *textCtx = AcquireRunContext(page, target, cacheRun, &run);
+
     fz_text_sheet *sheet = NULL;
     fz_text_page *text = NULL;
     fz_device *dev = NULL;
     fz_var(sheet);
     fz_var(text);
 
-    EnterCriticalSection(&ctxAccess);
-    fz_try(ctx) {
-        sheet = fz_new_text_sheet(ctx);
-        text = fz_new_text_page(ctx);
-        dev = fz_new_text_device(ctx, sheet, text);
-    }
-    fz_catch(ctx) {
-        fz_free_text_page(ctx, text);
-        fz_free_text_sheet(ctx, sheet);
-        LeaveCriticalSection(&ctxAccess);
+    LockContext(textCtx);
+    fz_try(textCtx) {
+        sheet = fz_new_text_sheet(textCtx);
+        text = fz_new_text_page(textCtx);
+        dev = fz_new_text_device(textCtx, sheet, text);
+    }
+    fz_catch(textCtx) {
+        fz_free_text_page(textCtx, text);
+        fz_free_text_sheet(textCtx, sheet);
+        UnlockContext(textCtx);
+        ReleaseRunContext(textCtx, run);
         return NULL;
     }
-    LeaveCriticalSection(&ctxAccess);
+    UnlockContext(textCtx);
 
     if (!cacheRun)
         fz_enable_device_hints(dev, FZ_NO_CACHE);
@@ -2520,16 +3114,23 @@ WCHAR *PdfEngineImpl::ExtractPageText(pdf_page *page, const WCHAR *lineSep, Rect
     // use an infinite rectangle as bounds (instead of pdf_bound_page) to ensure that
     // the extracted text is consistent between cached runs using a list device and
     // fresh runs (otherwise the list device omits text outside the mediabox bounds)
-    bool ok = RunPage(page, dev, &fz_identity, target, NULL, cacheRun);
-
-    ScopedCritSec scope(&ctxAccess);
+    bool ok;
+    if (run)
+        ok = RunPageList(run, page, dev, &fz_identity, NULL, NULL);
+    else
+        ok = RunPage(page, dev, &fz_identity, target, NULL, cacheRun);
 
+    LockContext(textCtx);
     WCHAR *content = NULL;
     if (ok)
         content = fz_text_page_to_str(text, lineSep, coords_out);
-    fz_free_text_page(ctx, text);
-    fz_free_text_sheet(ctx, sheet);
+    fz_free_text_page(textCtx, text);
+    fz_free_text_sheet(textCtx, sheet);
+    UnlockContext(textCtx);
 
+    ReleaseRunContext(textCtx, run);
+    if (cacheRun)
+        EnforceMemoryBudget();
     return content;
 }
 
@@ -3305,6 +3906,16 @@ BaseEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI)
     return PdfEngineImpl::CreateFromStream(stream, pwdUI);
 }
 
+bool BenchLexer(BaseEngine *engine, int iterations, size_t *tokensOut, size_t *bytesOut, double *bestMsOut)
+{
+    return static_cast<PdfEngineImpl *>(engine)->BenchLexer(iterations, tokensOut, bytesOut, bestMsOut);
+}
+
+bool BenchDisplayLists(BaseEngine *engine, int iterations, size_t *listBytesOut, double *recordMsOut, double *bestReplayMsOut)
+{
+    return static_cast<PdfEngineImpl *>(engine)->BenchDisplayLists(iterations, listBytesOut, recordMsOut, bestReplayMsOut);
+}
+
 }
 
 ///// XPS-specific extensions to Fitz/MuXPS /////
@@ -3465,23 +4076,24 @@ xps_extract_doc_props(xps_document *doc)
 struct XpsPageRun {
     xps_page *page;
     fz_display_list *list;
-    size_t size_est;
+    size_t size; // memory used by list
     int refs;
 
-    XpsPageRun(xps_page *page, fz_display_list *list, ListInspectionData& data) :
-        page(page), list(list), size_est(data.mem_estimate), refs(1) { }
+    XpsPageRun(xps_page *page, fz_display_list *list, size_t size) :
+        page(page), list(list), size(size), refs(1) { }
 };
 
 class XpsTocItem;
 class XpsImage;
 
-class XpsEngineImpl : public BaseEngine {
+class XpsEngineImpl : public BaseEngine, public MemoryConsumer {
     friend XpsImage;
 
 public:
     XpsEngineImpl();
     virtual ~XpsEngineImpl();
     virtual BaseEngine *Clone();
+    virtual bool SupportsParallelTextExtraction() const { return true; }
 
     virtual const WCHAR *FileName() const { return _fileName; };
     virtual int PageCount() const {
@@ -3528,6 +4140,8 @@ public:
 
     fz_rect FindDestRect(const char *target);
 
+    virtual size_t FreeMemory(MemoryCategory cat, size_t bytes);
+
     static BaseEngine *CreateFromFile(const WCHAR *fileName);
     static BaseEngine *CreateFromStream(IStream *stream);
 
@@ -3572,6 +4186,8 @@ protected:
                             const fz_rect *cliprect=NULL, bool cacheRun=true,
                             FitzAbortCookie *cookie=NULL);
     void            DropPageRun(XpsPageRun *run, bool forceRemove=false);
+    void            UpdateMemoryUsage();
+    void            EnforceMemoryBudget();
 
     XpsTocItem    * BuildTocTree(fz_outline *entry, int& idCounter);
     void            LinkifyPageText(xps_page *page, int pageNo);
@@ -3667,11 +4283,17 @@ XpsEngineImpl::XpsEngineImpl() : _fileName(NULL), _doc(NULL), _pages(NULL), _med
     fz_locks_ctx.user = &ctxAccess;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    // cf. PdfEngineImpl::PdfEngineImpl
+    ctx = fz_new_context(NULL, &fz_locks_ctx, (unsigned int)membudget::GetLimit());
+    if (ctx)
+        fz_set_glyph_cache_limit(ctx, MAX_GLYPH_CACHE_MEMORY);
+    membudget::Register(this);
 }
 
 XpsEngineImpl::~XpsEngineImpl()
 {
+    membudget::Unregister(this);
+
     EnterCriticalSection(&_pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -3885,7 +4507,7 @@ XpsPageRun *XpsEngineImpl::CreatePageRun(xps_page *page, fz_display_list *list)
         }
     }
 
-    return new XpsPageRun(page, list, data);
+    return new XpsPageRun(page, list, fz_display_list_size(ctx, list));
 }
 
 XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
@@ -3901,15 +4523,6 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
         }
     }
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
         if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
             assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
             DropPageRun(runCache.Last(), true);
@@ -4010,6 +4623,21 @@ void XpsEngineImpl::DropPageRun(XpsPageRun *run, bool forceRemove)
     }
 }
 
+void XpsEngineImpl::UpdateMemoryUsage()
+{
+    UpdateFitzMemoryUsage(this, runCache, &_pagesAccess, &ctxAccess, ctx);
+}
+
+void XpsEngineImpl::EnforceMemoryBudget()
+{
+    EnforceFitzMemoryBudget(this, runCache, &_pagesAccess, &ctxAccess, ctx);
+}
+
+size_t XpsEngineImpl::FreeMemory(MemoryCategory cat, size_t bytes)
+{
+    return FreeFitzMemory(this, runCache, &_pagesAccess, &ctxAccess, ctx, NULL, cat, bytes);
+}
+
 RectD XpsEngineImpl::PageMediabox(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
@@ -4140,7 +4768,9 @@ bool XpsEngineImpl::RenderPage(HDC hDC, xps_page *page, RectI screenRect, const
     FitzAbortCookie *cookie = NULL;
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
-    return RunPage(page, dev, ctm, &cliprect, true, cookie);
+    bool ok = RunPage(page, dev, ctm, &cliprect, true, cookie);
+    EnforceMemoryBudget();
+    return ok;
 }
 
 RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
@@ -4211,12 +4841,14 @@ RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
     fz_rect cliprect;
     bool ok = RunPage(page, dev, &ctm, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
 
-    ScopedCritSec scope(&ctxAccess);
-
+    EnterCriticalSection(&ctxAccess);
     RenderedBitmap *bitmap = NULL;
     if (ok)
         bitmap = new_rendered_fz_pixmap(ctx, image);
     fz_drop_pixmap(ctx, image);
+    LeaveCriticalSection(&ctxAccess);
+
+    EnforceMemoryBudget();
     return bitmap;
 }
 
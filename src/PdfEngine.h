@@ -19,6 +19,13 @@ bool IsSupportedFile(const WCHAR *fileName, bool sniff=false);
 BaseEngine *CreateFromFile(const WCHAR *fileName, PasswordUI *pwdUI=NULL);
 BaseEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI=NULL);
 
+// tokenizes the content streams of all pages of a PDF engine's document
+// (for -bench <file> lexer)
+bool BenchLexer(BaseEngine *engine, int iterations, size_t *tokensOut, size_t *bytesOut, double *bestMsOut);
+// records display lists for all pages of a PDF engine's document and
+// replays them into a bbox device (for -bench <file> displaylist)
+bool BenchDisplayLists(BaseEngine *engine, int iterations, size_t *listBytesOut, double *recordMsOut, double *bestReplayMsOut);
+
 }
 
 namespace XpsEngine {
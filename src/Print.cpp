@@ -114,6 +114,8 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI *progressUI=NULL
 
     BaseEngine& engine = *pd.engine;
     ScopedMem<WCHAR> fileName;
+    // the cloned engine might still be laying out pages
+    engine.WaitForPages(INT_MAX);
 
     DOCINFO di = { 0 };
     di.cbSize = sizeof (DOCINFO);
@@ -524,6 +526,9 @@ void OnMenuPrint(WindowInfo *win, bool waitForCompletion)
             return;
     }
     AbortPrinting(win);
+    // all pages must have been layed out before they can be selected
+    dm->GetEngine()->WaitForPages(INT_MAX);
+    UpdatePageCount(win);
 
     // the Print dialog allows access to the file system, so fall back
     // to printing the entire document without dialog if that isn't desired
@@ -791,6 +796,7 @@ bool PrintFile(BaseEngine *engine, WCHAR *printerName, bool displayErrors, const
     {
         Print_Advanced_Data advanced;
         Vec<PRINTPAGERANGE> ranges;
+        engine->WaitForPages(INT_MAX);
         ApplyPrintSettings(settings, engine->PageCount(), ranges, advanced, devMode);
 
         PrintData pd(engine, infoData, devMode, ranges, advanced);
@@ -6,6 +6,7 @@
 
 #include "DisplayModel.h"
 #include "TextSelection.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 
 // TODO: remove this and always conserve memory?
@@ -18,29 +19,39 @@
 #undef SHOW_TILE_LAYOUT
 
 RenderCache::RenderCache()
-    : cacheCount(0), requestCount(0),
+    : cacheCount(0), cacheMemUsed(0), cacheHits(0), cacheMisses(0),
+      requestCount(0), renderThreadCount(0), maxRenderThreads(1),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
       isRemoteSession(GetSystemMetrics(SM_REMOTESESSION))
 {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
 
+    ZeroMemory(cacheBuckets, sizeof(cacheBuckets));
+    ZeroMemory(curReqs, sizeof(curReqs));
+    ZeroMemory(renderThreads, sizeof(renderThreads));
+
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
 
     startRendering = CreateEvent(NULL, FALSE, FALSE, NULL);
-    renderThread = CreateThread(NULL, 0, RenderCacheThread, this, 0, 0);
-    assert(NULL != renderThread);
+    SetMaxRenderThreads(0);
+
+    membudget::Register(this);
 }
 
 RenderCache::~RenderCache()
 {
+    membudget::Unregister(this);
+
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    for (int i = 0; i < renderThreadCount; i++) {
+        CloseHandle(renderThreads[i]);
+    }
     CloseHandle(startRendering);
-    assert(!curReq && 0 == requestCount && 0 == cacheCount);
+    assert(!IsRendering() && 0 == requestCount && 0 == cacheCount);
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
@@ -48,6 +59,21 @@ RenderCache::~RenderCache()
     DeleteCriticalSection(&requestAccess);
 }
 
+void RenderCache::SetMaxRenderThreads(int count)
+{
+    ScopedCritSec scope(&requestAccess);
+    if (count <= 0)
+        count = GetProcessorCount();
+    // threads which have already been started keep running
+    maxRenderThreads = limitValue(count, std::max(renderThreadCount, 1), MAX_RENDER_THREADS);
+}
+
+static inline int GetBucketIdx(DisplayModel *dm, int pageNo)
+{
+    size_t hash = ((size_t)dm >> 4) ^ ((size_t)pageNo * 2654435761U);
+    return (int)(hash & (BITMAP_CACHE_BUCKETS - 1));
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
@@ -55,11 +81,11 @@ BitmapCacheEntry *RenderCache::Find(DisplayModel *dm, int pageNo, int rotation,
 {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry *entry = cache[i];
+    for (BitmapCacheEntry *entry = cacheBuckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->nextInBucket) {
         if ((dm == entry->dm) && (pageNo == entry->pageNo) && (rotation == entry->rotation) &&
             (INVALID_ZOOM == zoom || zoom == entry->zoom) && (!tile || entry->tile == *tile)) {
             entry->refs++;
+            entry->lastAccess = GetTickCount();
             return entry;
         }
     }
@@ -84,9 +110,32 @@ void RenderCache::DropCacheEntry(BitmapCacheEntry *entry)
     }
 }
 
+void RenderCache::LinkCacheEntry(BitmapCacheEntry *entry)
+{
+    int idx = GetBucketIdx(entry->dm, entry->pageNo);
+    entry->nextInBucket = cacheBuckets[idx];
+    cacheBuckets[idx] = entry;
+    cacheCount++;
+    cacheMemUsed += entry->bitmapSize;
+    membudget::Update(this, Mem_Bitmaps, cacheMemUsed);
+}
+
+// removes the entry *link points to from its bucket (the caller
+// is responsible for calling DropCacheEntry on the returned entry)
+BitmapCacheEntry *RenderCache::UnlinkCacheEntry(BitmapCacheEntry **link)
+{
+    BitmapCacheEntry *entry = *link;
+    *link = entry->nextInBucket;
+    entry->nextInBucket = NULL;
+    cacheCount--;
+    cacheMemUsed -= entry->bitmapSize;
+    membudget::Update(this, Mem_Bitmaps, cacheMemUsed);
+    return entry;
+}
+
 void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
 {
-    ScopedCritSec scope(&cacheAccess);
+    EnterCriticalSection(&cacheAccess);
     assert(req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
@@ -95,31 +144,32 @@ void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    if (cacheCount >= MAX_BITMAPS_CACHED) {
-        // free an invisible page of the same DisplayModel ...
-        for (int i = 0; i < cacheCount; i++) {
-            if (cache[i]->dm == req.dm && !req.dm->PageVisibleNearby(cache[i]->pageNo)) {
-                DropCacheEntry(cache[i]);
-                cacheCount--;
-                memmove(&cache[i], &cache[i + 1], (cacheCount - i) * sizeof(cache[0]));
-                break;
-            }
-        }
-        // ... or just the oldest cached page
-        if (cacheCount >= MAX_BITMAPS_CACHED) {
-            DropCacheEntry(cache[0]);
-            cacheCount--;
-            memmove(&cache[0], &cache[1], cacheCount * sizeof(cache[0]));
-        }
-    }
-
     // Copy the PageRenderRequest as it will be reused
-    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
-    CrashIf(!cache[cacheCount]);
-    if (!cache[cacheCount])
+    BitmapCacheEntry *entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
+    CrashIf(!entry);
+    if (!entry) {
+        LeaveCriticalSection(&cacheAccess);
         delete bitmap;
-    else
-        cacheCount++;
+        return;
+    }
+
+    while (cacheCount > 0 && cacheCount >= MAX_BITMAPS_CACHED) {
+        EvictCacheEntry();
+    }
+    LinkCacheEntry(entry);
+    LeaveCriticalSection(&cacheAccess);
+
+    // make room for the new bitmap (from this or any other cache)
+    membudget::Enforce();
+}
+
+void RenderCache::GetCacheStats(BitmapCacheStats& stats)
+{
+    ScopedCritSec scope(&cacheAccess);
+    stats.hits = cacheHits;
+    stats.misses = cacheMisses;
+    stats.count = cacheCount;
+    stats.memUsed = cacheMemUsed;
 }
 
 static RectD GetTileRect(RectD pagerect, TilePosition tile)
@@ -171,47 +221,110 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
     return !tileOnScreen.Intersect(screen).IsEmpty();
 }
 
+static bool IsVisible(BitmapCacheEntry *entry)
+{
+    if (!entry->dm->PageVisible(entry->pageNo))
+        return false;
+    return 0 == entry->tile.res || IsTileVisible(entry->dm, entry->pageNo, entry->tile);
+}
+
+// the larger the weight, the better a candidate for eviction: bitmaps which
+// haven't been painted in a while and which are far from the visible pages
+static double GetEvictionWeight(BitmapCacheEntry *entry, DWORD now)
+{
+    double age = (double)(now - entry->lastAccess) + 1;
+    int distance = 0;
+    if (!entry->dm->PageVisible(entry->pageNo))
+        distance = 1 + abs(entry->pageNo - entry->dm->CurrentPageNo());
+    else if (!IsVisible(entry))
+        distance = 1;
+    if (entry->outOfDate)
+        distance++;
+    return age * (distance + 1);
+}
+
+// free the cached bitmap least likely to be painted again soon
+// and return how much memory that bitmap has used
+size_t RenderCache::EvictCacheEntry(bool onlyNotVisible)
+{
+    ScopedCritSec scope(&cacheAccess);
+    DWORD now = GetTickCount();
+    BitmapCacheEntry **victim = NULL;
+    double maxWeight = -1;
+
+    for (int i = 0; i < BITMAP_CACHE_BUCKETS; i++) {
+        for (BitmapCacheEntry **link = &cacheBuckets[i]; *link; link = &(*link)->nextInBucket) {
+            if (onlyNotVisible && IsVisible(*link))
+                continue;
+            double weight = GetEvictionWeight(*link, now);
+            if (weight > maxWeight) {
+                maxWeight = weight;
+                victim = link;
+            }
+        }
+    }
+    if (!victim)
+        return 0;
+    size_t size = (*victim)->bitmapSize;
+    DropCacheEntry(UnlinkCacheEntry(victim));
+    return size;
+}
+
+size_t RenderCache::FreeMemory(MemoryCategory cat, size_t bytes)
+{
+    CrashIf(cat != Mem_Bitmaps);
+    // this might be called from any thread, so don't wait for cacheAccess
+    if (!TryEnterCriticalSection(&cacheAccess))
+        return 0;
+    // bitmaps currently being displayed are never given up
+    size_t freed = 0, size;
+    while (freed < bytes && (size = EvictCacheEntry(true)) > 0) {
+        freed += size;
+    }
+    LeaveCriticalSection(&cacheAccess);
+    return freed;
+}
+
 /* Free all bitmaps in the cache that are of a specific page (or all pages
    of the given DisplayModel, or even all invisible pages). */
 void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
     ScopedCritSec scope(&cacheAccess);
-    int cacheCountTmp = cacheCount;
-    int curPos = 0;
 
-    for (int i = 0; i < cacheCountTmp; i++) {
-        BitmapCacheEntry* entry = cache[i];
-        bool shouldFree;
-        if (dm && pageNo != INVALID_PAGE_NO) {
-            // a specific page
-            shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
-            if (tile) {
-                // a given tile of the page or all tiles not rendered at a given resolution
-                // (and at resolution 0 for quick zoom previews)
-                shouldFree = shouldFree && (entry->tile == *tile ||
-                    tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                    tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+    for (int i = 0; i < BITMAP_CACHE_BUCKETS; i++) {
+        // all bitmaps of a specific page are in the same bucket
+        if (dm && pageNo != INVALID_PAGE_NO && i != GetBucketIdx(dm, pageNo))
+            continue;
+
+        BitmapCacheEntry **link = &cacheBuckets[i];
+        while (*link) {
+            BitmapCacheEntry *entry = *link;
+            bool shouldFree;
+            if (dm && pageNo != INVALID_PAGE_NO) {
+                // a specific page
+                shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
+                if (tile) {
+                    // a given tile of the page or all tiles not rendered at a given resolution
+                    // (and at resolution 0 for quick zoom previews)
+                    shouldFree = shouldFree && (entry->tile == *tile ||
+                        tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
+                        tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+                }
+            } else if (dm) {
+                // all pages of this DisplayModel
+                shouldFree = (entry->dm == dm);
+            } else {
+                // all invisible pages resp. page tiles
+                shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
+                if (!shouldFree && entry->tile.res > 1)
+                    shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
             }
-        } else if (dm) {
-            // all pages of this DisplayModel
-            shouldFree = (cache[i]->dm == dm);
-        } else {
-            // all invisible pages resp. page tiles
-            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
-            if (!shouldFree && entry->tile.res > 1)
-                shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
-        }
 
-        if (shouldFree) {
-            DropCacheEntry(entry);
-            cache[i] = NULL;
-            cacheCount--;
+            if (shouldFree)
+                DropCacheEntry(UnlinkCacheEntry(link));
+            else
+                link = &entry->nextInBucket;
         }
-
-        if (curPos != i)
-            cache[curPos] = cache[i];
-        if (!shouldFree)
-            curPos++;
     }
 }
 
@@ -220,15 +333,28 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
 {
     ScopedCritSec scope(&cacheAccess);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == oldDm) {
-            if (oldDm->PageVisible(cache[i]->pageNo))
-                cache[i]->dm = newDm;
-            // make sure that the page is rerendered eventually
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+    Vec<BitmapCacheEntry *> moved;
+    for (int i = 0; i < BITMAP_CACHE_BUCKETS; i++) {
+        BitmapCacheEntry **link = &cacheBuckets[i];
+        while (*link) {
+            BitmapCacheEntry *entry = *link;
+            if (entry->dm == oldDm) {
+                // make sure that the page is rerendered eventually
+                entry->zoom = INVALID_ZOOM;
+                entry->outOfDate = true;
+                if (oldDm != newDm && oldDm->PageVisible(entry->pageNo)) {
+                    // the entry has to be rehashed for the new DisplayModel
+                    moved.Append(UnlinkCacheEntry(link));
+                    continue;
+                }
+            }
+            link = &entry->nextInBucket;
         }
     }
+    for (size_t i = 0; i < moved.Count(); i++) {
+        moved.At(i)->dm = newDm;
+        LinkCacheEntry(moved.At(i));
+    }
 }
 
 // marks all tiles containing rect of pageNo as out of date
@@ -237,17 +363,16 @@ void RenderCache::Invalidate(DisplayModel *dm, int pageNo, RectD rect)
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
-        AbortCurrentRequest();
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
     RectD mediabox = dm->GetEngine()->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            !GetTileRect(mediabox, cache[i]->tile).Intersect(rect).IsEmpty()) {
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+    for (BitmapCacheEntry *entry = cacheBuckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->nextInBucket) {
+        if (entry->dm == dm && entry->pageNo == pageNo &&
+            !GetTileRect(mediabox, entry->tile).Intersect(rect).IsEmpty()) {
+            entry->zoom = INVALID_ZOOM;
+            entry->outOfDate = true;
         }
     }
 }
@@ -286,10 +411,10 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation)
 {
     ScopedCritSec scope(&cacheAccess);
     USHORT maxRes = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            cache[i]->rotation == rotation) {
-            maxRes = std::max(cache[i]->tile.res, maxRes);
+    for (BitmapCacheEntry *entry = cacheBuckets[GetBucketIdx(dm, pageNo)]; entry; entry = entry->nextInBucket) {
+        if (entry->dm == dm && entry->pageNo == pageNo &&
+            entry->rotation == rotation) {
+            maxRes = std::max(entry->tile.res, maxRes);
         }
     }
     return maxRes;
@@ -311,11 +436,13 @@ bool RenderCache::ReduceTileSize()
         maxTileSize.dy /= 2;
 
     // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0)
-        FreeForDisplayModel(cache[0]->dm);
+    for (int i = 0; i < BITMAP_CACHE_BUCKETS; i++) {
+        while (cacheBuckets[i])
+            DropCacheEntry(UnlinkCacheEntry(&cacheBuckets[i]));
+    }
     while (requestCount > 0)
         ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
@@ -337,6 +464,14 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo)
     }
 }
 
+// note: must be called under requestAccess
+static void AbortRequest(PageRenderRequest *req)
+{
+    if (req->abortCookie)
+        req->abortCookie->Abort();
+    req->abort = true;
+}
+
 /* Render a bitmap for page <pageNo> in <dm>. */
 void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage)
 {
@@ -348,14 +483,15 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    PageRenderRequest *curReq = FindCurrentRequest(dm, pageNo, tile);
+    if (curReq) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        AbortRequest(curReq);
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -447,15 +583,59 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     newRequest->renderCb = renderCb;
 
     SetEvent(startRendering);
+    StartRenderThreadIfNeeded();
 
     return true;
 }
 
+// start another render thread if all the running ones are busy
+void RenderCache::StartRenderThreadIfNeeded()
+{
+    ScopedCritSec scope(&requestAccess);
+    if (renderThreadCount >= maxRenderThreads)
+        return;
+
+    int busyThreads = 0;
+    for (int i = 0; i < MAX_RENDER_THREADS; i++) {
+        if (curReqs[i])
+            busyThreads++;
+    }
+    if (busyThreads < renderThreadCount)
+        return;
+
+    HANDLE hThread = CreateThread(NULL, 0, RenderCacheThread, this, 0, 0);
+    CrashIf(!hThread);
+    if (hThread)
+        renderThreads[renderThreadCount++] = hThread;
+}
+
+PageRenderRequest *RenderCache::FindCurrentRequest(DisplayModel *dm, int pageNo, TilePosition tile)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < MAX_RENDER_THREADS; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (req && req->pageNo == pageNo && req->dm == dm && req->tile == tile)
+            return req;
+    }
+    return NULL;
+}
+
+bool RenderCache::IsRendering(DisplayModel *dm)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < MAX_RENDER_THREADS; i++) {
+        if (curReqs[i] && (!dm || curReqs[i]->dm == dm))
+            return true;
+    }
+    return false;
+}
+
 UINT RenderCache::GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile)
 {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
+    PageRenderRequest *curReq = FindCurrentRequest(dm, pageNo, tile);
+    if (curReq)
         return GetTickCount() - curReq->timestamp;
 
     for (int i = 0; i < requestCount; i++)
@@ -474,21 +654,43 @@ bool RenderCache::GetNextRequest(PageRenderRequest *req)
 
     assert(requestCount > 0);
     assert(requestCount <= MAX_PAGE_REQUESTS);
+    // render the most recent request for a visible page (or a request with
+    // a callback) first and only then prefetch pages nearby
+    int idx = requestCount - 1;
+    for (int i = requestCount - 1; i >= 0; i--) {
+        if (requests[i].renderCb || requests[i].dm->PageVisible(requests[i].pageNo)) {
+            idx = i;
+            break;
+        }
+    }
+    *req = requests[idx];
     requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
+    memmove(&requests[idx], &requests[idx + 1], (requestCount - idx) * sizeof(PageRenderRequest));
     assert(requestCount >= 0);
     assert(!req->abort);
 
+    int slot = 0;
+    while (slot < MAX_RENDER_THREADS && curReqs[slot])
+        slot++;
+    CrashIf(slot == MAX_RENDER_THREADS);
+    curReqs[slot] = req;
+
+    // wake up another idle render thread for the remaining requests
+    if (requestCount > 0)
+        SetEvent(startRendering);
+
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest()
+bool RenderCache::ClearCurrentRequest(PageRenderRequest *req)
 {
     ScopedCritSec scope(&requestAccess);
-    if (curReq)
-        delete curReq->abortCookie;
-    curReq = NULL;
+    for (int i = 0; i < MAX_RENDER_THREADS; i++) {
+        if (curReqs[i] == req) {
+            delete req->abortCookie;
+            curReqs[i] = NULL;
+        }
+    }
 
     bool isQueueEmpty = requestCount == 0;
     return isQueueEmpty;
@@ -503,14 +705,14 @@ void RenderCache::CancelRendering(DisplayModel *dm)
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        if (!IsRendering(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -538,14 +740,16 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel *dm, int pageNo, TilePo
     }
 }
 
-void RenderCache::AbortCurrentRequest()
+// abort the requests currently rendered for a given page (or all
+// pages of the given DisplayModel, or even all pages)
+void RenderCache::AbortCurrentRequests(DisplayModel *dm, int pageNo)
 {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq)
-        return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
+    for (int i = 0; i < MAX_RENDER_THREADS; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (req && (!dm || req->dm == dm) && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo))
+            AbortRequest(req);
+    }
 }
 
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
@@ -555,7 +759,7 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
     RenderedBitmap *    bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
+        if (cache->ClearCurrentRequest(&req)) {
             DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
             // Is it not a page render request?
             if (WAIT_OBJECT_0 != waitResult)
@@ -611,6 +815,11 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     BitmapCacheEntry *entry = Find(dm, pageNo, dm->GetRotation(), dm->GetZoomReal(), &tile);
     UINT renderDelay = 0;
 
+    if (entry)
+        cacheHits++;
+    else
+        cacheMisses++;
+
     if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement)
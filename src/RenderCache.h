@@ -5,15 +5,21 @@
 #define RenderCache_h
 
 #include "DisplayModel.h"
+#include "MemoryBudget.h"
 
 #define RENDER_DELAY_UNDEFINED ((UINT)-1)
 #define RENDER_DELAY_FAILED    ((UINT)-2)
 #define INVALID_TILE_RES       ((USHORT)-1)
 
 #define MAX_PAGE_REQUESTS 8
+// upper limit for the number of threads rendering pages in parallel
+// (the actual number defaults to the number of processor cores)
+#define MAX_RENDER_THREADS 8
 // keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+// GDI resources when caching many (smaller) bitmaps
+#define MAX_BITMAPS_CACHED 256
+// number of hash buckets for finding cached bitmaps (must be a power of 2)
+#define BITMAP_CACHE_BUCKETS 128
 
 class RenderingCallback {
 public:
@@ -45,14 +51,29 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap * bitmap;
+    size_t           bitmapSize; // in bytes
     bool             outOfDate;
     int              refs;
+    // when the bitmap was last found in the cache
+    DWORD            lastAccess;
+    // next entry in the same hash bucket of RenderCache
+    BitmapCacheEntry *nextInBucket;
 
     BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap) :
-        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1) { }
+        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap),
+        outOfDate(false), refs(1), lastAccess(GetTickCount()), nextInBucket(NULL) {
+        bitmapSize = bitmap ? (size_t)bitmap->Size().dx * bitmap->Size().dy * 4 : 0;
+    }
     ~BitmapCacheEntry() { delete bitmap; }
 };
 
+struct BitmapCacheStats {
+    size_t  hits;
+    size_t  misses;
+    int     count;
+    size_t  memUsed;
+};
+
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
    while BitmapCacheEntries are ref-counted) */
@@ -72,20 +93,29 @@ struct PageRenderRequest {
     RenderingCallback * renderCb;
 };
 
-class RenderCache
+// how much memory cached bitmaps may use is up to the shared memory budget
+class RenderCache : public MemoryConsumer
 {
 private:
-    BitmapCacheEntry *  cache[MAX_BITMAPS_CACHED];
+    // entries are hashed by DisplayModel and page number
+    BitmapCacheEntry *  cacheBuckets[BITMAP_CACHE_BUCKETS];
     int                 cacheCount;
+    size_t              cacheMemUsed;
+    size_t              cacheHits;
+    size_t              cacheMisses;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION    cacheAccess;
 
     PageRenderRequest   requests[MAX_PAGE_REQUESTS];
     int                 requestCount;
-    PageRenderRequest * curReq;
+    // requests currently being rendered (one per busy render thread)
+    PageRenderRequest * curReqs[MAX_RENDER_THREADS];
     CRITICAL_SECTION    requestAccess;
-    HANDLE              renderThread;
+    // render threads are started on demand (up to maxRenderThreads)
+    HANDLE              renderThreads[MAX_RENDER_THREADS];
+    int                 renderThreadCount;
+    int                 maxRenderThreads;
 
     SizeI               maxTileSize;
     bool                isRemoteSession;
@@ -97,6 +127,10 @@ public:
     RenderCache();
     ~RenderCache();
 
+    // count <= 0 means one render thread per processor core
+    // (only effective before the first rendering request)
+    void    SetMaxRenderThreads(int count);
+
     void    RequestRendering(DisplayModel *dm, int pageNo);
     void    Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
                    RectD pageRect, RenderingCallback& callback);
@@ -111,12 +145,15 @@ public:
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     UINT    Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                   PageInfo *pageInfo, bool *renderOutOfDateCue);
+    void    GetCacheStats(BitmapCacheStats& stats);
+
+    virtual size_t FreeMemory(MemoryCategory cat, size_t bytes);
 
 protected:
     /* Interface for page rendering thread */
     HANDLE  startRendering;
 
-    bool    ClearCurrentRequest();
+    bool    ClearCurrentRequest(PageRenderRequest *req);
     bool    GetNextRequest(PageRenderRequest *req);
     void    Add(PageRenderRequest &req, RenderedBitmap *bitmap);
 
@@ -133,13 +170,19 @@ private:
                    RenderingCallback *callback=NULL);
     void    ClearQueueForDisplayModel(DisplayModel *dm, int pageNo=INVALID_PAGE_NO,
                                       TilePosition *tile=NULL);
-    void    AbortCurrentRequest();
+    PageRenderRequest * FindCurrentRequest(DisplayModel *dm, int pageNo, TilePosition tile);
+    bool    IsRendering(DisplayModel *dm=NULL);
+    void    AbortCurrentRequests(DisplayModel *dm=NULL, int pageNo=INVALID_PAGE_NO);
+    void    StartRenderThreadIfNeeded();
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry *  Find(DisplayModel *dm, int pageNo, int rotation,
                              float zoom=INVALID_ZOOM, TilePosition *tile=NULL);
     void    DropCacheEntry(BitmapCacheEntry *entry);
+    void    LinkCacheEntry(BitmapCacheEntry *entry);
+    BitmapCacheEntry *  UnlinkCacheEntry(BitmapCacheEntry **link);
+    size_t  EvictCacheEntry(bool onlyNotVisible=false);
     void    FreePage(DisplayModel *dm=NULL, int pageNo=-1, TilePosition *tile=NULL);
     void    FreeNotVisible() { FreePage(); }
 
@@ -15,6 +15,7 @@
 #include "Controller.h"
 #include "DisplayModel.h"
 #include "EngineManager.h"
+#include "FileThumbnails.h"
 #include "FileUtil.h"
 #include "Notifications.h"
 #include "PdfEngine.h"
@@ -23,6 +24,8 @@
 #include "Selection.h"
 #include "SumatraDialogs.h"
 #include "SumatraPDF.h"
+#include "TextIndex.h"
+#include "TextSearch.h"
 #include "Translations.h"
 #include "UITask.h"
 #include "WindowInfo.h"
@@ -150,6 +153,8 @@ static void ShowSearchResult(WindowInfo& win, TextSel *result, bool addNavPt)
     if (0 == result->len || !result->pages || !result->rects)
         return;
 
+    // the result might be on a page that's only just been layed out
+    UpdatePageCount(&win);
     DisplayModel *dm = win.AsFixed();
     if (addNavPt || !dm->PageShown(result->pages[0]) ||
         (dm->GetZoomVirtual() == ZOOM_FIT_PAGE || dm->GetZoomVirtual() == ZOOM_FIT_CONTENT))
@@ -291,6 +296,18 @@ public:
     }
 };
 
+// smaller documents are searched quickly enough without a text index
+#define TEXT_INDEX_MIN_PAGES    50
+
+// the text index is saved along with the thumbnails (i.e. only if the
+// user doesn't mind SumatraPDF remembering which files have been opened)
+static bool UseTextIndex(DisplayModel *dm)
+{
+    BaseEngine *engine = dm->GetEngine();
+    return HasPermission(Perm_SavePreferences | Perm_DiskAccess) && gGlobalPrefs->rememberOpenedFiles &&
+           engine->PageCount() >= TEXT_INDEX_MIN_PAGES && !engine->IsLayoutPending();
+}
+
 static DWORD WINAPI FindThread(LPVOID data)
 {
     FindThreadData *ftd = (FindThreadData *)data;
@@ -298,6 +315,10 @@ static DWORD WINAPI FindThread(LPVOID data)
     WindowInfo *win = ftd->win;
     DisplayModel *dm = win->AsFixed();
 
+    bool useIndex = UseTextIndex(dm);
+    if (useIndex && !dm->textSearch->GetTextIndex())
+        dm->textSearch->SetTextIndex(LoadTextIndex(dm->FilePath(), dm->GetEngine()->PageCount()));
+
     TextSel *rect;
     dm->textSearch->SetDirection(ftd->direction);
     if (ftd->wasModified || !win->ctrl->ValidPageNo(dm->textSearch->GetCurrentPageNo()) ||
@@ -316,6 +337,11 @@ static DWORD WINAPI FindThread(LPVOID data)
         }
     }
 
+    // save the index as soon as all pages have been searched
+    PageTextIndex *index = dm->textSearch->GetTextIndex();
+    if (useIndex && index && index->IsComplete() && index->IsModified())
+        SaveTextIndex(dm->FilePath(), index);
+
     // wait for FindTextOnThread to return so that
     // FindEndTask closes the correct handle to
     // the current find thread
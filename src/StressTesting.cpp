@@ -16,12 +16,15 @@
 #include "EngineManager.h"
 #include "FileUtil.h"
 #include "HtmlWindow.h"
+#include "MemoryBudget.h"
 #include "ParseCommandLine.h"
 #include "Mui.h"
+#include "PdfEngine.h"
 #include "RenderCache.h"
 #include "SimpleLog.h"
 #include "Search.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Timer.h"
 #include "WindowInfo.h"
 #include "WinUtil.h"
@@ -117,12 +120,188 @@ static void BenchLoadRender(BaseEngine *engine, int pagenum)
     logbench(L"pagerender %3d: %.2f ms", pagenum, timeMs);
 }
 
+// pages are split into BENCH_TILE_SPLIT x BENCH_TILE_SPLIT tiles
+#define BENCH_TILE_SPLIT    4
+#define BENCH_TILE_ZOOM     2.0f
+#define BENCH_TILE_PAGES    10
+
+struct BenchTilesData {
+    BaseEngine *engine;
+    LONG        nextTile;
+    LONG        tileCount;
+};
+
+static DWORD WINAPI BenchTilesThread(LPVOID data)
+{
+    BenchTilesData *bd = (BenchTilesData *)data;
+    const int tilesPerPage = BENCH_TILE_SPLIT * BENCH_TILE_SPLIT;
+    for (LONG i = InterlockedIncrement(&bd->nextTile) - 1; i < bd->tileCount; i = InterlockedIncrement(&bd->nextTile) - 1) {
+        int pageNo = 1 + i / tilesPerPage;
+        int tileNo = i % tilesPerPage;
+        RectD mediabox = bd->engine->PageMediabox(pageNo);
+        RectD tile(0, 0, mediabox.dx / BENCH_TILE_SPLIT, mediabox.dy / BENCH_TILE_SPLIT);
+        tile.x = mediabox.x + (tileNo % BENCH_TILE_SPLIT) * tile.dx;
+        tile.y = mediabox.y + (tileNo / BENCH_TILE_SPLIT) * tile.dy;
+        delete bd->engine->RenderBitmap(pageNo, BENCH_TILE_ZOOM, 0, &tile);
+    }
+    return 0;
+}
+
+// measures how many tiles per second can be rendered with an increasing
+// number of threads (up to as many as RenderCache would use)
+static void BenchTileRendering(BaseEngine *engine)
+{
+    int maxThreads = std::min(GetProcessorCount(), MAX_RENDER_THREADS);
+    int pageCount = std::min(engine->PageCount(), BENCH_TILE_PAGES);
+    HANDLE threads[MAX_RENDER_THREADS];
+
+    for (int threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreads)) {
+        BenchTilesData data = { engine, 0, pageCount * BENCH_TILE_SPLIT * BENCH_TILE_SPLIT };
+        Timer t;
+        for (int i = 0; i < threadCount; i++) {
+            threads[i] = CreateThread(NULL, 0, BenchTilesThread, &data, 0, 0);
+        }
+        WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+        double timeMs = t.Stop();
+        for (int i = 0; i < threadCount; i++) {
+            CloseHandle(threads[i]);
+        }
+        logbench(L"tiles (%d threads): %d in %.2f ms, %.2f tiles/s", threadCount,
+                 data.tileCount, timeMs, data.tileCount * 1000.0 / timeMs);
+        if (threadCount == maxThreads)
+            break;
+    }
+}
+
+// renders pages at the zoom level at which they fit the screen, both at once
+// and split into tiles (for scanned pages this mostly measures image scaling)
+static void BenchScaledRendering(BaseEngine *engine)
+{
+    int pageCount = std::min(engine->PageCount(), BENCH_TILE_PAGES);
+    int screenDy = GetSystemMetrics(SM_CYSCREEN);
+
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        RectD mediabox = engine->PageMediabox(pageNo);
+        float zoom = (float)(screenDy / mediabox.dy);
+        Timer t;
+        delete engine->RenderBitmap(pageNo, zoom, 0);
+        double timeMs = t.Stop();
+        t.Start();
+        for (int tileNo = 0; tileNo < BENCH_TILE_SPLIT * BENCH_TILE_SPLIT; tileNo++) {
+            RectD tile(0, 0, mediabox.dx / BENCH_TILE_SPLIT, mediabox.dy / BENCH_TILE_SPLIT);
+            tile.x = mediabox.x + (tileNo % BENCH_TILE_SPLIT) * tile.dx;
+            tile.y = mediabox.y + (tileNo / BENCH_TILE_SPLIT) * tile.dy;
+            delete engine->RenderBitmap(pageNo, zoom, 0, &tile);
+        }
+        double tilesMs = t.Stop();
+        logbench(L"scaled %3d (zoom %.3f): %.2f ms, as tiles: %.2f ms", pageNo, zoom, timeMs, tilesMs);
+    }
+}
+
+struct BenchTextData {
+    BaseEngine *engine;
+    WStrVec *   reference;
+    LONG        nextPage;
+    LONG        pageCount;
+    LONG        mismatches;
+};
+
+static DWORD WINAPI BenchTextThread(LPVOID data)
+{
+    BenchTextData *bd = (BenchTextData *)data;
+    for (LONG i = InterlockedIncrement(&bd->nextPage) - 1; i < bd->pageCount; i = InterlockedIncrement(&bd->nextPage) - 1) {
+        ScopedMem<WCHAR> text(bd->engine->ExtractPageText(i + 1, L"\n"));
+        if (!str::Eq(text, bd->reference->At(i)))
+            InterlockedIncrement(&bd->mismatches);
+    }
+    return 0;
+}
+
+// measures how many pages per second text can be extracted from with an
+// increasing number of threads and verifies that the extracted text doesn't
+// differ from the text extracted by a single thread
+static void BenchTextExtraction(BaseEngine *engine)
+{
+    int maxThreads = std::min(GetProcessorCount(), MAX_RENDER_THREADS);
+    int pageCount = engine->PageCount();
+    HANDLE threads[MAX_RENDER_THREADS];
+
+    WStrVec reference;
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        reference.Append(engine->ExtractPageText(pageNo, L"\n"));
+    }
+
+    for (int threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreads)) {
+        BenchTextData data = { engine, &reference, 0, pageCount, 0 };
+        Timer t;
+        for (int i = 0; i < threadCount; i++) {
+            threads[i] = CreateThread(NULL, 0, BenchTextThread, &data, 0, 0);
+        }
+        WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+        double timeMs = t.Stop();
+        for (int i = 0; i < threadCount; i++) {
+            CloseHandle(threads[i]);
+        }
+        logbench(L"text (%d threads): %d pages in %.2f ms, %.2f pages/s, %d mismatches", threadCount,
+                 pageCount, timeMs, pageCount * 1000.0 / timeMs, data.mismatches);
+        if (threadCount == maxThreads)
+            break;
+    }
+}
+
+#define BENCH_LEXER_ITERATIONS  10
+
+// measures how many tokens per second the content streams of all pages
+// of a PDF document can be tokenized with (fastest of several iterations)
+static void BenchLexer(BaseEngine *engine, EngineType engineType)
+{
+    if (engineType != Engine_PDF) {
+        logbench(L"Error: lexer benchmark requires a PDF document");
+        return;
+    }
+    size_t tokens, bytes;
+    double timeMs;
+    if (!PdfEngine::BenchLexer(engine, BENCH_LEXER_ITERATIONS, &tokens, &bytes, &timeMs)) {
+        logbench(L"Error: failed to tokenize content streams");
+        return;
+    }
+    logbench(L"lexer: %u tokens (%.2f MB) in %.2f ms, %.2f Mtokens/s, %.2f MB/s", (unsigned int)tokens,
+             bytes / (1024.0 * 1024.0), timeMs, tokens / (timeMs * 1000.0), bytes * 1000.0 / (timeMs * 1024.0 * 1024.0));
+}
+
+#define BENCH_DISPLAY_LIST_ITERATIONS  10
+
+// measures how much memory the display lists of all pages of a PDF
+// document use and how fast they can be replayed (fastest of several
+// iterations)
+static void BenchDisplayLists(BaseEngine *engine, EngineType engineType)
+{
+    if (engineType != Engine_PDF) {
+        logbench(L"Error: display list benchmark requires a PDF document");
+        return;
+    }
+    size_t listBytes;
+    double recordMs, replayMs;
+    if (!PdfEngine::BenchDisplayLists(engine, BENCH_DISPLAY_LIST_ITERATIONS, &listBytes, &recordMs, &replayMs)) {
+        logbench(L"Error: failed to record or replay display lists");
+        return;
+    }
+    logbench(L"displaylist: %d pages, %.2f MB, recorded in %.2f ms, replayed in %.2f ms", engine->PageCount(),
+             listBytes / (1024.0 * 1024.0), recordMs, replayMs);
+}
+
 // <s> can be:
 // * "loadonly"
+// * "tiles"
+// * "text"
+// * "scaled"
+// * "lexer"
+// * "displaylist"
 // * description of page ranges e.g. "1", "1-5", "2-3,6,8-10"
 bool IsBenchPagesInfo(const WCHAR *s)
 {
-    return str::EqI(s, L"loadonly") || IsValidPageRange(s);
+    return str::EqI(s, L"loadonly") || str::EqI(s, L"tiles") || str::EqI(s, L"text") || str::EqI(s, L"scaled") ||
+           str::EqI(s, L"lexer") || str::EqI(s, L"displaylist") || IsValidPageRange(s);
 }
 
 static int FormatWholeDoc(Doc& doc) {
@@ -219,6 +398,18 @@ static void BenchChmLoadOnly(const WCHAR *filePath)
     logbench(L"Finished (in %.2f ms): %s", total.GetTimeInMs(), filePath);
 }
 
+static void LogMemoryBudget()
+{
+    MemoryBudgetStats stats;
+    membudget::GetStats(stats);
+    logbench(L"memory budget: %d MB for %d caches", (int)(stats.limit / (1024 * 1024)), stats.consumers);
+    for (int cat = 0; cat < Mem_CategoryCount; cat++) {
+        ScopedMem<WCHAR> name(str::conv::FromAnsi(membudget::GetCategoryName((MemoryCategory)cat)));
+        logbench(L"  %s: %.2f MB used, %.2f MB reclaimed", name.Get(),
+                 stats.used[cat] / (1024.0 * 1024), stats.reclaimed[cat] / (1024.0 * 1024));
+    }
+}
+
 static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
 {
     if (!file::Exists(filePath)) {
@@ -243,7 +434,8 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
     logbench(L"Starting: %s", filePath);
 
     Timer t;
-    BaseEngine *engine = EngineManager::CreateEngine(filePath);
+    EngineType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, NULL, &engineType);
     if (!engine) {
         logbench(L"Error: failed to load %s", filePath);
         return;
@@ -251,8 +443,44 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
 
     double timeMs = t.Stop();
     logbench(L"load: %.2f ms", timeMs);
+    if (engine->IsLayoutPending()) {
+        // compare how long it takes until the first pages can be displayed
+        // to how long it takes until all pages have been layed out
+        int firstPages = engine->PageCount();
+        Timer layout;
+        engine->WaitForPages(INT_MAX);
+        double layoutMs = timeMs + layout.Stop();
+        logbench(L"layout: first %d pages in %.2f ms, all %d pages in %.2f ms",
+                 firstPages, timeMs, engine->PageCount(), layoutMs);
+    }
     int pages = engine->PageCount();
     logbench(L"page count: %d", pages);
+    if (engine->IsImageCollection()) {
+        // the sizes of all pages are needed before the document can be displayed
+        Timer mediaboxes;
+        for (int i = 1; i <= pages; i++) {
+            engine->PageMediabox(i);
+        }
+        double mediaboxesMs = mediaboxes.Stop();
+        logbench(L"page sizes: %.2f ms (%.2f ms per page), open: %.2f ms",
+                 mediaboxesMs, mediaboxesMs / pages, timeMs + mediaboxesMs);
+    }
+
+    if (str::EqI(pagesSpec, L"tiles")) {
+        BenchTileRendering(engine);
+    }
+    else if (str::EqI(pagesSpec, L"text")) {
+        BenchTextExtraction(engine);
+    }
+    else if (str::EqI(pagesSpec, L"scaled")) {
+        BenchScaledRendering(engine);
+    }
+    else if (str::EqI(pagesSpec, L"lexer")) {
+        BenchLexer(engine, engineType);
+    }
+    else if (str::EqI(pagesSpec, L"displaylist")) {
+        BenchDisplayLists(engine, engineType);
+    }
 
     if (NULL == pagesSpec) {
         for (int i = 1; i <= pages; i++) {
@@ -271,6 +499,7 @@ static void BenchFile(const WCHAR *filePath, const WCHAR *pagesSpec)
         }
     }
 
+    LogMemoryBudget();
     delete engine;
     total.Stop();
 
@@ -629,7 +858,11 @@ void StressTest::Finished(bool success)
     if (success) {
         int secs = SecsSinceSystemTime(stressStartTime);
         ScopedMem<WCHAR> tm(FormatTime(secs));
-        ScopedMem<WCHAR> s(str::Format(L"Stress test complete, rendered %d files in %s", filesCount, tm));
+        BitmapCacheStats stats;
+        renderCache->GetCacheStats(stats);
+        size_t lookups = std::max(stats.hits + stats.misses, (size_t)1);
+        ScopedMem<WCHAR> s(str::Format(L"Stress test complete, rendered %d files in %s (bitmap cache hits: %d%%)",
+                                       filesCount, tm, (int)(stats.hits * 100 / lookups)));
         win->ShowNotification(s, false, false, NG_STRESS_TEST_SUMMARY);
     }
 
@@ -950,6 +950,30 @@ void ControllerCallbackHandler::UpdateScrollbars(SizeI canvas)
     SetScrollInfo(win->hwndCanvas, SB_VERT, &si, TRUE);
 }
 
+// engines might continue laying out pages in the background after loading
+// (cf. BaseEngine::IsLayoutPending), so regularly pick up the new pages
+static void StartPageCountUpdates(WindowInfo *win)
+{
+    DisplayModel *dm = win->AsFixed();
+    if (dm && (dm->GetEngine()->IsLayoutPending() || dm->GetEngine()->PageCount() != dm->PageCount()))
+        SetTimer(win->hwndCanvas, UPDATE_PAGE_COUNT_TIMER_ID, UPDATE_PAGE_COUNT_DELAY_IN_MS, NULL);
+}
+
+// returns false once there'll be no more pages to pick up
+bool UpdatePageCount(WindowInfo *win)
+{
+    DisplayModel *dm = win->AsFixed();
+    if (!dm)
+        return false;
+    int pageCount = dm->PageCount();
+    bool pending = dm->UpdatePageCount();
+    if (dm->PageCount() != pageCount) {
+        UpdateToolbarPageText(win, dm->PageCount(), true);
+        ToolbarUpdateStateForWindow(win, false);
+    }
+    return pending;
+}
+
 // meaning of the internal values of LoadArgs:
 // isNewWindow : if true then 'win' refers to a newly created window that needs
 //   to be resized and placed
@@ -1105,6 +1129,7 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
             UpdateToolbarFindText(win);
         }
     }
+    StartPageCountUpdates(win);
 
     const WCHAR *filePath = win->IsDocLoaded() ? win->ctrl->FilePath() : args.fileName;
     const WCHAR *titlePath = gGlobalPrefs->fullPathInTitle ? filePath : path::GetBaseName(filePath);
@@ -1667,6 +1692,7 @@ void LoadModelIntoTab(WindowInfo *win, TabData *tdata)
     UpdateToolbarPageText(win, pageCount);
     if (pageCount > 0)
         UpdateToolbarFindText(win);
+    StartPageCountUpdates(win);
 
     win->tocState = tdata->tocState;
     if (win->isFullScreen || win->presentation != PM_DISABLED)
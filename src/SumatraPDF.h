@@ -35,6 +35,9 @@
 
 #define EBOOK_LAYOUT_TIMER_ID       7
 
+#define UPDATE_PAGE_COUNT_TIMER_ID  8
+#define UPDATE_PAGE_COUNT_DELAY_IN_MS 500
+
 // permissions that can be revoked (or explicitly set) through Group Policies
 enum {
     // enables Update checks, crash report submitting and hyperlinks
@@ -127,6 +130,7 @@ void  UpdateTabFileDisplayStateForWin(WindowInfo *win, TabData *td);
 bool  FrameOnKeydown(WindowInfo* win, WPARAM key, LPARAM lparam, bool inTextfield=false);
 void  SwitchToDisplayMode(WindowInfo *win, DisplayMode displayMode, bool keepContinuous=false);
 void  ReloadDocument(WindowInfo *win, bool autorefresh=false);
+bool  UpdatePageCount(WindowInfo *win);
 bool  CanSendAsEmailAttachment(WindowInfo *win=NULL);
 void  OnMenuViewFullscreen(WindowInfo* win, bool presentation=false);
 
@@ -460,6 +460,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
     gPolicyRestrictions = GetPolicies(i.restrictedUse);
     GetFixedPageUiColors(gRenderCache.textColor, gRenderCache.backgroundColor);
+    gRenderCache.SetMaxRenderThreads(gGlobalPrefs->renderThreadCount);
+    membudget::SetLimit((size_t)std::max(gGlobalPrefs->cacheMemoryLimit, 0) * 1024 * 1024);
     DebugGdiPlusDevice(gUseGdiRenderer);
 
     if (!RegisterWinClass())
@@ -405,6 +405,22 @@ void LoadTocTree(WindowInfo *win)
     RedrawWindow(win->hwndTocTree, NULL, NULL, fl);
 }
 
+// reloads an already loaded ToC while preserving its expansion state
+// (e.g. after all of its destinations have become available)
+void ReloadTocTree(WindowInfo *win)
+{
+    if (!win->tocLoaded)
+        return;
+
+    win->tocState.Reset();
+    HTREEITEM hRoot = TreeView_GetRoot(win->hwndTocTree);
+    if (hRoot)
+        UpdateTocExpansionState(win, hRoot);
+    ClearTocBox(win);
+    LoadTocTree(win);
+    UpdateTocSelection(win, win->ctrl->CurrentPageNo());
+}
+
 static LRESULT OnTocTreeNotify(WindowInfo *win, LPNMTREEVIEW pnmtv)
 {
     switch (pnmtv->hdr.code)
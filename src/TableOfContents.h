@@ -10,6 +10,7 @@ void CreateToc(WindowInfo *win);
 void ClearTocBox(WindowInfo *win);
 void ToggleTocBox(WindowInfo *win);
 void LoadTocTree(WindowInfo *win);
+void ReloadTocTree(WindowInfo *win);
 void UpdateTocColors(WindowInfo *win);
 void UpdateTocSelection(WindowInfo *win, int currPageNo);
 void UpdateTocExpansionState(WindowInfo *win, HTREEITEM hItem);
@@ -29,6 +29,11 @@ static bool gSaveHtml = false;
 static bool gSaveImages = false;
 // if true, we'll do a layout of mobi files
 static bool gLayout = false;
+// if true, we'll compare the output of the HuffDic decoder against
+// the (slower) reference decoder and report the throughput of both
+static bool gTestHuffDic = false;
+// if true, we'll run mobi tests on documents created in memory
+static bool gMobiBuiltinTest = false;
 // directory to which we'll save mobi html and images
 #define MOBI_SAVE_DIR L"..\\ebooks-converted"
 
@@ -39,6 +44,8 @@ static int Usage()
     printf("  -layout - will also layout mobi files\n");
     printf("  -save-html] - will save html content of mobi file\n");
     printf("  -save-images - will save images extracted from mobi files\n");
+    printf("  -huffdic - will compare and benchmark HuffDic decoders\n");
+    printf("  -mobi-builtin - run mobi tests on documents created in memory\n");
     printf("  -zip-create - creates a sample zip file that needs to be manually checked that it worked\n");
     printf("  -bench-md5 - compare Window's md5 vs. our code\n");
     system("pause");
@@ -157,6 +164,37 @@ static void MobiLayout(MobiDoc *mobiDoc)
     delete pages;
 }
 
+static double MBPerSec(size_t size, double timeMs)
+{
+    if (timeMs <= 0)
+        return 0;
+    return (size / (1024.0 * 1024.0)) / (timeMs / 1000.0);
+}
+
+static void MobiTestHuffDic(MobiDoc *mobiDoc)
+{
+    str::Str<char> ref;
+    Timer t;
+    if (!mobiDoc->DecompressHuffDicRecords(ref, true)) {
+        printf(" not HuffDic compressed (or broken)\n");
+        return;
+    }
+    printf(" reference decoder: %.2f MB/s\n", MBPerSec(ref.Size(), t.Stop()));
+
+    // the second run profits from dictionary entries expanded during the first one
+    for (int i = 0; i < 2; i++) {
+        str::Str<char> data;
+        Timer t2;
+        bool ok = mobiDoc->DecompressHuffDicRecords(data);
+        double timeMs = t2.Stop();
+        if (!ok || data.Size() != ref.Size() || memcmp(data.Get(), ref.Get(), ref.Size()) != 0) {
+            printf(" error: HuffDic decoders don't agree\n");
+            return;
+        }
+        printf(" HuffDic decoder: %.2f MB/s\n", MBPerSec(data.Size(), timeMs));
+    }
+}
+
 static void MobiTestFile(const WCHAR *filePath)
 {
     wprintf(L"Testing file '%s'\n", filePath);
@@ -166,6 +204,9 @@ static void MobiTestFile(const WCHAR *filePath)
         return;
     }
 
+    if (gTestHuffDic)
+        MobiTestHuffDic(mobiDoc);
+
     if (gLayout) {
         Timer t;
         MobiLayout(mobiDoc);
@@ -219,6 +260,299 @@ static void MobiTest(WCHAR *dirOrFile)
         MobiTestDir(dirOrFile);
 }
 
+static void AppendBE16(str::Str<char>& s, uint16 v)
+{
+    s.Append((char)(v >> 8));
+    s.Append((char)v);
+}
+
+static void AppendBE32(str::Str<char>& s, uint32 v)
+{
+    AppendBE16(s, (uint16)(v >> 16));
+    AppendBE16(s, (uint16)v);
+}
+
+// creates a minimal Mobipocket document from already compressed text records
+// (and the HUFF and CDIC records needed for HuffDic compression)
+static MobiDoc *CreateTestMobiDoc(uint16 compression, size_t textLen, Vec<str::Str<char> *>& textRecs, Vec<str::Str<char> *>& huffRecs)
+{
+    str::Str<char> rec0;
+    // PalmDOC header
+    AppendBE16(rec0, compression);
+    AppendBE16(rec0, 0);
+    AppendBE32(rec0, (uint32)textLen);
+    AppendBE16(rec0, (uint16)textRecs.Count());
+    AppendBE16(rec0, 4096);
+    AppendBE32(rec0, 0); // no encryption
+    // MOBI header (only up to exthFlags)
+    uint32 huffFirstRec = huffRecs.Count() > 0 ? (uint32)(1 + textRecs.Count()) : 0;
+    uint32 mobiHdr[] = {
+        116, 2, CP_UTF8, 1, 6, (uint32)-1, (uint32)-1, (uint32)-1, (uint32)-1,
+        (uint32)-1, (uint32)-1, (uint32)-1, (uint32)-1, (uint32)-1, (uint32)-1,
+        (uint32)-1, 0, 0, 1033, 0, 0, 6, (uint32)-1 /* no images */,
+        huffFirstRec, (uint32)huffRecs.Count(), 0, 0, 0 /* no EXTH */
+    };
+    rec0.Append("MOBI", 4);
+    for (size_t i = 0; i < dimof(mobiHdr); i++) {
+        AppendBE32(rec0, mobiHdr[i]);
+    }
+    while (rec0.Size() < 16 + 232) {
+        rec0.Append('\0');
+    }
+
+    Vec<str::Str<char> *> recs;
+    recs.Append(&rec0);
+    recs.Append(textRecs.LendData(), textRecs.Count());
+    recs.Append(huffRecs.LendData(), huffRecs.Count());
+
+    str::Str<char> pdb;
+    pdb.Append("Test", 4);
+    while (pdb.Size() < 60) {
+        pdb.Append('\0');
+    }
+    pdb.Append("BOOKMOBI", 8);
+    AppendBE32(pdb, 0);
+    AppendBE32(pdb, 0);
+    AppendBE16(pdb, (uint16)recs.Count());
+    uint32 offset = (uint32)(pdb.Size() + recs.Count() * 8);
+    for (size_t i = 0; i < recs.Count(); i++) {
+        AppendBE32(pdb, offset);
+        AppendBE32(pdb, (uint32)i);
+        offset += (uint32)recs.At(i)->Size();
+    }
+    for (size_t i = 0; i < recs.Count(); i++) {
+        pdb.Append(recs.At(i)->Get(), recs.At(i)->Size());
+    }
+
+    ScopedComPtr<IStream> stream(CreateStreamFromData(pdb.Get(), pdb.Size()));
+    if (!stream)
+        return NULL;
+    return MobiDoc::CreateFromStream(stream);
+}
+
+#define kLazyTestRecordCount 64
+// the first page and 32 KB of lookahead fit into this many 4 KB records
+#define kLazyTestMaxFirstPageRecords 12
+
+// creates an uncompressed document of 64 text records with its ToC at tocPos
+static MobiDoc *CreateLazyTestMobiDoc(uint32 tocPos)
+{
+    str::Str<char> text;
+    text.AppendFmt("<html><head><guide><reference type=\"toc\" filepos=%u /></guide></head><body>", tocPos);
+    for (int i = 0; text.Size() < kLazyTestRecordCount * 4096; i++) {
+        text.AppendFmt("<p>Paragraph %d: Lorem ipsum dolor sit amet, consectetur adipiscing elit.</p>", i);
+    }
+
+    // records end in the middle of words and tags
+    Vec<str::Str<char> *> textRecs, huffRecs;
+    for (size_t i = 0; i < kLazyTestRecordCount; i++) {
+        str::Str<char> *rec = new str::Str<char>();
+        rec->Append(text.Get() + i * 4096, 4096);
+        textRecs.Append(rec);
+    }
+    MobiDoc *doc = CreateTestMobiDoc(1 /* no compression */, kLazyTestRecordCount * 4096, textRecs, huffRecs);
+    DeleteVecMembers(textRecs);
+    return doc;
+}
+
+// checks that laying out the first page doesn't decompress the whole text
+static bool MobiTestLazyText()
+{
+    MobiDoc *doc = CreateLazyTestMobiDoc(200000);
+    if (!doc) {
+        printf(" error: failed to create the lazy test document\n");
+        return false;
+    }
+
+    PoolAllocator textAllocator;
+    HtmlFormatterArgs args;
+    args.pageDx = 640;
+    args.pageDy = 480;
+    args.SetFontName(L"Tahoma");
+    args.fontSize = 12;
+    args.htmlStr = doc->GetHtmlDataPrefix(0, args.htmlStrLen);
+    args.textAllocator = &textAllocator;
+
+    MobiFormatter mf(&args, doc);
+    HtmlPage *page = mf.Next();
+    size_t decompressed = doc->GetDecompressedRecordCount();
+    printf(" lazy text: %d of %d records decompressed for the first page\n", (int)decompressed, kLazyTestRecordCount);
+    bool ok = page != NULL && decompressed <= kLazyTestMaxFirstPageRecords;
+    delete page;
+    if (!ok)
+        printf(" error: too many records decompressed for the first page\n");
+
+    // the ToC's position is checked against the decompressed text
+    if (!doc->HasToc()) {
+        printf(" error: ToC within the text not found\n");
+        ok = false;
+    }
+    delete doc;
+
+    doc = CreateLazyTestMobiDoc(300000);
+    if (!doc || doc->HasToc()) {
+        printf(" error: ToC beyond the end of the text accepted\n");
+        ok = false;
+    }
+    delete doc;
+    return ok;
+}
+
+// HuffDic test dictionary: all codes are 8 bits long and the byte b stands
+// for entry 255 - b. An entry is either literal text or a HuffDic compressed
+// sequence of other entries
+struct HuffDicTestEntry {
+    const char *literal;
+    int refs[4]; // terminated by -1
+};
+
+static HuffDicTestEntry gHuffDicTestEntries[] = {
+    { "<p>" }, { "</p>" }, { "Hello" }, { " " }, { "world" },
+    { NULL, { 2, 3, 4, -1 } },  // 5: "Hello world"
+    { NULL, { 0, 5, 1, -1 } },  // 6: "<p>Hello world</p>" (nested)
+    { NULL, { 7, -1 } },        // 7: refers to itself (invalid)
+    { NULL, { 6, 7, -1 } },     // 8: valid start, invalid end
+};
+
+static void AppendHuffDicCodes(str::Str<char>& s, const int *entries)
+{
+    for (; *entries >= 0; entries++) {
+        s.Append((char)(255 - *entries));
+    }
+}
+
+static str::Str<char> *CreateHuffDicTestRecord(const int *entries)
+{
+    str::Str<char> *rec = new str::Str<char>();
+    AppendHuffDicCodes(*rec, entries);
+    return rec;
+}
+
+static void CreateHuffDicTestTables(Vec<str::Str<char> *>& huffRecs)
+{
+    str::Str<char> *huff = new str::Str<char>();
+    huff->Append("HUFF", 4);
+    AppendBE32(*huff, 24);
+    AppendBE32(*huff, 24);
+    AppendBE32(*huff, 24 + 1024);
+    AppendBE32(*huff, 24 + 1024 + 256);
+    AppendBE32(*huff, 24 + 1024 + 256 + 1024);
+    // all codes are terminal after 8 bits
+    for (int i = 0; i < 256; i++) {
+        AppendBE32(*huff, (255 << 8) | 0x80 | 8);
+    }
+    while (huff->Size() < 24 + 2 * 1024 + 2 * 256) {
+        huff->Append('\0');
+    }
+    huffRecs.Append(huff);
+
+    str::Str<char> *cdic = new str::Str<char>();
+    cdic->Append("CDIC", 4);
+    AppendBE32(*cdic, 16);
+    AppendBE32(*cdic, 0);
+    AppendBE32(*cdic, 8);
+    str::Str<char> entries;
+    for (size_t i = 0; i < dimof(gHuffDicTestEntries); i++) {
+        AppendBE16(*cdic, (uint16)(512 + entries.Size()));
+        str::Str<char> data;
+        if (gHuffDicTestEntries[i].literal)
+            data.Append(gHuffDicTestEntries[i].literal);
+        else
+            AppendHuffDicCodes(data, gHuffDicTestEntries[i].refs);
+        AppendBE16(entries, (uint16)data.Size() | (gHuffDicTestEntries[i].literal ? 0x8000 : 0));
+        entries.Append(data.Get(), data.Size());
+    }
+    // all unused codes are empty literals
+    for (size_t i = dimof(gHuffDicTestEntries); i < 256; i++) {
+        AppendBE16(*cdic, (uint16)(512 + entries.Size()));
+    }
+    AppendBE16(entries, 0x8000);
+    cdic->Append(entries.Get(), entries.Size());
+    huffRecs.Append(cdic);
+}
+
+static bool EqData(str::Str<char>& data, const char *expected)
+{
+    return data.Size() == str::Len(expected) && memeq(data.Get(), expected, data.Size());
+}
+
+// checks both HuffDic decoders against a small built-in dictionary
+static bool MobiTestHuffDicBuiltin()
+{
+    static const int rec1[] = { 6, 6, 5, 3, 2, -1 };
+    static const int rec2[] = { 6, -1 };
+    static const int recInvalid[] = { 8, -1 };
+    const char *expected = "<p>Hello world</p><p>Hello world</p>Hello world Hello<p>Hello world</p>";
+
+    Vec<str::Str<char> *> textRecs, huffRecs;
+    CreateHuffDicTestTables(huffRecs);
+    textRecs.Append(CreateHuffDicTestRecord(rec1));
+    textRecs.Append(CreateHuffDicTestRecord(rec2));
+    MobiDoc *doc = CreateTestMobiDoc(17480 /* HuffDic */, str::Len(expected), textRecs, huffRecs);
+    DeleteVecMembers(textRecs);
+    if (!doc) {
+        printf(" error: failed to create the HuffDic test document\n");
+        DeleteVecMembers(huffRecs);
+        return false;
+    }
+
+    bool ok = true;
+    str::Str<char> ref;
+    if (!doc->DecompressHuffDicRecords(ref, true) || !EqData(ref, expected)) {
+        printf(" error: reference HuffDic decoder failed\n");
+        ok = false;
+    }
+    // the second run uses the dictionary entries expanded during the first one
+    for (int i = 0; i < 2; i++) {
+        str::Str<char> data;
+        if (!doc->DecompressHuffDicRecords(data) || !EqData(data, expected)) {
+            printf(" error: HuffDic decoder failed\n");
+            ok = false;
+        }
+    }
+    size_t len;
+    const char *html = doc->GetHtmlData(len);
+    if (len != str::Len(expected) || !memeq(html, expected, len)) {
+        printf(" error: decompressed HuffDic text differs\n");
+        ok = false;
+    }
+    delete doc;
+
+    // an entry which refers to itself must fail to decode, but the
+    // text before the broken record must still be shown
+    textRecs.Append(CreateHuffDicTestRecord(rec2));
+    textRecs.Append(CreateHuffDicTestRecord(recInvalid));
+    doc = CreateTestMobiDoc(17480 /* HuffDic */, 2 * str::Len("<p>Hello world</p>"), textRecs, huffRecs);
+    DeleteVecMembers(textRecs);
+    DeleteVecMembers(huffRecs);
+    if (!doc) {
+        printf(" error: failed to create the broken HuffDic test document\n");
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        str::Str<char> data;
+        if (doc->DecompressHuffDicRecords(data, 0 == i)) {
+            printf(" error: recursive HuffDic entry not detected\n");
+            ok = false;
+        }
+    }
+    html = doc->GetHtmlData(len);
+    if (len != str::Len("<p>Hello world</p>") || !memeq(html, "<p>Hello world</p>", len)) {
+        printf(" error: text before the broken HuffDic record differs\n");
+        ok = false;
+    }
+    delete doc;
+    return ok;
+}
+
+static void MobiBuiltinTest()
+{
+    printf("Testing built-in mobi documents\n");
+    bool ok = MobiTestLazyText();
+    ok = MobiTestHuffDicBuiltin() && ok;
+    printf(ok ? " passed\n" : " failed\n");
+}
+
 // we assume this is called from main sumatradirectory, e.g. as:
 // ./obj-dbg/tester.exe, so we use the known files 
 void ZipCreateTest()
@@ -270,6 +604,12 @@ int TesterMain()
         } else if (str::Eq(argv[i], L"-layout")) {
             gLayout = true;
             ++i;
+        } else if (str::Eq(argv[i], L"-huffdic")) {
+            gTestHuffDic = true;
+            ++i;
+        } else if (str::Eq(argv[i], L"-mobi-builtin")) {
+            gMobiBuiltinTest = true;
+            ++i;
         } else if (str::Eq(argv[i], L"-save-html")) {
             gSaveHtml = true;
             ++i;
@@ -295,6 +635,9 @@ int TesterMain()
     if (mobiTest) {
         MobiTest(dirOrFile);
     }
+    if (gMobiBuiltinTest) {
+        MobiBuiltinTest();
+    }
 
     mui::Destroy();
     system("pause");
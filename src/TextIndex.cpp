@@ -0,0 +1,201 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "TextIndex.h"
+
+#include "FileUtil.h"
+#include "TextSelection.h"
+
+#define TEXT_INDEX_MAGIC        "SPTI"
+#define TEXT_INDEX_VERSION      2
+
+// number of bits set in the Bloom filter for each trigram
+#define BLOOM_HASH_COUNT        3
+// minimal filter bits per (not necessarily unique) trigram: the rate of false
+// positives for a single trigram is (1 - e^(-3/4))^3, i.e. about 15% at worst
+// and about 3% for filters rounded up to twice the size (the more trigrams
+// a word has, the less likely a false positive for the entire word)
+#define BLOOM_BITS_PER_TRIGRAM  4
+// filter size limits in 32-bit words
+#define BLOOM_MIN_WORDS         2
+#define BLOOM_MAX_WORDS         (64 * 1024 / 32)
+
+// only trigrams of characters matched by TextSearch's anchors are indexed
+#define isindexchar(c) (iswordchar(c) && (unsigned short)(c) < 0x2E80)
+
+static inline uint32 HashTrigram(const WCHAR *s)
+{
+    return MurmurHash2(s, 3 * sizeof(WCHAR));
+}
+
+// derives the n-th bit position from a single hash (double hashing)
+static inline uint32 BloomBit(uint32 hash, uint32 n, uint32 words)
+{
+    uint32 hash2 = (hash >> 17) | (hash << 15) | 1;
+    return (hash + n * hash2) & (words * 32 - 1);
+}
+
+PageTextIndex::PageTextIndex(int pageCount, int64 fileSize, FILETIME fileTime) :
+    pageCount(pageCount), indexedCount(0), modified(false), fileSize(fileSize), fileTime(fileTime)
+{
+    filters = AllocArray<uint32 *>(pageCount);
+    filterSizes = AllocArray<uint32>(pageCount);
+    InitializeCriticalSection(&access);
+}
+
+PageTextIndex::~PageTextIndex()
+{
+    for (int i = 0; i < pageCount; i++) {
+        free(filters[i]);
+    }
+    free(filters);
+    free(filterSizes);
+    DeleteCriticalSection(&access);
+}
+
+bool PageTextIndex::IsComplete()
+{
+    ScopedCritSec scope(&access);
+    return indexedCount == pageCount;
+}
+
+bool PageTextIndex::IsModified()
+{
+    ScopedCritSec scope(&access);
+    return modified;
+}
+
+void PageTextIndex::AddPage(int pageNo, const WCHAR *text)
+{
+    if (pageNo < 1 || pageNo > pageCount || !text)
+        return;
+    {
+        ScopedCritSec scope(&access);
+        if (filters[pageNo - 1])
+            return;
+    }
+
+    // lower-case the same way as TextSearch::MatchLen (i.e. one character at a time)
+    ScopedMem<WCHAR> lower(str::Dup(text));
+    size_t len = str::Len(lower);
+    CharLowerBuff(lower, (DWORD)len);
+
+    size_t trigrams = 0;
+    for (size_t i = 2; i < len; i++) {
+        if (isindexchar(lower[i]) && isindexchar(lower[i - 1]) && isindexchar(lower[i - 2]))
+            trigrams++;
+    }
+    size_t words = RoundToPowerOf2(trigrams * BLOOM_BITS_PER_TRIGRAM / 32 + 1);
+    words = limitValue(words, (size_t)BLOOM_MIN_WORDS, (size_t)BLOOM_MAX_WORDS);
+
+    uint32 *filter = AllocArray<uint32>(words);
+    for (size_t i = 2; i < len; i++) {
+        if (!isindexchar(lower[i]) || !isindexchar(lower[i - 1]) || !isindexchar(lower[i - 2]))
+            continue;
+        uint32 hash = HashTrigram(lower + i - 2);
+        for (uint32 n = 0; n < BLOOM_HASH_COUNT; n++) {
+            uint32 bit = BloomBit(hash, n, (uint32)words);
+            filter[bit / 32] |= 1u << (bit % 32);
+        }
+    }
+
+    ScopedCritSec scope(&access);
+    if (filters[pageNo - 1]) {
+        free(filter);
+        return;
+    }
+    filters[pageNo - 1] = filter;
+    filterSizes[pageNo - 1] = (uint32)words;
+    indexedCount++;
+    modified = true;
+}
+
+bool PageTextIndex::MightContain(int pageNo, const WCHAR *word)
+{
+    size_t len = str::Len(word);
+    if (pageNo < 1 || pageNo > pageCount || len < 3)
+        return true;
+
+    ScopedMem<WCHAR> lower(str::Dup(word));
+    CharLowerBuff(lower, (DWORD)len);
+
+    ScopedCritSec scope(&access);
+    uint32 *filter = filters[pageNo - 1];
+    if (!filter)
+        return true;
+    uint32 words = filterSizes[pageNo - 1];
+    for (size_t i = 2; i < len; i++) {
+        if (!isindexchar(lower[i]) || !isindexchar(lower[i - 1]) || !isindexchar(lower[i - 2]))
+            continue;
+        uint32 hash = HashTrigram(lower + i - 2);
+        for (uint32 n = 0; n < BLOOM_HASH_COUNT; n++) {
+            uint32 bit = BloomBit(hash, n, words);
+            if (!(filter[bit / 32] & (1u << (bit % 32))))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* serialized format (all numbers are little-endian uint32):
+   magic, version, page count, the file's size (low and high part) and
+   modification time (low and high part), then for every page the filter's
+   size in 32-bit words (0 if the page hasn't been indexed) followed by the filter */
+
+char *PageTextIndex::Serialize(size_t *lenOut)
+{
+    ScopedCritSec scope(&access);
+    str::Str<char> data;
+    uint32 header[] = { TEXT_INDEX_VERSION, (uint32)pageCount,
+                        (uint32)fileSize, (uint32)((uint64)fileSize >> 32),
+                        fileTime.dwLowDateTime, fileTime.dwHighDateTime };
+    data.Append(TEXT_INDEX_MAGIC, 4);
+    data.Append((const char *)header, sizeof(header));
+    for (int i = 0; i < pageCount; i++) {
+        uint32 words = filters[i] ? filterSizes[i] : 0;
+        data.Append((const char *)&words, sizeof(words));
+        if (words)
+            data.Append((const char *)filters[i], words * sizeof(uint32));
+    }
+    modified = false;
+    if (lenOut)
+        *lenOut = data.Size();
+    return data.StealData();
+}
+
+PageTextIndex *PageTextIndex::Deserialize(const char *data, size_t len, int pageCount,
+                                          int64 fileSize, FILETIME fileTime)
+{
+    uint32 header[6];
+    if (len < 4 + sizeof(header) || !str::StartsWith(data, TEXT_INDEX_MAGIC))
+        return NULL;
+    memcpy(header, data + 4, sizeof(header));
+    if (header[0] != TEXT_INDEX_VERSION || header[1] != (uint32)pageCount)
+        return NULL;
+    FILETIME indexedTime = { header[4], header[5] };
+    if (((uint64)header[3] << 32 | header[2]) != (uint64)fileSize || !FileTimeEq(indexedTime, fileTime))
+        return NULL;
+
+    ScopedPtr<PageTextIndex> index(new PageTextIndex(pageCount, fileSize, fileTime));
+    size_t offset = 4 + sizeof(header);
+    for (int i = 0; i < pageCount; i++) {
+        uint32 words;
+        if (len - offset < sizeof(words))
+            return NULL;
+        memcpy(&words, data + offset, sizeof(words));
+        offset += sizeof(words);
+        if (0 == words)
+            continue;
+        if (words > BLOOM_MAX_WORDS || (words & (words - 1)) != 0 || len - offset < words * sizeof(uint32))
+            return NULL;
+        index->filters[i] = AllocArray<uint32>(words);
+        memcpy(index->filters[i], data + offset, words * sizeof(uint32));
+        index->filterSizes[i] = words;
+        index->indexedCount++;
+        offset += words * sizeof(uint32);
+    }
+    if (offset != len)
+        return NULL;
+    return index.Detach();
+}
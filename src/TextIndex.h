@@ -0,0 +1,61 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef TextIndex_h
+#define TextIndex_h
+
+/* A PageTextIndex summarizes every page's text as a Bloom filter of the
+page's (lower-cased) trigrams of word characters. This allows TextSearch
+to skip pages which can't contain a word without extracting their text.
+
+The index is built while searching (i.e. once all pages have been
+searched at least once) and can be saved to disk, so that searches in
+later sessions only have to extract the text of candidate pages (whether
+those actually contain the search text is still determined by
+TextSearch). Words shorter than three characters can't be looked up.
+
+A saved index is only used for the exact same version of the file, i.e.
+for a file with the same size and modification time.
+*/
+
+class PageTextIndex {
+    int         pageCount;
+    // Bloom filter for each page (NULL if the page hasn't been indexed yet)
+    uint32 **   filters;
+    // size of each filter in 32-bit words (always a power of 2)
+    uint32 *    filterSizes;
+    int         indexedCount;
+    bool        modified;
+    // identifies the version of the indexed file
+    int64       fileSize;
+    FILETIME    fileTime;
+
+    // AddPage is called by the searching thread while other
+    // search threads might call MightContain
+    CRITICAL_SECTION access;
+
+public:
+    PageTextIndex(int pageCount, int64 fileSize, FILETIME fileTime);
+    ~PageTextIndex();
+
+    int PageCount() const { return pageCount; }
+    // true if all pages have been indexed
+    bool IsComplete();
+    // true if pages have been added since creation resp. deserialization
+    bool IsModified();
+
+    // indexes a page's text (unless it's already been indexed)
+    void AddPage(int pageNo, const WCHAR *text);
+    // returns false if the page has been indexed and doesn't contain the word
+    // (ignoring case); returns true for all words shorter than three characters
+    bool MightContain(int pageNo, const WCHAR *word);
+
+    // caller must free() the result
+    char *Serialize(size_t *lenOut);
+    // returns NULL if data isn't a valid index for a document with pageCount pages
+    // or if it's been created for a file of a different size or modification time
+    static PageTextIndex *Deserialize(const char *data, size_t len, int pageCount,
+                                      int64 fileSize, FILETIME fileTime);
+};
+
+#endif
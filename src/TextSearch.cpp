@@ -4,8 +4,15 @@
 #include "BaseUtil.h"
 #include "TextSearch.h"
 
+#include "TextIndex.h"
+#include "ThreadUtil.h"
+
 enum { SEARCH_PAGE, SKIP_PAGE };
 
+// number of pages to search without a match before continuing in parallel
+#define PARALLEL_SEARCH_MIN_PAGES   16
+#define MAX_SEARCH_THREADS          4
+
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
 // ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
 // cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
@@ -16,15 +23,24 @@ TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache) :
     findText(NULL), anchor(NULL), pageText(NULL),
     caseSensitive(false), forward(true),
     matchWordStart(false), matchWordEnd(false),
-    findPage(0), findIndex(0), lastText(NULL)
+    findPage(0), findIndex(0), lastText(NULL), textIndex(NULL)
 {
-    findCache = AllocArray<BYTE>(this->engine->PageCount());
+    findCacheCount = this->engine->PageCount();
+    findCache = AllocArray<BYTE>(findCacheCount);
 }
 
 TextSearch::~TextSearch()
 {
     Clear();
     free(findCache);
+    delete textIndex;
+}
+
+void TextSearch::SetTextIndex(PageTextIndex *index)
+{
+    CrashIf(index && index->PageCount() != engine->PageCount());
+    delete textIndex;
+    textIndex = index;
 }
 
 void TextSearch::Reset()
@@ -73,7 +89,7 @@ void TextSearch::SetText(const WCHAR *text)
     if (str::EndsWith(this->findText, L" "))
         this->findText[str::Len(this->findText) - 1] = '\0';
 
-    memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
+    memset(this->findCache, SEARCH_PAGE, this->findCacheCount);
 }
 
 void TextSearch::SetSensitive(bool sensitive)
@@ -82,7 +98,7 @@ void TextSearch::SetSensitive(bool sensitive)
         return;
     this->caseSensitive = sensitive;
 
-    memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
+    memset(this->findCache, SEARCH_PAGE, this->findCacheCount);
 }
 
 void TextSearch::SetDirection(TextSearchDirection direction)
@@ -109,13 +125,13 @@ void TextSearch::SetLastResult(TextSelection *sel)
     forward = true;
 }
 
-// try to match "findText" from "start" with whitespace tolerance
+// try to match "findText" from "start" (within "text") with whitespace tolerance
 // (ignore all whitespace except after alphanumeric characters)
-int TextSearch::MatchLen(const WCHAR *start) const
+int TextSearch::MatchLen(const WCHAR *text, const WCHAR *start) const
 {
     const WCHAR *match = findText, *end = start;
 
-    if (matchWordStart && start > pageText && iswordchar(start[-1]) && iswordchar(start[0]))
+    if (matchWordStart && start > text && iswordchar(start[-1]) && iswordchar(start[0]))
         return -1;
 
     if (!match)
@@ -151,12 +167,36 @@ int TextSearch::MatchLen(const WCHAR *start) const
         }
     }
 
-    if (matchWordEnd && end > pageText && iswordchar(end[-1]) && iswordchar(end[0]))
+    if (matchWordEnd && end > text && iswordchar(end[-1]) && iswordchar(end[0]))
         return -1;
 
     return (int)(end - start);
 }
 
+bool TextSearch::HasMatch(const WCHAR *text) const
+{
+    if (str::IsEmpty(findText))
+        return false;
+
+    for (const WCHAR *s = text; *s; s++) {
+        if (anchor)
+            s = (caseSensitive ? StrStr : StrStrI)(s, anchor);
+        if (!s)
+            return false;
+        if (MatchLen(text, s) > 0)
+            return true;
+    }
+    return false;
+}
+
+bool TextSearch::IndexMightMatch(int pageNo) const
+{
+    // the index only knows about words (and TextSearch's anchor is the first word)
+    if (!textIndex || !anchor)
+        return true;
+    return textIndex->MightContain(pageNo, anchor);
+}
+
 static const WCHAR *GetNextIndex(const WCHAR *base, int offset, bool forward)
 {
     const WCHAR *c = base + offset + (forward ? 0 : -1);
@@ -185,7 +225,7 @@ bool TextSearch::FindTextInPage(int pageNo)
         if (!found)
             return false;
         findIndex = (int)(found - pageText) + (forward ? 1 : 0);
-        length = MatchLen(found);
+        length = MatchLen(pageText, found);
     } while (length <= 0);
 
     int offset = (int)(found - pageText);
@@ -200,33 +240,195 @@ bool TextSearch::FindTextInPage(int pageNo)
     return true;
 }
 
+// makes room for pages which have been layed out in the background
+// since the last call and returns the current page count
+int TextSearch::UpdateFindCache()
+{
+    int pageCount = engine->PageCount();
+    if (pageCount > findCacheCount) {
+        BYTE *newCache = (BYTE *)realloc(findCache, pageCount);
+        CrashIf(!newCache); // TODO: use infallible realloc
+        memset(newCache + findCacheCount, SEARCH_PAGE, pageCount - findCacheCount);
+        findCache = newCache;
+        findCacheCount = pageCount;
+    }
+    return pageCount;
+}
+
+enum { Page_Unclaimed, Page_Claimed, Page_NoMatch, Page_Match };
+
+class SearchThread : public ThreadBase {
+    ParallelSearch *search;
+
+public:
+    explicit SearchThread(ParallelSearch *search) :
+        ThreadBase("SearchThread"), search(search) { }
+    virtual ~SearchThread() { }
+
+    bool IsCancelled() { return WasCancelRequested(); }
+
+    virtual void Run();
+};
+
+// Engines mostly serialize text extraction, so helper threads extract and
+// scan the pages ahead of the search position using their own clones of the
+// engine (filling the shared PageTextCache). The searching thread still goes
+// through the pages in order (so that results are found in page order), but
+// skips the pages the helpers haven't found a match on. Pages the helpers
+// haven't gotten to yet are searched as usual.
+class ParallelSearch {
+    TextSearch *search;
+    int startPage, count;
+    bool forward;
+    // one of Page_* for each page from startPage on (in search direction)
+    LONG *states;
+    // index of the next page for a helper to claim
+    LONG nextIdx;
+    // signaled whenever a helper is done with a page
+    HANDLE progressEvent;
+    Vec<SearchThread *> threads;
+
+    int PageNoAt(int idx) const { return forward ? startPage + idx : startPage - idx; }
+
+public:
+    ParallelSearch(TextSearch *search, int startPage, int total);
+    ~ParallelSearch();
+
+    // returns false if a helper hasn't found a match on pageNo
+    // (waits for the helper, if it's currently at that page,
+    // unless the search is canceled through tracker)
+    bool MightMatch(int pageNo, ProgressUpdateUI *tracker);
+
+    void SearchPages(SearchThread *thread);
+};
+
+void SearchThread::Run()
+{
+    search->SearchPages(this);
+}
+
+ParallelSearch::ParallelSearch(TextSearch *search, int startPage, int total) :
+    search(search), startPage(startPage), forward(search->forward), nextIdx(0)
+{
+    count = forward ? total - startPage + 1 : startPage;
+    states = AllocArray<LONG>(std::max(count, 0));
+    progressEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    int threadCount = std::min(GetProcessorCount() - 1, MAX_SEARCH_THREADS);
+    for (int i = 0; i < threadCount; i++) {
+        SearchThread *thread = new SearchThread(this);
+        thread->Start();
+        threads.Append(thread);
+    }
+}
+
+ParallelSearch::~ParallelSearch()
+{
+    for (size_t i = 0; i < threads.Count(); i++) {
+        threads.At(i)->RequestCancel();
+    }
+    for (size_t i = 0; i < threads.Count(); i++) {
+        bool ok = threads.At(i)->Join();
+        CrashIf(!ok);
+        delete threads.At(i);
+    }
+    CloseHandle(progressEvent);
+    free(states);
+}
+
+bool ParallelSearch::MightMatch(int pageNo, ProgressUpdateUI *tracker)
+{
+    int idx = forward ? pageNo - startPage : startPage - pageNo;
+    if (idx < 0 || idx >= count)
+        return true;
+    // if no helper has claimed this page yet, the caller searches it
+    if (InterlockedCompareExchange(&states[idx], Page_Claimed, Page_Unclaimed) == Page_Unclaimed)
+        return true;
+    while (Page_Claimed == states[idx]) {
+        if (tracker && tracker->WasCanceled())
+            return true;
+        WaitForSingleObject(progressEvent, 100);
+    }
+    return states[idx] != Page_NoMatch;
+}
+
+void ParallelSearch::SearchPages(SearchThread *thread)
+{
+    BaseEngine *engine = search->engine->Clone();
+    if (!engine)
+        return;
+
+    while (!thread->IsCancelled()) {
+        LONG idx = InterlockedIncrement(&nextIdx) - 1;
+        if (idx >= count)
+            break;
+        if (InterlockedCompareExchange(&states[idx], Page_Claimed, Page_Unclaimed) != Page_Unclaimed)
+            continue;
+        if (!search->IndexMightMatch(PageNoAt(idx))) {
+            InterlockedExchange(&states[idx], Page_NoMatch);
+            SetEvent(progressEvent);
+            continue;
+        }
+        const WCHAR *text = search->textCache->GetData(PageNoAt(idx), NULL, NULL, engine);
+        InterlockedExchange(&states[idx], text && search->HasMatch(text) ? Page_Match : Page_NoMatch);
+        SetEvent(progressEvent);
+    }
+
+    delete engine;
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
 {
     if (str::IsEmpty(findText))
         return false;
 
-    int total = engine->PageCount();
+    int total = UpdateFindCache();
+    ScopedPtr<ParallelSearch> parallel;
+    int searched = 0;
     while (1 <= pageNo && pageNo <= total && (!tracker || !tracker->WasCanceled())) {
         if (tracker)
             tracker->UpdateProgress(pageNo, total);
 
-        if (SKIP_PAGE == findCache[pageNo - 1]) {
-            pageNo += forward ? 1 : -1;
-            continue;
-        }
-
-        Reset();
-
-        pageText = textCache->GetData(pageNo, &findIndex);
-        if (pageText) {
-            if (forward)
-                findIndex = 0;
-            if (FindTextInPage(pageNo))
-                return true;
+        if (SKIP_PAGE != findCache[pageNo - 1] && !IndexMightMatch(pageNo))
+            findCache[pageNo - 1] = SKIP_PAGE;
+        if (SKIP_PAGE != findCache[pageNo - 1] && parallel && !parallel->MightMatch(pageNo, tracker)) {
             findCache[pageNo - 1] = SKIP_PAGE;
+            if (textIndex)
+                textIndex->AddPage(pageNo, textCache->GetData(pageNo));
+        }
+        // don't start extracting the page's text if the search was canceled
+        // while waiting for a helper
+        if (tracker && tracker->WasCanceled())
+            break;
+
+        if (SKIP_PAGE != findCache[pageNo - 1]) {
+            Reset();
+
+            pageText = textCache->GetData(pageNo, &findIndex);
+            if (textIndex)
+                textIndex->AddPage(pageNo, pageText);
+            if (pageText) {
+                if (forward)
+                    findIndex = 0;
+                if (FindTextInPage(pageNo))
+                    return true;
+                findCache[pageNo - 1] = SKIP_PAGE;
+            }
+            searched++;
         }
 
         pageNo += forward ? 1 : -1;
+        // only pay for cloning the engine when searching for a rare text
+        if (!parallel && PARALLEL_SEARCH_MIN_PAGES == searched && 1 <= pageNo && pageNo <= total &&
+            engine->SupportsParallelTextExtraction() && !engine->IsLayoutPending() &&
+            GetProcessorCount() > 1) {
+            parallel = new ParallelSearch(this, pageNo, total);
+        }
+        if (pageNo > total && engine->IsLayoutPending()) {
+            // continue with the pages still being layed out
+            engine->WaitForPages(pageNo);
+            total = UpdateFindCache();
+        }
     }
 
     // allow for the first/last page to be included in the next search
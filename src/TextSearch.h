@@ -6,6 +6,8 @@
 
 #include "TextSelection.h"
 
+class PageTextIndex;
+
 enum TextSearchDirection {
     FIND_BACKWARD = false,
     FIND_FORWARD  = true
@@ -19,8 +21,12 @@ public:
     virtual ~ProgressUpdateUI() { }
 };
 
+class ParallelSearch;
+
 class TextSearch : public TextSelection
 {
+    friend ParallelSearch;
+
 public:
     TextSearch(BaseEngine *engine, PageTextCache *textCache);
     ~TextSearch();
@@ -34,6 +40,12 @@ public:
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const { return findPage; }
 
+    // the index allows to skip pages without extracting their text
+    // and is updated with the text of all searched pages
+    // (takes ownership of index)
+    void SetTextIndex(PageTextIndex *index);
+    PageTextIndex *GetTextIndex() const { return textIndex; }
+
 protected:
     WCHAR *findText;
     WCHAR *anchor;
@@ -49,7 +61,12 @@ protected:
     void SetText(const WCHAR *text);
     bool FindTextInPage(int pageNo = 0);
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker);
-    int MatchLen(const WCHAR *start) const;
+    int UpdateFindCache();
+    int MatchLen(const WCHAR *text, const WCHAR *start) const;
+    // doesn't modify any state, so that it can be called on several threads
+    bool HasMatch(const WCHAR *text) const;
+    // returns false if the text index rules out a match on pageNo
+    bool IndexMightMatch(int pageNo) const;
 
     void Clear()
     {
@@ -66,6 +83,10 @@ private:
 
     WCHAR *lastText;
     BYTE *findCache;
+    // the engine might lay out further pages in the background
+    int findCacheCount;
+
+    PageTextIndex *textIndex;
 };
 
 #endif
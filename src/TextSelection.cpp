@@ -6,7 +6,7 @@
 
 PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine)
 {
-    int count = engine->PageCount();
+    count = engine->PageCount();
     coords = AllocArray<RectI *>(count);
     text = AllocArray<WCHAR *>(count);
     lens = AllocArray<int>(count);
@@ -21,7 +21,7 @@ PageTextCache::~PageTextCache()
 {
     EnterCriticalSection(&access);
 
-    for (int i = 0; i < engine->PageCount(); i++) {
+    for (int i = 0; i < count; i++) {
         free(coords[i]);
         free(text[i]);
     }
@@ -34,28 +34,69 @@ PageTextCache::~PageTextCache()
     DeleteCriticalSection(&access);
 }
 
+template <typename T>
+static T *GrowArray(T *arr, int count, int newCount)
+{
+    T *newArr = (T *)realloc(arr, sizeof(T) * newCount);
+    CrashIf(!newArr); // TODO: use infallible realloc
+    ZeroMemory(newArr + count, sizeof(T) * (newCount - count));
+    return newArr;
+}
+
+// makes room for pages which have been layed out after this cache's creation
+// (caller must hold access)
+void PageTextCache::EnsureCount(int pageNo)
+{
+    if (pageNo <= count)
+        return;
+    int newCount = engine->PageCount();
+    CrashIf(pageNo > newCount);
+    coords = GrowArray(coords, count, newCount);
+    text = GrowArray(text, count, newCount);
+    lens = GrowArray(lens, count, newCount);
+#ifdef DEBUG
+    debug_size += (newCount - count) * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int));
+#endif
+    count = newCount;
+}
+
 bool PageTextCache::HasData(int pageNo)
 {
     CrashIf(pageNo < 1 || pageNo > engine->PageCount());
-    return text[pageNo - 1] != NULL;
+    ScopedCritSec scope(&access);
+    return pageNo <= count && text[pageNo - 1] != NULL;
 }
 
-const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut)
+const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut, BaseEngine *extractor)
 {
     ScopedCritSec scope(&access);
+    EnsureCount(pageNo);
 
     if (!text[pageNo - 1]) {
-        text[pageNo - 1] = engine->ExtractPageText(pageNo, L"\n", &coords[pageNo - 1]);
-        if (!text[pageNo - 1]) {
+        // don't block other threads while extracting
+        LeaveCriticalSection(&access);
+        RectI *pageCoords = NULL;
+        WCHAR *pageText = (extractor ? extractor : engine)->ExtractPageText(pageNo, L"\n", &pageCoords);
+        EnterCriticalSection(&access);
+
+        // another thread might have extracted the same page in the meantime
+        if (text[pageNo - 1]) {
+            free(pageText);
+            free(pageCoords);
+        }
+        else if (!pageText) {
+            free(pageCoords);
             text[pageNo - 1] = str::Dup(L"");
             lens[pageNo - 1] = 0;
         }
         else {
-            lens[pageNo - 1] = (int)str::Len(text[pageNo - 1]);
-        }
+            text[pageNo - 1] = pageText;
+            coords[pageNo - 1] = pageCoords;
+            lens[pageNo - 1] = (int)str::Len(pageText);
 #ifdef DEBUG
-        debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
+            debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
 #endif
+        }
     }
 
     if (lenOut)
@@ -14,6 +14,8 @@ inline unsigned int distSq(int x, int y) { return x * x + y * y; }
 
 class PageTextCache {
     BaseEngine* engine;
+    // the engine might lay out further pages in the background
+    int         count;
     RectI    ** coords;
     WCHAR    ** text;
     int       * lens;
@@ -23,12 +25,17 @@ class PageTextCache {
 
     CRITICAL_SECTION access;
 
+    void        EnsureCount(int pageNo);
+
 public:
     explicit PageTextCache(BaseEngine *engine);
     ~PageTextCache();
 
     bool HasData(int pageNo);
-    const WCHAR *GetData(int pageNo, int *lenOut=NULL, RectI **coordsOut=NULL);
+    // extractor can be a clone of engine, so that several threads
+    // can extract text at once
+    const WCHAR *GetData(int pageNo, int *lenOut=NULL, RectI **coordsOut=NULL,
+                         BaseEngine *extractor=NULL);
 };
 
 struct TextSel {
@@ -123,6 +123,8 @@ static void BenchRangeTest()
     utassert(IsBenchPagesInfo(L"1-3,4,6-9,13"));
     utassert(IsBenchPagesInfo(L"2-"));
     utassert(IsBenchPagesInfo(L"loadonly"));
+    utassert(IsBenchPagesInfo(L"tiles"));
+    utassert(IsBenchPagesInfo(L"text"));
 
     utassert(!IsBenchPagesInfo(L""));
     utassert(!IsBenchPagesInfo(L"-2"));
@@ -4,6 +4,8 @@
 #include "BaseUtil.h"
 #include "ArchUtil.h"
 
+#include "FileUtil.h"
+
 extern "C" {
 #include <unarr.h>
 }
@@ -13,11 +15,140 @@ extern "C" {
 // fails to open or extract and uses that as a fallback
 #define ENABLE_UNRARDLL_FALLBACK
 
-#ifdef ENABLE_UNRARDLL_FALLBACK
-#include "FileUtil.h"
-#endif
+// entries of solid archives can only be uncompressed in order (uncompressing
+// an entry requires uncompressing all preceding entries first), so they're
+// all uncompressed once and kept in memory - or in a temporary file, once
+// they'd use more than SOLID_CACHE_MAX_MEMORY
+#define SOLID_CACHE_MAX_MEMORY (64 * 1024 * 1024)
+
+class SolidCache {
+    struct Entry {
+        // NULL if the entry isn't cached or has been spilled
+        char *  data;
+        size_t  len;
+        // -1 if the entry isn't in the spill file
+        int64_t spillOffset;
+    };
+
+    Vec<Entry> entries;
+    size_t memoryUsed;
+    HANDLE spillFile;
+    int64_t spillFileSize;
+
+    bool Spill(Entry& e, const char *data, size_t len);
+
+public:
+    // index of the next entry to uncompress in order
+    size_t next;
+
+    explicit SolidCache(size_t count);
+    ~SolidCache();
+
+    // takes ownership of data
+    void Add(size_t idx, char *data, size_t len);
+    // returns a copy of the entry's data (or NULL if it isn't cached)
+    // caller must free() the result
+    char *Get(size_t idx, size_t *len);
+};
+
+SolidCache::SolidCache(size_t count) : memoryUsed(0), spillFile(INVALID_HANDLE_VALUE),
+    spillFileSize(0), next(0)
+{
+    Entry empty = { NULL, 0, -1 };
+    entries.AppendBlanks(count);
+    for (size_t i = 0; i < count; i++) {
+        entries.At(i) = empty;
+    }
+}
+
+SolidCache::~SolidCache()
+{
+    for (size_t i = 0; i < entries.Count(); i++) {
+        free(entries.At(i).data);
+    }
+    if (spillFile != INVALID_HANDLE_VALUE)
+        CloseHandle(spillFile);
+}
+
+bool SolidCache::Spill(Entry& e, const char *data, size_t len)
+{
+    if (INVALID_HANDLE_VALUE == spillFile) {
+        ScopedMem<WCHAR> path(path::GetTempPath(L"Arc"));
+        if (!path)
+            return false;
+        spillFile = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (INVALID_HANDLE_VALUE == spillFile)
+            return false;
+    }
+    if (len > (DWORD)-1)
+        return false;
+
+    LARGE_INTEGER off;
+    off.QuadPart = spillFileSize;
+    DWORD written;
+    if (!SetFilePointerEx(spillFile, off, NULL, FILE_BEGIN) ||
+        !WriteFile(spillFile, data, (DWORD)len, &written, NULL) || written != len) {
+        return false;
+    }
+    e.spillOffset = spillFileSize;
+    e.len = len;
+    spillFileSize += len;
+    return true;
+}
+
+void SolidCache::Add(size_t idx, char *data, size_t len)
+{
+    if (idx >= entries.Count()) {
+        free(data);
+        return;
+    }
+    Entry& e = entries.At(idx);
+    CrashIf(e.data || e.spillOffset != -1);
+    if (memoryUsed + len <= SOLID_CACHE_MAX_MEMORY) {
+        e.data = data;
+        e.len = len;
+        memoryUsed += len;
+        return;
+    }
+    // if spilling fails, the entry will have to be uncompressed again
+    Spill(e, data, len);
+    free(data);
+}
+
+char *SolidCache::Get(size_t idx, size_t *len)
+{
+    if (idx >= entries.Count())
+        return NULL;
+    Entry& e = entries.At(idx);
+    if (!e.data && -1 == e.spillOffset)
+        return NULL;
+
+    ScopedMem<char> data((char *)malloc(e.len + 2));
+    if (!data)
+        return NULL;
+    if (e.data) {
+        memcpy(data, e.data, e.len);
+    }
+    else {
+        LARGE_INTEGER off;
+        off.QuadPart = e.spillOffset;
+        DWORD read;
+        if (!SetFilePointerEx(spillFile, off, NULL, FILE_BEGIN) ||
+            !ReadFile(spillFile, data, (DWORD)e.len, &read, NULL) || read != e.len) {
+            return NULL;
+        }
+    }
+    // zero-terminate for convenience
+    data[e.len] = data[e.len + 1] = '\0';
+
+    if (len)
+        *len = e.len;
+    return data.StealData();
+}
 
-ArchFile::ArchFile(ar_stream *data, ar_archive *(* openFormat)(ar_stream *)) : data(data), ar(NULL)
+ArchFile::ArchFile(ar_stream *data, ar_archive *(* openFormat)(ar_stream *)) :
+    data(data), ar(NULL), solidCache(NULL)
 {
     if (data && openFormat)
         ar = openFormat(data);
@@ -34,6 +165,7 @@ ArchFile::ArchFile(ar_stream *data, ar_archive *(* openFormat)(ar_stream *)) : d
 
 ArchFile::~ArchFile()
 {
+    delete solidCache;
     ar_close_archive(ar);
     ar_close(data);
 }
@@ -62,27 +194,76 @@ char *ArchFile::GetFileDataByName(const WCHAR *fileName, size_t *len)
 }
 
 char *ArchFile::GetFileDataByIdx(size_t fileindex, size_t *len)
+{
+    return GetFileDataPrefixByIdx(fileindex, SIZE_MAX, len);
+}
+
+// uncompresses the first size bytes of the current entry
+static char *UncompressEntry(ar_archive *ar, size_t size)
+{
+    if (size > SIZE_MAX - 2)
+        return NULL;
+    ScopedMem<char> data((char *)malloc(size + 2));
+    if (!data)
+        return NULL;
+    if (!ar_entry_uncompress(ar, data, size))
+        return NULL;
+    // zero-terminate for convenience
+    data[size] = data[size + 1] = '\0';
+    return data.StealData();
+}
+
+char *ArchFile::GetSolidFileData(size_t fileindex, size_t *len)
+{
+    if (!solidCache)
+        solidCache = new SolidCache(filepos.Count());
+    char *data = solidCache->Get(fileindex, len);
+    if (data || fileindex < solidCache->next)
+        return data;
+
+    // uncompress (and cache) all entries up to the requested one in order
+    for (; solidCache->next <= fileindex; solidCache->next++) {
+        size_t idx = solidCache->next;
+        if (idx >= filepos.Count() || -1 == filepos.At(idx) || !ar_parse_entry_at(ar, filepos.At(idx)))
+            continue;
+        size_t size = ar_entry_get_size(ar);
+        data = UncompressEntry(ar, size);
+        if (data)
+            solidCache->Add(idx, data, size);
+    }
+    return solidCache->Get(fileindex, len);
+}
+
+char *ArchFile::GetFileDataPrefixByIdx(size_t fileindex, size_t maxLen, size_t *len)
 {
     if (fileindex >= filenames.Count())
         return NULL;
 
+    // entries of solid archives and entries extracted by the fallback are
+    // always uncompressed completely, so all of their data is returned
+    if (ar && ar_is_solid(ar) && filepos.At(fileindex) != -1) {
+        char *data = GetSolidFileData(fileindex, len);
+        if (data)
+            return data;
+    }
+
     if (!ar || !ar_parse_entry_at(ar, filepos.At(fileindex)))
         return GetFileFromFallback(fileindex, len);
 
     size_t size = ar_entry_get_size(ar);
+    // uncompressing only part of an entry would require solid archives
+    // to be uncompressed from the start for the following entry
+    if (size > maxLen && !ar_is_solid(ar))
+        size = maxLen;
     if (size > SIZE_MAX - 2)
         return NULL;
-    ScopedMem<char> data((char *)malloc(size + 2));
+    char *data = UncompressEntry(ar, size);
     if (!data)
-        return NULL;
-    if (!ar_entry_uncompress(ar, data, size))
         return GetFileFromFallback(fileindex, len);
-    // zero-terminate for convenience
-    data[size] = data[size + 1] = '\0';
 
     if (len)
         *len = size;
-    return data.StealData();
+    return data;
 }
 
 FILETIME ArchFile::GetFileTime(const WCHAR *fileName)
@@ -9,6 +9,8 @@ typedef struct ar_stream_s ar_stream;
 typedef struct ar_archive_s ar_archive;
 }
 
+class SolidCache;
+
 class ArchFile {
 protected:
     WStrList filenames;
@@ -17,6 +19,10 @@ protected:
     ar_stream *data;
     ar_archive *ar;
 
+    // for solid archives, all entries are uncompressed in order and cached
+    SolidCache *solidCache;
+    char *GetSolidFileData(size_t fileindex, size_t *len);
+
     // call with fileindex = -1 for filename extraction using the fallback
     virtual char *GetFileFromFallback(size_t fileindex, size_t *len=NULL) { return NULL; }
 
@@ -33,6 +39,11 @@ public:
     // caller must free() the result
     char *GetFileDataByName(const WCHAR *filename, size_t *len=NULL);
     char *GetFileDataByIdx(size_t fileindex, size_t *len=NULL);
+    // uncompresses only the first maxLen bytes (e.g. for reading the file's header)
+    // returns more data if the entry has to be uncompressed completely anyway
+    // (as for solid archives), so *len != maxLen means that the file is complete
+    // caller must free() the result
+    char *GetFileDataPrefixByIdx(size_t fileindex, size_t maxLen, size_t *len=NULL);
 
     FILETIME GetFileTime(const WCHAR *filename);
     FILETIME GetFileTime(size_t fileindex);
@@ -82,16 +82,30 @@ RectF MeasureTextStandard(Graphics *g, Font *f, const WCHAR *s, int len)
     return bbox;
 }
 
+// remembers for MeasureTextQuick which fonts don't need adjustments
+// (text can be measured on several threads concurrently)
+class QuickMeasureFontCache {
+public:
+    CRITICAL_SECTION access;
+    Vec<Font *> fonts;
+    Vec<bool> isItalicOrMonospace;
+
+    QuickMeasureFontCache() { InitializeCriticalSection(&access); }
+    ~QuickMeasureFontCache() { DeleteCriticalSection(&access); }
+};
+
+static QuickMeasureFontCache gQuickMeasureFontCache;
+
 RectF MeasureTextQuick(Graphics *g, Font *f, const WCHAR *s, int len)
 {
     CrashIf(0 >= len);
 
-    static Vec<Font *> fontCache;
-    static Vec<bool> fixCache;
-
     RectF bbox;
     g->MeasureString(s, len, f, PointF(0, 0), &bbox);
-    int idx = fontCache.Find(f);
+
+    QuickMeasureFontCache& c = gQuickMeasureFontCache;
+    EnterCriticalSection(&c.access);
+    int idx = c.fonts.Find(f);
     if (-1 == idx) {
         LOGFONTW lfw;
         Status ok = f->GetLogFontW(g, &lfw);
@@ -100,12 +114,15 @@ RectF MeasureTextQuick(Graphics *g, Font *f, const WCHAR *s, int len)
                                    str::Find(lfw.lfFaceName, L"Consol") ||
                                    str::EndsWith(lfw.lfFaceName, L"Mono") ||
                                    str::EndsWith(lfw.lfFaceName, L"Typewriter");
-        fontCache.Append(f);
-        fixCache.Append(isItalicOrMonospace);
-        idx = (int)fontCache.Count() - 1;
+        c.fonts.Append(f);
+        c.isItalicOrMonospace.Append(isItalicOrMonospace);
+        idx = (int)c.fonts.Count() - 1;
     }
+    bool noAdjustments = c.isItalicOrMonospace.At(idx);
+    LeaveCriticalSection(&c.access);
+
     // most documents look good enough with these adjustments
-    if (!fixCache.At(idx)) {
+    if (!noAdjustments) {
         REAL correct = 0;
         for (int i = 0; i < len; i++) {
             switch (s[i]) {
@@ -344,8 +361,10 @@ Bitmap *BitmapFromData(const char *data, size_t len)
     return bmp;
 }
 
+// determines the image size by parsing only the image's header, so data may
+// be just the first few bytes of an image (returns an empty size on failure)
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const char *data, size_t len)
+Size BitmapSizeFromHeader(const char *data, size_t len)
 {
     Size result;
     ByteReader r(data, len);
@@ -476,6 +495,12 @@ Size BitmapSizeFromData(const char *data, size_t len)
         break;
     }
 
+    return result;
+}
+
+Size BitmapSizeFromData(const char *data, size_t len)
+{
+    Size result = BitmapSizeFromHeader(data, len);
     if (result.Empty()) {
         // let GDI+ extract the image size if we've failed
         // (currently happens for animated GIF)
@@ -25,6 +25,7 @@ void     GetBaseTransform(Matrix& m, RectF pageRect, float zoom, int rotation);
 const WCHAR * GfxFileExtFromData(const char *data, size_t len);
 bool          IsGdiPlusNativeFormat(const char *data, size_t len);
 Bitmap *      BitmapFromData(const char *data, size_t len);
+Size          BitmapSizeFromHeader(const char *data, size_t len);
 Size          BitmapSizeFromData(const char *data, size_t len);
 CLSID         GetEncoderClsid(const WCHAR *format);
 
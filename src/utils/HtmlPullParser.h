@@ -86,10 +86,21 @@ public:
     HtmlPullParser(const char *s, const char *end) : currPos(s), end(end), start(s), len(end - s) { }
 
     void         SetCurrPosOff(ptrdiff_t off) { currPos = start + off; }
+    size_t       CurrPosOff() const { return currPos - start; }
     size_t       Len()   const { return len;   }
     const char * Start() const { return start; }
 
     HtmlToken *  Next();
+
+    // for text which is still being appended to: s must start with the
+    // same data as the current text (but might have moved in memory)
+    void         ExtendData(const char *s, size_t newLen) {
+        CrashIf(newLen < len);
+        currPos = s + (currPos - start);
+        start = s;
+        end = s + newLen;
+        len = newLen;
+    }
 };
 
 bool        SkipWs(const char*& s, const char *end);
@@ -0,0 +1,188 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "MemoryBudget.h"
+
+// bounds for the limit chosen if none has been set explicitly
+#define MIN_AUTO_LIMIT  ((size_t)256 * 1024 * 1024)
+#ifdef _WIN64
+#define MAX_AUTO_LIMIT  ((size_t)2048 * 1024 * 1024)
+#else
+// leave enough address space for everything else
+#define MAX_AUTO_LIMIT  ((size_t)768 * 1024 * 1024)
+#endif
+
+// share of the budget in percent that each category can use before
+// being considered first for giving up memory
+static const int gCategoryShares[Mem_CategoryCount] = { 20, 30, 5, 45 };
+static const char *gCategoryNames[Mem_CategoryCount] = { "page runs", "resources", "glyphs", "bitmaps" };
+
+MemoryConsumer::MemoryConsumer() : lastUse(GetTickCount())
+{
+    ZeroMemory(used, sizeof(used));
+}
+
+namespace membudget {
+
+struct MemoryBudget {
+    CRITICAL_SECTION        access;
+    size_t                  limit;
+    Vec<MemoryConsumer *>   consumers;
+    size_t                  reclaimed[Mem_CategoryCount];
+    // set while FreeMemory is being called from Enforce
+    bool                    enforcing;
+
+    MemoryBudget() : limit(0), enforcing(false) {
+        InitializeCriticalSection(&access);
+        ZeroMemory(reclaimed, sizeof(reclaimed));
+    }
+    ~MemoryBudget() { DeleteCriticalSection(&access); }
+};
+
+// consumers might be created during static initialization (e.g. gRenderCache)
+static MemoryBudget& GetBudget()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+static size_t GetAutoLimit()
+{
+    MEMORYSTATUSEX ms = { 0 };
+    ms.dwLength = sizeof(ms);
+    if (!GlobalMemoryStatusEx(&ms))
+        return MIN_AUTO_LIMIT;
+    ULONGLONG limit = ms.ullTotalPhys / 4;
+    return (size_t)limitValue(limit, (ULONGLONG)MIN_AUTO_LIMIT, (ULONGLONG)MAX_AUTO_LIMIT);
+}
+
+void SetLimit(size_t limit)
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    b.limit = limit > 0 ? limit : GetAutoLimit();
+}
+
+size_t GetLimit()
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    if (0 == b.limit)
+        b.limit = GetAutoLimit();
+    return b.limit;
+}
+
+void Register(MemoryConsumer *c)
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    CrashIf(b.consumers.Contains(c));
+    b.consumers.Append(c);
+}
+
+void Unregister(MemoryConsumer *c)
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    b.consumers.Remove(c);
+}
+
+void Update(MemoryConsumer *c, MemoryCategory cat, size_t used)
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    c->used[cat] = used;
+    // giving up memory doesn't count as being used
+    if (!b.enforcing)
+        c->lastUse = GetTickCount();
+}
+
+static size_t GetTotalUsed(MemoryBudget& b, size_t used[Mem_CategoryCount])
+{
+    size_t total = 0;
+    for (int cat = 0; cat < Mem_CategoryCount; cat++) {
+        used[cat] = 0;
+        for (size_t i = 0; i < b.consumers.Count(); i++) {
+            used[cat] += b.consumers.At(i)->used[cat];
+        }
+        total += used[cat];
+    }
+    return total;
+}
+
+void Enforce()
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    if (b.enforcing)
+        return;
+    if (0 == b.limit)
+        b.limit = GetAutoLimit();
+
+    b.enforcing = true;
+    // consumers which couldn't free any more memory of a category
+    // (index into b.consumers * Mem_CategoryCount + category)
+    Vec<size_t> exhausted;
+    size_t used[Mem_CategoryCount];
+    for (size_t total = GetTotalUsed(b, used); total > b.limit; total = GetTotalUsed(b, used)) {
+        MemoryConsumer *victim = NULL;
+        size_t victimIdx = 0;
+        int victimCat = -1;
+        double maxRatio = -1;
+        DWORD now = GetTickCount();
+        for (int cat = 0; cat < Mem_CategoryCount; cat++) {
+            double ratio = (double)used[cat] / gCategoryShares[cat];
+            if (ratio <= maxRatio)
+                continue;
+            // the least recently used consumer still having memory of this category
+            MemoryConsumer *candidate = NULL;
+            size_t candidateIdx = 0;
+            for (size_t i = 0; i < b.consumers.Count(); i++) {
+                MemoryConsumer *c = b.consumers.At(i);
+                if (0 == c->used[cat] || exhausted.Contains(i * Mem_CategoryCount + cat))
+                    continue;
+                if (!candidate || now - c->lastUse > now - candidate->lastUse) {
+                    candidate = c;
+                    candidateIdx = i;
+                }
+            }
+            if (candidate) {
+                victim = candidate;
+                victimIdx = candidateIdx;
+                victimCat = cat;
+                maxRatio = ratio;
+            }
+        }
+        if (!victim)
+            break;
+
+        size_t freed = victim->FreeMemory((MemoryCategory)victimCat, total - b.limit);
+        if (0 == freed)
+            exhausted.Append(victimIdx * Mem_CategoryCount + victimCat);
+        b.reclaimed[victimCat] += freed;
+    }
+    b.enforcing = false;
+}
+
+void GetStats(MemoryBudgetStats& stats)
+{
+    MemoryBudget& b = GetBudget();
+    ScopedCritSec scope(&b.access);
+    if (0 == b.limit)
+        b.limit = GetAutoLimit();
+    stats.limit = b.limit;
+    stats.consumers = (int)b.consumers.Count();
+    GetTotalUsed(b, stats.used);
+    for (int cat = 0; cat < Mem_CategoryCount; cat++) {
+        stats.reclaimed[cat] = b.reclaimed[cat];
+    }
+}
+
+const char *GetCategoryName(MemoryCategory cat)
+{
+    CrashIf(cat < 0 || cat >= Mem_CategoryCount);
+    return gCategoryNames[cat];
+}
+
+}
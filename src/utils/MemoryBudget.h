@@ -0,0 +1,62 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef MemoryBudget_h
+#define MemoryBudget_h
+
+/* All caches (of all open documents) share a single memory budget. Whenever
+   it's exceeded, memory is reclaimed from the category using most memory
+   relative to its share of the budget and within that category from the
+   cache which has been used least recently (e.g. from a background tab). */
+
+enum MemoryCategory {
+    Mem_PageRuns,   // cached page content (display lists)
+    Mem_Resources,  // decoded images, fonts, etc. (MuPDF's store)
+    Mem_Glyphs,     // rendered glyphs
+    Mem_Bitmaps,    // rendered pages and tiles
+    Mem_CategoryCount
+};
+
+class MemoryConsumer {
+public:
+    // only to be changed through membudget::Update
+    size_t  used[Mem_CategoryCount];
+    DWORD   lastUse;
+
+    MemoryConsumer();
+    virtual ~MemoryConsumer() { }
+
+    // should free at least the given number of bytes of the given category
+    // and return how many bytes have actually been freed. Note: this must never
+    // block, so use TryEnterCriticalSection and return 0 if that fails.
+    virtual size_t FreeMemory(MemoryCategory cat, size_t bytes) = 0;
+};
+
+struct MemoryBudgetStats {
+    size_t  limit;
+    int     consumers;
+    size_t  used[Mem_CategoryCount];
+    // number of bytes freed in order to stay within the budget
+    size_t  reclaimed[Mem_CategoryCount];
+};
+
+namespace membudget {
+
+// limit == 0 means a limit depending on the amount of physical memory
+void    SetLimit(size_t limit);
+size_t  GetLimit();
+
+void    Register(MemoryConsumer *c);
+void    Unregister(MemoryConsumer *c);
+// sets how much memory c currently uses for category cat (and marks c as used)
+void    Update(MemoryConsumer *c, MemoryCategory cat, size_t used);
+// reclaims memory until all consumers are back within the budget (if possible);
+// call this after a consumer has grown and don't hold any of its locks
+void    Enforce();
+
+void    GetStats(MemoryBudgetStats& stats);
+const char *GetCategoryName(MemoryCategory cat);
+
+}
+
+#endif
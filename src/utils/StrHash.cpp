@@ -0,0 +1,95 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "StrHash.h"
+
+// entries are 8-byte aligned so that values can be of any type
+#define ENTRY_ALIGN 8
+
+// an entry consists of the Entry struct, the value and a copy of the string
+#define ENTRY_VALUE_OFFSET RoundUp(sizeof(void *) + 2 * sizeof(uint32), ENTRY_ALIGN)
+
+static inline size_t EntryHeaderSize(size_t valueSize)
+{
+    return ENTRY_VALUE_OFFSET + RoundUp(valueSize, ENTRY_ALIGN);
+}
+
+StrHashNT::StrHashNT(size_t valueSize, size_t initialSize) :
+    allocator(ENTRY_ALIGN), nUsed(0), valueSize(valueSize)
+{
+    nEntries = RoundToPowerOf2(initialSize);
+    entries = AllocArray<Entry *>(nEntries);
+    memUsed = nEntries * sizeof(Entry *);
+}
+
+StrHashNT::~StrHashNT()
+{
+    free(entries);
+}
+
+StrHashNT::Entry *StrHashNT::Find(const char *s, size_t len, uint32 hash) const
+{
+    size_t headerSize = EntryHeaderSize(valueSize);
+    for (Entry *e = entries[hash & (nEntries - 1)]; e; e = e->next) {
+        if (e->hash == hash && e->len == len && 0 == memcmp((char *)e + headerSize, s, len))
+            return e;
+    }
+    return NULL;
+}
+
+void StrHashNT::Resize()
+{
+    size_t newSize = nEntries * 2;
+    Entry **newEntries = AllocArray<Entry *>(newSize);
+    for (size_t i = 0; i < nEntries; i++) {
+        Entry *next;
+        for (Entry *e = entries[i]; e; e = next) {
+            next = e->next;
+            size_t pos = e->hash & (newSize - 1);
+            e->next = newEntries[pos];
+            newEntries[pos] = e;
+        }
+    }
+    free(entries);
+    entries = newEntries;
+    memUsed += (newSize - nEntries) * sizeof(Entry *);
+    nEntries = newSize;
+}
+
+void *StrHashNT::Lookup(const char *s, size_t len, bool createIfNotExists, bool& createdOut)
+{
+    createdOut = false;
+    CrashIf((uint32)len != len);
+    uint32 hash = MurmurHash2(s, len);
+    size_t headerSize = EntryHeaderSize(valueSize);
+    Entry *e = Find(s, len, hash);
+    if (e)
+        return (char *)e + ENTRY_VALUE_OFFSET;
+    if (!createIfNotExists)
+        return NULL;
+
+    // same load factor as dict::HashTable
+    if (nUsed >= (nEntries * 3) / 2)
+        Resize();
+    // PoolAllocator's blocks are zeroed out and never reused
+    e = (Entry *)allocator.Alloc(headerSize + len);
+    e->hash = hash;
+    e->len = (uint32)len;
+    memcpy((char *)e + headerSize, s, len);
+    size_t pos = hash & (nEntries - 1);
+    e->next = entries[pos];
+    entries[pos] = e;
+    nUsed++;
+    memUsed += RoundUp(headerSize + len, ENTRY_ALIGN);
+    createdOut = true;
+    return (char *)e + ENTRY_VALUE_OFFSET;
+}
+
+void StrHashNT::Reset()
+{
+    allocator.FreeAll();
+    ZeroMemory(entries, nEntries * sizeof(Entry *));
+    nUsed = 0;
+    memUsed = nEntries * sizeof(Entry *);
+}
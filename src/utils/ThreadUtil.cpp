@@ -48,6 +48,13 @@ void SetThreadName(DWORD, const char *)
 }
 #endif
 
+int GetProcessorCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::max((int)si.dwNumberOfProcessors, 1);
+}
+
 // We need a way to uniquely identified threads (so that we can test for equality).
 // Thread id assigned by the OS might be recycled. The memory address given to ThreadBase
 // object can be recycled as well, so we keep our own counter.
@@ -49,4 +49,7 @@ public:
 
 void SetThreadName(DWORD threadId, const char *threadName);
 
+// number of logical processors available to this process (at least 1)
+int GetProcessorCount();
+
 #endif
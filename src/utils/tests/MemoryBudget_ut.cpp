@@ -0,0 +1,85 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "MemoryBudget.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+class TestConsumer : public MemoryConsumer {
+public:
+    bool refuse;
+
+    TestConsumer() : refuse(false) { membudget::Register(this); }
+    virtual ~TestConsumer() { membudget::Unregister(this); }
+
+    virtual size_t FreeMemory(MemoryCategory cat, size_t bytes) {
+        if (refuse)
+            return 0;
+        size_t freed = std::min(bytes, used[cat]);
+        membudget::Update(this, cat, used[cat] - freed);
+        return freed;
+    }
+};
+
+static size_t GetReclaimed(MemoryCategory cat)
+{
+    MemoryBudgetStats stats;
+    membudget::GetStats(stats);
+    return stats.reclaimed[cat];
+}
+
+void MemoryBudgetTest()
+{
+    membudget::SetLimit(1000);
+    utassert(membudget::GetLimit() == 1000);
+    size_t reclaimedBitmaps = GetReclaimed(Mem_Bitmaps);
+    size_t reclaimedGlyphs = GetReclaimed(Mem_Glyphs);
+
+    {
+        TestConsumer a, b;
+        membudget::Update(&a, Mem_Bitmaps, 600);
+        membudget::Enforce();
+        utassert(a.used[Mem_Bitmaps] == 600);
+
+        // memory is reclaimed from the least recently used consumer
+        Sleep(50);
+        membudget::Update(&b, Mem_Bitmaps, 600);
+        membudget::Enforce();
+        utassert(a.used[Mem_Bitmaps] == 400 && b.used[Mem_Bitmaps] == 600);
+        utassert(GetReclaimed(Mem_Bitmaps) - reclaimedBitmaps == 200);
+
+        // ... of the category exceeding its share the most
+        Sleep(50);
+        membudget::Update(&b, Mem_Glyphs, 200);
+        membudget::Enforce();
+        utassert(a.used[Mem_Bitmaps] == 400 && b.used[Mem_Bitmaps] == 600);
+        utassert(b.used[Mem_Glyphs] == 0);
+        utassert(GetReclaimed(Mem_Glyphs) - reclaimedGlyphs == 200);
+
+        // consumers which can't give up memory are skipped
+        b.refuse = true;
+        Sleep(50);
+        membudget::Update(&a, Mem_Bitmaps, 700);
+        membudget::Enforce();
+        utassert(a.used[Mem_Bitmaps] == 400 && b.used[Mem_Bitmaps] == 600);
+
+        // if nobody is willing to give up memory, the budget is exceeded
+        a.refuse = true;
+        membudget::Update(&a, Mem_Bitmaps, 700);
+        membudget::Enforce();
+        utassert(a.used[Mem_Bitmaps] == 700 && b.used[Mem_Bitmaps] == 600);
+
+        MemoryBudgetStats stats;
+        membudget::GetStats(stats);
+        utassert(2 == stats.consumers && 1300 == stats.used[Mem_Bitmaps]);
+        utassert(GetReclaimed(Mem_Bitmaps) - reclaimedBitmaps == 500);
+    }
+
+    MemoryBudgetStats stats;
+    membudget::GetStats(stats);
+    utassert(0 == stats.consumers && 0 == stats.used[Mem_Bitmaps]);
+    membudget::SetLimit(0);
+    utassert(membudget::GetLimit() >= 256 * 1024 * 1024);
+}
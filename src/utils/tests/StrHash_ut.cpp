@@ -0,0 +1,74 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "StrHash.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+struct TestVal {
+    int     n;
+    double  d;
+};
+
+static void StrHashTestBasic()
+{
+    StrHash<TestVal> h(4); // start small so that we can test resizing
+    bool created;
+
+    utassert(0 == h.Count());
+    utassert(!h.Get("foo", 3));
+    TestVal *v = h.Lookup("foo", 3, false, created);
+    utassert(!v && !created);
+
+    v = h.Lookup("foo", 3, true, created);
+    utassert(v && created);
+    utassert(0 == v->n && 0 == v->d);
+    v->n = 5;
+    v->d = 2.5;
+    utassert(1 == h.Count());
+    TestVal *v2 = h.Lookup("foo", 3, true, created);
+    utassert(v2 == v && !created);
+    utassert(5 == v2->n && 2.5 == v2->d);
+    // prefixes and binary strings are different keys
+    utassert(!h.Get("fo", 2));
+    utassert(!h.Get("foo\0", 4));
+    v = h.Lookup("foo\0", 4, true, created);
+    utassert(v && created && v != v2);
+    v = h.Lookup("", 0, true, created);
+    utassert(v && created);
+    utassert(h.Get("", 0) == v);
+    utassert(3 == h.Count());
+
+    size_t mem = h.MemoryUsed();
+    h.Reset();
+    utassert(0 == h.Count());
+    utassert(h.MemoryUsed() < mem);
+    utassert(!h.Get("foo", 3));
+}
+
+static void StrHashTestMany()
+{
+    StrHash<int> h(4);
+    bool created;
+    for (int i = 0; i < 10000; i++) {
+        ScopedMem<char> key(str::Format("key%d", i));
+        int *v = h.Lookup(key, str::Len(key), true, created);
+        utassert(v && created);
+        *v = i;
+    }
+    utassert(10000 == h.Count());
+    for (int i = 0; i < 10000; i++) {
+        ScopedMem<char> key(str::Format("key%d", i));
+        int *v = h.Get(key, str::Len(key));
+        utassert(v && *v == i);
+    }
+    utassert(!h.Get("key10000", 8));
+}
+
+void StrHashTest()
+{
+    StrHashTestBasic();
+    StrHashTestMany();
+}
@@ -0,0 +1,118 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "TextIndex.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static const WCHAR *gPage1 = L"The quick brown fox jumps over the lazy dog";
+static const WCHAR *gPage3 = L"Lorem ipsum dolor sit amet, consectetur adipiscing elit";
+
+static PageTextIndex *CreateTestIndex(int64 fileSize, FILETIME fileTime)
+{
+    PageTextIndex *index = new PageTextIndex(3, fileSize, fileTime);
+    index->AddPage(1, gPage1);
+    index->AddPage(3, gPage3);
+    return index;
+}
+
+static void RoundTripTest()
+{
+    FILETIME ft = { 0x12345678, 0x01D00000 };
+    int64 size = 0x123456789ALL;
+    ScopedPtr<PageTextIndex> index(CreateTestIndex(size, ft));
+    utassert(!index->IsComplete() && index->IsModified());
+
+    size_t len;
+    ScopedMem<char> data(index->Serialize(&len));
+    utassert(data && len > 0);
+    utassert(!index->IsModified());
+
+    ScopedPtr<PageTextIndex> copy(PageTextIndex::Deserialize(data, len, 3, size, ft));
+    utassert(copy);
+    utassert(!copy->IsComplete() && !copy->IsModified());
+    const WCHAR *words[] = { L"quick", L"LAZY", L"ipsum", L"dolor", L"zebra", L"xylophone" };
+    for (size_t i = 0; i < dimof(words); i++) {
+        for (int pageNo = 1; pageNo <= 3; pageNo++) {
+            utassert(copy->MightContain(pageNo, words[i]) == index->MightContain(pageNo, words[i]));
+        }
+    }
+
+    // serializing again produces the same data
+    size_t len2;
+    ScopedMem<char> data2(copy->Serialize(&len2));
+    utassert(len2 == len && memeq(data, data2, len));
+
+    // pages indexed after deserialization are saved as well
+    copy->AddPage(2, L"second page");
+    utassert(copy->IsComplete() && copy->IsModified());
+}
+
+static void KeyTest()
+{
+    FILETIME ft = { 0x12345678, 0x01D00000 };
+    int64 size = 4096;
+    ScopedPtr<PageTextIndex> index(CreateTestIndex(size, ft));
+    size_t len;
+    ScopedMem<char> data(index->Serialize(&len));
+
+    // the index is only valid for the exact same file
+    FILETIME otherTime = { ft.dwLowDateTime + 1, ft.dwHighDateTime };
+    utassert(!PageTextIndex::Deserialize(data, len, 3, size + 1, ft));
+    utassert(!PageTextIndex::Deserialize(data, len, 3, size + ((int64)1 << 32), ft));
+    utassert(!PageTextIndex::Deserialize(data, len, 3, size, otherTime));
+    utassert(!PageTextIndex::Deserialize(data, len, 4, size, ft));
+    // ... and invalid data is rejected
+    utassert(!PageTextIndex::Deserialize(data, len - 1, 3, size, ft));
+    utassert(!PageTextIndex::Deserialize(data, 8, 3, size, ft));
+    ScopedMem<char> badMagic((char *)memdup(data, len));
+    badMagic[0] = 'X';
+    utassert(!PageTextIndex::Deserialize(badMagic, len, 3, size, ft));
+
+    PageTextIndex *copy = PageTextIndex::Deserialize(data, len, 3, size, ft);
+    utassert(copy);
+    delete copy;
+}
+
+static void NoFalseNegativesTest()
+{
+    FILETIME ft = { 0 };
+    PageTextIndex index(2, 0, ft);
+    str::Str<WCHAR> text;
+    for (int i = 0; i < 2000; i++) {
+        ScopedMem<WCHAR> word(str::Format(L"Word%dx%c ", i * 7919, 'a' + i % 26));
+        text.Append(word);
+    }
+    index.AddPage(1, text.Get());
+
+    // unindexed pages and words shorter than three characters always match
+    utassert(index.MightContain(2, L"anything"));
+    utassert(index.MightContain(1, L"ab"));
+
+    // every word (and every part of a word) on an indexed page must match
+    for (int i = 0; i < 2000; i++) {
+        ScopedMem<WCHAR> word(str::Format(L"Word%dx%c", i * 7919, 'a' + i % 26));
+        utassert(index.MightContain(1, word));
+        CharUpperBuff(word, (DWORD)str::Len(word));
+        utassert(index.MightContain(1, word));
+        utassert(index.MightContain(1, word + 2));
+    }
+
+    // a page without the word's trigrams is ruled out most of the time
+    int falsePositives = 0;
+    for (int i = 0; i < 100; i++) {
+        ScopedMem<WCHAR> word(str::Format(L"Zyq%dv", i));
+        if (index.MightContain(1, word))
+            falsePositives++;
+    }
+    utassert(falsePositives < 50);
+}
+
+void TextIndexTest()
+{
+    RoundTripTest();
+    KeyTest();
+    NoFalseNegativesTest();
+}
@@ -360,6 +360,7 @@ func main() {
 			&MingwCcDirTask{Dir: "src/utils", Files: []string{
 				"LabelWithCloseWnd.cpp",
 				"LzmaSimpleArchive.cpp",
+				"MemoryBudget.cpp",
 				"NoFreeAllocator.cpp",
 				"PalmDbReader.cpp",
 				"SerializeTxt.cpp",
@@ -22,12 +22,15 @@ extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void MemoryBudgetTest();
 extern void SettingsUtilTest();
 extern void SigSlotTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
+extern void StrHashTest();
 extern void StrTest();
+extern void TextIndexTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VarintGobTest();
 extern void VecTest();
@@ -46,12 +49,15 @@ int main(int argc, char **argv)
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    MemoryBudgetTest();
     SettingsUtilTest();
     SigSlotTest();
     SimpleLogTest();
     SquareTreeTest();
     StrFormatTest();
+    StrHashTest();
     StrTest();
+    TextIndexTest();
     TrivialHtmlParser_UnitTests();
     VarintGobTest();
     VecTest();